@@ -0,0 +1,436 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ */
+
+/* The syscall wrappers below replace the libc functions; fortified
+ * inline versions of them would clash */
+#undef _FORTIFY_SOURCE
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "bench.h"
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+/* Counts may exceed the baseline by this much per operation on top of
+ * the tolerance, for one-off allocations such as a table growing */
+#define BASELINE_SLACK 0.01
+
+#define DEFAULT_TOLERANCE 0.1
+
+typedef struct {
+    gchar *key;
+    double value;
+} Metric;
+
+typedef struct {
+    gchar *name;
+    guint ops;
+    double ops_per_s;
+    double p50_ns;
+    double p99_ns;
+    double allocs_per_op;
+    double syscalls_per_op;
+    GArray *metrics;
+} Result;
+
+static GPtrArray *results;
+static gchar *json_path;
+static gchar *baseline_path;
+static gchar *write_baseline_path;
+
+/* ============================================================================
+ * Allocation and syscall counting
+ *
+ * malloc() and the I/O calls GLib makes (reads and writes, sockets, poll)
+ * are wrapped at the libc boundary, which covers the main loop, GDBus and
+ * file access. Calls glibc makes internally, such as stdio's writes, are
+ * not seen.
+ * ========================================================================== */
+
+static atomic_uint_fast64_t allocations;
+static atomic_uint_fast64_t syscalls;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+#define WRAP_SYSCALL(ret, name, params, args)                       \
+    ret name params                                                 \
+    {                                                               \
+        static ret (*real) params;                                  \
+        if (real == NULL) {                                         \
+            *(void **)&real = dlsym(RTLD_NEXT, #name);              \
+        }                                                           \
+        atomic_fetch_add_explicit(&syscalls, 1, memory_order_relaxed); \
+        return real args;                                           \
+    }
+
+WRAP_SYSCALL(ssize_t, read, (int fd, void *buf, size_t count), (fd, buf, count))
+WRAP_SYSCALL(ssize_t, write, (int fd, const void *buf, size_t count), (fd, buf, count))
+WRAP_SYSCALL(ssize_t, readv, (int fd, const struct iovec *iov, int iovcnt), (fd, iov, iovcnt))
+WRAP_SYSCALL(ssize_t, writev, (int fd, const struct iovec *iov, int iovcnt), (fd, iov, iovcnt))
+WRAP_SYSCALL(ssize_t, recv, (int fd, void *buf, size_t len, int flags), (fd, buf, len, flags))
+WRAP_SYSCALL(ssize_t, recvmsg, (int fd, struct msghdr *msg, int flags), (fd, msg, flags))
+WRAP_SYSCALL(ssize_t, send, (int fd, const void *buf, size_t len, int flags), (fd, buf, len, flags))
+WRAP_SYSCALL(ssize_t, sendmsg, (int fd, const struct msghdr *msg, int flags), (fd, msg, flags))
+WRAP_SYSCALL(int, poll, (struct pollfd *fds, nfds_t nfds, int timeout), (fds, nfds, timeout))
+WRAP_SYSCALL(int, close, (int fd), (fd))
+WRAP_SYSCALL(int, fsync, (int fd), (fd))
+WRAP_SYSCALL(int, rename, (const char *oldpath, const char *newpath), (oldpath, newpath))
+
+int open(const char *path, int flags, ...)
+{
+    static int (*real)(const char *, int, ...);
+    if (real == NULL) {
+        *(void **)&real = dlsym(RTLD_NEXT, "open");
+    }
+
+    mode_t mode = 0;
+    if (flags & (O_CREAT | O_TMPFILE)) {
+        va_list args;
+        va_start(args, flags);
+        mode = va_arg(args, mode_t);
+        va_end(args);
+    }
+
+    atomic_fetch_add_explicit(&syscalls, 1, memory_order_relaxed);
+    return real(path, flags, mode);
+}
+
+guint64 bench_allocations(void)
+{
+    return atomic_load_explicit(&allocations, memory_order_relaxed);
+}
+
+guint64 bench_syscalls(void)
+{
+    return atomic_load_explicit(&syscalls, memory_order_relaxed);
+}
+
+gint64 bench_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (gint64)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* ============================================================================
+ * Running and reporting
+ * ========================================================================== */
+
+/* Format messages as the daemon would, but only let warnings through */
+static GLogWriterOutput quiet_writer(GLogLevelFlags log_level, const GLogField *fields,
+                                     gsize n_fields, gpointer user_data)
+{
+    if (log_level & (G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL | G_LOG_LEVEL_WARNING)) {
+        return g_log_writer_default(log_level, fields, n_fields, user_data);
+    }
+
+    g_free(g_log_writer_format_fields(log_level, fields, n_fields, FALSE));
+    return G_LOG_WRITER_HANDLED;
+}
+
+void bench_init(int *argc, char ***argv)
+{
+    GOptionEntry entries[] = {
+        {"json", 0, 0, G_OPTION_ARG_FILENAME, &json_path,
+         "Write the report to FILE instead of standard output", "FILE"},
+        {"baseline", 0, 0, G_OPTION_ARG_FILENAME, &baseline_path,
+         "Fail if counts exceed the baseline in FILE", "FILE"},
+        {"write-baseline", 0, 0, G_OPTION_ARG_FILENAME, &write_baseline_path,
+         "Add this run's counts to the baseline in FILE", "FILE"},
+        {NULL, 0, 0, 0, NULL, NULL, NULL}
+    };
+
+    GError *error = NULL;
+    GOptionContext *context = g_option_context_new("- LibrePods benchmark");
+    g_option_context_add_main_entries(context, entries, NULL);
+    if (!g_option_context_parse(context, argc, argv, &error)) {
+        g_printerr("%s\n", error->message);
+        exit(2);
+    }
+    g_option_context_free(context);
+
+    g_log_set_writer_func(quiet_writer, NULL, NULL);
+    results = g_ptr_array_new();
+}
+
+static int compare_doubles(gconstpointer a, gconstpointer b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(GArray *sorted, guint percent)
+{
+    if (sorted->len == 0) {
+        return 0.0;
+    }
+    return g_array_index(sorted, double, (sorted->len - 1) * percent / 100);
+}
+
+void bench_report(const char *name, guint ops, GArray *samples_ns, gint64 elapsed_ns,
+                  guint64 allocs, guint64 calls)
+{
+    Result *result = g_new0(Result, 1);
+    result->name = g_strdup(name);
+    result->ops = ops;
+    result->metrics = g_array_new(FALSE, FALSE, sizeof(Metric));
+
+    g_array_sort(samples_ns, compare_doubles);
+    result->p50_ns = percentile(samples_ns, 50);
+    result->p99_ns = percentile(samples_ns, 99);
+
+    if (ops > 0) {
+        result->ops_per_s = elapsed_ns > 0 ? ops * 1e9 / elapsed_ns : 0.0;
+        result->allocs_per_op = (double)allocs / ops;
+        result->syscalls_per_op = (double)calls / ops;
+    }
+
+    g_ptr_array_add(results, result);
+
+    g_printerr("%-24s %12.0f ops/s  p50 %9.0f ns  p99 %9.0f ns  %7.2f allocs  %6.2f syscalls\n",
+               name, result->ops_per_s, result->p50_ns, result->p99_ns,
+               result->allocs_per_op, result->syscalls_per_op);
+}
+
+void bench_add_metric(const char *key, double value)
+{
+    g_return_if_fail(results->len > 0);
+
+    Result *result = g_ptr_array_index(results, results->len - 1);
+    Metric metric = { g_strdup(key), value };
+    g_array_append_val(result->metrics, metric);
+
+    g_printerr("%-24s %s %.2f\n", "", key, value);
+}
+
+void bench_run(const BenchCase *bench)
+{
+    guint batch = MAX(bench->batch, 1);
+
+    for (guint i = 0; i < batch; i++) {
+        bench->run(i, bench->data);
+    }
+
+    GArray *samples = g_array_sized_new(FALSE, FALSE, sizeof(double), bench->ops / batch + 1);
+    guint64 allocs_before = bench_allocations();
+    guint64 calls_before = bench_syscalls();
+    gint64 start = bench_now_ns();
+
+    for (guint done = 0; done < bench->ops; ) {
+        guint n = MIN(batch, bench->ops - done);
+        gint64 batch_start = bench_now_ns();
+        for (guint i = 0; i < n; i++) {
+            bench->run(done + i, bench->data);
+        }
+        double per_op = (double)(bench_now_ns() - batch_start) / n;
+        g_array_append_val(samples, per_op);
+        done += n;
+    }
+
+    gint64 elapsed = bench_now_ns() - start;
+    guint64 allocs = bench_allocations() - allocs_before;
+    guint64 calls = bench_syscalls() - calls_before;
+
+    bench_report(bench->name, bench->ops, samples, elapsed, allocs, calls);
+    g_array_unref(samples);
+}
+
+static void append_number(GString *json, const char *key, double value)
+{
+    char buf[G_ASCII_DTOSTR_BUF_SIZE];
+    g_string_append_printf(json, ", \"%s\": %s", key, g_ascii_formatd(buf, sizeof(buf), "%.2f", value));
+}
+
+static gchar *report_to_json(void)
+{
+    GString *json = g_string_new(NULL);
+
+    g_string_append_printf(json, "{\"suite\": \"%s\", \"benchmarks\": [", g_get_prgname());
+    for (guint i = 0; i < results->len; i++) {
+        Result *result = g_ptr_array_index(results, i);
+
+        g_string_append_printf(json, "%s\n  {\"name\": \"%s\", \"ops\": %u",
+                               i > 0 ? "," : "", result->name, result->ops);
+        append_number(json, "ops_per_s", result->ops_per_s);
+        append_number(json, "p50_ns", result->p50_ns);
+        append_number(json, "p99_ns", result->p99_ns);
+        append_number(json, "allocs_per_op", result->allocs_per_op);
+        append_number(json, "syscalls_per_op", result->syscalls_per_op);
+        for (guint j = 0; j < result->metrics->len; j++) {
+            Metric *metric = &g_array_index(result->metrics, Metric, j);
+            append_number(json, metric->key, metric->value);
+        }
+        g_string_append(json, "}");
+    }
+    g_string_append(json, "\n]}\n");
+
+    return g_string_free(json, FALSE);
+}
+
+/* A result value by baseline key, false if the result has no such value */
+static bool result_value(const Result *result, const char *key, double *value)
+{
+    if (g_strcmp0(key, "allocs_per_op") == 0) {
+        *value = result->allocs_per_op;
+        return true;
+    }
+    if (g_strcmp0(key, "syscalls_per_op") == 0) {
+        *value = result->syscalls_per_op;
+        return true;
+    }
+    for (guint i = 0; i < result->metrics->len; i++) {
+        const Metric *metric = &g_array_index(result->metrics, Metric, i);
+        if (g_strcmp0(key, metric->key) == 0) {
+            *value = metric->value;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Every key of the case's group (other than the tolerance) is a limit */
+static bool check_result(GKeyFile *baseline, const Result *result)
+{
+    if (!g_key_file_has_group(baseline, result->name)) {
+        g_printerr("%s: not in the baseline\n", result->name);
+        return true;
+    }
+
+    double tolerance = DEFAULT_TOLERANCE;
+    if (g_key_file_has_key(baseline, result->name, "tolerance", NULL)) {
+        tolerance = g_key_file_get_double(baseline, result->name, "tolerance", NULL);
+    } else if (g_key_file_has_key(baseline, "baseline", "tolerance", NULL)) {
+        tolerance = g_key_file_get_double(baseline, "baseline", "tolerance", NULL);
+    }
+
+    bool ok = true;
+    gchar **keys = g_key_file_get_keys(baseline, result->name, NULL, NULL);
+    for (gchar **key = keys; key != NULL && *key != NULL; key++) {
+        double value;
+        if (g_strcmp0(*key, "tolerance") == 0 || !result_value(result, *key, &value)) {
+            continue;
+        }
+
+        double limit = g_key_file_get_double(baseline, result->name, *key, NULL);
+        if (value > limit * (1.0 + tolerance) + BASELINE_SLACK) {
+            g_printerr("%s: %s is %.2f, baseline %.2f (tolerance %.0f%%)\n",
+                       result->name, *key, value, limit, tolerance * 100);
+            ok = false;
+        }
+    }
+    g_strfreev(keys);
+
+    return ok;
+}
+
+static bool check_baseline(void)
+{
+    GKeyFile *baseline = g_key_file_new();
+    GError *error = NULL;
+
+    if (!g_key_file_load_from_file(baseline, baseline_path, G_KEY_FILE_NONE, &error)) {
+        g_printerr("Failed to load baseline: %s\n", error->message);
+        g_error_free(error);
+        g_key_file_free(baseline);
+        return false;
+    }
+
+    bool ok = true;
+    for (guint i = 0; i < results->len; i++) {
+        ok = check_result(baseline, g_ptr_array_index(results, i)) && ok;
+    }
+
+    g_key_file_free(baseline);
+    return ok;
+}
+
+static void set_count(GKeyFile *keyfile, const char *group, const char *key, double value)
+{
+    char buf[G_ASCII_DTOSTR_BUF_SIZE];
+    g_key_file_set_value(keyfile, group, key, g_ascii_formatd(buf, sizeof(buf), "%.2f", value));
+}
+
+/* Replace this suite's cases in the baseline, keeping everything else */
+static bool write_baseline(void)
+{
+    GKeyFile *baseline = g_key_file_new();
+    g_key_file_load_from_file(baseline, write_baseline_path, G_KEY_FILE_KEEP_COMMENTS, NULL);
+
+    for (guint i = 0; i < results->len; i++) {
+        Result *result = g_ptr_array_index(results, i);
+        set_count(baseline, result->name, "allocs_per_op", result->allocs_per_op);
+        set_count(baseline, result->name, "syscalls_per_op", result->syscalls_per_op);
+    }
+
+    GError *error = NULL;
+    bool ok = g_key_file_save_to_file(baseline, write_baseline_path, &error);
+    if (!ok) {
+        g_printerr("Failed to write baseline: %s\n", error->message);
+        g_error_free(error);
+    }
+
+    g_key_file_free(baseline);
+    return ok;
+}
+
+int bench_finish(void)
+{
+    int status = 0;
+
+    gchar *json = report_to_json();
+    if (json_path != NULL) {
+        GError *error = NULL;
+        if (!g_file_set_contents(json_path, json, -1, &error)) {
+            g_printerr("Failed to write report: %s\n", error->message);
+            g_error_free(error);
+            status = 1;
+        }
+    } else {
+        fputs(json, stdout);
+    }
+    g_free(json);
+
+    if (write_baseline_path != NULL && !write_baseline()) {
+        status = 1;
+    }
+    if (baseline_path != NULL && !check_baseline()) {
+        status = 1;
+    }
+
+    return status;
+}
@@ -0,0 +1,70 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * Benchmark harness: timing, allocation and syscall counts, JSON report
+ * and comparison against the checked-in baseline
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <glib.h>
+
+/* One benchmark case */
+typedef struct {
+    const char *name;       /* Key in the report and the baseline */
+    guint ops;              /* Operations to measure */
+    guint batch;            /* Operations per timed sample */
+    void (*run)(guint i, gpointer data);    /* One operation */
+    gpointer data;
+} BenchCase;
+
+/**
+ * Parse the harness options (--json, --baseline, --write-baseline)
+ *
+ * Also quietens g_message() and below: messages are still formatted, as
+ * in the daemon, but not written out.
+ */
+void bench_init(int *argc, char ***argv);
+
+/**
+ * Run a case: one batch to warm up, then ops operations in batches
+ *
+ * Percentiles are over the per-batch time per operation. Allocations
+ * and syscalls are counted process-wide, so work that helper threads
+ * (such as the GDBus worker) do meanwhile is included.
+ */
+void bench_run(const BenchCase *bench);
+
+/**
+ * Report a case that measures itself, e.g. one driven by the main loop
+ *
+ * @param samples_ns Time per operation, one or more samples
+ * @param elapsed_ns Wall time for all ops
+ * @param allocations Allocations made during the ops
+ * @param syscalls Syscalls made during the ops
+ */
+void bench_report(const char *name, guint ops, GArray *samples_ns, gint64 elapsed_ns,
+                  guint64 allocations, guint64 syscalls);
+
+/**
+ * Add a value of its own to the last reported case, e.g. CPU time
+ */
+void bench_add_metric(const char *key, double value);
+
+/**
+ * Write the report and check it against the baseline
+ *
+ * @return Exit status: 0, or 1 if a count is over its baseline
+ */
+int bench_finish(void);
+
+/* Monotonic time in nanoseconds */
+gint64 bench_now_ns(void);
+
+/* Allocations and syscalls since the start */
+guint64 bench_allocations(void);
+guint64 bench_syscalls(void);
+
+#endif /* BENCH_H */
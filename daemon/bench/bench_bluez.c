@@ -0,0 +1,409 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * Benchmarks for BlueZ signal handling under a storm of Device1 signals
+ *
+ * Includes bluez_monitor.c, so that the benchmark can wait on its signal
+ * count. A fake org.bluez on a private bus, standing in for the system
+ * bus, exports one adapter and a few hundred devices through
+ * ObjectManager; signals are emitted from the benchmark's own thread.
+ * Allocations, syscalls and CPU time include the emitting side.
+ */
+
+#include "../src/bluez_monitor.c"
+
+#include "bench.h"
+
+#include <sys/resource.h>
+
+#define ADAPTER_PATH "/org/bluez/hci0"
+
+/* Devices on the fake adapter; every AIRPODS_EVERY-th is AirPods */
+#define DEVICES 500
+#define AIRPODS_EVERY 50
+
+/* Signals per storm case, and between waits for the monitor */
+#define STORM_SIGNALS 100000
+#define STORM_BATCH 1000
+
+/* Background signals queued ahead of each connect or disconnect */
+#define SIGNALS_AHEAD 100
+
+static const gchar bluez_xml[] =
+    "<node>"
+    "  <interface name='org.freedesktop.DBus.ObjectManager'>"
+    "    <method name='GetManagedObjects'>"
+    "      <arg name='objects' type='a{oa{sa{sv}}}' direction='out'/>"
+    "    </method>"
+    "  </interface>"
+    "  <interface name='org.bluez.Device1'>"
+    "    <property name='Address' type='s' access='read'/>"
+    "    <property name='Name' type='s' access='read'/>"
+    "    <property name='Adapter' type='o' access='read'/>"
+    "    <property name='Connected' type='b' access='read'/>"
+    "    <property name='Paired' type='b' access='read'/>"
+    "    <property name='UUIDs' type='as' access='read'/>"
+    "    <property name='RSSI' type='n' access='read'/>"
+    "  </interface>"
+    "</node>";
+
+/* The fake BlueZ and the thread that answers its method calls */
+typedef struct {
+    GDBusNodeInfo *info;
+    GDBusConnection *connection;
+    guint registrations[DEVICES + 1];
+    guint owner_id;
+    gint connected[DEVICES];
+
+    GMainContext *context;
+    GMainLoop *loop;
+    GThread *thread;
+    GMutex lock;
+    GCond cond;
+    bool ready;
+} FakeBluez;
+
+static FakeBluez bluez;
+
+/* Connected and disconnected callbacks so far */
+static guint notifications;
+
+/* ============================================================================
+ * Fake BlueZ
+ * ========================================================================== */
+
+static bool is_airpods(guint i)
+{
+    return i % AIRPODS_EVERY == 0;
+}
+
+static gchar *device_path(guint i)
+{
+    return g_strdup_printf(ADAPTER_PATH "/dev_00_00_00_00_%02X_%02X", i >> 8, i & 0xFF);
+}
+
+static GVariant *device_property(guint i, const gchar *name)
+{
+    if (g_strcmp0(name, "Address") == 0) {
+        gchar *address = g_strdup_printf("00:00:00:00:%02X:%02X", i >> 8, i & 0xFF);
+        GVariant *value = g_variant_new_string(address);
+        g_free(address);
+        return value;
+    }
+    if (g_strcmp0(name, "Name") == 0) {
+        gchar *device_name = g_strdup_printf("%s %u", is_airpods(i) ? "AirPods" : "Device", i);
+        GVariant *value = g_variant_new_string(device_name);
+        g_free(device_name);
+        return value;
+    }
+    if (g_strcmp0(name, "Adapter") == 0) {
+        return g_variant_new_object_path(ADAPTER_PATH);
+    }
+    if (g_strcmp0(name, "Connected") == 0) {
+        return g_variant_new_boolean(g_atomic_int_get(&bluez.connected[i]));
+    }
+    if (g_strcmp0(name, "Paired") == 0) {
+        return g_variant_new_boolean(TRUE);
+    }
+    if (g_strcmp0(name, "UUIDs") == 0) {
+        const gchar *uuids[] = { "0000110b-0000-1000-8000-00805f9b34fb", AIRPODS_UUID, NULL };
+        if (!is_airpods(i)) {
+            uuids[1] = NULL;
+        }
+        return g_variant_new_strv(uuids, -1);
+    }
+    return g_variant_new_int16(-60);
+}
+
+static GVariant *device_properties(guint i)
+{
+    static const gchar *const names[] = {
+        "Address", "Name", "Adapter", "Connected", "Paired", "UUIDs", "RSSI",
+    };
+    GVariantBuilder props;
+
+    g_variant_builder_init(&props, G_VARIANT_TYPE("a{sv}"));
+    for (guint j = 0; j < G_N_ELEMENTS(names); j++) {
+        g_variant_builder_add(&props, "{sv}", names[j], device_property(i, names[j]));
+    }
+    return g_variant_builder_end(&props);
+}
+
+static GVariant *managed_objects(void)
+{
+    GVariantBuilder objects;
+    GVariantBuilder interfaces;
+    GVariantBuilder adapter;
+
+    g_variant_builder_init(&objects, G_VARIANT_TYPE("a{oa{sa{sv}}}"));
+
+    g_variant_builder_init(&adapter, G_VARIANT_TYPE("a{sv}"));
+    g_variant_builder_add(&adapter, "{sv}", "Address", g_variant_new_string("00:11:22:33:44:55"));
+    g_variant_builder_add(&adapter, "{sv}", "Powered", g_variant_new_boolean(TRUE));
+    g_variant_builder_add(&adapter, "{sv}", "PowerState", g_variant_new_string("on"));
+    g_variant_builder_init(&interfaces, G_VARIANT_TYPE("a{sa{sv}}"));
+    g_variant_builder_add(&interfaces, "{s@a{sv}}", BLUEZ_ADAPTER_INTERFACE,
+                          g_variant_builder_end(&adapter));
+    g_variant_builder_add(&objects, "{o@a{sa{sv}}}", ADAPTER_PATH,
+                          g_variant_builder_end(&interfaces));
+
+    for (guint i = 0; i < DEVICES; i++) {
+        gchar *path = device_path(i);
+        g_variant_builder_init(&interfaces, G_VARIANT_TYPE("a{sa{sv}}"));
+        g_variant_builder_add(&interfaces, "{s@a{sv}}", BLUEZ_DEVICE_INTERFACE, device_properties(i));
+        g_variant_builder_add(&objects, "{o@a{sa{sv}}}", path, g_variant_builder_end(&interfaces));
+        g_free(path);
+    }
+
+    return g_variant_new("(@a{oa{sa{sv}}})", g_variant_builder_end(&objects));
+}
+
+static void on_bluez_method(GDBusConnection *connection, const gchar *sender,
+                            const gchar *object_path, const gchar *interface_name,
+                            const gchar *method_name, GVariant *parameters,
+                            GDBusMethodInvocation *invocation, gpointer user_data)
+{
+    (void)connection;
+    (void)sender;
+    (void)object_path;
+    (void)interface_name;
+    (void)method_name;
+    (void)parameters;
+    (void)user_data;
+    g_dbus_method_invocation_return_value(invocation, managed_objects());
+}
+
+static GVariant *on_device_get_property(GDBusConnection *connection, const gchar *sender,
+                                        const gchar *object_path, const gchar *interface_name,
+                                        const gchar *property_name, GError **error,
+                                        gpointer user_data)
+{
+    (void)connection;
+    (void)sender;
+    (void)object_path;
+    (void)interface_name;
+    (void)error;
+    return device_property(GPOINTER_TO_UINT(user_data), property_name);
+}
+
+static const GDBusInterfaceVTable object_manager_vtable = { on_bluez_method, NULL, NULL, { 0 } };
+static const GDBusInterfaceVTable device_vtable = { NULL, on_device_get_property, NULL, { 0 } };
+
+static void on_bluez_name_acquired(GDBusConnection *connection, const gchar *name, gpointer user_data)
+{
+    (void)connection;
+    (void)name;
+    (void)user_data;
+    g_mutex_lock(&bluez.lock);
+    bluez.ready = true;
+    g_cond_signal(&bluez.cond);
+    g_mutex_unlock(&bluez.lock);
+}
+
+static gpointer bluez_thread(gpointer data)
+{
+    const gchar *address = data;
+    GError *error = NULL;
+
+    g_main_context_push_thread_default(bluez.context);
+
+    bluez.connection = g_dbus_connection_new_for_address_sync(
+        address,
+        G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+        G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+        NULL, NULL, &error);
+    g_assert_no_error(error);
+
+    bluez.registrations[DEVICES] = g_dbus_connection_register_object(
+        bluez.connection, "/", bluez.info->interfaces[0],
+        &object_manager_vtable, NULL, NULL, &error);
+    g_assert_no_error(error);
+
+    for (guint i = 0; i < DEVICES; i++) {
+        gchar *path = device_path(i);
+        bluez.registrations[i] = g_dbus_connection_register_object(
+            bluez.connection, path, bluez.info->interfaces[1],
+            &device_vtable, GUINT_TO_POINTER(i), NULL, &error);
+        g_assert_no_error(error);
+        g_free(path);
+    }
+
+    bluez.owner_id = g_bus_own_name_on_connection(bluez.connection, BLUEZ_SERVICE,
+                                                  G_BUS_NAME_OWNER_FLAGS_NONE,
+                                                  on_bluez_name_acquired, NULL, NULL, NULL);
+
+    g_main_loop_run(bluez.loop);
+
+    g_bus_unown_name(bluez.owner_id);
+    for (guint i = 0; i < G_N_ELEMENTS(bluez.registrations); i++) {
+        g_dbus_connection_unregister_object(bluez.connection, bluez.registrations[i]);
+    }
+    g_dbus_connection_close_sync(bluez.connection, NULL, NULL);
+    g_object_unref(bluez.connection);
+
+    g_main_context_pop_thread_default(bluez.context);
+    return NULL;
+}
+
+static void start_bluez(const gchar *address)
+{
+    bluez.info = g_dbus_node_info_new_for_xml(bluez_xml, NULL);
+    g_assert_nonnull(bluez.info);
+
+    bluez.context = g_main_context_new();
+    bluez.loop = g_main_loop_new(bluez.context, FALSE);
+    bluez.thread = g_thread_new("bluez", bluez_thread, (gpointer)address);
+
+    g_mutex_lock(&bluez.lock);
+    while (!bluez.ready) {
+        g_cond_wait(&bluez.cond, &bluez.lock);
+    }
+    g_mutex_unlock(&bluez.lock);
+}
+
+static void stop_bluez(void)
+{
+    g_main_loop_quit(bluez.loop);
+    g_thread_join(bluez.thread);
+    g_main_loop_unref(bluez.loop);
+    g_main_context_unref(bluez.context);
+    g_dbus_node_info_unref(bluez.info);
+}
+
+static void emit_device_changed(guint i, GVariant *changed)
+{
+    gchar *path = device_path(i);
+    g_dbus_connection_emit_signal(bluez.connection, NULL, path,
+                                  DBUS_PROPERTIES_INTERFACE, "PropertiesChanged",
+                                  g_variant_new("(s@a{sv}as)", BLUEZ_DEVICE_INTERFACE, changed, NULL),
+                                  NULL);
+    g_free(path);
+}
+
+/* A signal nobody acts on, from a device that is not AirPods */
+static void emit_rssi(guint n)
+{
+    guint i = n * 7 % DEVICES;
+    if (is_airpods(i)) {
+        i++;
+    }
+
+    GVariantBuilder changed;
+    g_variant_builder_init(&changed, G_VARIANT_TYPE("a{sv}"));
+    g_variant_builder_add(&changed, "{sv}", "RSSI", g_variant_new_int16(-40 - (gint16)(n % 40)));
+    emit_device_changed(i, g_variant_builder_end(&changed));
+}
+
+static void emit_connected(guint i, bool connected)
+{
+    g_atomic_int_set(&bluez.connected[i], connected);
+
+    GVariantBuilder changed;
+    g_variant_builder_init(&changed, G_VARIANT_TYPE("a{sv}"));
+    g_variant_builder_add(&changed, "{sv}", "Connected", g_variant_new_boolean(connected));
+    emit_device_changed(i, g_variant_builder_end(&changed));
+}
+
+/* ============================================================================
+ * Benchmarks
+ * ========================================================================== */
+
+static void on_device(const BluezDeviceInfo *device, void *user_data)
+{
+    (void)device;
+    (void)user_data;
+    notifications++;
+}
+
+static void wait_for_signals(BluezMonitor *monitor, guint64 signals)
+{
+    g_dbus_connection_flush_sync(bluez.connection, NULL, NULL);
+    while (monitor->signals < signals) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+}
+
+static void run_storm(guint i, gpointer data)
+{
+    BluezMonitor *monitor = data;
+    static guint64 emitted;
+
+    emit_rssi(i);
+    emitted++;
+    if ((i + 1) % STORM_BATCH == 0) {
+        wait_for_signals(monitor, emitted);
+    }
+}
+
+/* Connect or disconnect an AirPods device behind a burst of signals */
+static void run_detection(guint i, gpointer data)
+{
+    (void)data;
+    guint expected = notifications + 1;
+
+    for (guint n = 0; n < SIGNALS_AHEAD; n++) {
+        emit_rssi(i * SIGNALS_AHEAD + n);
+    }
+    emit_connected(i / 2 * AIRPODS_EVERY % DEVICES, i % 2 == 0);
+    g_dbus_connection_flush_sync(bluez.connection, NULL, NULL);
+
+    while (notifications < expected) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+}
+
+static gint64 process_cpu_us(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return ((gint64)usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * G_USEC_PER_SEC +
+           usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static void bench_storm(BluezMonitor *monitor)
+{
+    guint64 signals = monitor->signals;
+    gint64 handler_cpu = monitor->signal_cpu_us;
+    gint64 cpu = process_cpu_us();
+
+    bench_run(&(BenchCase){ "bluez-signal-storm", STORM_SIGNALS, STORM_BATCH, run_storm, monitor });
+
+    signals = monitor->signals - signals;
+    bench_add_metric("cpu_us_per_1000_signals", (process_cpu_us() - cpu) * 1000.0 / signals);
+    bench_add_metric("handler_cpu_us_per_1000_signals",
+                     (monitor->signal_cpu_us - handler_cpu) * 1000.0 / signals);
+}
+
+int main(int argc, char *argv[])
+{
+    bench_init(&argc, &argv);
+
+    /* The monitor connects to the system bus */
+    GTestDBus *bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+    g_test_dbus_up(bus);
+    g_setenv("DBUS_SYSTEM_BUS_ADDRESS", g_test_dbus_get_bus_address(bus), TRUE);
+
+    start_bluez(g_test_dbus_get_bus_address(bus));
+
+    BluezMonitor *monitor = bluez_monitor_new();
+    g_assert_nonnull(monitor);
+    bluez_monitor_set_connected_callback(monitor, on_device, NULL);
+    bluez_monitor_set_disconnected_callback(monitor, on_device, NULL);
+    g_assert_true(bluez_monitor_start(monitor));
+    bluez_monitor_check_existing_devices(monitor);
+    g_assert_cmpuint(g_hash_table_size(monitor->device_cache), ==, DEVICES);
+
+    bench_storm(monitor);
+
+    /* Time per operation is the detection latency behind the burst */
+    bench_run(&(BenchCase){ "bluez-detection", 2000, 1, run_detection, monitor });
+    bench_add_metric("sync_calls", monitor->sync_calls);
+
+    bluez_monitor_free(monitor);
+    stop_bluez();
+    g_test_dbus_down(bus);
+    g_object_unref(bus);
+
+    return bench_finish();
+}
@@ -0,0 +1,84 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * Benchmarks for loading and saving device profiles and usage
+ */
+
+#include "bench.h"
+#include "config.h"
+
+#include <glib/gstdio.h>
+
+/* A few paired devices, each with a month of usage */
+#define N_DEVICES 4
+#define N_DAYS 30
+
+static BtAddr devices[N_DEVICES];
+static DeviceProfile profile;
+static DailyUsage usage[USAGE_MAX_DAYS];
+
+static void run_load_profile(guint i, gpointer data)
+{
+    (void)data;
+    config_load_device_profile(&devices[i % N_DEVICES], &profile);
+}
+
+static void run_save_profile(guint i, gpointer data)
+{
+    (void)data;
+    profile.adaptive_noise_level = i % 100;
+    config_save_device_profile(&devices[i % N_DEVICES], &profile);
+}
+
+static void run_load_usage(guint i, gpointer data)
+{
+    (void)data;
+    config_load_device_usage(&devices[i % N_DEVICES], usage);
+}
+
+static void run_save_usage(guint i, gpointer data)
+{
+    (void)data;
+    usage[N_DAYS - 1].transitions = i;
+    config_save_device_usage(&devices[i % N_DEVICES], usage, N_DAYS);
+}
+
+static void remove_file(const char *dir, const char *name)
+{
+    gchar *path = g_build_filename(dir, name, NULL);
+    g_remove(path);
+    g_free(path);
+}
+
+int main(int argc, char *argv[])
+{
+    bench_init(&argc, &argv);
+
+    gchar *dir = g_dir_make_tmp("librepods-bench-XXXXXX", NULL);
+    g_assert_nonnull(dir);
+    config_set_directory(dir);
+
+    config_get_default_profile(&profile);
+    g_strlcpy(profile.display_name, "AirPods Pro", sizeof(profile.display_name));
+    for (guint i = 0; i < N_DAYS; i++) {
+        usage[i] = (DailyUsage){ 2460000 + i, 3 * 3600, 600, 18 * 3600, 12 };
+    }
+    for (guint i = 0; i < N_DEVICES; i++) {
+        devices[i] = (BtAddr){ { 0xAA, 0xBB, 0xCC, 0x00, 0x11, (guint8)i } };
+        g_assert_true(config_save_device_profile(&devices[i], &profile));
+        g_assert_true(config_save_device_usage(&devices[i], usage, N_DAYS));
+    }
+
+    bench_run(&(BenchCase){ "config-load-profile", 2000, 10, run_load_profile, NULL });
+    bench_run(&(BenchCase){ "config-save-profile", 2000, 10, run_save_profile, NULL });
+    bench_run(&(BenchCase){ "config-load-usage", 2000, 10, run_load_usage, NULL });
+    bench_run(&(BenchCase){ "config-save-usage", 2000, 10, run_save_usage, NULL });
+
+    remove_file(dir, DEVICES_FILE_NAME);
+    remove_file(dir, "usage.conf");
+    g_rmdir(dir);
+    g_free(dir);
+
+    return bench_finish();
+}
@@ -0,0 +1,82 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * Benchmarks for event dispatch; the time per operation is the cost of
+ * publishing one event, including the bus's own accounting
+ */
+
+#include "bench.h"
+#include "frames.h"
+#include "event_bus.h"
+
+static Event events[64];
+static AapParsedPacket packets[64];
+static guint64 handled;
+
+static void on_event(const Event *event, void *user_data)
+{
+    (void)event;
+    (void)user_data;
+    handled++;
+}
+
+#define STATE_EVENTS (EVENT_MASK(AAP_PKT_TYPE_BATTERY) | \
+                      EVENT_MASK(AAP_PKT_TYPE_EAR_DETECTION) | \
+                      EVENT_MASK(AAP_PKT_TYPE_NOISE_CONTROL) | \
+                      EVENT_MASK(AAP_PKT_TYPE_CONV_AWARENESS) | \
+                      EVENT_MASK(AAP_PKT_TYPE_CA_DETECTION) | \
+                      EVENT_MASK(AAP_PKT_TYPE_LISTENING_MODES) | \
+                      EVENT_MASK(AAP_PKT_TYPE_METADATA))
+
+/* The daemon's subscriber table with every optional subsystem built in */
+static const EventSubscriber daemon_subscribers[] = {
+    { "state",    STATE_EVENTS, 0, on_event },
+    { "dbus",     STATE_EVENTS, 10, on_event },
+    { "media",    EVENT_MASK(AAP_PKT_TYPE_EAR_DETECTION) |
+                  EVENT_MASK(AAP_PKT_TYPE_CA_DETECTION), 20, on_event },
+    { "usage",    EVENT_MASK(AAP_PKT_TYPE_EAR_DETECTION), 30, on_event },
+    { "resume",   EVENT_MASK(AAP_PKT_TYPE_BATTERY), 40, on_event },
+    { "sampler",  EVENT_MASK(AAP_PKT_TYPE_UNKNOWN), 50, on_event },
+};
+
+/* As many subscribers as a bus takes, all of them wanting everything */
+static EventSubscriber full_subscribers[EVENT_MAX_SUBSCRIBERS];
+
+static void run_publish(guint i, gpointer data)
+{
+    event_bus_publish(data, &events[i % bench_session_len]);
+}
+
+int main(int argc, char *argv[])
+{
+    bench_init(&argc, &argv);
+
+    g_assert_cmpuint(bench_session_len, <=, G_N_ELEMENTS(events));
+    for (guint i = 0; i < bench_session_len; i++) {
+        const BenchFrame *frame = &bench_session[i];
+        events[i] = (Event){ AAP_PKT_TYPE_UNKNOWN, NULL, frame->data, frame->len };
+        if (aap_parse_packet(frame->data, frame->len, &packets[i]) == AAP_PARSE_OK) {
+            events[i].type = packets[i].type;
+            events[i].packet = &packets[i];
+        }
+    }
+
+    for (guint i = 0; i < G_N_ELEMENTS(full_subscribers); i++) {
+        full_subscribers[i] = (EventSubscriber){ "full", G_MAXUINT32, (int)i, on_event };
+    }
+
+    EventBus *daemon_bus = event_bus_new(daemon_subscribers, G_N_ELEMENTS(daemon_subscribers), NULL);
+    EventBus *full_bus = event_bus_new(full_subscribers, G_N_ELEMENTS(full_subscribers), NULL);
+    g_assert_nonnull(daemon_bus);
+    g_assert_nonnull(full_bus);
+
+    bench_run(&(BenchCase){ "event-bus-publish", 5000000, 1000, run_publish, daemon_bus });
+    bench_run(&(BenchCase){ "event-bus-publish-full", 2000000, 1000, run_publish, full_bus });
+
+    event_bus_free(full_bus);
+    event_bus_free(daemon_bus);
+
+    g_assert_cmpuint(handled, >, 0);
+    return bench_finish();
+}
@@ -0,0 +1,389 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * Benchmarks for the pause fan-out to MPRIS players
+ *
+ * Includes media_control.c, so that the benchmark can wait on its player
+ * cache. Synthetic players on a private session bus run in a thread of
+ * their own; some of them answer late and some never answer at all.
+ * Operations alternate between pods out and pods in, and each one lasts
+ * until every player that answers has paused or is playing again, so
+ * the time per operation is the fan-out latency. Allocations and
+ * syscalls include the players' side.
+ */
+
+#include "../src/media_control.c"
+
+#include "bench.h"
+
+/* How late a slow player answers Pause and Play */
+#define SLOW_REPLY_MS 10
+
+/* Every tenth player is slow, and every tenth hangs */
+#define SLOW_EVERY 10
+#define SLOW_OFFSET 4
+#define HUNG_OFFSET 9
+
+/* Ear changes per case, as pause and resume pairs */
+#define CHANGES 200
+
+typedef enum {
+    PLAYER_NORMAL,
+    PLAYER_SLOW,
+    PLAYER_HUNG,            /* Never answers Pause */
+} PlayerKind;
+
+typedef struct {
+    gchar *name;
+    PlayerKind kind;
+    GDBusConnection *connection;
+    guint registration_id;
+    guint owner_id;
+    bool playing;
+    GSList *hung_calls;     /* Pause calls left unanswered */
+} FakePlayer;
+
+/* Players and the thread that runs them */
+typedef struct {
+    FakePlayer *players;
+    guint count;
+    GMainContext *context;
+    GMainLoop *loop;
+    GThread *thread;
+} PlayerHost;
+
+/* A reply held back by a slow player */
+typedef struct {
+    FakePlayer *player;
+    GDBusMethodInvocation *invocation;
+    bool playing;
+} DelayedReply;
+
+static const gchar player_xml[] =
+    "<node>"
+    "  <interface name='org.mpris.MediaPlayer2.Player'>"
+    "    <method name='Pause'/>"
+    "    <method name='Play'/>"
+    "    <property name='PlaybackStatus' type='s' access='read'/>"
+    "    <property name='Volume' type='d' access='readwrite'/>"
+    "  </interface>"
+    "</node>";
+
+static GDBusNodeInfo *player_info;
+static gchar *bus_address;
+
+/* ============================================================================
+ * Synthetic players
+ * ========================================================================== */
+
+static void set_playing(FakePlayer *player, bool playing)
+{
+    player->playing = playing;
+
+    GVariantBuilder changed;
+    g_variant_builder_init(&changed, G_VARIANT_TYPE("a{sv}"));
+    g_variant_builder_add(&changed, "{sv}", "PlaybackStatus",
+                          g_variant_new_string(playing ? "Playing" : "Paused"));
+
+    g_dbus_connection_emit_signal(player->connection, NULL, MPRIS_DBUS_PATH,
+                                  DBUS_PROPERTIES_INTERFACE, "PropertiesChanged",
+                                  g_variant_new("(sa{sv}as)", MPRIS_PLAYER_INTERFACE,
+                                                &changed, NULL),
+                                  NULL);
+}
+
+static void reply(FakePlayer *player, GDBusMethodInvocation *invocation, bool playing)
+{
+    set_playing(player, playing);
+    g_dbus_method_invocation_return_value(invocation, NULL);
+}
+
+static gboolean on_delayed_reply(gpointer user_data)
+{
+    DelayedReply *delayed = user_data;
+    reply(delayed->player, delayed->invocation, delayed->playing);
+    g_free(delayed);
+    return G_SOURCE_REMOVE;
+}
+
+static void on_player_method(GDBusConnection *connection, const gchar *sender,
+                             const gchar *object_path, const gchar *interface_name,
+                             const gchar *method_name, GVariant *parameters,
+                             GDBusMethodInvocation *invocation, gpointer user_data)
+{
+    (void)connection;
+    (void)sender;
+    (void)object_path;
+    (void)interface_name;
+    (void)parameters;
+    FakePlayer *player = user_data;
+    bool playing = g_strcmp0(method_name, "Play") == 0;
+
+    switch (player->kind) {
+    case PLAYER_HUNG:
+        if (!playing) {
+            player->hung_calls = g_slist_prepend(player->hung_calls, invocation);
+            return;
+        }
+        reply(player, invocation, playing);
+        break;
+
+    case PLAYER_SLOW: {
+        DelayedReply *delayed = g_new0(DelayedReply, 1);
+        delayed->player = player;
+        delayed->invocation = invocation;
+        delayed->playing = playing;
+
+        GSource *source = g_timeout_source_new(SLOW_REPLY_MS);
+        g_source_set_callback(source, on_delayed_reply, delayed, NULL);
+        g_source_attach(source, g_main_context_get_thread_default());
+        g_source_unref(source);
+        break;
+    }
+
+    default:
+        reply(player, invocation, playing);
+        break;
+    }
+}
+
+static GVariant *on_player_get_property(GDBusConnection *connection, const gchar *sender,
+                                        const gchar *object_path, const gchar *interface_name,
+                                        const gchar *property_name, GError **error,
+                                        gpointer user_data)
+{
+    (void)connection;
+    (void)sender;
+    (void)object_path;
+    (void)interface_name;
+    (void)error;
+    FakePlayer *player = user_data;
+
+    if (g_strcmp0(property_name, "PlaybackStatus") == 0) {
+        return g_variant_new_string(player->playing ? "Playing" : "Paused");
+    }
+    return g_variant_new_double(1.0);
+}
+
+static gboolean on_player_set_property(GDBusConnection *connection, const gchar *sender,
+                                       const gchar *object_path, const gchar *interface_name,
+                                       const gchar *property_name, GVariant *value,
+                                       GError **error, gpointer user_data)
+{
+    (void)connection;
+    (void)sender;
+    (void)object_path;
+    (void)interface_name;
+    (void)property_name;
+    (void)value;
+    (void)error;
+    (void)user_data;
+    return TRUE;
+}
+
+static const GDBusInterfaceVTable player_vtable = {
+    on_player_method,
+    on_player_get_property,
+    on_player_set_property,
+    { 0 }
+};
+
+static void start_player(FakePlayer *player)
+{
+    GError *error = NULL;
+
+    player->connection = g_dbus_connection_new_for_address_sync(
+        bus_address,
+        G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+        G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+        NULL, NULL, &error);
+    g_assert_no_error(error);
+
+    player->registration_id = g_dbus_connection_register_object(
+        player->connection, MPRIS_DBUS_PATH, player_info->interfaces[0],
+        &player_vtable, player, NULL, &error);
+    g_assert_no_error(error);
+
+    player->owner_id = g_bus_own_name_on_connection(player->connection, player->name,
+                                                    G_BUS_NAME_OWNER_FLAGS_NONE,
+                                                    NULL, NULL, NULL, NULL);
+}
+
+static void stop_player(FakePlayer *player)
+{
+    for (GSList *l = player->hung_calls; l != NULL; l = l->next) {
+        g_dbus_method_invocation_return_dbus_error(l->data, "org.mpris.MediaPlayer2.Error.Hung",
+                                                   "Player hung");
+    }
+    g_slist_free(player->hung_calls);
+
+    g_bus_unown_name(player->owner_id);
+    g_dbus_connection_unregister_object(player->connection, player->registration_id);
+    g_dbus_connection_close_sync(player->connection, NULL, NULL);
+    g_object_unref(player->connection);
+    g_free(player->name);
+}
+
+static gpointer player_thread(gpointer data)
+{
+    PlayerHost *host = data;
+
+    g_main_context_push_thread_default(host->context);
+    for (guint i = 0; i < host->count; i++) {
+        start_player(&host->players[i]);
+    }
+
+    g_main_loop_run(host->loop);
+
+    for (guint i = 0; i < host->count; i++) {
+        stop_player(&host->players[i]);
+    }
+    g_main_context_pop_thread_default(host->context);
+    return NULL;
+}
+
+static PlayerKind player_kind(guint count, guint i)
+{
+    if (count < SLOW_EVERY) {
+        return PLAYER_NORMAL;
+    }
+    switch (i % SLOW_EVERY) {
+    case SLOW_OFFSET:
+        return PLAYER_SLOW;
+    case HUNG_OFFSET:
+        return PLAYER_HUNG;
+    default:
+        return PLAYER_NORMAL;
+    }
+}
+
+static PlayerHost *player_host_new(guint count)
+{
+    PlayerHost *host = g_new0(PlayerHost, 1);
+    host->players = g_new0(FakePlayer, count);
+    host->count = count;
+    for (guint i = 0; i < count; i++) {
+        host->players[i].name = g_strdup_printf(MPRIS_DBUS_NAME_PREFIX "bench%u", i);
+        host->players[i].kind = player_kind(count, i);
+        host->players[i].playing = true;
+    }
+
+    host->context = g_main_context_new();
+    host->loop = g_main_loop_new(host->context, FALSE);
+    host->thread = g_thread_new("players", player_thread, host);
+    return host;
+}
+
+static void player_host_free(PlayerHost *host)
+{
+    g_main_loop_quit(host->loop);
+    g_thread_join(host->thread);
+    g_main_loop_unref(host->loop);
+    g_main_context_unref(host->context);
+    g_free(host->players);
+    g_free(host);
+}
+
+/* ============================================================================
+ * Fan-out
+ * ========================================================================== */
+
+typedef struct {
+    MediaControl *mc;
+    guint players;
+    guint answering;        /* Players that answer Pause */
+    gint64 blocking_ns;     /* Time spent inside media_control */
+} FanOut;
+
+static guint cached_playing(MediaControl *mc)
+{
+    GHashTableIter iter;
+    gpointer value;
+    guint playing = 0;
+
+    g_hash_table_iter_init(&iter, mc->players);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        MprisPlayer *player = value;
+        playing += player->playing;
+    }
+    return playing;
+}
+
+static bool paused(FanOut *fan_out)
+{
+    return g_list_length(fan_out->mc->paused_players) == fan_out->answering &&
+           cached_playing(fan_out->mc) == fan_out->players - fan_out->answering;
+}
+
+static bool resumed(FanOut *fan_out)
+{
+    return cached_playing(fan_out->mc) == fan_out->players;
+}
+
+static void run_ear_change(guint i, gpointer data)
+{
+    FanOut *fan_out = data;
+    bool in_ear = i % 2 == 1;
+
+    gint64 start = bench_now_ns();
+    media_control_on_ear_detection_changed(fan_out->mc, in_ear, true);
+    fan_out->blocking_ns += bench_now_ns() - start;
+
+    while (!(in_ear ? resumed(fan_out) : paused(fan_out))) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+}
+
+static void bench_fan_out(guint players)
+{
+    PlayerHost *host = player_host_new(players);
+    FanOut fan_out = { .players = players, .answering = players };
+    for (guint i = 0; i < players; i++) {
+        fan_out.answering -= player_kind(players, i) == PLAYER_HUNG;
+    }
+
+    fan_out.mc = media_control_new();
+    g_assert_nonnull(fan_out.mc);
+
+    /* Wait until the cache knows every player to be playing */
+    while (g_hash_table_size(fan_out.mc->players) < players || !resumed(&fan_out)) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    media_control_on_ear_detection_changed(fan_out.mc, true, true);
+
+    gchar *name = g_strdup_printf("media-pause-%u", players);
+    bench_run(&(BenchCase){ name, CHANGES, 2, run_ear_change, &fan_out });
+    bench_add_metric("blocking_ns_per_op", (double)fan_out.blocking_ns / (CHANGES + 2));
+    bench_add_metric("pause_failures", fan_out.mc->pause_failures);
+    g_free(name);
+
+    media_control_free(fan_out.mc);
+    player_host_free(host);
+
+    /* Let cancelled calls complete before the next case */
+    while (g_main_context_iteration(NULL, FALSE)) {
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    bench_init(&argc, &argv);
+
+    GTestDBus *bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+    g_test_dbus_up(bus);
+    bus_address = g_strdup(g_test_dbus_get_bus_address(bus));
+    player_info = g_dbus_node_info_new_for_xml(player_xml, NULL);
+    g_assert_nonnull(player_info);
+
+    bench_fan_out(1);
+    bench_fan_out(10);
+    bench_fan_out(100);
+
+    g_dbus_node_info_unref(player_info);
+    g_free(bus_address);
+    g_test_dbus_down(bus);
+    g_object_unref(bus);
+
+    return bench_finish();
+}
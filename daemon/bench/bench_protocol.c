@@ -0,0 +1,87 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * Benchmarks for packet parsing and state updates
+ */
+
+#include "bench.h"
+#include "frames.h"
+#include "aap_protocol.h"
+#include "airpods_state.h"
+
+static AapParsedPacket parsed[64];
+static AirPodsState state;
+
+/* Keeps the parse from being optimized away */
+static volatile AapPacketType parsed_type;
+
+static void run_parse(guint i, gpointer data)
+{
+    (void)data;
+    const BenchFrame *frame = &bench_session[i % bench_session_len];
+    AapParsedPacket packet;
+
+    aap_parse_packet(frame->data, frame->len, &packet);
+    parsed_type = packet.type;
+}
+
+/* The state updates of the daemon's "state" subscriber, without the logging */
+static void run_state_update(guint i, gpointer data)
+{
+    (void)data;
+    const AapParsedPacket *packet = &parsed[i % bench_session_len];
+
+    switch (packet->type) {
+    case AAP_PKT_TYPE_BATTERY:
+        airpods_state_set_battery(&state,
+                                  packet->data.battery.left_level,
+                                  packet->data.battery.left_status,
+                                  packet->data.battery.right_level,
+                                  packet->data.battery.right_status,
+                                  packet->data.battery.case_level,
+                                  packet->data.battery.case_status);
+        break;
+    case AAP_PKT_TYPE_EAR_DETECTION:
+        airpods_state_set_ear_detection(&state,
+                                        packet->data.ear_detection.primary_in_ear,
+                                        packet->data.ear_detection.secondary_in_ear,
+                                        packet->data.ear_detection.primary_left);
+        break;
+    case AAP_PKT_TYPE_NOISE_CONTROL:
+        airpods_state_set_noise_control(&state, packet->data.noise_control);
+        break;
+    case AAP_PKT_TYPE_CONV_AWARENESS:
+        airpods_state_set_conversational_awareness(&state, packet->data.conversational_awareness);
+        break;
+    case AAP_PKT_TYPE_LISTENING_MODES:
+        airpods_state_set_listening_modes(&state,
+                                          packet->data.listening_modes.off_enabled,
+                                          packet->data.listening_modes.transparency_enabled,
+                                          packet->data.listening_modes.anc_enabled,
+                                          packet->data.listening_modes.adaptive_enabled);
+        break;
+    case AAP_PKT_TYPE_METADATA:
+        state.model = airpods_model_from_number(packet->data.metadata.model_number);
+        break;
+    default:
+        break;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    bench_init(&argc, &argv);
+
+    g_assert_cmpuint(bench_session_len, <=, G_N_ELEMENTS(parsed));
+    for (guint i = 0; i < bench_session_len; i++) {
+        aap_parse_packet(bench_session[i].data, bench_session[i].len, &parsed[i]);
+    }
+    airpods_state_init(&state);
+
+    bench_run(&(BenchCase){ "parse", 2000000, 1000, run_parse, NULL });
+    bench_run(&(BenchCase){ "state-update", 2000000, 1000, run_state_update, NULL });
+
+    airpods_state_cleanup(&state);
+    return bench_finish();
+}
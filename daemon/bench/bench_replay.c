@@ -0,0 +1,138 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * Benchmarks for property emission and end-to-end packet handling
+ *
+ * Includes main.c, so that received packets go through the daemon's own
+ * subscriber table, with the D-Bus service on a private session bus.
+ * Nobody listens to the signals: the cost is the daemon's alone.
+ */
+
+#define main librepods_daemon_main
+#include "../src/main.c"
+#undef main
+
+#include "bench.h"
+#include "frames.h"
+
+#include <glib/gstdio.h>
+
+/* Operations between flushes of the D-Bus connection */
+#define FLUSH_EVERY 100
+
+static const BtAddr device = { { 0xAA, 0xBB, 0xCC, 0x00, 0x11, 0x22 } };
+
+static GDBusConnection *connection;
+
+/* Let the GDBus worker catch up, so its work is counted with the ops */
+static void flush_every(guint i)
+{
+    if ((i + 1) % FLUSH_EVERY == 0) {
+        g_dbus_connection_flush_sync(connection, NULL, NULL);
+        while (g_main_context_iteration(NULL, FALSE)) {
+        }
+    }
+}
+
+static void run_emit_property(guint i, gpointer data)
+{
+    (void)data;
+    dbus_service_emit_properties_changed(app.dbus_service, "BatteryLeft");
+    flush_every(i);
+}
+
+static void run_replay(guint i, gpointer data)
+{
+    (void)data;
+    const BenchFrame *frame = &bench_session[i % bench_session_len];
+
+    on_bt_data_received(frame->data, frame->len, NULL);
+    flush_every(i);
+}
+
+static void on_name_appeared(GDBusConnection *bus_connection, const gchar *name,
+                             const gchar *name_owner, gpointer user_data)
+{
+    (void)bus_connection;
+    (void)name;
+    (void)name_owner;
+    *(bool *)user_data = true;
+}
+
+/* Set the daemon up as if the AirPods had just connected */
+static void start_daemon(void)
+{
+    airpods_state_init(&app.state);
+    airpods_state_set_device(&app.state, "AirPods Pro", &device, AIRPODS_MODEL_PRO);
+
+#if HAVE_PACKET_SAMPLER
+    app.packet_sampler = packet_sampler_new();
+#endif
+#if HAVE_USAGE_STATS
+    app.usage_stats = usage_stats_new();
+    usage_stats_start(app.usage_stats, &device);
+#endif
+
+    app.event_bus = event_bus_new(packet_subscribers, G_N_ELEMENTS(packet_subscribers), NULL);
+    g_assert_nonnull(app.event_bus);
+
+    app.dbus_service = dbus_service_new(&app.state, G_BUS_TYPE_SESSION);
+    g_assert_nonnull(app.dbus_service);
+    g_assert_true(dbus_service_start(app.dbus_service));
+
+    /* The service uses the shared session connection, so this is it */
+    bool owned = false;
+    guint watch_id = g_bus_watch_name(G_BUS_TYPE_SESSION, DBUS_SERVICE_NAME,
+                                      G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                      on_name_appeared, NULL, &owned, NULL);
+    while (!owned) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    g_bus_unwatch_name(watch_id);
+
+    connection = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
+    g_assert_nonnull(connection);
+}
+
+static void remove_dir(const char *dir)
+{
+    GDir *entries = g_dir_open(dir, 0, NULL);
+    const gchar *name;
+    while (entries != NULL && (name = g_dir_read_name(entries)) != NULL) {
+        gchar *path = g_build_filename(dir, name, NULL);
+        g_remove(path);
+        g_free(path);
+    }
+    if (entries != NULL) {
+        g_dir_close(entries);
+    }
+    g_rmdir(dir);
+}
+
+int main(int argc, char *argv[])
+{
+    bench_init(&argc, &argv);
+
+    gchar *dir = g_dir_make_tmp("librepods-bench-XXXXXX", NULL);
+    g_assert_nonnull(dir);
+    config_set_directory(dir);
+
+    GTestDBus *bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+    g_test_dbus_up(bus);
+
+    start_daemon();
+
+    bench_run(&(BenchCase){ "property-emission", 20000, FLUSH_EVERY, run_emit_property, NULL });
+    bench_run(&(BenchCase){ "replay", 20000, FLUSH_EVERY, run_replay, NULL });
+
+    cleanup();
+    g_object_unref(connection);
+    g_test_dbus_down(bus);
+    g_object_unref(bus);
+
+    remove_dir(dir);
+    g_free(dir);
+
+    return bench_finish();
+}
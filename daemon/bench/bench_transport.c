@@ -0,0 +1,168 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * Benchmarks for the Bluetooth transport, poll source against io_uring
+ *
+ * Includes bluetooth.c, so that the benchmark can read the connection's
+ * own I/O counters. The device is the other end of a socketpair. The
+ * harness counts syscalls through the libc wrappers, which do not see
+ * io_uring_enter, so each case also reports the syscalls the backend
+ * made per packet: that is the figure to compare between backends.
+ */
+
+#include "../src/aap_protocol.h"
+
+/* The packet dump goes to stderr on every packet; leave it out, so that
+ * the cases time the transport rather than the terminal */
+#define aap_debug_print_packet(prefix, data, len) ((void)0)
+
+#include "../src/bluetooth.c"
+
+#include "bench.h"
+#include "frames.h"
+
+/* Packets the device sends, or the connection queues, back to back */
+#define BURST 16
+
+#define PACKETS 20000
+
+static const BtAddr device = { { 0xAA, 0xBB, 0xCC, 0x00, 0x11, 0x22 } };
+
+typedef struct {
+    BluetoothConnection *conn;
+    int peer;                   /* The fake device's end */
+    guint64 sent;               /* Packets the device sent */
+    guint64 received;           /* Packets the connection handled */
+    guint64 queued;             /* Packets the connection was given to send */
+} Transport;
+
+static void on_data(const uint8_t *data, size_t len, void *user_data)
+{
+    (void)data;
+    (void)len;
+    ((Transport *)user_data)->received++;
+}
+
+static void device_send(Transport *transport)
+{
+    const BenchFrame *frame = &bench_session[transport->sent % bench_session_len];
+
+    g_assert_cmpint(send(transport->peer, frame->data, frame->len, 0), ==, (ssize_t)frame->len);
+    transport->sent++;
+}
+
+static void wait_received(Transport *transport, guint64 count)
+{
+    while (transport->received < count) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+}
+
+/* One packet from the device, handled before the next is sent */
+static void run_rx(guint i, gpointer data)
+{
+    (void)i;
+    Transport *transport = data;
+
+    device_send(transport);
+    wait_received(transport, transport->sent);
+}
+
+/* Packets from the device in bursts; an operation is one packet handled */
+static void run_rx_burst(guint i, gpointer data)
+{
+    (void)i;
+    Transport *transport = data;
+
+    if (transport->received == transport->sent) {
+        for (guint n = 0; n < BURST; n++) {
+            device_send(transport);
+        }
+    }
+    wait_received(transport, transport->received + 1);
+}
+
+/* Packets to the device, read back after each burst */
+static void run_tx_burst(guint i, gpointer data)
+{
+    (void)i;
+    Transport *transport = data;
+    const BenchFrame *frame = &bench_session[transport->queued % bench_session_len];
+
+    g_assert_cmpint(bt_connection_send(transport->conn, frame->data, frame->len), ==,
+                    (ssize_t)frame->len);
+    if (++transport->queued % BURST != 0) {
+        return;
+    }
+
+    uint8_t buffer[BT_MAX_PACKET_SIZE];
+    for (guint n = 0; n < BURST; n++) {
+        while (recv(transport->peer, buffer, sizeof(buffer), MSG_DONTWAIT) < 0) {
+            g_assert_cmpint(errno, ==, EAGAIN);
+            g_main_context_iteration(NULL, TRUE);
+        }
+    }
+}
+
+/* Run a case and report the backend's own syscalls per packet */
+static void run_case(Transport *transport, const char *name, const char *backend,
+                     void (*run)(guint i, gpointer data))
+{
+    const BtIoCounters *io = &transport->conn->io;
+    guint64 syscalls = io->rx_syscalls + io->tx_syscalls;
+    guint64 packets = io->rx_packets + io->tx_packets;
+
+    gchar *full_name = g_strdup_printf("%s-%s", name, backend);
+    bench_run(&(BenchCase){ full_name, PACKETS, BURST, run, transport });
+    g_free(full_name);
+
+    bench_add_metric("backend_syscalls_per_packet",
+                     (double)(io->rx_syscalls + io->tx_syscalls - syscalls) /
+                     (io->rx_packets + io->tx_packets - packets));
+}
+
+static void bench_backend(const char *backend)
+{
+    Transport transport = { 0 };
+    int fds[2];
+
+    g_setenv("LIBREPODS_IO_BACKEND", backend, TRUE);
+    g_assert_cmpint(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds), ==, 0);
+    transport.peer = fds[1];
+
+    transport.conn = bt_connection_new();
+    bt_connection_set_data_callback(transport.conn, on_data, &transport);
+    g_assert_true(bt_connection_adopt_socket(transport.conn, fds[0], &device));
+    g_assert_true(bt_connection_attach_to_mainloop(transport.conn, NULL));
+
+    /* The first packet settles the backend: io_uring falls back to poll
+     * where the build, or the kernel, has no multishot receive */
+    device_send(&transport);
+    wait_received(&transport, transport.sent);
+
+    if (g_strcmp0(backend, "poll") == 0 || transport.conn->uring != NULL) {
+        run_case(&transport, "transport-rx", backend, run_rx);
+        run_case(&transport, "transport-rx-burst", backend, run_rx_burst);
+        run_case(&transport, "transport-tx-burst", backend, run_tx_burst);
+    } else {
+        g_printerr("%s unavailable, skipping its cases\n", backend);
+    }
+
+    bt_connection_free(transport.conn);
+    close(transport.peer);
+
+    /* Let the io_uring teardown finish */
+    while (g_main_context_iteration(NULL, FALSE)) {
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    bench_init(&argc, &argv);
+
+    bench_backend("poll");
+    bench_backend("io_uring");
+
+    return bench_finish();
+}
@@ -0,0 +1,54 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ */
+
+#include "frames.h"
+
+#define FRAME(...) { (const uint8_t[]){ __VA_ARGS__ }, sizeof((const uint8_t[]){ __VA_ARGS__ }) }
+
+const BenchFrame bench_session[] = {
+    /* Metadata: name, model number, manufacturer */
+    FRAME(0x04, 0x00, 0x04, 0x00, 0x1D, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00,
+          'A', 'i', 'r', 'P', 'o', 'd', 's', ' ', 'P', 'r', 'o', 0x00,
+          'A', '2', '0', '8', '4', 0x00,
+          'A', 'p', 'p', 'l', 'e', ' ', 'I', 'n', 'c', '.', 0x00),
+    /* Listening modes: transparency and ANC */
+    FRAME(0x04, 0x00, 0x04, 0x00, 0x09, 0x00, 0x1A, 0x06, 0x00, 0x00, 0x00),
+    /* Noise control: ANC */
+    FRAME(0x04, 0x00, 0x04, 0x00, 0x09, 0x00, 0x0D, 0x02, 0x00, 0x00, 0x00),
+    /* Conversational awareness on */
+    FRAME(0x04, 0x00, 0x04, 0x00, 0x09, 0x00, 0x28, 0x01, 0x00, 0x00, 0x00),
+    /* Battery: right, left, case */
+    FRAME(0x04, 0x00, 0x04, 0x00, 0x04, 0x00, 0x03,
+          0x02, 0x01, 0x64, 0x02, 0x01,
+          0x04, 0x01, 0x63, 0x02, 0x01,
+          0x08, 0x01, 0x34, 0x01, 0x01),
+    /* Both in ear */
+    FRAME(0x04, 0x00, 0x04, 0x00, 0x06, 0x00, 0x00, 0x00),
+    /* Head tracking (not parsed) */
+    FRAME(0x04, 0x00, 0x04, 0x00, 0x17, 0x00, 0x00, 0x00, 0x10, 0x00, 0x0B, 0x00,
+          0x5A, 0x01, 0x8C, 0xFF, 0x02, 0x00, 0x00, 0x00),
+    /* User starts and stops speaking */
+    FRAME(0x04, 0x00, 0x04, 0x00, 0x4B, 0x00, 0x02, 0x00, 0x01, 0x01),
+    FRAME(0x04, 0x00, 0x04, 0x00, 0x4B, 0x00, 0x02, 0x00, 0x01, 0x08),
+    /* Battery */
+    FRAME(0x04, 0x00, 0x04, 0x00, 0x04, 0x00, 0x03,
+          0x02, 0x01, 0x63, 0x02, 0x01,
+          0x04, 0x01, 0x62, 0x02, 0x01,
+          0x08, 0x01, 0x34, 0x01, 0x01),
+    /* One bud out and back in */
+    FRAME(0x04, 0x00, 0x04, 0x00, 0x06, 0x00, 0x01, 0x00),
+    FRAME(0x04, 0x00, 0x04, 0x00, 0x06, 0x00, 0x00, 0x00),
+    /* Noise control: transparency */
+    FRAME(0x04, 0x00, 0x04, 0x00, 0x09, 0x00, 0x0D, 0x03, 0x00, 0x00, 0x00),
+    /* Unknown control ID */
+    FRAME(0x04, 0x00, 0x04, 0x00, 0x09, 0x00, 0x1B, 0x01, 0x00, 0x00, 0x00),
+    /* Battery */
+    FRAME(0x04, 0x00, 0x04, 0x00, 0x04, 0x00, 0x03,
+          0x02, 0x01, 0x62, 0x02, 0x01,
+          0x04, 0x01, 0x62, 0x02, 0x01,
+          0x08, 0x01, 0x34, 0x01, 0x01),
+};
+
+const guint bench_session_len = G_N_ELEMENTS(bench_session);
@@ -0,0 +1,31 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * AAP frames for the benchmarks
+ */
+
+#ifndef BENCH_FRAMES_H
+#define BENCH_FRAMES_H
+
+#include <glib.h>
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+} BenchFrame;
+
+/**
+ * A short connection, as the AirPods send it
+ *
+ * The status burst after the handshake (metadata, settings, battery),
+ * then what arrives while they are worn: battery updates, ear detection,
+ * conversational awareness, mode changes and frames the parser does not
+ * know.
+ */
+extern const BenchFrame bench_session[];
+extern const guint bench_session_len;
+
+#endif /* BENCH_FRAMES_H */
@@ -60,6 +60,10 @@
 #define AAP_EAR_OUT      0x01
 #define AAP_EAR_IN_CASE  0x02
 
+/* Conversational awareness detection levels (CA detection data[9]) */
+#define AAP_CA_LEVEL_SPEAKING  0x02  /* 0x01-0x02: user started speaking */
+#define AAP_CA_LEVEL_STOPPED   0x08  /* 0x08 and up: user stopped speaking */
+
 /* Packet sizes */
 #define AAP_HANDSHAKE_SIZE       16
 #define AAP_REQUEST_NOTIF_SIZE   10
@@ -99,6 +103,7 @@ typedef enum {
     AAP_PKT_TYPE_CA_DETECTION,
     AAP_PKT_TYPE_METADATA,
     AAP_PKT_TYPE_LISTENING_MODES,
+    AAP_PKT_TYPE_COUNT,
 } AapPacketType;
 
 /* Parsed battery data */
@@ -115,6 +120,8 @@ typedef struct {
 typedef struct {
     bool primary_in_ear;
     bool secondary_in_ear;
+    bool primary_in_case;
+    bool secondary_in_case;
     bool primary_left;
 } AapEarDetectionData;
 
@@ -13,7 +13,6 @@ void airpods_state_init(AirPodsState *state)
 
     state->connected = false;
     state->device_name = NULL;
-    state->device_address = NULL;
     state->display_name = NULL;
     state->model = AIRPODS_MODEL_UNKNOWN;
 
@@ -44,10 +43,8 @@ void airpods_state_cleanup(AirPodsState *state)
 {
     g_mutex_lock(&state->lock);
     g_free(state->device_name);
-    g_free(state->device_address);
     g_free(state->display_name);
     state->device_name = NULL;
-    state->device_address = NULL;
     state->display_name = NULL;
     g_mutex_unlock(&state->lock);
     g_mutex_clear(&state->lock);
@@ -59,10 +56,9 @@ void airpods_state_reset(AirPodsState *state)
 
     state->connected = false;
     g_free(state->device_name);
-    g_free(state->device_address);
     g_free(state->display_name);
     state->device_name = NULL;
-    state->device_address = NULL;
+    memset(&state->device_address, 0, sizeof(state->device_address));
     state->display_name = NULL;
     state->model = AIRPODS_MODEL_UNKNOWN;
 
@@ -88,14 +84,13 @@ void airpods_state_reset(AirPodsState *state)
 
 void airpods_state_set_device(AirPodsState *state,
                                const char *name,
-                               const char *address,
+                               const BtAddr *address,
                                AirPodsModel model)
 {
     g_mutex_lock(&state->lock);
     g_free(state->device_name);
-    g_free(state->device_address);
     state->device_name = g_strdup(name);
-    state->device_address = g_strdup(address);
+    state->device_address = *address;
     state->model = model;
     state->connected = true;
     g_mutex_unlock(&state->lock);
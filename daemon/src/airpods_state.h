@@ -10,6 +10,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "bt_addr.h"
+
 /* AirPods model identifiers (from BLE advertisement) */
 typedef enum {
     AIRPODS_MODEL_UNKNOWN = 0,
@@ -76,7 +78,7 @@ typedef struct {
     /* Connection info */
     bool connected;
     char *device_name;
-    char *device_address;
+    BtAddr device_address;  /* All zero while disconnected */
     char *display_name;     /* Custom display name (NULL = use model name) */
     AirPodsModel model;
 
@@ -112,7 +114,7 @@ void airpods_state_reset(AirPodsState *state);
 /* Set device info */
 void airpods_state_set_device(AirPodsState *state,
                                const char *name,
-                               const char *address,
+                               const BtAddr *address,
                                AirPodsModel model);
 
 /* Set custom display name */
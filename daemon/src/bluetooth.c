@@ -5,6 +5,10 @@
 
 #include "bluetooth.h"
 #include "aap_protocol.h"
+#include "bt_uring.h"
+#include "stall_detector.h"
+#include "wakeup_stats.h"
+#include "histogram.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,15 +16,27 @@
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <time.h>
 
 #include <sys/socket.h>
+#include <linux/net_tstamp.h>
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/l2cap.h>
 
+/* Packet waiting in the paced TX queue */
+typedef struct {
+    guint delay_ms;         /* Gap after the previous paced packet */
+    size_t len;
+    uint8_t data[];
+} PacedPacket;
+
+/* Room for SCM_TIMESTAMPING (three timespecs) */
+#define RX_CONTROL_LEN CMSG_SPACE(3 * sizeof(struct timespec))
+
 struct BluetoothConnection {
     int socket_fd;
     BluetoothState state;
-    char *address;
+    BtAddr address;
 
     BtDataCallback data_callback;
     void *data_user_data;
@@ -30,6 +46,27 @@ struct BluetoothConnection {
 
     GSource *source;
     uint8_t recv_buffer[BT_MAX_PACKET_SIZE];
+
+    /* io_uring backend, used instead of the poll source when available */
+    BtUring *uring;
+    bool uring_receiving;   /* Got data since attaching */
+    BtIoCounters io;
+
+    /* Packets sent with a gap after each other, see bt_connection_send_paced() */
+    GQueue paced_tx;
+    guint paced_timer_id;
+
+    /* Kernel RX timestamps */
+    BtTimestampMode timestamp_mode;
+    uint8_t control_buffer[RX_CONTROL_LEN];
+    Log2Histogram kernel_delay_us;  /* Kernel receive to recvmsg() */
+    Log2Histogram processing_us;    /* Packet handling on the main loop */
+};
+
+static const char *timestamp_mode_names[] = {
+    [BT_TIMESTAMP_NONE] = "none",
+    [BT_TIMESTAMP_NS] = "SO_TIMESTAMPNS",
+    [BT_TIMESTAMP_SOFTWARE] = "SO_TIMESTAMPING",
 };
 
 BluetoothConnection *bt_connection_new(void)
@@ -37,7 +74,6 @@ BluetoothConnection *bt_connection_new(void)
     BluetoothConnection *conn = g_new0(BluetoothConnection, 1);
     conn->socket_fd = -1;
     conn->state = BT_STATE_DISCONNECTED;
-    conn->address = NULL;
     conn->source = NULL;
     return conn;
 }
@@ -48,7 +84,6 @@ void bt_connection_free(BluetoothConnection *conn)
         return;
 
     bt_connection_disconnect(conn);
-    g_free(conn->address);
     g_free(conn);
 }
 
@@ -76,8 +111,97 @@ static void set_state(BluetoothConnection *conn, BluetoothState state, const cha
     }
 }
 
-bool bt_connection_connect(BluetoothConnection *conn, const char *address)
+/* Ask the kernel to stamp received packets, so queueing delay can be measured */
+static void enable_rx_timestamps(BluetoothConnection *conn)
+{
+    /* Prefer the generic timestamping API, fall back to the older option.
+     * Without either, only processing time is measured. */
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    if (setsockopt(conn->socket_fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0) {
+        conn->timestamp_mode = BT_TIMESTAMP_SOFTWARE;
+    } else {
+        int on = 1;
+        conn->timestamp_mode = setsockopt(conn->socket_fd, SOL_SOCKET, SO_TIMESTAMPNS,
+                                          &on, sizeof(on)) == 0
+                               ? BT_TIMESTAMP_NS : BT_TIMESTAMP_NONE;
+    }
+
+    g_debug("RX timestamps: %s", timestamp_mode_names[conn->timestamp_mode]);
+}
+
+/* Receive timestamp from a recvmsg() control buffer, or NULL if none */
+static const struct timespec *rx_timestamp(struct msghdr *msg)
+{
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET)
+            continue;
+
+        /* SCM_TIMESTAMPING carries three stamps, the software one first */
+        if (cmsg->cmsg_type == SCM_TIMESTAMPING || cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            return (const struct timespec *)CMSG_DATA(cmsg);
+        }
+    }
+
+    return NULL;
+}
+
+/* Time between the kernel receiving a packet and now, or -1 if unknown */
+static gint64 rx_kernel_delay_us(const struct timespec *stamp)
+{
+    if (stamp == NULL || (stamp->tv_sec == 0 && stamp->tv_nsec == 0)) {
+        return -1;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    gint64 delay = (gint64)(now.tv_sec - stamp->tv_sec) * G_USEC_PER_SEC +
+                   (now.tv_nsec - stamp->tv_nsec) / 1000;
+    return MAX(delay, 0);
+}
+
+/* Report a failed connection attempt and return to the disconnected state
+ * so that a later attempt (e.g. through another adapter) is accepted */
+static void fail_connect(BluetoothConnection *conn, int err)
 {
+    if (conn->socket_fd >= 0) {
+        close(conn->socket_fd);
+        conn->socket_fd = -1;
+    }
+    set_state(conn, BT_STATE_ERROR, strerror(err));
+    conn->state = BT_STATE_DISCONNECTED;
+}
+
+/* Set up a socket that has just connected and report the connection */
+static void finish_connect(BluetoothConnection *conn, const char *address_str)
+{
+    enable_rx_timestamps(conn);
+
+    /* Set non-blocking after connect */
+    int flags = fcntl(conn->socket_fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(conn->socket_fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        g_warning("Failed to set non-blocking mode: %s", strerror(errno));
+    }
+
+    g_message("Connected to %s", address_str);
+    set_state(conn, BT_STATE_CONNECTED, NULL);
+}
+
+/* bdaddr_t is stored least significant byte first */
+static void addr_to_bdaddr(const BtAddr *addr, bdaddr_t *bdaddr)
+{
+    for (size_t i = 0; i < sizeof(addr->b); i++) {
+        bdaddr->b[i] = addr->b[sizeof(addr->b) - 1 - i];
+    }
+}
+
+bool bt_connection_connect(BluetoothConnection *conn, const BtAddr *address,
+                           const BtAddr *adapter_address)
+{
+    char address_str[BT_ADDR_STRLEN];
+    char adapter_str[BT_ADDR_STRLEN];
+    bt_addr_to_string(address, address_str);
+
     if (conn->state != BT_STATE_DISCONNECTED) {
         g_warning("Cannot connect: already connected or connecting");
         return false;
@@ -87,7 +211,7 @@ bool bt_connection_connect(BluetoothConnection *conn, const char *address)
     conn->socket_fd = socket(AF_BLUETOOTH, SOCK_SEQPACKET, BTPROTO_L2CAP);
     if (conn->socket_fd < 0) {
         g_warning("Failed to create L2CAP socket: %s", strerror(errno));
-        set_state(conn, BT_STATE_ERROR, strerror(errno));
+        fail_connect(conn, errno);
         return false;
     }
 
@@ -100,43 +224,86 @@ bool bt_connection_connect(BluetoothConnection *conn, const char *address)
         setsockopt(conn->socket_fd, SOL_L2CAP, L2CAP_OPTIONS, &opts, sizeof(opts));
     }
 
+    /* Bind to the adapter BlueZ reports for the device, otherwise the
+     * kernel routes through the first controller it finds */
+    if (adapter_address != NULL) {
+        struct sockaddr_l2 local;
+        memset(&local, 0, sizeof(local));
+        local.l2_family = AF_BLUETOOTH;
+        addr_to_bdaddr(adapter_address, &local.l2_bdaddr);
+
+        if (bind(conn->socket_fd, (struct sockaddr *)&local, sizeof(local)) < 0) {
+            g_warning("Failed to bind to adapter %s: %s",
+                      bt_addr_to_string(adapter_address, adapter_str), strerror(errno));
+            fail_connect(conn, errno);
+            return false;
+        }
+    }
+
     /* Prepare destination address */
     struct sockaddr_l2 addr;
     memset(&addr, 0, sizeof(addr));
     addr.l2_family = AF_BLUETOOTH;
     addr.l2_psm = htobs(AIRPODS_L2CAP_PSM);
-    str2ba(address, &addr.l2_bdaddr);
+    addr_to_bdaddr(address, &addr.l2_bdaddr);
 
-    g_free(conn->address);
-    conn->address = g_strdup(address);
+    conn->address = *address;
 
     set_state(conn, BT_STATE_CONNECTING, NULL);
 
-    g_message("Connecting to %s on PSM 0x%04X...", address, AIRPODS_L2CAP_PSM);
+    g_message("Connecting to %s on PSM 0x%04X via %s...", address_str, AIRPODS_L2CAP_PSM,
+              adapter_address ? bt_addr_to_string(adapter_address, adapter_str) : "default adapter");
 
     /* Connect (blocking for now, could be made async) */
-    if (connect(conn->socket_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-        g_warning("Failed to connect to %s: %s", address, strerror(errno));
-        close(conn->socket_fd);
-        conn->socket_fd = -1;
-        set_state(conn, BT_STATE_ERROR, strerror(errno));
+    const char *prev_activity = stall_detector_enter("l2cap-connect");
+    int ret = connect(conn->socket_fd, (struct sockaddr *)&addr, sizeof(addr));
+    stall_detector_leave(prev_activity);
+
+    if (ret < 0) {
+        g_warning("Failed to connect to %s: %s", address_str, strerror(errno));
+        fail_connect(conn, errno);
         return false;
     }
 
-    /* Set non-blocking after connect */
-    int flags = fcntl(conn->socket_fd, F_GETFL, 0);
-    if (flags < 0 || fcntl(conn->socket_fd, F_SETFL, flags | O_NONBLOCK) < 0) {
-        g_warning("Failed to set non-blocking mode: %s", strerror(errno));
+    finish_connect(conn, address_str);
+    return true;
+}
+
+bool bt_connection_adopt_socket(BluetoothConnection *conn, int fd, const BtAddr *address)
+{
+    char address_str[BT_ADDR_STRLEN];
+    bt_addr_to_string(address, address_str);
+
+    if (conn->state != BT_STATE_DISCONNECTED) {
+        g_warning("Cannot connect: already connected or connecting");
+        close(fd);
+        return false;
     }
 
-    g_message("Connected to %s", address);
-    set_state(conn, BT_STATE_CONNECTED, NULL);
+    conn->socket_fd = fd;
+    conn->address = *address;
 
+    set_state(conn, BT_STATE_CONNECTING, NULL);
+    finish_connect(conn, address_str);
     return true;
 }
 
 void bt_connection_disconnect(BluetoothConnection *conn)
 {
+    if (conn->paced_timer_id != 0) {
+        g_source_remove(conn->paced_timer_id);
+        conn->paced_timer_id = 0;
+    }
+    PacedPacket *packet;
+    while ((packet = g_queue_pop_head(&conn->paced_tx)) != NULL) {
+        g_free(packet);
+    }
+
+    if (conn->uring) {
+        bt_uring_free(conn->uring);
+        conn->uring = NULL;
+    }
+
     if (conn->source) {
         g_source_destroy(conn->source);
         g_source_unref(conn->source);
@@ -172,6 +339,14 @@ ssize_t bt_connection_send(BluetoothConnection *conn, const uint8_t *data, size_
 
     aap_debug_print_packet("TX", data, len);
 
+    /* Errors surface later, as completions */
+    if (conn->uring) {
+        return bt_uring_send(conn->uring, data, len) ? (ssize_t)len : -1;
+    }
+
+    conn->io.tx_packets++;
+    conn->io.tx_syscalls++;
+
     ssize_t sent = send(conn->socket_fd, data, len, 0);
     if (sent < 0) {
         g_warning("Send failed: %s", strerror(errno));
@@ -183,6 +358,68 @@ ssize_t bt_connection_send(BluetoothConnection *conn, const uint8_t *data, size_
     return sent;
 }
 
+void bt_connection_flush(BluetoothConnection *conn)
+{
+    if (conn->uring) {
+        bt_uring_flush(conn->uring);
+    }
+}
+
+static gboolean on_paced_timer(gpointer user_data);
+
+/* Arm the timer for the next queued packet, unless one is already armed */
+static void schedule_paced(BluetoothConnection *conn)
+{
+    PacedPacket *next = g_queue_peek_head(&conn->paced_tx);
+    if (next != NULL && conn->paced_timer_id == 0) {
+        /* The gaps are part of the protocol, no slack */
+        conn->paced_timer_id = wakeup_timeout_add(next->delay_ms, 0, on_paced_timer, conn);
+    }
+}
+
+static gboolean on_paced_timer(gpointer user_data)
+{
+    BluetoothConnection *conn = user_data;
+
+    wakeup_stats_count(WAKEUP_TIMER_TX_PACING);
+    conn->paced_timer_id = 0;
+
+    PacedPacket *packet = g_queue_pop_head(&conn->paced_tx);
+    if (packet != NULL) {
+        bt_connection_send(conn, packet->data, packet->len);
+        bt_connection_flush(conn);
+        g_free(packet);
+    }
+
+    /* Sending may have failed and disconnected, which empties the queue */
+    schedule_paced(conn);
+    return G_SOURCE_REMOVE;
+}
+
+bool bt_connection_send_paced(BluetoothConnection *conn, guint delay_ms,
+                              const uint8_t *data, size_t len)
+{
+    if (conn->socket_fd < 0) {
+        return false;
+    }
+
+    PacedPacket *packet = g_malloc(sizeof(PacedPacket) + len);
+    packet->delay_ms = delay_ms;
+    packet->len = len;
+    memcpy(packet->data, data, len);
+
+    g_queue_push_tail(&conn->paced_tx, packet);
+    schedule_paced(conn);
+    return true;
+}
+
+bool bt_connection_start_handshake(BluetoothConnection *conn)
+{
+    return bt_connection_send_paced(conn, 100, AAP_PKT_HANDSHAKE, AAP_HANDSHAKE_SIZE) &&
+           bt_connection_send_paced(conn, 50, AAP_PKT_SET_FEATURES, AAP_SET_FEATURES_SIZE) &&
+           bt_connection_send_paced(conn, 50, AAP_PKT_REQUEST_NOTIFICATIONS, AAP_REQUEST_NOTIF_SIZE);
+}
+
 bool bt_connection_send_handshake(BluetoothConnection *conn)
 {
     ssize_t sent = bt_connection_send(conn, AAP_PKT_HANDSHAKE, AAP_HANDSHAKE_SIZE);
@@ -206,6 +443,27 @@ int bt_connection_get_fd(BluetoothConnection *conn)
     return conn->socket_fd;
 }
 
+/* Record latency for one received packet and pass it to the data callback */
+static void handle_rx_packet(BluetoothConnection *conn, const uint8_t *data, size_t len,
+                             const struct timespec *stamp)
+{
+    gint64 kernel_delay = rx_kernel_delay_us(stamp);
+    if (kernel_delay >= 0) {
+        log2_histogram_add(&conn->kernel_delay_us, kernel_delay);
+    }
+
+    gint64 start = g_get_monotonic_time();
+    aap_debug_print_packet("RX", data, len);
+
+    if (conn->data_callback) {
+        const char *prev_activity = stall_detector_enter("bt-packet");
+        conn->data_callback(data, len, conn->data_user_data);
+        stall_detector_leave(prev_activity);
+    }
+
+    log2_histogram_add(&conn->processing_us, g_get_monotonic_time() - start);
+}
+
 /* GSource callbacks for main loop integration */
 typedef struct {
     GSource source;
@@ -232,6 +490,8 @@ static gboolean bt_source_dispatch(GSource *source,
     BtSource *bt_source = (BtSource *)source;
     BluetoothConnection *conn = bt_source->conn;
 
+    wakeup_stats_count(WAKEUP_BT_SOCKET);
+
     if (bt_source->poll_fd.revents & (G_IO_HUP | G_IO_ERR | G_IO_NVAL)) {
         g_warning("Socket error or hangup");
         bt_connection_disconnect(conn);
@@ -239,7 +499,19 @@ static gboolean bt_source_dispatch(GSource *source,
     }
 
     if (bt_source->poll_fd.revents & G_IO_IN) {
-        ssize_t len = recv(conn->socket_fd, conn->recv_buffer, BT_MAX_PACKET_SIZE, 0);
+        struct iovec iov = {
+            .iov_base = conn->recv_buffer,
+            .iov_len = BT_MAX_PACKET_SIZE,
+        };
+        struct msghdr msg = {
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = conn->control_buffer,
+            .msg_controllen = sizeof(conn->control_buffer),
+        };
+
+        ssize_t len = recvmsg(conn->socket_fd, &msg, 0);
+        conn->io.rx_syscalls++;
 
         if (len < 0) {
             if (errno != EAGAIN && errno != EWOULDBLOCK) {
@@ -252,11 +524,8 @@ static gboolean bt_source_dispatch(GSource *source,
             bt_connection_disconnect(conn);
             return G_SOURCE_REMOVE;
         } else {
-            aap_debug_print_packet("RX", conn->recv_buffer, len);
-
-            if (conn->data_callback) {
-                conn->data_callback(conn->recv_buffer, len, conn->data_user_data);
-            }
+            conn->io.rx_packets++;
+            handle_rx_packet(conn, conn->recv_buffer, len, rx_timestamp(&msg));
         }
     }
 
@@ -275,18 +544,9 @@ static GSourceFuncs bt_source_funcs = {
     .finalize = bt_source_finalize,
 };
 
-bool bt_connection_attach_to_mainloop(BluetoothConnection *conn, GMainContext *context)
+/* Receive through a poll-based GSource, when io_uring is unavailable */
+static void attach_poll_source(BluetoothConnection *conn, GMainContext *context)
 {
-    if (conn->socket_fd < 0) {
-        g_warning("Cannot attach: not connected");
-        return false;
-    }
-
-    if (conn->source != NULL) {
-        g_warning("Already attached to main loop");
-        return false;
-    }
-
     BtSource *bt_source = (BtSource *)g_source_new(&bt_source_funcs, sizeof(BtSource));
     bt_source->conn = conn;
     bt_source->poll_fd.fd = conn->socket_fd;
@@ -297,15 +557,117 @@ bool bt_connection_attach_to_mainloop(BluetoothConnection *conn, GMainContext *c
     g_source_attach((GSource *)bt_source, context);
 
     conn->source = (GSource *)bt_source;
+}
+
+/* io_uring receive completion: a packet, or a negative errno when receiving stopped */
+static bool on_uring_recv(const uint8_t *data, ssize_t len,
+                          const struct timespec *stamp, void *user_data)
+{
+    BluetoothConnection *conn = user_data;
+    BtUring *self = conn->uring;
 
+    wakeup_stats_count(WAKEUP_BT_SOCKET);
+
+    if (len > 0) {
+        conn->uring_receiving = true;
+        handle_rx_packet(conn, data, len, stamp);
+
+        /* Handling may disconnect, or even reconnect with a new backend */
+        return conn->uring == self;
+    }
+
+    /* Multishot recvmsg needs Linux 6.0; older kernels reject it */
+    if (len == -EINVAL && !conn->uring_receiving) {
+        g_message("io_uring receive not supported, falling back to poll");
+        bt_uring_free(conn->uring);
+        conn->uring = NULL;
+        attach_poll_source(conn, NULL);
+        return false;
+    }
+
+    if (len == 0) {
+        g_message("Connection closed by peer");
+    } else {
+        g_warning("Connection error: %s", strerror(-len));
+    }
+    bt_connection_disconnect(conn);
+    return false;
+}
+
+bool bt_connection_attach_to_mainloop(BluetoothConnection *conn, GMainContext *context)
+{
+    if (conn->socket_fd < 0) {
+        g_warning("Cannot attach: not connected");
+        return false;
+    }
+
+    if (conn->source != NULL || conn->uring != NULL) {
+        g_warning("Already attached to main loop");
+        return false;
+    }
+
+    /* io_uring completions are bridged into the default context only.
+     * LIBREPODS_IO_BACKEND=poll forces the poll source, for comparison. */
+    bool default_context = context == NULL || context == g_main_context_default();
+    if (default_context && g_strcmp0(g_getenv("LIBREPODS_IO_BACKEND"), "poll") != 0) {
+        conn->uring = bt_uring_new(conn->socket_fd, RX_CONTROL_LEN, &conn->io,
+                                   on_uring_recv, conn);
+        if (conn->uring != NULL) {
+            conn->uring_receiving = false;
+            g_message("Using io_uring I/O backend");
+            return true;
+        }
+    }
+
+    attach_poll_source(conn, context);
     return true;
 }
 
 void bt_connection_detach_from_mainloop(BluetoothConnection *conn)
 {
+    if (conn->uring) {
+        bt_uring_free(conn->uring);
+        conn->uring = NULL;
+    }
+
     if (conn->source) {
         g_source_destroy(conn->source);
         g_source_unref(conn->source);
         conn->source = NULL;
     }
 }
+
+GVariant *bt_connection_get_latency_stats(BluetoothConnection *conn)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+
+    g_variant_builder_add(&builder, "{sv}", "TimestampSource",
+                          g_variant_new_string(timestamp_mode_names[conn->timestamp_mode]));
+    g_variant_builder_add(&builder, "{sv}", "KernelToUserUs",
+                          log2_histogram_to_variant(&conn->kernel_delay_us));
+    g_variant_builder_add(&builder, "{sv}", "ProcessingUs",
+                          log2_histogram_to_variant(&conn->processing_us));
+
+    return g_variant_builder_end(&builder);
+}
+
+GVariant *bt_connection_get_io_stats(BluetoothConnection *conn)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+
+    guint64 packets = conn->io.rx_packets + conn->io.tx_packets;
+    guint64 syscalls = conn->io.rx_syscalls + conn->io.tx_syscalls;
+
+    g_variant_builder_add(&builder, "{sv}", "Backend",
+                          g_variant_new_string(conn->uring ? "io_uring" : "poll"));
+    g_variant_builder_add(&builder, "{sv}", "RxPackets", g_variant_new_uint64(conn->io.rx_packets));
+    g_variant_builder_add(&builder, "{sv}", "RxSyscalls", g_variant_new_uint64(conn->io.rx_syscalls));
+    g_variant_builder_add(&builder, "{sv}", "TxPackets", g_variant_new_uint64(conn->io.tx_packets));
+    g_variant_builder_add(&builder, "{sv}", "TxSyscalls", g_variant_new_uint64(conn->io.tx_syscalls));
+    g_variant_builder_add(&builder, "{sv}", "SyscallsPerPacket",
+                          g_variant_new_double(packets > 0 ? (double)syscalls / packets : 0.0));
+
+    return g_variant_builder_end(&builder);
+}
@@ -12,6 +12,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "bt_addr.h"
+
 /* AirPods L2CAP PSM */
 #define AIRPODS_L2CAP_PSM 0x1001
 
@@ -29,6 +31,13 @@ typedef enum {
     BT_STATE_ERROR,
 } BluetoothState;
 
+/* Source of kernel RX timestamps */
+typedef enum {
+    BT_TIMESTAMP_NONE,
+    BT_TIMESTAMP_NS,        /* SO_TIMESTAMPNS */
+    BT_TIMESTAMP_SOFTWARE,  /* SO_TIMESTAMPING, software RX stamps */
+} BtTimestampMode;
+
 /* Callback types */
 typedef void (*BtDataCallback)(const uint8_t *data, size_t len, void *user_data);
 typedef void (*BtStateCallback)(BluetoothState state, const char *error, void *user_data);
@@ -66,10 +75,24 @@ void bt_connection_set_state_callback(BluetoothConnection *conn,
  * Connect to AirPods device
  *
  * @param conn Connection context
- * @param address Bluetooth MAC address (XX:XX:XX:XX:XX:XX)
+ * @param address Device address
+ * @param adapter_address Local adapter to connect through, or NULL to let
+ *                        the kernel pick one
  * @return true if connection initiated, false on error
  */
-bool bt_connection_connect(BluetoothConnection *conn, const char *address);
+bool bt_connection_connect(BluetoothConnection *conn, const BtAddr *address,
+                           const BtAddr *adapter_address);
+
+/**
+ * Take over a socket that is already connected to the device
+ *
+ * Tests use this to talk to a fake device through one end of a
+ * socketpair instead of L2CAP. The connection owns the socket from then
+ * on, even if this fails.
+ *
+ * @return true if connected, false if already connected or connecting
+ */
+bool bt_connection_adopt_socket(BluetoothConnection *conn, int fd, const BtAddr *address);
 
 /**
  * Disconnect from device
@@ -96,6 +119,33 @@ BluetoothState bt_connection_get_state(BluetoothConnection *conn);
  */
 ssize_t bt_connection_send(BluetoothConnection *conn, const uint8_t *data, size_t len);
 
+/**
+ * Push out packets queued by bt_connection_send()
+ *
+ * Only the io_uring backend queues; sends are batched until the next
+ * main loop iteration unless flushed explicitly.
+ */
+void bt_connection_flush(BluetoothConnection *conn);
+
+/**
+ * Queue a packet to go out delay_ms after the previously queued one
+ *
+ * Paces command sequences with main loop timers instead of sleeping.
+ * The queue is dropped on disconnect.
+ *
+ * @param delay_ms Gap after the previous paced packet, or after now if
+ *                 none is pending
+ * @return true if queued
+ */
+bool bt_connection_send_paced(BluetoothConnection *conn, guint delay_ms,
+                              const uint8_t *data, size_t len);
+
+/**
+ * Queue the initialization sequence (handshake, set features, request
+ * notifications) with the gaps the AirPods expect
+ */
+bool bt_connection_start_handshake(BluetoothConnection *conn);
+
 /**
  * Send handshake packet
  */
@@ -119,7 +169,8 @@ int bt_connection_get_fd(BluetoothConnection *conn);
 
 /**
  * Attach connection to GLib main loop
- * This sets up a GSource to monitor the socket
+ * This uses the io_uring backend when it is built in and supported by the
+ * kernel, and otherwise sets up a GSource to monitor the socket
  */
 bool bt_connection_attach_to_mainloop(BluetoothConnection *conn, GMainContext *context);
 
@@ -128,4 +179,17 @@ bool bt_connection_attach_to_mainloop(BluetoothConnection *conn, GMainContext *c
  */
 void bt_connection_detach_from_mainloop(BluetoothConnection *conn);
 
+/**
+ * Get RX latency histograms as a{sv}
+ *
+ * Kernel-to-userspace delay (from socket RX timestamps, if the stack
+ * provides them) is kept apart from the time spent handling packets.
+ */
+GVariant *bt_connection_get_latency_stats(BluetoothConnection *conn);
+
+/**
+ * Get I/O backend, packet and syscall counters as a{sv}
+ */
+GVariant *bt_connection_get_io_stats(BluetoothConnection *conn);
+
 #endif /* BLUETOOTH_H */
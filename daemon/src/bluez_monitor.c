@@ -5,12 +5,17 @@
 
 #include "bluez_monitor.h"
 #include "bluetooth.h"
+#include "histogram.h"
+#include "stall_detector.h"
+#include "wakeup_stats.h"
 
 #include <string.h>
+#include <time.h>
 
 struct BluezMonitor {
     GDBusConnection *connection;
-    guint properties_signal_id;
+    guint adapter_props_signal_id;
+    guint device_props_signal_id;   /* 0 while dormant */
     guint interfaces_added_id;
     guint interfaces_removed_id;
 
@@ -20,17 +25,127 @@ struct BluezMonitor {
     BluezDeviceCallback disconnected_callback;
     void *disconnected_user_data;
 
+    BluezPowerCallback power_callback;
+    void *power_user_data;
+
+    /* No powered, unblocked adapter: ignore devices entirely */
+    bool dormant;
+    guint dormant_entries;
+
     /* Track known devices */
-    GHashTable *known_devices;  /* path -> BluezDeviceInfo */
+    GHashTable *known_devices;  /* device key -> KnownDevice */
+    GHashTable *device_cache;   /* path -> CachedDevice, every Device1 */
+
+    /* Track adapters */
+    GHashTable *adapters;       /* path -> BluezAdapterInfo */
+
+    /* Signal handling cost */
+    gint64 signal_started_us;   /* While handling a signal, else 0 */
+    guint64 signals;
+    gint64 signal_cpu_us;
+    guint sync_calls;           /* GetAll round trips on cache misses */
+    Log2Histogram signal_us;
+    Log2Histogram detection_us; /* Signal to connected callback */
 };
 
+/* A device connected through one adapter. The key packs the adapter
+ * index and the 48-bit address, so one device reachable through two
+ * adapters has two entries. */
+typedef struct {
+    guint64 key;
+    BluezDeviceInfo *info;
+} KnownDevice;
+
+static bool device_key_from_path(const char *object_path, guint64 *key)
+{
+    BtAddr address;
+    guint adapter_index;
+    if (!bt_addr_from_device_path(object_path, &address, &adapter_index)) {
+        return false;
+    }
+
+    *key = (guint64)(adapter_index & 0xFFFF) << 48 | bt_addr_to_u64(&address);
+    return true;
+}
+
+static void known_device_free(KnownDevice *device)
+{
+    bluez_device_info_free(device->info);
+    g_free(device);
+}
+
+static void add_known_device(BluezMonitor *monitor, const BluezDeviceInfo *info)
+{
+    KnownDevice *device = g_new(KnownDevice, 1);
+    if (!device_key_from_path(info->object_path, &device->key)) {
+        g_free(device);
+        return;
+    }
+
+    device->info = bluez_device_info_copy(info);
+    /* Replace, not insert: the key lives inside the value */
+    g_hash_table_replace(monitor->known_devices, &device->key, device);
+}
+
+static KnownDevice *lookup_known_device(BluezMonitor *monitor, const char *object_path)
+{
+    guint64 key;
+    return device_key_from_path(object_path, &key)
+        ? g_hash_table_lookup(monitor->known_devices, &key) : NULL;
+}
+
+static void remove_known_device(BluezMonitor *monitor, const char *object_path)
+{
+    guint64 key;
+    if (device_key_from_path(object_path, &key)) {
+        g_hash_table_remove(monitor->known_devices, &key);
+    }
+}
+
+static void bluez_adapter_info_free(BluezAdapterInfo *info)
+{
+    if (info == NULL)
+        return;
+    g_free(info->object_path);
+    g_free(info);
+}
+
+static void update_adapter(BluezMonitor *monitor, const char *object_path, GVariant *props)
+{
+    BluezAdapterInfo *adapter = g_hash_table_lookup(monitor->adapters, object_path);
+    if (adapter == NULL) {
+        adapter = g_new0(BluezAdapterInfo, 1);
+        adapter->object_path = g_strdup(object_path);
+        g_hash_table_insert(monitor->adapters, g_strdup(object_path), adapter);
+    }
+
+    GVariant *value = g_variant_lookup_value(props, "Address", G_VARIANT_TYPE_STRING);
+    if (value) {
+        bt_addr_from_string(g_variant_get_string(value, NULL), &adapter->address);
+        g_variant_unref(value);
+    }
+
+    value = g_variant_lookup_value(props, "Powered", G_VARIANT_TYPE_BOOLEAN);
+    if (value) {
+        adapter->powered = g_variant_get_boolean(value);
+        g_variant_unref(value);
+    }
+
+    /* BlueZ reports rfkill soft/hard blocks through PowerState */
+    value = g_variant_lookup_value(props, "PowerState", G_VARIANT_TYPE_STRING);
+    if (value) {
+        adapter->blocked = g_strcmp0(g_variant_get_string(value, NULL), "off-blocked") == 0;
+        g_variant_unref(value);
+    }
+}
+
 void bluez_device_info_free(BluezDeviceInfo *info)
 {
     if (info == NULL)
         return;
-    g_free(info->address);
     g_free(info->name);
     g_free(info->object_path);
+    g_free(info->adapter_path);
     g_free(info);
 }
 
@@ -40,67 +155,114 @@ BluezDeviceInfo *bluez_device_info_copy(const BluezDeviceInfo *info)
         return NULL;
 
     BluezDeviceInfo *copy = g_new0(BluezDeviceInfo, 1);
-    copy->address = g_strdup(info->address);
+    copy->address = info->address;
     copy->name = g_strdup(info->name);
     copy->object_path = g_strdup(info->object_path);
+    copy->adapter_path = g_strdup(info->adapter_path);
     copy->connected = info->connected;
     copy->paired = info->paired;
     return copy;
 }
 
-static bool device_is_airpods(GDBusConnection *connection, const char *object_path)
+/* ============================================================================
+ * Device property cache
+ *
+ * Device1 properties arrive with GetManagedObjects, InterfacesAdded and
+ * PropertiesChanged, so signals are handled from the cache instead of a
+ * round trip to BlueZ per signal. Only a device that showed up while we
+ * were not listening costs one GetAll.
+ * ========================================================================== */
+
+typedef struct {
+    BluezDeviceInfo info;
+    bool is_airpods;        /* Advertises the AirPods service UUID */
+} CachedDevice;
+
+static void cached_device_free(CachedDevice *device)
 {
-    GError *error = NULL;
+    g_free(device->info.name);
+    g_free(device->info.object_path);
+    g_free(device->info.adapter_path);
+    g_free(device);
+}
 
-    GVariant *result = g_dbus_connection_call_sync(
-        connection,
-        BLUEZ_SERVICE,
-        object_path,
-        DBUS_PROPERTIES_INTERFACE,
-        "Get",
-        g_variant_new("(ss)", BLUEZ_DEVICE_INTERFACE, "UUIDs"),
-        G_VARIANT_TYPE("(v)"),
-        G_DBUS_CALL_FLAGS_NONE,
-        -1,
-        NULL,
-        &error
-    );
+static void replace_string(char **field, GVariant *props, const char *key, const GVariantType *type)
+{
+    GVariant *value = g_variant_lookup_value(props, key, type);
+    if (value) {
+        g_free(*field);
+        *field = g_variant_dup_string(value, NULL);
+        g_variant_unref(value);
+    }
+}
 
-    if (error) {
-        g_error_free(error);
-        return false;
+/* Merge a (possibly partial) Device1 property dictionary */
+static void update_cached_device(CachedDevice *device, GVariant *props)
+{
+    BluezDeviceInfo *info = &device->info;
+    GVariant *value;
+
+    value = g_variant_lookup_value(props, "Address", G_VARIANT_TYPE_STRING);
+    if (value) {
+        bt_addr_from_string(g_variant_get_string(value, NULL), &info->address);
+        g_variant_unref(value);
     }
 
-    GVariant *variant = NULL;
-    g_variant_get(result, "(v)", &variant);
+    replace_string(&info->name, props, "Name", G_VARIANT_TYPE_STRING);
+    replace_string(&info->adapter_path, props, "Adapter", G_VARIANT_TYPE_OBJECT_PATH);
+
+    value = g_variant_lookup_value(props, "Connected", G_VARIANT_TYPE_BOOLEAN);
+    if (value) {
+        info->connected = g_variant_get_boolean(value);
+        g_variant_unref(value);
+    }
 
-    bool is_airpods = false;
+    value = g_variant_lookup_value(props, "Paired", G_VARIANT_TYPE_BOOLEAN);
+    if (value) {
+        info->paired = g_variant_get_boolean(value);
+        g_variant_unref(value);
+    }
 
-    if (g_variant_is_of_type(variant, G_VARIANT_TYPE_STRING_ARRAY)) {
+    value = g_variant_lookup_value(props, "UUIDs", G_VARIANT_TYPE_STRING_ARRAY);
+    if (value) {
         gsize n_uuids = 0;
-        const gchar **uuids = g_variant_get_strv(variant, &n_uuids);
+        const gchar **uuids = g_variant_get_strv(value, &n_uuids);
 
+        device->is_airpods = false;
         for (gsize i = 0; i < n_uuids; i++) {
             if (g_ascii_strcasecmp(uuids[i], AIRPODS_UUID) == 0) {
-                is_airpods = true;
+                device->is_airpods = true;
                 break;
             }
         }
         g_free(uuids);
+        g_variant_unref(value);
     }
+}
 
-    g_variant_unref(variant);
-    g_variant_unref(result);
+static CachedDevice *cache_device(BluezMonitor *monitor, const char *object_path, GVariant *props)
+{
+    CachedDevice *device = g_hash_table_lookup(monitor->device_cache, object_path);
+    if (device == NULL) {
+        device = g_new0(CachedDevice, 1);
+        device->info.object_path = g_strdup(object_path);
+        g_hash_table_insert(monitor->device_cache, device->info.object_path, device);
+    }
 
-    return is_airpods;
+    update_cached_device(device, props);
+    return device;
 }
 
-static BluezDeviceInfo *get_device_info(GDBusConnection *connection, const char *object_path)
+/* Cache miss: ask BlueZ for everything at once */
+static CachedDevice *fetch_device(BluezMonitor *monitor, const char *object_path)
 {
     GError *error = NULL;
 
+    monitor->sync_calls++;
+
+    const char *prev_activity = stall_detector_enter("bluez-call");
     GVariant *result = g_dbus_connection_call_sync(
-        connection,
+        monitor->connection,
         BLUEZ_SERVICE,
         object_path,
         DBUS_PROPERTIES_INTERFACE,
@@ -112,6 +274,7 @@ static BluezDeviceInfo *get_device_info(GDBusConnection *connection, const char
         NULL,
         &error
     );
+    stall_detector_leave(prev_activity);
 
     if (error) {
         g_warning("Failed to get device properties: %s", error->message);
@@ -119,113 +282,211 @@ static BluezDeviceInfo *get_device_info(GDBusConnection *connection, const char
         return NULL;
     }
 
-    BluezDeviceInfo *info = g_new0(BluezDeviceInfo, 1);
-    info->object_path = g_strdup(object_path);
-
     GVariant *props = NULL;
     g_variant_get(result, "(@a{sv})", &props);
+    CachedDevice *device = cache_device(monitor, object_path, props);
+    g_variant_unref(props);
+    g_variant_unref(result);
 
-    GVariant *value;
+    return device;
+}
 
-    value = g_variant_lookup_value(props, "Address", G_VARIANT_TYPE_STRING);
-    if (value) {
-        info->address = g_variant_dup_string(value, NULL);
-        g_variant_unref(value);
-    }
+/* ============================================================================
+ * Signal handling
+ * ========================================================================== */
 
-    value = g_variant_lookup_value(props, "Name", G_VARIANT_TYPE_STRING);
-    if (value) {
-        info->name = g_variant_dup_string(value, NULL);
-        g_variant_unref(value);
+static gint64 thread_cpu_time_us(void)
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+        return 0;
     }
+    return (gint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
 
-    value = g_variant_lookup_value(props, "Connected", G_VARIANT_TYPE_BOOLEAN);
-    if (value) {
-        info->connected = g_variant_get_boolean(value);
-        g_variant_unref(value);
-    }
+static void signal_begin(BluezMonitor *monitor, gint64 *cpu_start)
+{
+    monitor->signal_started_us = g_get_monotonic_time();
+    *cpu_start = thread_cpu_time_us();
+}
 
-    value = g_variant_lookup_value(props, "Paired", G_VARIANT_TYPE_BOOLEAN);
-    if (value) {
-        info->paired = g_variant_get_boolean(value);
-        g_variant_unref(value);
-    }
+static void signal_end(BluezMonitor *monitor, gint64 cpu_start)
+{
+    monitor->signals++;
+    monitor->signal_cpu_us += thread_cpu_time_us() - cpu_start;
+    log2_histogram_add(&monitor->signal_us, g_get_monotonic_time() - monitor->signal_started_us);
+    monitor->signal_started_us = 0;
+}
 
-    g_variant_unref(props);
-    g_variant_unref(result);
+static void notify_connected(BluezMonitor *monitor, const BluezDeviceInfo *info)
+{
+    add_known_device(monitor, info);
 
-    return info;
+    /* Time from signal dispatch to handing the device over */
+    if (monitor->signal_started_us != 0) {
+        log2_histogram_add(&monitor->detection_us,
+                           g_get_monotonic_time() - monitor->signal_started_us);
+    }
+
+    if (monitor->connected_callback) {
+        monitor->connected_callback(info, monitor->connected_user_data);
+    }
 }
 
 static void on_properties_changed(GDBusConnection *connection,
-                                   const gchar *sender_name G_GNUC_UNUSED,
+                                   const gchar *sender_name,
                                    const gchar *object_path,
-                                   const gchar *interface_name G_GNUC_UNUSED,
-                                   const gchar *signal_name G_GNUC_UNUSED,
+                                   const gchar *interface_name,
+                                   const gchar *signal_name,
                                    GVariant *parameters,
-                                   gpointer user_data)
-{
-    BluezMonitor *monitor = user_data;
+                                   gpointer user_data);
 
-    const gchar *iface = NULL;
-    GVariant *changed_props = NULL;
+static guint subscribe_properties(BluezMonitor *monitor, const char *iface)
+{
+    /* arg0 is the interface name, so the bus drops everything else
+     * (MediaTransport1, Battery1, ...) before it wakes us up */
+    return g_dbus_connection_signal_subscribe(
+        monitor->connection,
+        BLUEZ_SERVICE,
+        DBUS_PROPERTIES_INTERFACE,
+        "PropertiesChanged",
+        NULL,  /* Match all object paths */
+        iface,
+        G_DBUS_SIGNAL_FLAGS_NONE,
+        on_properties_changed,
+        monitor,
+        NULL
+    );
+}
 
-    g_variant_get(parameters, "(&s@a{sv}as)", &iface, &changed_props, NULL);
+static void update_power_state(BluezMonitor *monitor)
+{
+    bool usable = false;
+
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, monitor->adapters);
+    while (!usable && g_hash_table_iter_next(&iter, NULL, &value)) {
+        const BluezAdapterInfo *adapter = value;
+        usable = adapter->powered && !adapter->blocked;
+    }
 
-    /* Only care about Device1 interface */
-    if (g_strcmp0(iface, BLUEZ_DEVICE_INTERFACE) != 0) {
-        g_variant_unref(changed_props);
+    if (usable != monitor->dormant) {
         return;
     }
 
+    monitor->dormant = !usable;
+
+    if (monitor->dormant) {
+        g_message("No powered Bluetooth adapter, going dormant");
+        monitor->dormant_entries++;
+
+        if (monitor->device_props_signal_id > 0) {
+            g_dbus_connection_signal_unsubscribe(monitor->connection,
+                                                 monitor->device_props_signal_id);
+            monitor->device_props_signal_id = 0;
+        }
+        g_hash_table_remove_all(monitor->known_devices);
+        g_hash_table_remove_all(monitor->device_cache);
+    } else {
+        g_message("Bluetooth adapter powered, leaving dormant mode");
+
+        if (monitor->device_props_signal_id == 0 && monitor->adapter_props_signal_id > 0) {
+            monitor->device_props_signal_id = subscribe_properties(monitor, BLUEZ_DEVICE_INTERFACE);
+        }
+    }
+
+    if (monitor->power_callback) {
+        monitor->power_callback(usable, monitor->power_user_data);
+    }
+}
+
+static void handle_device_properties(BluezMonitor *monitor, const gchar *object_path,
+                                     GVariant *changed_props)
+{
+    CachedDevice *device = g_hash_table_lookup(monitor->device_cache, object_path);
+    if (device) {
+        update_cached_device(device, changed_props);
+    }
+
     /* Check if Connected property changed */
     GVariant *connected_var = g_variant_lookup_value(changed_props, "Connected", G_VARIANT_TYPE_BOOLEAN);
     if (connected_var == NULL) {
-        g_variant_unref(changed_props);
         return;
     }
 
     bool connected = g_variant_get_boolean(connected_var);
     g_variant_unref(connected_var);
-    g_variant_unref(changed_props);
 
-    /* Check if this is an AirPods device */
-    if (!device_is_airpods(connection, object_path)) {
-        return;
+    if (device == NULL) {
+        device = fetch_device(monitor, object_path);
+        if (device == NULL) {
+            return;
+        }
     }
 
-    BluezDeviceInfo *info = get_device_info(connection, object_path);
-    if (info == NULL) {
+    /* Check if this is an AirPods device */
+    if (!device->is_airpods) {
         return;
     }
 
+    const BluezDeviceInfo *info = &device->info;
+
+    char address[BT_ADDR_STRLEN];
     g_message("AirPods %s: %s (%s)",
               connected ? "connected" : "disconnected",
               info->name ? info->name : "Unknown",
-              info->address ? info->address : "Unknown");
+              bt_addr_to_string(&info->address, address));
 
     if (connected) {
-        /* Store in known devices */
-        g_hash_table_insert(monitor->known_devices,
-                            g_strdup(object_path),
-                            bluez_device_info_copy(info));
-
-        if (monitor->connected_callback) {
-            monitor->connected_callback(info, monitor->connected_user_data);
-        }
+        notify_connected(monitor, info);
     } else {
         /* Remove from known devices */
-        g_hash_table_remove(monitor->known_devices, object_path);
+        remove_known_device(monitor, object_path);
 
         if (monitor->disconnected_callback) {
             monitor->disconnected_callback(info, monitor->disconnected_user_data);
         }
     }
+}
 
-    bluez_device_info_free(info);
+static void on_properties_changed(GDBusConnection *connection G_GNUC_UNUSED,
+                                   const gchar *sender_name G_GNUC_UNUSED,
+                                   const gchar *object_path,
+                                   const gchar *interface_name G_GNUC_UNUSED,
+                                   const gchar *signal_name G_GNUC_UNUSED,
+                                   GVariant *parameters,
+                                   gpointer user_data)
+{
+    BluezMonitor *monitor = user_data;
+
+    const gchar *iface = NULL;
+    GVariant *changed_props = NULL;
+
+    g_variant_get(parameters, "(&s@a{sv}as)", &iface, &changed_props, NULL);
+
+    /* Track adapter address and power state */
+    if (g_strcmp0(iface, BLUEZ_ADAPTER_INTERFACE) == 0) {
+        wakeup_stats_count(WAKEUP_BLUEZ_ADAPTER_SIGNAL);
+        update_adapter(monitor, object_path, changed_props);
+        g_variant_unref(changed_props);
+        update_power_state(monitor);
+        return;
+    }
+
+    /* Only care about Device1 interface */
+    if (g_strcmp0(iface, BLUEZ_DEVICE_INTERFACE) == 0 && !monitor->dormant) {
+        gint64 cpu_start;
+        wakeup_stats_count(WAKEUP_BLUEZ_DEVICE_SIGNAL);
+        signal_begin(monitor, &cpu_start);
+        handle_device_properties(monitor, object_path, changed_props);
+        signal_end(monitor, cpu_start);
+    }
+
+    g_variant_unref(changed_props);
 }
 
-static void on_interfaces_added(GDBusConnection *connection,
+static void on_interfaces_added(GDBusConnection *connection G_GNUC_UNUSED,
                                  const gchar *sender_name G_GNUC_UNUSED,
                                  const gchar *object_path G_GNUC_UNUSED,
                                  const gchar *interface_name G_GNUC_UNUSED,
@@ -240,31 +501,39 @@ static void on_interfaces_added(GDBusConnection *connection,
     GVariant *interfaces = NULL;
 
     g_variant_get(parameters, "(&o@a{sa{sv}})", &obj_path, &interfaces);
+    wakeup_stats_count(WAKEUP_BLUEZ_OBJECT_SIGNAL);
+
+    /* New adapter (e.g. a USB dongle was plugged in) */
+    GVariant *adapter_props = NULL;
+    if (g_variant_lookup(interfaces, BLUEZ_ADAPTER_INTERFACE, "@a{sv}", &adapter_props)) {
+        update_adapter(monitor, obj_path, adapter_props);
+        g_message("Bluetooth adapter added: %s", obj_path);
+        g_variant_unref(adapter_props);
+        update_power_state(monitor);
+    }
 
     /* Check if Device1 interface is present */
-    if (!g_variant_lookup(interfaces, BLUEZ_DEVICE_INTERFACE, "@a{sv}", NULL)) {
+    GVariant *device_props = NULL;
+    if (monitor->dormant ||
+        !g_variant_lookup(interfaces, BLUEZ_DEVICE_INTERFACE, "@a{sv}", &device_props)) {
         g_variant_unref(interfaces);
         return;
     }
 
-    g_variant_unref(interfaces);
+    gint64 cpu_start;
+    signal_begin(monitor, &cpu_start);
 
-    /* Check if AirPods and connected */
-    if (device_is_airpods(connection, obj_path)) {
-        BluezDeviceInfo *info = get_device_info(connection, obj_path);
-        if (info && info->connected) {
-            g_message("New connected AirPods discovered: %s", info->name);
+    /* The signal carries all properties, no need to ask */
+    const CachedDevice *device = cache_device(monitor, obj_path, device_props);
+    if (device->is_airpods && device->info.connected) {
+        g_message("New connected AirPods discovered: %s", device->info.name);
+        notify_connected(monitor, &device->info);
+    }
 
-            g_hash_table_insert(monitor->known_devices,
-                                g_strdup(obj_path),
-                                bluez_device_info_copy(info));
+    signal_end(monitor, cpu_start);
 
-            if (monitor->connected_callback) {
-                monitor->connected_callback(info, monitor->connected_user_data);
-            }
-        }
-        bluez_device_info_free(info);
-    }
+    g_variant_unref(device_props);
+    g_variant_unref(interfaces);
 }
 
 static void on_interfaces_removed(GDBusConnection *connection G_GNUC_UNUSED,
@@ -278,18 +547,42 @@ static void on_interfaces_removed(GDBusConnection *connection G_GNUC_UNUSED,
     BluezMonitor *monitor = user_data;
 
     const gchar *obj_path = NULL;
-    g_variant_get(parameters, "(&oas)", &obj_path, NULL);
+    GVariantIter *iter = NULL;
+    const gchar *iface = NULL;
+    g_variant_get(parameters, "(&oas)", &obj_path, &iter);
+    wakeup_stats_count(WAKEUP_BLUEZ_OBJECT_SIGNAL);
+
+    bool adapter_removed = false;
+    bool device_removed = false;
+    while (g_variant_iter_loop(iter, "&s", &iface)) {
+        if (g_strcmp0(iface, BLUEZ_ADAPTER_INTERFACE) == 0 &&
+            g_hash_table_remove(monitor->adapters, obj_path)) {
+            g_message("Bluetooth adapter removed: %s", obj_path);
+            adapter_removed = true;
+        } else if (g_strcmp0(iface, BLUEZ_DEVICE_INTERFACE) == 0) {
+            device_removed = true;
+        }
+    }
+    g_variant_iter_free(iter);
 
     /* Check if we were tracking this device */
-    BluezDeviceInfo *info = g_hash_table_lookup(monitor->known_devices, obj_path);
-    if (info) {
-        g_message("AirPods device removed: %s", info->name);
+    KnownDevice *device = lookup_known_device(monitor, obj_path);
+    if (device) {
+        g_message("AirPods device removed: %s", device->info->name);
 
         if (monitor->disconnected_callback) {
-            monitor->disconnected_callback(info, monitor->disconnected_user_data);
+            monitor->disconnected_callback(device->info, monitor->disconnected_user_data);
         }
 
-        g_hash_table_remove(monitor->known_devices, obj_path);
+        remove_known_device(monitor, obj_path);
+    }
+
+    if (device_removed) {
+        g_hash_table_remove(monitor->device_cache, obj_path);
+    }
+
+    if (adapter_removed) {
+        update_power_state(monitor);
     }
 }
 
@@ -307,8 +600,17 @@ BluezMonitor *bluez_monitor_new(void)
     BluezMonitor *monitor = g_new0(BluezMonitor, 1);
     monitor->connection = connection;
     monitor->known_devices = g_hash_table_new_full(
+        g_int64_hash, g_int64_equal,
+        NULL, (GDestroyNotify)known_device_free
+    );
+    monitor->adapters = g_hash_table_new_full(
+        g_str_hash, g_str_equal,
+        g_free, (GDestroyNotify)bluez_adapter_info_free
+    );
+    /* Keys are the entries' own object_path */
+    monitor->device_cache = g_hash_table_new_full(
         g_str_hash, g_str_equal,
-        g_free, (GDestroyNotify)bluez_device_info_free
+        NULL, (GDestroyNotify)cached_device_free
     );
 
     return monitor;
@@ -321,25 +623,19 @@ void bluez_monitor_free(BluezMonitor *monitor)
 
     bluez_monitor_stop(monitor);
     g_hash_table_destroy(monitor->known_devices);
+    g_hash_table_destroy(monitor->device_cache);
+    g_hash_table_destroy(monitor->adapters);
     g_object_unref(monitor->connection);
     g_free(monitor);
 }
 
 bool bluez_monitor_start(BluezMonitor *monitor)
 {
-    /* Subscribe to PropertiesChanged signal */
-    monitor->properties_signal_id = g_dbus_connection_signal_subscribe(
-        monitor->connection,
-        BLUEZ_SERVICE,
-        DBUS_PROPERTIES_INTERFACE,
-        "PropertiesChanged",
-        NULL,  /* Match all object paths */
-        NULL,
-        G_DBUS_SIGNAL_FLAGS_NONE,
-        on_properties_changed,
-        monitor,
-        NULL
-    );
+    /* Subscribe to PropertiesChanged signals of adapters and devices */
+    monitor->adapter_props_signal_id = subscribe_properties(monitor, BLUEZ_ADAPTER_INTERFACE);
+    if (!monitor->dormant) {
+        monitor->device_props_signal_id = subscribe_properties(monitor, BLUEZ_DEVICE_INTERFACE);
+    }
 
     /* Subscribe to InterfacesAdded signal */
     monitor->interfaces_added_id = g_dbus_connection_signal_subscribe(
@@ -375,9 +671,14 @@ bool bluez_monitor_start(BluezMonitor *monitor)
 
 void bluez_monitor_stop(BluezMonitor *monitor)
 {
-    if (monitor->properties_signal_id > 0) {
-        g_dbus_connection_signal_unsubscribe(monitor->connection, monitor->properties_signal_id);
-        monitor->properties_signal_id = 0;
+    if (monitor->adapter_props_signal_id > 0) {
+        g_dbus_connection_signal_unsubscribe(monitor->connection, monitor->adapter_props_signal_id);
+        monitor->adapter_props_signal_id = 0;
+    }
+
+    if (monitor->device_props_signal_id > 0) {
+        g_dbus_connection_signal_unsubscribe(monitor->connection, monitor->device_props_signal_id);
+        monitor->device_props_signal_id = 0;
     }
 
     if (monitor->interfaces_added_id > 0) {
@@ -407,11 +708,25 @@ void bluez_monitor_set_disconnected_callback(BluezMonitor *monitor,
     monitor->disconnected_user_data = user_data;
 }
 
+void bluez_monitor_set_power_callback(BluezMonitor *monitor,
+                                      BluezPowerCallback callback,
+                                      void *user_data)
+{
+    monitor->power_callback = callback;
+    monitor->power_user_data = user_data;
+}
+
+bool bluez_monitor_is_dormant(BluezMonitor *monitor)
+{
+    return monitor->dormant;
+}
+
 void bluez_monitor_check_existing_devices(BluezMonitor *monitor)
 {
     GError *error = NULL;
 
     /* Call GetManagedObjects to enumerate all devices */
+    const char *prev_activity = stall_detector_enter("bluez-call");
     GVariant *result = g_dbus_connection_call_sync(
         monitor->connection,
         BLUEZ_SERVICE,
@@ -425,6 +740,7 @@ void bluez_monitor_check_existing_devices(BluezMonitor *monitor)
         NULL,
         &error
     );
+    stall_detector_leave(prev_activity);
 
     if (error) {
         g_warning("Failed to get managed objects: %s", error->message);
@@ -439,27 +755,46 @@ void bluez_monitor_check_existing_devices(BluezMonitor *monitor)
     const gchar *object_path;
     GVariant *interfaces;
 
+    /* Collect adapters first so devices can be routed through them */
+    g_variant_iter_init(&iter, objects);
+    while (g_variant_iter_next(&iter, "{&o@a{sa{sv}}}", &object_path, &interfaces)) {
+        GVariant *adapter_props = NULL;
+        if (g_variant_lookup(interfaces, BLUEZ_ADAPTER_INTERFACE, "@a{sv}", &adapter_props)) {
+            update_adapter(monitor, object_path, adapter_props);
+            g_variant_unref(adapter_props);
+        }
+        g_variant_unref(interfaces);
+    }
+
+    g_message("Found %u Bluetooth adapter(s)", g_hash_table_size(monitor->adapters));
+
+    /* Nothing can be connected without a powered adapter */
+    update_power_state(monitor);
+    if (monitor->dormant) {
+        g_variant_unref(objects);
+        g_variant_unref(result);
+        return;
+    }
+
+    /* Refill the device cache from scratch, the reply has every property */
+    g_hash_table_remove_all(monitor->device_cache);
+
     g_variant_iter_init(&iter, objects);
     while (g_variant_iter_next(&iter, "{&o@a{sa{sv}}}", &object_path, &interfaces)) {
         /* Check if this object has Device1 interface */
-        if (g_variant_lookup(interfaces, BLUEZ_DEVICE_INTERFACE, "@a{sv}", NULL)) {
-            /* Check if it's AirPods */
-            if (device_is_airpods(monitor->connection, object_path)) {
-                BluezDeviceInfo *info = get_device_info(monitor->connection, object_path);
-                if (info && info->connected) {
-                    g_message("Found already connected AirPods: %s (%s)",
-                              info->name ? info->name : "Unknown",
-                              info->address ? info->address : "Unknown");
-
-                    g_hash_table_insert(monitor->known_devices,
-                                        g_strdup(object_path),
-                                        bluez_device_info_copy(info));
-
-                    if (monitor->connected_callback) {
-                        monitor->connected_callback(info, monitor->connected_user_data);
-                    }
-                }
-                bluez_device_info_free(info);
+        GVariant *device_props = NULL;
+        if (g_variant_lookup(interfaces, BLUEZ_DEVICE_INTERFACE, "@a{sv}", &device_props)) {
+            const CachedDevice *device = cache_device(monitor, object_path, device_props);
+            g_variant_unref(device_props);
+
+            /* Check if it's connected AirPods */
+            if (device->is_airpods && device->info.connected) {
+                char address[BT_ADDR_STRLEN];
+                g_message("Found already connected AirPods: %s (%s)",
+                          device->info.name ? device->info.name : "Unknown",
+                          bt_addr_to_string(&device->info.address, address));
+
+                notify_connected(monitor, &device->info);
             }
         }
         g_variant_unref(interfaces);
@@ -468,3 +803,127 @@ void bluez_monitor_check_existing_devices(BluezMonitor *monitor)
     g_variant_unref(objects);
     g_variant_unref(result);
 }
+
+/* ============================================================================
+ * Adapter routing and metrics
+ * ========================================================================== */
+
+const BluezAdapterInfo *bluez_monitor_select_adapter(BluezMonitor *monitor,
+                                                     const BluezDeviceInfo *device)
+{
+    if (device == NULL || device->adapter_path == NULL)
+        return NULL;
+
+    const BluezAdapterInfo *own = g_hash_table_lookup(monitor->adapters, device->adapter_path);
+    if (own != NULL && own->powered) {
+        return own;
+    }
+
+    /* A device paired with several controllers shows up once per adapter */
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, monitor->known_devices);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        const BluezDeviceInfo *other = ((const KnownDevice *)value)->info;
+        if (!other->connected || other->adapter_path == NULL ||
+            !bt_addr_equal(&other->address, &device->address)) {
+            continue;
+        }
+
+        const BluezAdapterInfo *candidate = g_hash_table_lookup(monitor->adapters, other->adapter_path);
+        if (candidate != NULL && candidate->powered) {
+            return candidate;
+        }
+    }
+
+    return own;
+}
+
+void bluez_monitor_record_connect_attempt(BluezMonitor *monitor, const char *adapter_path)
+{
+    BluezAdapterInfo *adapter = adapter_path ? g_hash_table_lookup(monitor->adapters, adapter_path) : NULL;
+    if (adapter) {
+        adapter->connect_attempts++;
+    }
+}
+
+void bluez_monitor_record_connect_result(BluezMonitor *monitor,
+                                          const char *adapter_path,
+                                          bool success,
+                                          gint64 elapsed_us)
+{
+    BluezAdapterInfo *adapter = adapter_path ? g_hash_table_lookup(monitor->adapters, adapter_path) : NULL;
+    if (adapter == NULL)
+        return;
+
+    if (success) {
+        adapter->active_connections++;
+        adapter->connect_time_total_us += elapsed_us;
+    } else {
+        adapter->connect_failures++;
+    }
+}
+
+void bluez_monitor_record_disconnect(BluezMonitor *monitor, const char *adapter_path)
+{
+    BluezAdapterInfo *adapter = adapter_path ? g_hash_table_lookup(monitor->adapters, adapter_path) : NULL;
+    if (adapter && adapter->active_connections > 0) {
+        adapter->active_connections--;
+    }
+}
+
+GVariant *bluez_monitor_get_adapter_stats(BluezMonitor *monitor)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, monitor->adapters);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        const BluezAdapterInfo *adapter = value;
+        char address[BT_ADDR_STRLEN];
+        guint successes = adapter->connect_attempts - adapter->connect_failures;
+
+        GVariantBuilder entry;
+        g_variant_builder_init(&entry, G_VARIANT_TYPE("a{sv}"));
+        g_variant_builder_add(&entry, "{sv}", "Address",
+                              g_variant_new_string(bt_addr_is_null(&adapter->address)
+                                                   ? "" : bt_addr_to_string(&adapter->address, address)));
+        g_variant_builder_add(&entry, "{sv}", "Powered", g_variant_new_boolean(adapter->powered));
+        g_variant_builder_add(&entry, "{sv}", "ConnectAttempts", g_variant_new_uint32(adapter->connect_attempts));
+        g_variant_builder_add(&entry, "{sv}", "ConnectFailures", g_variant_new_uint32(adapter->connect_failures));
+        g_variant_builder_add(&entry, "{sv}", "ActiveConnections", g_variant_new_uint32(adapter->active_connections));
+        g_variant_builder_add(&entry, "{sv}", "ConnectTimeAvgMs",
+                              g_variant_new_uint32(successes > 0
+                                                   ? (guint32)(adapter->connect_time_total_us / successes / 1000)
+                                                   : 0));
+
+        g_variant_builder_add(&builder, "{sv}", adapter->object_path, g_variant_builder_end(&entry));
+    }
+
+    return g_variant_builder_end(&builder);
+}
+
+GVariant *bluez_monitor_get_power_stats(BluezMonitor *monitor)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+
+    g_variant_builder_add(&builder, "{sv}", "Dormant", g_variant_new_boolean(monitor->dormant));
+    g_variant_builder_add(&builder, "{sv}", "DormantEntries", g_variant_new_uint32(monitor->dormant_entries));
+
+    /* Device signal handling cost */
+    g_variant_builder_add(&builder, "{sv}", "CachedDevices",
+                          g_variant_new_uint32(g_hash_table_size(monitor->device_cache)));
+    g_variant_builder_add(&builder, "{sv}", "DeviceSignals", g_variant_new_uint64(monitor->signals));
+    g_variant_builder_add(&builder, "{sv}", "SyncCalls", g_variant_new_uint32(monitor->sync_calls));
+    g_variant_builder_add(&builder, "{sv}", "SignalUs", log2_histogram_to_variant(&monitor->signal_us));
+    g_variant_builder_add(&builder, "{sv}", "DetectionUs", log2_histogram_to_variant(&monitor->detection_us));
+    g_variant_builder_add(&builder, "{sv}", "CpuUsPerThousandSignals",
+                          g_variant_new_double(monitor->signals > 0
+                                               ? monitor->signal_cpu_us * 1000.0 / monitor->signals
+                                               : 0.0));
+
+    return g_variant_builder_end(&builder);
+}
@@ -12,6 +12,8 @@
 #include <gio/gio.h>
 #include <stdbool.h>
 
+#include "bt_addr.h"
+
 /* BlueZ D-Bus constants */
 #define BLUEZ_SERVICE           "org.bluez"
 #define BLUEZ_ADAPTER_INTERFACE "org.bluez.Adapter1"
@@ -21,15 +23,30 @@
 
 /* Device info from BlueZ */
 typedef struct {
-    char *address;
+    BtAddr address;
     char *name;
     char *object_path;
+    char *adapter_path;     /* Adapter1 object the device belongs to */
     bool connected;
     bool paired;
 } BluezDeviceInfo;
 
+/* Adapter info and connection metrics */
+typedef struct {
+    char *object_path;
+    BtAddr address;
+    bool powered;
+    bool blocked;                  /* PowerState "off-blocked" (rfkill) */
+
+    guint connect_attempts;
+    guint connect_failures;
+    guint active_connections;
+    gint64 connect_time_total_us;  /* Sum over successful connects */
+} BluezAdapterInfo;
+
 /* Callback types */
 typedef void (*BluezDeviceCallback)(const BluezDeviceInfo *device, void *user_data);
+typedef void (*BluezPowerCallback)(bool powered, void *user_data);
 
 /* BlueZ monitor context */
 typedef struct BluezMonitor BluezMonitor;
@@ -73,12 +90,70 @@ void bluez_monitor_set_disconnected_callback(BluezMonitor *monitor,
                                               BluezDeviceCallback callback,
                                               void *user_data);
 
+/**
+ * Set adapter power callback
+ *
+ * Called with false when no adapter is powered and unblocked any more (the
+ * monitor then goes dormant and stops listening to device signals), and
+ * with true when one comes back.
+ */
+void bluez_monitor_set_power_callback(BluezMonitor *monitor,
+                                      BluezPowerCallback callback,
+                                      void *user_data);
+
+/**
+ * Check whether the monitor is dormant (no usable adapter)
+ */
+bool bluez_monitor_is_dormant(BluezMonitor *monitor);
+
 /**
  * Check for already connected AirPods devices
  * Will trigger connected callback for each found device
  */
 void bluez_monitor_check_existing_devices(BluezMonitor *monitor);
 
+/**
+ * Select the adapter to route a device connection through
+ *
+ * The device's own adapter is used while it is powered. Otherwise a
+ * powered adapter the same device is also connected through is used.
+ * The daemon holds a single connection, so there is no load to spread.
+ *
+ * @return Adapter info owned by the monitor, or NULL if unknown
+ */
+const BluezAdapterInfo *bluez_monitor_select_adapter(BluezMonitor *monitor,
+                                                     const BluezDeviceInfo *device);
+
+/**
+ * Record the start of a connection attempt through an adapter
+ */
+void bluez_monitor_record_connect_attempt(BluezMonitor *monitor, const char *adapter_path);
+
+/**
+ * Record the outcome of a connection attempt through an adapter
+ *
+ * @param elapsed_us Time from attempt to result
+ */
+void bluez_monitor_record_connect_result(BluezMonitor *monitor,
+                                          const char *adapter_path,
+                                          bool success,
+                                          gint64 elapsed_us);
+
+/**
+ * Record that an established connection through an adapter went away
+ */
+void bluez_monitor_record_disconnect(BluezMonitor *monitor, const char *adapter_path);
+
+/**
+ * Get per-adapter metrics as an a{sv} dictionary keyed by object path
+ */
+GVariant *bluez_monitor_get_adapter_stats(BluezMonitor *monitor);
+
+/**
+ * Get dormant state and Device1 signal handling cost as a{sv}
+ */
+GVariant *bluez_monitor_get_power_stats(BluezMonitor *monitor);
+
 /**
  * Free device info structure
  */
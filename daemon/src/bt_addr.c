@@ -0,0 +1,68 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ */
+
+#include "bt_addr.h"
+
+bool bt_addr_from_string(const char *str, BtAddr *addr)
+{
+    if (str == NULL) {
+        return false;
+    }
+
+    BtAddr parsed;
+    for (size_t i = 0; i < sizeof(parsed.b); i++) {
+        const char *p = str + i * 3;
+        int hi = g_ascii_xdigit_value(p[0]);
+        int lo = hi < 0 ? -1 : g_ascii_xdigit_value(p[1]);
+        if (lo < 0) {
+            return false;
+        }
+
+        char next = p[2];
+        bool last = i == sizeof(parsed.b) - 1;
+        if (last ? next != '\0' : (next != ':' && next != '_')) {
+            return false;
+        }
+
+        parsed.b[i] = (uint8_t)(hi << 4 | lo);
+    }
+
+    *addr = parsed;
+    return true;
+}
+
+bool bt_addr_from_device_path(const char *object_path, BtAddr *addr, guint *adapter_index)
+{
+    if (object_path == NULL) {
+        return false;
+    }
+
+    const char *dev = strrchr(object_path, '/');
+    if (dev == NULL || !g_str_has_prefix(dev, "/dev_") || !bt_addr_from_string(dev + 5, addr)) {
+        return false;
+    }
+
+    if (adapter_index != NULL) {
+        /* Adapter segment is "/hciN" right before the device segment */
+        const char *hci = g_strrstr_len(object_path, dev - object_path, "/hci");
+        *adapter_index = hci ? (guint)g_ascii_strtoull(hci + 4, NULL, 10) : 0;
+    }
+
+    return true;
+}
+
+const char *bt_addr_format(const BtAddr *addr, char separator, char buf[BT_ADDR_STRLEN])
+{
+    static const char hex[] = "0123456789ABCDEF";
+
+    for (size_t i = 0; i < sizeof(addr->b); i++) {
+        buf[i * 3] = hex[addr->b[i] >> 4];
+        buf[i * 3 + 1] = hex[addr->b[i] & 0x0F];
+        buf[i * 3 + 2] = separator;
+    }
+    buf[BT_ADDR_STRLEN - 1] = '\0';
+
+    return buf;
+}
@@ -0,0 +1,79 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * Compact Bluetooth device addresses
+ */
+
+#ifndef BT_ADDR_H
+#define BT_ADDR_H
+
+#include <glib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/* 48-bit device address, most significant byte first (as written).
+ * All-zero means "no address". */
+typedef struct {
+    uint8_t b[6];
+} BtAddr;
+
+/* "XX:XX:XX:XX:XX:XX" plus terminator */
+#define BT_ADDR_STRLEN 18
+
+static inline bool bt_addr_equal(const BtAddr *a, const BtAddr *b)
+{
+    return memcmp(a->b, b->b, sizeof(a->b)) == 0;
+}
+
+static inline bool bt_addr_is_null(const BtAddr *addr)
+{
+    static const BtAddr null_addr;
+    return bt_addr_equal(addr, &null_addr);
+}
+
+/* Address as a 48-bit integer, usable as (part of) a hash key */
+static inline guint64 bt_addr_to_u64(const BtAddr *addr)
+{
+    guint64 value = 0;
+    for (size_t i = 0; i < sizeof(addr->b); i++) {
+        value = (value << 8) | addr->b[i];
+    }
+    return value;
+}
+
+/**
+ * Parse "XX:XX:XX:XX:XX:XX" (':' or '_' separated, any case)
+ *
+ * @return true on success; addr is left untouched on failure
+ */
+bool bt_addr_from_string(const char *str, BtAddr *addr);
+
+/**
+ * Parse the address out of a BlueZ device object path
+ * (/org/bluez/hciN/dev_XX_XX_XX_XX_XX_XX)
+ *
+ * @param adapter_index Set to N, may be NULL
+ * @return true on success
+ */
+bool bt_addr_from_device_path(const char *object_path, BtAddr *addr, guint *adapter_index);
+
+/**
+ * Format address with the given separator into buf
+ *
+ * @return buf, for use in format arguments
+ */
+const char *bt_addr_format(const BtAddr *addr, char separator, char buf[BT_ADDR_STRLEN]);
+
+/**
+ * Format address as "XX:XX:XX:XX:XX:XX" into buf
+ *
+ * @return buf, for use in format arguments
+ */
+static inline const char *bt_addr_to_string(const BtAddr *addr, char buf[BT_ADDR_STRLEN])
+{
+    return bt_addr_format(addr, ':', buf);
+}
+
+#endif /* BT_ADDR_H */
@@ -0,0 +1,437 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ */
+
+#include "build-config.h"
+#include "bt_uring.h"
+
+#if HAVE_LIBURING
+
+#include <glib-unix.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <liburing.h>
+
+#include "bluetooth.h"
+
+#define URING_ENTRIES 64
+
+/* Provided RX buffers (power of two) */
+#define RX_BUFFER_COUNT 16
+#define RX_BUFFER_GROUP 0
+
+/* How long teardown waits for cancelled requests to complete before
+ * releasing their memory anyway */
+#define CANCEL_TIMEOUT_MS 1000
+
+/* User data of the teardown cancel request */
+static char cancel_tag;
+
+typedef struct {
+    GList link;                 /* In BtUring.tx_buffers until completed */
+    size_t len;
+    uint8_t data[];
+} TxBuffer;
+
+struct BtUring {
+    struct io_uring ring;
+    int socket_fd;
+    int event_fd;
+    guint event_source_id;
+    guint flush_source_id;
+    guint queued_sends;
+    GQueue tx_buffers;          /* Queued or in flight, owned until completion */
+    bool recv_armed;
+    bool cancelling;            /* Teardown cancel request not completed yet */
+    guint teardown_timeout_id;
+
+    /* Multishot recvmsg: each buffer holds header, control and payload */
+    struct io_uring_buf_ring *buf_ring;
+    uint8_t *rx_buffers;
+    size_t rx_buffer_size;
+    struct msghdr rx_msg;
+
+    BtIoCounters *counters;
+    BtUringRecvCallback callback;
+    void *user_data;
+};
+
+static uint8_t *rx_buffer(BtUring *uring, unsigned int id)
+{
+    return uring->rx_buffers + (size_t)id * uring->rx_buffer_size;
+}
+
+static void recycle_rx_buffer(BtUring *uring, unsigned int id)
+{
+    io_uring_buf_ring_add(uring->buf_ring, rx_buffer(uring, id), uring->rx_buffer_size, id,
+                          io_uring_buf_ring_mask(RX_BUFFER_COUNT), 0);
+    io_uring_buf_ring_advance(uring->buf_ring, 1);
+}
+
+static bool arm_recv(BtUring *uring)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&uring->ring);
+    if (sqe == NULL) {
+        return false;
+    }
+
+    io_uring_prep_recvmsg_multishot(sqe, uring->socket_fd, &uring->rx_msg, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RX_BUFFER_GROUP;
+    io_uring_sqe_set_data(sqe, NULL);  /* NULL marks the receive */
+
+    uring->counters->rx_syscalls++;
+    uring->recv_armed = io_uring_submit(&uring->ring) >= 0;
+    return uring->recv_armed;
+}
+
+static void release_tx_buffer(BtUring *uring, TxBuffer *tx)
+{
+    g_queue_unlink(&uring->tx_buffers, &tx->link);
+    g_free(tx);
+}
+
+/* Returns false if the callback freed the backend */
+static bool handle_recv(BtUring *uring, int res, unsigned int flags)
+{
+    if (!(flags & IORING_CQE_F_MORE)) {
+        uring->recv_armed = false;
+    }
+
+    if (res == -ENOBUFS) {
+        /* All buffers were in flight; they are back by now */
+        return arm_recv(uring) || uring->callback(NULL, -ENOBUFS, NULL, uring->user_data);
+    }
+
+    if (res <= 0) {
+        return uring->callback(NULL, res, NULL, uring->user_data);
+    }
+
+    unsigned int id = flags >> IORING_CQE_BUFFER_SHIFT;
+    uint8_t *buf = rx_buffer(uring, id);
+    bool alive = true;
+
+    struct io_uring_recvmsg_out *out = io_uring_recvmsg_validate(buf, res, &uring->rx_msg);
+    if (out != NULL) {
+        const struct timespec *stamp = NULL;
+        for (struct cmsghdr *cmsg = io_uring_recvmsg_cmsg_firsthdr(out, &uring->rx_msg);
+             cmsg != NULL;
+             cmsg = io_uring_recvmsg_cmsg_nexthdr(out, &uring->rx_msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET &&
+                (cmsg->cmsg_type == SCM_TIMESTAMPING || cmsg->cmsg_type == SCM_TIMESTAMPNS)) {
+                stamp = (const struct timespec *)CMSG_DATA(cmsg);
+                break;
+            }
+        }
+
+        uring->counters->rx_packets++;
+        alive = uring->callback(io_uring_recvmsg_payload(out, &uring->rx_msg),
+                                io_uring_recvmsg_payload_length(out, res, &uring->rx_msg),
+                                stamp, uring->user_data);
+    }
+
+    if (!alive) {
+        return false;
+    }
+
+    recycle_rx_buffer(uring, id);
+
+    /* The kernel ends a multishot receive from time to time */
+    if (!(flags & IORING_CQE_F_MORE) && !arm_recv(uring)) {
+        return uring->callback(NULL, -EIO, NULL, uring->user_data);
+    }
+
+    return true;
+}
+
+static gboolean on_completions(gint fd, GIOCondition condition G_GNUC_UNUSED, gpointer user_data)
+{
+    BtUring *uring = user_data;
+    eventfd_t value;
+
+    if (eventfd_read(fd, &value) < 0) {
+        return G_SOURCE_CONTINUE;
+    }
+    uring->counters->rx_syscalls++;
+
+    struct io_uring_cqe *cqe;
+    while (io_uring_peek_cqe(&uring->ring, &cqe) == 0) {
+        TxBuffer *tx = io_uring_cqe_get_data(cqe);
+        int res = cqe->res;
+        unsigned int flags = cqe->flags;
+        io_uring_cqe_seen(&uring->ring, cqe);
+
+        if (tx != NULL) {
+            release_tx_buffer(uring, tx);
+            if (res >= 0) {
+                continue;
+            }
+
+            g_warning("Send failed: %s", strerror(-res));
+
+            /* Same as the poll backend: these mean the link is gone */
+            if ((res == -ECONNRESET || res == -EPIPE || res == -ENOTCONN) &&
+                !uring->callback(NULL, res, NULL, uring->user_data)) {
+                return G_SOURCE_REMOVE;
+            }
+            continue;
+        }
+
+        if (!handle_recv(uring, res, flags)) {
+            return G_SOURCE_REMOVE;
+        }
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean on_flush(gpointer user_data)
+{
+    BtUring *uring = user_data;
+    uring->flush_source_id = 0;
+    bt_uring_flush(uring);
+    return G_SOURCE_REMOVE;
+}
+
+BtUring *bt_uring_new(int socket_fd, size_t control_len, BtIoCounters *counters,
+                      BtUringRecvCallback callback, void *user_data)
+{
+    BtUring *uring = g_new0(BtUring, 1);
+    uring->socket_fd = socket_fd;
+    uring->event_fd = -1;
+    uring->counters = counters;
+    uring->callback = callback;
+    uring->user_data = user_data;
+    g_queue_init(&uring->tx_buffers);
+
+    int ret = io_uring_queue_init(URING_ENTRIES, &uring->ring, 0);
+    if (ret < 0) {
+        g_debug("io_uring unavailable: %s", strerror(-ret));
+        g_free(uring);
+        return NULL;
+    }
+
+    /* Provided buffer rings need Linux 5.19 */
+    uring->buf_ring = io_uring_setup_buf_ring(&uring->ring, RX_BUFFER_COUNT,
+                                              RX_BUFFER_GROUP, 0, &ret);
+    if (uring->buf_ring == NULL) {
+        g_debug("io_uring buffer ring unavailable: %s", strerror(-ret));
+        io_uring_queue_exit(&uring->ring);
+        g_free(uring);
+        return NULL;
+    }
+
+    uring->rx_msg.msg_controllen = control_len;
+    uring->rx_buffer_size = sizeof(struct io_uring_recvmsg_out) + control_len + BT_MAX_PACKET_SIZE;
+    uring->rx_buffers = g_malloc(uring->rx_buffer_size * RX_BUFFER_COUNT);
+    for (unsigned int i = 0; i < RX_BUFFER_COUNT; i++) {
+        io_uring_buf_ring_add(uring->buf_ring, rx_buffer(uring, i), uring->rx_buffer_size, i,
+                              io_uring_buf_ring_mask(RX_BUFFER_COUNT), i);
+    }
+    io_uring_buf_ring_advance(uring->buf_ring, RX_BUFFER_COUNT);
+
+    uring->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (uring->event_fd < 0 ||
+        io_uring_register_eventfd(&uring->ring, uring->event_fd) < 0 ||
+        !arm_recv(uring)) {
+        g_debug("Failed to set up io_uring completions");
+        bt_uring_free(uring);
+        return NULL;
+    }
+
+    uring->event_source_id = g_unix_fd_add(uring->event_fd, G_IO_IN, on_completions, uring);
+
+    return uring;
+}
+
+static bool requests_in_flight(BtUring *uring)
+{
+    return uring->cancelling || uring->recv_armed || !g_queue_is_empty(&uring->tx_buffers);
+}
+
+/* Release the ring and all buffers, once nothing uses them any more */
+static void destroy(BtUring *uring)
+{
+    if (uring->event_source_id != 0) {
+        g_source_remove(uring->event_source_id);
+    }
+    if (uring->teardown_timeout_id != 0) {
+        g_source_remove(uring->teardown_timeout_id);
+    }
+
+    /* Whatever is left was never submitted or is beyond waiting for */
+    TxBuffer *tx;
+    while ((tx = g_queue_peek_head(&uring->tx_buffers)) != NULL) {
+        release_tx_buffer(uring, tx);
+    }
+
+    io_uring_free_buf_ring(&uring->ring, uring->buf_ring, RX_BUFFER_COUNT, RX_BUFFER_GROUP);
+    io_uring_queue_exit(&uring->ring);
+
+    if (uring->event_fd >= 0) {
+        close(uring->event_fd);
+    }
+
+    g_free(uring->rx_buffers);
+    g_free(uring);
+}
+
+/* Reap completions during teardown: only what is still in flight matters */
+static void drain_completions(BtUring *uring)
+{
+    struct io_uring_cqe *cqe;
+    while (io_uring_peek_cqe(&uring->ring, &cqe) == 0) {
+        void *data = io_uring_cqe_get_data(cqe);
+        if (data == &cancel_tag) {
+            uring->cancelling = false;
+        } else if (data != NULL) {
+            release_tx_buffer(uring, data);
+        } else if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            uring->recv_armed = false;
+        }
+        io_uring_cqe_seen(&uring->ring, cqe);
+    }
+}
+
+static gboolean on_teardown_completions(gint fd, GIOCondition condition G_GNUC_UNUSED,
+                                        gpointer user_data)
+{
+    BtUring *uring = user_data;
+    eventfd_t value;
+
+    eventfd_read(fd, &value);
+    drain_completions(uring);
+    if (requests_in_flight(uring)) {
+        return G_SOURCE_CONTINUE;
+    }
+
+    uring->event_source_id = 0;
+    destroy(uring);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean on_teardown_timeout(gpointer user_data)
+{
+    BtUring *uring = user_data;
+
+    uring->teardown_timeout_id = 0;
+    g_warning("io_uring requests did not finish, %u send buffers left",
+              uring->tx_buffers.length);
+    destroy(uring);
+    return G_SOURCE_REMOVE;
+}
+
+void bt_uring_free(BtUring *uring)
+{
+    if (uring == NULL)
+        return;
+
+    /* No more callbacks or counter updates: the connection may go away
+     * right after this returns */
+    if (uring->event_source_id != 0) {
+        g_source_remove(uring->event_source_id);
+        uring->event_source_id = 0;
+    }
+    if (uring->flush_source_id != 0) {
+        g_source_remove(uring->flush_source_id);
+        uring->flush_source_id = 0;
+    }
+
+    /* The kernel may still read send buffers and write receive buffers:
+     * cancel everything (queued sends go out with the cancel) and keep
+     * the memory until the requests are done */
+    if (requests_in_flight(uring)) {
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&uring->ring);
+        if (sqe != NULL) {
+            io_uring_prep_cancel(sqe, NULL, IORING_ASYNC_CANCEL_ANY);
+            io_uring_sqe_set_data(sqe, &cancel_tag);
+            uring->cancelling = io_uring_submit(&uring->ring) >= 0;
+        }
+    }
+
+    /* Cancellation usually completes inline */
+    drain_completions(uring);
+    if (!requests_in_flight(uring) || uring->event_fd < 0) {
+        destroy(uring);
+        return;
+    }
+
+    /* Otherwise finish on the main loop instead of blocking it */
+    uring->event_source_id = g_unix_fd_add(uring->event_fd, G_IO_IN,
+                                           on_teardown_completions, uring);
+    uring->teardown_timeout_id = g_timeout_add(CANCEL_TIMEOUT_MS, on_teardown_timeout, uring);
+}
+
+bool bt_uring_send(BtUring *uring, const uint8_t *data, size_t len)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&uring->ring);
+    if (sqe == NULL) {
+        /* Submission queue full: push the batch out and retry */
+        bt_uring_flush(uring);
+        sqe = io_uring_get_sqe(&uring->ring);
+        if (sqe == NULL) {
+            return false;
+        }
+    }
+
+    TxBuffer *tx = g_malloc(sizeof(TxBuffer) + len);
+    tx->link = (GList){ .data = tx };
+    tx->len = len;
+    memcpy(tx->data, data, len);
+    g_queue_push_tail_link(&uring->tx_buffers, &tx->link);
+
+    io_uring_prep_send(sqe, uring->socket_fd, tx->data, len, MSG_NOSIGNAL);
+    io_uring_sqe_set_data(sqe, tx);
+
+    uring->queued_sends++;
+    uring->counters->tx_packets++;
+
+    if (uring->flush_source_id == 0) {
+        uring->flush_source_id = g_idle_add_full(G_PRIORITY_HIGH, on_flush, uring, NULL);
+    }
+
+    return true;
+}
+
+void bt_uring_flush(BtUring *uring)
+{
+    if (uring->queued_sends == 0) {
+        return;
+    }
+
+    uring->queued_sends = 0;
+    uring->counters->tx_syscalls++;
+
+    int ret = io_uring_submit(&uring->ring);
+    if (ret < 0) {
+        g_warning("Failed to submit sends: %s", strerror(-ret));
+    }
+}
+
+#else /* !HAVE_LIBURING */
+
+BtUring *bt_uring_new(int socket_fd G_GNUC_UNUSED, size_t control_len G_GNUC_UNUSED,
+                      BtIoCounters *counters G_GNUC_UNUSED,
+                      BtUringRecvCallback callback G_GNUC_UNUSED, void *user_data G_GNUC_UNUSED)
+{
+    return NULL;
+}
+
+void bt_uring_free(BtUring *uring G_GNUC_UNUSED)
+{
+}
+
+bool bt_uring_send(BtUring *uring G_GNUC_UNUSED, const uint8_t *data G_GNUC_UNUSED,
+                   size_t len G_GNUC_UNUSED)
+{
+    return false;
+}
+
+void bt_uring_flush(BtUring *uring G_GNUC_UNUSED)
+{
+}
+
+#endif /* HAVE_LIBURING */
@@ -0,0 +1,81 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * Optional io_uring I/O backend for the L2CAP socket
+ */
+
+#ifndef BT_URING_H
+#define BT_URING_H
+
+#include <glib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* Per-connection I/O counters, shared by both backends */
+typedef struct {
+    guint64 rx_packets;
+    guint64 rx_syscalls;
+    guint64 tx_packets;
+    guint64 tx_syscalls;
+} BtIoCounters;
+
+/**
+ * Receive callback
+ *
+ * Also called with a negative len when a send fails because the link is
+ * gone (ECONNRESET, EPIPE, ENOTCONN).
+ *
+ * @param data Packet payload (NULL unless len > 0)
+ * @param len Payload length, 0 if the peer closed, -errno on error
+ * @param stamp Kernel RX timestamp or NULL
+ * @return false if the backend was freed from within the callback
+ */
+typedef bool (*BtUringRecvCallback)(const uint8_t *data, ssize_t len,
+                                    const struct timespec *stamp, void *user_data);
+
+/* io_uring backend context */
+typedef struct BtUring BtUring;
+
+/**
+ * Set up io_uring for a connected socket
+ *
+ * Arms a multishot receive with provided buffers and bridges completions
+ * into the default GLib main context through an eventfd.
+ *
+ * @param socket_fd Connected socket
+ * @param control_len Size of the control message area per packet
+ * @param counters Counters to update
+ * @return New backend, or NULL if io_uring is not available (not built in,
+ *         kernel too old, or disabled by seccomp)
+ */
+BtUring *bt_uring_new(int socket_fd, size_t control_len, BtIoCounters *counters,
+                      BtUringRecvCallback callback, void *user_data);
+
+/**
+ * Free backend (does not close the socket)
+ *
+ * Cancels the receive and any sends still in flight and returns at once.
+ * The callback is not called again; the ring and buffers are released
+ * from the main loop when the cancelled requests have completed.
+ */
+void bt_uring_free(BtUring *uring);
+
+/**
+ * Queue a packet for sending
+ *
+ * Queued packets are submitted together by bt_uring_flush(), which is
+ * also scheduled automatically at high priority.
+ *
+ * @return true if queued
+ */
+bool bt_uring_send(BtUring *uring, const uint8_t *data, size_t len);
+
+/**
+ * Submit all queued packets now
+ */
+void bt_uring_flush(BtUring *uring);
+
+#endif /* BT_URING_H */
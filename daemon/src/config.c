@@ -5,25 +5,48 @@
  * Configuration file management
  */
 
+#include "build-config.h"
 #include "config.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <sys/stat.h>
 
 #define CONFIG_DIR_NAME "librepods"
-#define CONFIG_FILE_NAME "daemon.conf"
 #define CONFIG_GROUP "Settings"
+#define DEFAULT_SEAT "seat0"
 
-static gchar *get_config_dir(void)
+/* Without persistence (-Dpersistence=false) loads give the defaults and
+ * saves are dropped; the file code below is then optimized out. */
+
+static gchar *config_directory_override = NULL;
+static bool config_system_mode = false;
+
+void config_set_directory(const char *directory)
+{
+    g_free(config_directory_override);
+    config_directory_override = g_strdup(directory);
+}
+
+void config_set_system_mode(bool system_mode)
 {
+    config_system_mode = system_mode;
+}
+
+gchar *config_get_directory(void)
+{
+    if (config_directory_override != NULL) {
+        return g_strdup(config_directory_override);
+    }
+
     const gchar *config_home = g_get_user_config_dir();
     return g_build_filename(config_home, CONFIG_DIR_NAME, NULL);
 }
 
 static gchar *get_config_path(void)
 {
-    gchar *config_dir = get_config_dir();
+    gchar *config_dir = config_get_directory();
     gchar *config_path = g_build_filename(config_dir, CONFIG_FILE_NAME, NULL);
     g_free(config_dir);
     return config_path;
@@ -31,7 +54,7 @@ static gchar *get_config_path(void)
 
 static bool ensure_config_dir(void)
 {
-    gchar *config_dir = get_config_dir();
+    gchar *config_dir = config_get_directory();
     int result = g_mkdir_with_parents(config_dir, 0755);
     g_free(config_dir);
 
@@ -46,6 +69,7 @@ static bool ensure_config_dir(void)
 void config_get_defaults(LibrePodsConfig *config)
 {
     config->ear_pause_mode = 1;  /* EAR_PAUSE_ONE_OUT */
+    g_strlcpy(config->seat, DEFAULT_SEAT, sizeof(config->seat));
 }
 
 bool config_load(LibrePodsConfig *config)
@@ -53,6 +77,10 @@ bool config_load(LibrePodsConfig *config)
     /* Start with defaults */
     config_get_defaults(config);
 
+    if (!HAVE_PERSISTENCE) {
+        return true;
+    }
+
     gchar *config_path = get_config_path();
     GKeyFile *keyfile = g_key_file_new();
     GError *error = NULL;
@@ -82,7 +110,15 @@ bool config_load(LibrePodsConfig *config)
         }
     }
 
-    g_message("Config loaded: ear_pause_mode=%d", config->ear_pause_mode);
+    if (g_key_file_has_key(keyfile, CONFIG_GROUP, "seat", NULL)) {
+        gchar *seat = g_key_file_get_string(keyfile, CONFIG_GROUP, "seat", NULL);
+        if (seat) {
+            g_strlcpy(config->seat, seat, sizeof(config->seat));
+            g_free(seat);
+        }
+    }
+
+    g_message("Config loaded: ear_pause_mode=%d seat=%s", config->ear_pause_mode, config->seat);
 
     g_key_file_free(keyfile);
     g_free(config_path);
@@ -91,6 +127,10 @@ bool config_load(LibrePodsConfig *config)
 
 bool config_save(const LibrePodsConfig *config)
 {
+    if (!HAVE_PERSISTENCE) {
+        return true;
+    }
+
     if (!ensure_config_dir()) {
         return false;
     }
@@ -99,11 +139,18 @@ bool config_save(const LibrePodsConfig *config)
 
     /* Write settings */
     g_key_file_set_integer(keyfile, CONFIG_GROUP, "ear_pause_mode", config->ear_pause_mode);
+    if (config_system_mode) {
+        g_key_file_set_string(keyfile, CONFIG_GROUP, "seat", config->seat);
+    }
 
     /* Add comment */
     g_key_file_set_comment(keyfile, CONFIG_GROUP, NULL,
-                           "LibrePods daemon configuration\n"
-                           "ear_pause_mode: 0=disabled, 1=pause when one removed, 2=pause when both removed",
+                           config_system_mode
+                           ? "LibrePods daemon configuration\n"
+                             "ear_pause_mode: 0=disabled, 1=pause when one removed, 2=pause when both removed\n"
+                             "seat: seat whose users may control devices"
+                           : "LibrePods daemon configuration\n"
+                             "ear_pause_mode: 0=disabled, 1=pause when one removed, 2=pause when both removed",
                            NULL);
 
     gchar *config_path = get_config_path();
@@ -128,24 +175,18 @@ bool config_save(const LibrePodsConfig *config)
  * Per-device listening modes configuration
  * ========================================================================== */
 
-#define DEVICES_FILE_NAME "devices.conf"
-
 static gchar *get_devices_config_path(void)
 {
-    gchar *config_dir = get_config_dir();
+    gchar *config_dir = config_get_directory();
     gchar *config_path = g_build_filename(config_dir, DEVICES_FILE_NAME, NULL);
     g_free(config_dir);
     return config_path;
 }
 
-/* Convert MAC address to group name (replace : with _) */
-static gchar *address_to_group(const char *address)
+/* Group name is the MAC address with _ instead of : */
+static void address_to_group(const BtAddr *address, char group[BT_ADDR_STRLEN])
 {
-    gchar *group = g_strdup(address);
-    for (gchar *p = group; *p; p++) {
-        if (*p == ':') *p = '_';
-    }
-    return group;
+    bt_addr_format(address, '_', group);
 }
 
 void config_get_default_listening_modes(ListeningModesConfig *modes)
@@ -157,12 +198,12 @@ void config_get_default_listening_modes(ListeningModesConfig *modes)
     modes->adaptive_enabled = false;
 }
 
-bool config_load_device_listening_modes(const char *device_address, ListeningModesConfig *modes)
+bool config_load_device_listening_modes(const BtAddr *device_address, ListeningModesConfig *modes)
 {
     /* Start with defaults */
     config_get_default_listening_modes(modes);
 
-    if (device_address == NULL || device_address[0] == '\0') {
+    if (!HAVE_PERSISTENCE || device_address == NULL || bt_addr_is_null(device_address)) {
         return false;
     }
 
@@ -182,12 +223,12 @@ bool config_load_device_listening_modes(const char *device_address, ListeningMod
         return false;
     }
 
-    gchar *group = address_to_group(device_address);
+    char group[BT_ADDR_STRLEN];
+    address_to_group(device_address, group);
 
     if (!g_key_file_has_group(keyfile, group)) {
         g_key_file_free(keyfile);
         g_free(config_path);
-        g_free(group);
         return false;
     }
 
@@ -205,20 +246,24 @@ bool config_load_device_listening_modes(const char *device_address, ListeningMod
         modes->adaptive_enabled = g_key_file_get_boolean(keyfile, group, "listening_mode_adaptive", NULL);
     }
 
+    char address_str[BT_ADDR_STRLEN];
     g_message("Loaded listening modes for %s: off=%d, transparency=%d, anc=%d, adaptive=%d",
-              device_address,
+              bt_addr_to_string(device_address, address_str),
               modes->off_enabled, modes->transparency_enabled,
               modes->anc_enabled, modes->adaptive_enabled);
 
     g_key_file_free(keyfile);
     g_free(config_path);
-    g_free(group);
     return true;
 }
 
-bool config_save_device_listening_modes(const char *device_address, const ListeningModesConfig *modes)
+bool config_save_device_listening_modes(const BtAddr *device_address, const ListeningModesConfig *modes)
 {
-    if (device_address == NULL || device_address[0] == '\0') {
+    if (!HAVE_PERSISTENCE) {
+        return true;
+    }
+
+    if (device_address == NULL || bt_addr_is_null(device_address)) {
         g_warning("Cannot save listening modes: no device address");
         return false;
     }
@@ -234,7 +279,8 @@ bool config_save_device_listening_modes(const char *device_address, const Listen
     /* Load existing file if present */
     g_key_file_load_from_file(keyfile, config_path, G_KEY_FILE_KEEP_COMMENTS, NULL);
 
-    gchar *group = address_to_group(device_address);
+    char group[BT_ADDR_STRLEN];
+    address_to_group(device_address, group);
 
     /* Write listening modes */
     g_key_file_set_boolean(keyfile, group, "listening_mode_off", modes->off_enabled);
@@ -247,18 +293,17 @@ bool config_save_device_listening_modes(const char *device_address, const Listen
         g_error_free(error);
         g_key_file_free(keyfile);
         g_free(config_path);
-        g_free(group);
         return false;
     }
 
+    char address_str[BT_ADDR_STRLEN];
     g_message("Saved listening modes for %s: off=%d, transparency=%d, anc=%d, adaptive=%d",
-              device_address,
+              bt_addr_to_string(device_address, address_str),
               modes->off_enabled, modes->transparency_enabled,
               modes->anc_enabled, modes->adaptive_enabled);
 
     g_key_file_free(keyfile);
     g_free(config_path);
-    g_free(group);
     return true;
 }
 
@@ -287,12 +332,12 @@ void config_get_default_profile(DeviceProfile *profile)
     profile->has_saved_settings = false;
 }
 
-bool config_load_device_profile(const char *device_address, DeviceProfile *profile)
+bool config_load_device_profile(const BtAddr *device_address, DeviceProfile *profile)
 {
     /* Start with defaults */
     config_get_default_profile(profile);
 
-    if (device_address == NULL || device_address[0] == '\0') {
+    if (!HAVE_PERSISTENCE || device_address == NULL || bt_addr_is_null(device_address)) {
         return false;
     }
 
@@ -312,12 +357,12 @@ bool config_load_device_profile(const char *device_address, DeviceProfile *profi
         return false;
     }
 
-    gchar *group = address_to_group(device_address);
+    char group[BT_ADDR_STRLEN];
+    address_to_group(device_address, group);
 
     if (!g_key_file_has_group(keyfile, group)) {
         g_key_file_free(keyfile);
         g_free(config_path);
-        g_free(group);
         return false;
     }
 
@@ -363,25 +408,36 @@ bool config_load_device_profile(const char *device_address, DeviceProfile *profi
             g_free(mode);
         }
     }
+    if (g_key_file_has_key(keyfile, group, "seat", NULL)) {
+        gchar *seat = g_key_file_get_string(keyfile, group, "seat", NULL);
+        if (seat) {
+            g_strlcpy(profile->seat, seat, sizeof(profile->seat));
+            g_free(seat);
+        }
+    }
 
     /* Check if this profile has been explicitly saved */
     if (g_key_file_has_key(keyfile, group, "has_saved_settings", NULL)) {
         profile->has_saved_settings = g_key_file_get_boolean(keyfile, group, "has_saved_settings", NULL);
     }
 
+    char address_str[BT_ADDR_STRLEN];
     g_message("Loaded profile for %s: display_name='%s', nc_mode=%s, ca=%d, adaptive_level=%d",
-              device_address, profile->display_name, profile->preferred_nc_mode,
+              bt_addr_to_string(device_address, address_str), profile->display_name, profile->preferred_nc_mode,
               profile->conversational_awareness, profile->adaptive_noise_level);
 
     g_key_file_free(keyfile);
     g_free(config_path);
-    g_free(group);
     return true;
 }
 
-bool config_save_device_profile(const char *device_address, const DeviceProfile *profile)
+bool config_save_device_profile(const BtAddr *device_address, const DeviceProfile *profile)
 {
-    if (device_address == NULL || device_address[0] == '\0') {
+    if (!HAVE_PERSISTENCE) {
+        return true;
+    }
+
+    if (device_address == NULL || bt_addr_is_null(device_address)) {
         g_warning("Cannot save profile: no device address");
         return false;
     }
@@ -396,7 +452,8 @@ bool config_save_device_profile(const char *device_address, const DeviceProfile
     /* Load existing file if present */
     g_key_file_load_from_file(keyfile, config_path, G_KEY_FILE_KEEP_COMMENTS, NULL);
 
-    gchar *group = address_to_group(device_address);
+    char group[BT_ADDR_STRLEN];
+    address_to_group(device_address, group);
 
     /* Write display name */
     g_key_file_set_string(keyfile, group, "display_name", profile->display_name);
@@ -411,6 +468,9 @@ bool config_save_device_profile(const char *device_address, const DeviceProfile
     g_key_file_set_boolean(keyfile, group, "conversational_awareness", profile->conversational_awareness);
     g_key_file_set_integer(keyfile, group, "adaptive_noise_level", profile->adaptive_noise_level);
     g_key_file_set_string(keyfile, group, "preferred_nc_mode", profile->preferred_nc_mode);
+    if (profile->seat[0] != '\0') {
+        g_key_file_set_string(keyfile, group, "seat", profile->seat);
+    }
     g_key_file_set_boolean(keyfile, group, "has_saved_settings", true);
 
     GError *error = NULL;
@@ -419,16 +479,142 @@ bool config_save_device_profile(const char *device_address, const DeviceProfile
         g_error_free(error);
         g_key_file_free(keyfile);
         g_free(config_path);
-        g_free(group);
         return false;
     }
 
+    char address_str[BT_ADDR_STRLEN];
     g_message("Saved profile for %s: display_name='%s', nc_mode=%s, ca=%d, adaptive_level=%d",
-              device_address, profile->display_name, profile->preferred_nc_mode,
+              bt_addr_to_string(device_address, address_str), profile->display_name, profile->preferred_nc_mode,
               profile->conversational_awareness, profile->adaptive_noise_level);
 
     g_key_file_free(keyfile);
     g_free(config_path);
-    g_free(group);
     return true;
 }
+
+/* ============================================================================
+ * Per-device usage
+ *
+ * One key per day ("2024-05-31=both;one;case;transitions;"), so the file
+ * stays small however often the buds go in and out.
+ * ========================================================================== */
+
+#define USAGE_FILE_NAME "usage.conf"
+#define USAGE_FIELDS 4
+
+static gchar *get_usage_path(void)
+{
+    gchar *config_dir = config_get_directory();
+    gchar *usage_path = g_build_filename(config_dir, USAGE_FILE_NAME, NULL);
+    g_free(config_dir);
+    return usage_path;
+}
+
+static int compare_days(const void *a, const void *b)
+{
+    const DailyUsage *day_a = a;
+    const DailyUsage *day_b = b;
+    return (day_a->day > day_b->day) - (day_a->day < day_b->day);
+}
+
+guint config_load_device_usage(const BtAddr *device_address, DailyUsage *days)
+{
+    if (!HAVE_PERSISTENCE) {
+        return 0;
+    }
+
+    gchar *usage_path = get_usage_path();
+    GKeyFile *keyfile = g_key_file_new();
+    guint n_days = 0;
+
+    if (!g_key_file_load_from_file(keyfile, usage_path, G_KEY_FILE_NONE, NULL)) {
+        g_key_file_free(keyfile);
+        g_free(usage_path);
+        return 0;
+    }
+
+    char group[BT_ADDR_STRLEN];
+    address_to_group(device_address, group);
+
+    gchar **keys = g_key_file_get_keys(keyfile, group, NULL, NULL);
+    for (gchar **key = keys; key != NULL && *key != NULL && n_days < USAGE_MAX_DAYS; key++) {
+        unsigned int year, month, day;
+        if (sscanf(*key, "%4u-%2u-%2u", &year, &month, &day) != 3 ||
+            !g_date_valid_dmy(day, month, year)) {
+            continue;
+        }
+
+        gsize len = 0;
+        gint *values = g_key_file_get_integer_list(keyfile, group, *key, &len, NULL);
+        if (values != NULL && len == USAGE_FIELDS) {
+            GDate date;
+            g_date_clear(&date, 1);
+            g_date_set_dmy(&date, day, month, year);
+
+            DailyUsage *usage = &days[n_days++];
+            usage->day = g_date_get_julian(&date);
+            usage->both_in_ear_s = MAX(values[0], 0);
+            usage->one_in_ear_s = MAX(values[1], 0);
+            usage->in_case_s = MAX(values[2], 0);
+            usage->transitions = MAX(values[3], 0);
+        }
+        g_free(values);
+    }
+    g_strfreev(keys);
+
+    qsort(days, n_days, sizeof(DailyUsage), compare_days);
+
+    g_key_file_free(keyfile);
+    g_free(usage_path);
+    return n_days;
+}
+
+bool config_save_device_usage(const BtAddr *device_address, const DailyUsage *days, guint n_days)
+{
+    if (!HAVE_PERSISTENCE || device_address == NULL || bt_addr_is_null(device_address)) {
+        return false;
+    }
+
+    if (!ensure_config_dir()) {
+        return false;
+    }
+
+    gchar *usage_path = get_usage_path();
+    GKeyFile *keyfile = g_key_file_new();
+
+    /* Other devices are kept as they are */
+    g_key_file_load_from_file(keyfile, usage_path, G_KEY_FILE_KEEP_COMMENTS, NULL);
+
+    char group[BT_ADDR_STRLEN];
+    address_to_group(device_address, group);
+    g_key_file_remove_group(keyfile, group, NULL);
+
+    for (guint i = 0; i < n_days; i++) {
+        GDate date;
+        g_date_clear(&date, 1);
+        g_date_set_julian(&date, days[i].day);
+
+        char key[16];
+        g_snprintf(key, sizeof(key), "%04u-%02u-%02u",
+                   g_date_get_year(&date), g_date_get_month(&date), g_date_get_day(&date));
+
+        gint values[USAGE_FIELDS] = {
+            (gint)MIN(days[i].both_in_ear_s, G_MAXINT),
+            (gint)MIN(days[i].one_in_ear_s, G_MAXINT),
+            (gint)MIN(days[i].in_case_s, G_MAXINT),
+            (gint)MIN(days[i].transitions, G_MAXINT),
+        };
+        g_key_file_set_integer_list(keyfile, group, key, values, USAGE_FIELDS);
+    }
+
+    GError *error = NULL;
+    bool ok = g_key_file_save_to_file(keyfile, usage_path, &error);
+    if (!ok) {
+        g_warning("Failed to save usage: %s", error->message);
+        g_error_free(error);
+    }
+
+    g_key_file_free(keyfile);
+    g_free(usage_path);
+    return ok;
+}
@@ -12,11 +12,40 @@
 #include <stdbool.h>
 #include "airpods_state.h"
 
+/* Files in the configuration directory */
+#define CONFIG_FILE_NAME "daemon.conf"
+#define DEVICES_FILE_NAME "devices.conf"
+
 /* Configuration data structure */
 typedef struct {
     int ear_pause_mode;   /* 0=disabled, 1=one_out, 2=both_out */
+    char seat[32];        /* Default seat for devices (system mode only) */
 } LibrePodsConfig;
 
+/**
+ * Override the configuration directory
+ * By default files live in $XDG_CONFIG_HOME/librepods. The system-wide
+ * daemon keeps them in its state directory instead.
+ *
+ * @param directory Directory path, or NULL to restore the default
+ */
+void config_set_directory(const char *directory);
+
+/**
+ * Select the system-wide daemon's settings
+ * Settings that only apply to that mode (the seat) are saved only when set.
+ *
+ * @param system_mode true for the system-wide daemon
+ */
+void config_set_system_mode(bool system_mode);
+
+/**
+ * Get the configuration directory
+ *
+ * @return Directory path (free with g_free)
+ */
+gchar *config_get_directory(void);
+
 /**
  * Load configuration from file
  * Creates default config if file doesn't exist
@@ -48,6 +77,7 @@ typedef struct {
     bool conversational_awareness;      /* CA enabled */
     int adaptive_noise_level;           /* 0-100 */
     char preferred_nc_mode[16];         /* "off", "anc", "transparency", "adaptive" */
+    char seat[32];                      /* Seat allowed to use the device (empty = default) */
     bool has_saved_settings;            /* Whether profile has saved settings */
 } DeviceProfile;
 
@@ -58,7 +88,7 @@ typedef struct {
  * @param profile Pointer to structure to fill with profile data
  * @return true if found and loaded, false if not found (defaults used)
  */
-bool config_load_device_profile(const char *device_address, DeviceProfile *profile);
+bool config_load_device_profile(const BtAddr *device_address, DeviceProfile *profile);
 
 /**
  * Save complete device profile
@@ -67,7 +97,7 @@ bool config_load_device_profile(const char *device_address, DeviceProfile *profi
  * @param profile Pointer to profile to save
  * @return true on success
  */
-bool config_save_device_profile(const char *device_address, const DeviceProfile *profile);
+bool config_save_device_profile(const BtAddr *device_address, const DeviceProfile *profile);
 
 /**
  * Get default device profile
@@ -83,7 +113,7 @@ void config_get_default_profile(DeviceProfile *profile);
  * @param modes Pointer to structure to fill with listening modes
  * @return true if found and loaded, false if not found (defaults used)
  */
-bool config_load_device_listening_modes(const char *device_address, ListeningModesConfig *modes);
+bool config_load_device_listening_modes(const BtAddr *device_address, ListeningModesConfig *modes);
 
 /**
  * Save listening modes for a specific device
@@ -92,7 +122,7 @@ bool config_load_device_listening_modes(const char *device_address, ListeningMod
  * @param modes Pointer to listening modes to save
  * @return true on success
  */
-bool config_save_device_listening_modes(const char *device_address, const ListeningModesConfig *modes);
+bool config_save_device_listening_modes(const BtAddr *device_address, const ListeningModesConfig *modes);
 
 /**
  * Get default listening modes
@@ -101,4 +131,35 @@ bool config_save_device_listening_modes(const char *device_address, const Listen
  */
 void config_get_default_listening_modes(ListeningModesConfig *modes);
 
+/* Days of usage kept per device */
+#define USAGE_MAX_DAYS 90
+
+/* Listening time of a device on one day */
+typedef struct {
+    guint32 day;            /* Julian day number (GDate), local time */
+    guint32 both_in_ear_s;  /* Both buds in ear */
+    guint32 one_in_ear_s;   /* Exactly one bud in ear */
+    guint32 in_case_s;      /* Both buds in the case */
+    guint32 transitions;    /* Ear state changes */
+} DailyUsage;
+
+/**
+ * Load per-day usage of a device, oldest day first
+ *
+ * @param device_address Bluetooth MAC address of the device
+ * @param days Array of USAGE_MAX_DAYS entries to fill
+ * @return Number of days loaded (0 if none stored)
+ */
+guint config_load_device_usage(const BtAddr *device_address, DailyUsage *days);
+
+/**
+ * Save per-day usage of a device, replacing what was stored
+ *
+ * @param device_address Bluetooth MAC address of the device
+ * @param days Days to store, oldest first
+ * @param n_days Number of days (at most USAGE_MAX_DAYS)
+ * @return true on success
+ */
+bool config_save_device_usage(const BtAddr *device_address, const DailyUsage *days, guint n_days);
+
 #endif /* CONFIG_H */
@@ -0,0 +1,303 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ */
+
+#include "config_monitor.h"
+#include "wakeup_stats.h"
+
+#include <gio/gio.h>
+#include <string.h>
+
+/* Editors and config management write in several steps; wait for the last */
+#define RELOAD_DELAY_MS 200
+
+struct ConfigMonitor {
+    GFileMonitor *file_monitor;
+    GCancellable *cancellable;
+    guint reload_timeout_id;
+
+    ConfigSnapshot snapshot;
+    guint generation;           /* Bumped whenever the watched device changes */
+    bool reloading;
+    bool reload_pending;        /* Files changed again during a reload */
+
+    ConfigReloadCallback callback;
+    void *callback_user_data;
+};
+
+/* Parsed in a worker thread, so large files never block the main loop */
+typedef struct {
+    BtAddr device;
+    guint generation;
+    ConfigSnapshot snapshot;
+} ReloadJob;
+
+static void schedule_reload(ConfigMonitor *monitor);
+
+/* ============================================================================
+ * Comparison
+ * ========================================================================== */
+
+static bool listening_modes_equal(const ListeningModesConfig *a, const ListeningModesConfig *b)
+{
+    return a->off_enabled == b->off_enabled &&
+           a->transparency_enabled == b->transparency_enabled &&
+           a->anc_enabled == b->anc_enabled &&
+           a->adaptive_enabled == b->adaptive_enabled;
+}
+
+static bool profile_equal(const DeviceProfile *a, const DeviceProfile *b)
+{
+    return strcmp(a->display_name, b->display_name) == 0 &&
+           listening_modes_equal(&a->listening_modes, &b->listening_modes) &&
+           a->conversational_awareness == b->conversational_awareness &&
+           a->adaptive_noise_level == b->adaptive_noise_level &&
+           strcmp(a->preferred_nc_mode, b->preferred_nc_mode) == 0 &&
+           strcmp(a->seat, b->seat) == 0 &&
+           a->has_saved_settings == b->has_saved_settings;
+}
+
+static bool snapshot_equal(const ConfigSnapshot *a, const ConfigSnapshot *b)
+{
+    return a->config.ear_pause_mode == b->config.ear_pause_mode &&
+           strcmp(a->config.seat, b->config.seat) == 0 &&
+           bt_addr_equal(&a->device, &b->device) &&
+           profile_equal(&a->profile, &b->profile);
+}
+
+/* ============================================================================
+ * Reload
+ * ========================================================================== */
+
+static void reload_thread(GTask *task, gpointer source_object, gpointer task_data,
+                          GCancellable *cancellable)
+{
+    (void)source_object;
+    (void)cancellable;
+    ReloadJob *job = task_data;
+
+    config_load(&job->snapshot.config);
+
+    job->snapshot.device = job->device;
+    if (bt_addr_is_null(&job->device)) {
+        config_get_default_profile(&job->snapshot.profile);
+    } else {
+        config_load_device_profile(&job->device, &job->snapshot.profile);
+    }
+
+    g_task_return_boolean(task, TRUE);
+}
+
+static void on_reload_done(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+    (void)source;
+    GError *error = NULL;
+
+    g_task_propagate_boolean(G_TASK(res), &error);
+    if (error) {
+        /* Cancelled means the monitor is gone */
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_warning("Failed to reload configuration: %s", error->message);
+        }
+        g_error_free(error);
+        return;
+    }
+
+    ConfigMonitor *monitor = user_data;
+    ReloadJob *job = g_task_get_task_data(G_TASK(res));
+
+    monitor->reloading = false;
+
+    /* A profile read for a device that has since gone is of no use */
+    if (job->generation != monitor->generation) {
+        monitor->reload_pending = true;
+    } else if (!snapshot_equal(&monitor->snapshot, &job->snapshot)) {
+        ConfigSnapshot old = monitor->snapshot;
+        monitor->snapshot = job->snapshot;
+
+        g_message("Configuration changed on disk, applying");
+        if (monitor->callback) {
+            monitor->callback(&old, &monitor->snapshot, monitor->callback_user_data);
+        }
+    }
+
+    if (monitor->reload_pending) {
+        monitor->reload_pending = false;
+        schedule_reload(monitor);
+    }
+}
+
+static gboolean on_reload_timeout(gpointer user_data)
+{
+    ConfigMonitor *monitor = user_data;
+    monitor->reload_timeout_id = 0;
+
+    if (monitor->reloading) {
+        monitor->reload_pending = true;
+        return G_SOURCE_REMOVE;
+    }
+
+    ReloadJob *job = g_new0(ReloadJob, 1);
+    job->device = monitor->snapshot.device;
+    job->generation = monitor->generation;
+
+    GTask *task = g_task_new(NULL, monitor->cancellable, on_reload_done, monitor);
+    g_task_set_task_data(task, job, g_free);
+    g_task_run_in_thread(task, reload_thread);
+    g_object_unref(task);
+
+    monitor->reloading = true;
+    return G_SOURCE_REMOVE;
+}
+
+static void schedule_reload(ConfigMonitor *monitor)
+{
+    /* Restart the delay, so a burst of events gives a single reload */
+    if (monitor->reload_timeout_id != 0) {
+        g_source_remove(monitor->reload_timeout_id);
+    }
+    monitor->reload_timeout_id = wakeup_timeout_add(RELOAD_DELAY_MS, 0, on_reload_timeout, monitor);
+}
+
+/* ============================================================================
+ * File events
+ * ========================================================================== */
+
+static bool is_config_file(GFile *file)
+{
+    if (file == NULL) {
+        return false;
+    }
+
+    gchar *name = g_file_get_basename(file);
+    bool watched = g_strcmp0(name, CONFIG_FILE_NAME) == 0 ||
+                   g_strcmp0(name, DEVICES_FILE_NAME) == 0;
+    g_free(name);
+
+    return watched;
+}
+
+static void on_file_changed(GFileMonitor *file_monitor, GFile *file, GFile *other_file,
+                            GFileMonitorEvent event_type, gpointer user_data)
+{
+    (void)file_monitor;
+    ConfigMonitor *monitor = user_data;
+
+    wakeup_stats_count(WAKEUP_CONFIG_FILE);
+
+    switch (event_type) {
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+    case G_FILE_MONITOR_EVENT_CREATED:
+    case G_FILE_MONITOR_EVENT_DELETED:
+    case G_FILE_MONITOR_EVENT_MOVED_IN:
+    case G_FILE_MONITOR_EVENT_RENAMED:
+        break;
+    default:
+        return;
+    }
+
+    /* Atomic saves rename a temporary file over the real one */
+    if (is_config_file(file) || is_config_file(other_file)) {
+        schedule_reload(monitor);
+    }
+}
+
+/* ============================================================================
+ * Public API
+ * ========================================================================== */
+
+ConfigMonitor *config_monitor_new(void)
+{
+    ConfigMonitor *monitor = g_new0(ConfigMonitor, 1);
+    config_get_defaults(&monitor->snapshot.config);
+    config_get_default_profile(&monitor->snapshot.profile);
+    return monitor;
+}
+
+void config_monitor_free(ConfigMonitor *monitor)
+{
+    if (monitor == NULL)
+        return;
+
+    config_monitor_stop(monitor);
+    g_free(monitor);
+}
+
+void config_monitor_set_callback(ConfigMonitor *monitor,
+                                 ConfigReloadCallback callback,
+                                 void *user_data)
+{
+    monitor->callback = callback;
+    monitor->callback_user_data = user_data;
+}
+
+bool config_monitor_start(ConfigMonitor *monitor, const LibrePodsConfig *config)
+{
+    if (monitor->file_monitor != NULL) {
+        return true;
+    }
+
+    monitor->snapshot.config = *config;
+
+    /* Watch the directory: editors replace files rather than write them */
+    gchar *path = config_get_directory();
+    GFile *directory = g_file_new_for_path(path);
+    GError *error = NULL;
+
+    monitor->file_monitor = g_file_monitor_directory(directory, G_FILE_MONITOR_WATCH_MOVES,
+                                                     NULL, &error);
+    g_object_unref(directory);
+
+    if (monitor->file_monitor == NULL) {
+        g_warning("Failed to watch %s: %s", path, error->message);
+        g_error_free(error);
+        g_free(path);
+        return false;
+    }
+
+    g_signal_connect(monitor->file_monitor, "changed", G_CALLBACK(on_file_changed), monitor);
+    monitor->cancellable = g_cancellable_new();
+
+    g_message("Watching %s for configuration changes", path);
+    g_free(path);
+    return true;
+}
+
+void config_monitor_stop(ConfigMonitor *monitor)
+{
+    if (monitor->reload_timeout_id != 0) {
+        g_source_remove(monitor->reload_timeout_id);
+        monitor->reload_timeout_id = 0;
+    }
+
+    if (monitor->cancellable) {
+        g_cancellable_cancel(monitor->cancellable);
+        g_object_unref(monitor->cancellable);
+        monitor->cancellable = NULL;
+    }
+
+    if (monitor->file_monitor) {
+        g_signal_handlers_disconnect_by_data(monitor->file_monitor, monitor);
+        g_file_monitor_cancel(monitor->file_monitor);
+        g_object_unref(monitor->file_monitor);
+        monitor->file_monitor = NULL;
+    }
+
+    monitor->reloading = false;
+    monitor->reload_pending = false;
+}
+
+void config_monitor_set_device(ConfigMonitor *monitor, const BtAddr *address,
+                               const DeviceProfile *profile)
+{
+    monitor->generation++;
+
+    if (address == NULL) {
+        memset(&monitor->snapshot.device, 0, sizeof(monitor->snapshot.device));
+        config_get_default_profile(&monitor->snapshot.profile);
+    } else {
+        monitor->snapshot.device = *address;
+        monitor->snapshot.profile = *profile;
+    }
+}
@@ -0,0 +1,80 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * Live reload of daemon.conf and devices.conf
+ */
+
+#ifndef CONFIG_MONITOR_H
+#define CONFIG_MONITOR_H
+
+#include <glib.h>
+#include <stdbool.h>
+#include "bt_addr.h"
+#include "config.h"
+
+/* Settings as last read from disk */
+typedef struct {
+    LibrePodsConfig config;
+    BtAddr device;              /* Device the profile belongs to (null if none) */
+    DeviceProfile profile;
+} ConfigSnapshot;
+
+/**
+ * Reload callback, called in the main thread when a file changed
+ *
+ * @param old Settings before the change
+ * @param new Settings now on disk
+ */
+typedef void (*ConfigReloadCallback)(const ConfigSnapshot *old, const ConfigSnapshot *new,
+                                     void *user_data);
+
+/* Config monitor context */
+typedef struct ConfigMonitor ConfigMonitor;
+
+/**
+ * Create a new config monitor
+ *
+ * @return New monitor
+ */
+ConfigMonitor *config_monitor_new(void);
+
+/**
+ * Free config monitor
+ */
+void config_monitor_free(ConfigMonitor *monitor);
+
+/**
+ * Set reload callback
+ */
+void config_monitor_set_callback(ConfigMonitor *monitor,
+                                 ConfigReloadCallback callback,
+                                 void *user_data);
+
+/**
+ * Start watching the configuration directory
+ *
+ * Changes are collected for a short while, then the files are parsed in
+ * a worker thread and compared with the previous snapshot. The callback
+ * only runs if a setting actually changed.
+ *
+ * @param config Settings currently in use
+ * @return true on success
+ */
+bool config_monitor_start(ConfigMonitor *monitor, const LibrePodsConfig *config);
+
+/**
+ * Stop watching and drop any reload in progress
+ */
+void config_monitor_stop(ConfigMonitor *monitor);
+
+/**
+ * Set the device whose profile is watched
+ *
+ * @param address Connected device, or NULL after a disconnect
+ * @param profile Profile currently in use (ignored if address is NULL)
+ */
+void config_monitor_set_device(ConfigMonitor *monitor, const BtAddr *address,
+                               const DeviceProfile *profile);
+
+#endif /* CONFIG_MONITOR_H */
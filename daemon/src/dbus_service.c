@@ -3,10 +3,13 @@
  * SPDX-FileCopyrightText: 2024 LibrePods Contributors
  */
 
+#include "build-config.h"
 #include "dbus_service.h"
+#include "wakeup_stats.h"
 #include <string.h>
 
-/* D-Bus introspection XML */
+/* D-Bus introspection XML; parts for subsystems left out of the build are
+ * not exported, so clients can tell what is available */
 static const gchar introspection_xml[] =
     "<node>"
     "  <interface name='" DBUS_INTERFACE_NAME "'>"
@@ -29,7 +32,9 @@ static const gchar introspection_xml[] =
     "    <property name='LeftInEar' type='b' access='read'/>"
     "    <property name='RightInEar' type='b' access='read'/>"
     "    <property name='AdaptiveNoiseLevel' type='i' access='read'/>"
+#if HAVE_MEDIA_CONTROL
     "    <property name='EarPauseMode' type='i' access='read'/>"
+#endif
     "    <property name='ListeningModeOff' type='b' access='read'/>"
     "    <property name='ListeningModeTransparency' type='b' access='read'/>"
     "    <property name='ListeningModeANC' type='b' access='read'/>"
@@ -43,9 +48,11 @@ static const gchar introspection_xml[] =
     "    <method name='SetAdaptiveNoiseLevel'>"
     "      <arg type='i' name='level' direction='in'/>"
     "    </method>"
+#if HAVE_MEDIA_CONTROL
     "    <method name='SetEarPauseMode'>"
     "      <arg type='i' name='mode' direction='in'/>"
     "    </method>"
+#endif
     "    <method name='SetListeningModes'>"
     "      <arg type='b' name='off' direction='in'/>"
     "      <arg type='b' name='transparency' direction='in'/>"
@@ -55,6 +62,16 @@ static const gchar introspection_xml[] =
     "    <method name='SetDisplayName'>"
     "      <arg type='s' name='name' direction='in'/>"
     "    </method>"
+    "    <method name='GetStats'>"
+    "      <arg type='s' name='category' direction='in'/>"
+    "      <arg type='a{sv}' name='stats' direction='out'/>"
+    "    </method>"
+#if HAVE_USAGE_STATS
+    "    <method name='GetUsage'>"
+    "      <arg type='s' name='address' direction='in'/>"
+    "      <arg type='aa{sv}' name='days' direction='out'/>"
+    "    </method>"
+#endif
     "    <signal name='DeviceConnected'>"
     "      <arg type='s' name='address'/>"
     "      <arg type='s' name='name'/>"
@@ -83,6 +100,7 @@ struct DbusService {
     GDBusNodeInfo *introspection_data;
     guint registration_id;
     guint bus_name_id;
+    GBusType bus_type;
 
     AirPodsState *state;
 
@@ -103,8 +121,62 @@ struct DbusService {
 
     DbusDisplayNameCallback display_name_callback;
     void *display_name_user_data;
+
+    DbusStatsCallback stats_callback;
+    void *stats_user_data;
+
+    DbusUsageCallback usage_callback;
+    void *usage_user_data;
+
+    DbusAuthorizeCallback authorize_callback;
+    void *authorize_user_data;
+
+    /* With an authorize callback, signals go only to clients that have
+     * talked to us and are allowed at the time of emission */
+    GHashTable *clients;        /* unique name -> name watch ID */
 };
 
+static void on_client_vanished(GDBusConnection *connection,
+                               const gchar *name,
+                               gpointer user_data)
+{
+    (void)connection;
+    DbusService *service = user_data;
+    g_hash_table_remove(service->clients, name);
+}
+
+static void unwatch_client(gpointer data)
+{
+    g_bus_unwatch_name(GPOINTER_TO_UINT(data));
+}
+
+/* Remember a client so it receives signals while it is authorized */
+static void track_client(DbusService *service, const gchar *sender)
+{
+    if (service->connection == NULL || g_hash_table_contains(service->clients, sender)) {
+        return;
+    }
+
+    guint watch_id = g_bus_watch_name_on_connection(service->connection, sender,
+                                                    G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                                    NULL, on_client_vanished,
+                                                    service, NULL);
+    g_hash_table_insert(service->clients, g_strdup(sender), GUINT_TO_POINTER(watch_id));
+}
+
+static bool is_authorized(DbusService *service, const gchar *sender)
+{
+    /* Internal lookups (e.g. for PropertiesChanged) have no sender */
+    if (sender == NULL || service->authorize_callback == NULL) {
+        return true;
+    }
+
+    /* Denied clients are kept too: they get signals once their session
+     * becomes active again */
+    track_client(service, sender);
+    return service->authorize_callback(sender, service->authorize_user_data);
+}
+
 static GVariant *get_property(GDBusConnection *connection,
                                const gchar *sender,
                                const gchar *object_path,
@@ -116,6 +188,17 @@ static GVariant *get_property(GDBusConnection *connection,
     DbusService *service = user_data;
     AirPodsState *state = service->state;
 
+    /* Internal lookups for PropertiesChanged have no sender */
+    if (sender != NULL) {
+        wakeup_stats_count(WAKEUP_DBUS_PROPERTY);
+    }
+
+    if (!is_authorized(service, sender)) {
+        g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_ACCESS_DENIED,
+                    "Access denied for this seat");
+        return NULL;
+    }
+
     g_mutex_lock(&state->lock);
 
     GVariant *result = NULL;
@@ -125,7 +208,9 @@ static GVariant *get_property(GDBusConnection *connection,
     } else if (g_strcmp0(property_name, "DeviceName") == 0) {
         result = g_variant_new_string(state->device_name ? state->device_name : "");
     } else if (g_strcmp0(property_name, "DeviceAddress") == 0) {
-        result = g_variant_new_string(state->device_address ? state->device_address : "");
+        char address[BT_ADDR_STRLEN];
+        result = g_variant_new_string(bt_addr_is_null(&state->device_address)
+                                      ? "" : bt_addr_to_string(&state->device_address, address));
     } else if (g_strcmp0(property_name, "DeviceModel") == 0) {
         result = g_variant_new_string(airpods_model_to_string(state->model));
     } else if (g_strcmp0(property_name, "DisplayName") == 0) {
@@ -186,6 +271,16 @@ static void handle_method_call(GDBusConnection *connection,
 {
     DbusService *service = user_data;
 
+    wakeup_stats_count(WAKEUP_DBUS_METHOD);
+
+    if (!is_authorized(service, sender)) {
+        g_dbus_method_invocation_return_error(invocation,
+                                               G_DBUS_ERROR,
+                                               G_DBUS_ERROR_ACCESS_DENIED,
+                                               "Access denied for this seat");
+        return;
+    }
+
     if (g_strcmp0(method_name, "SetNoiseControlMode") == 0) {
         const gchar *mode_str = NULL;
         g_variant_get(parameters, "(&s)", &mode_str);
@@ -264,6 +359,46 @@ static void handle_method_call(GDBusConnection *connection,
 
         g_dbus_method_invocation_return_value(invocation, NULL);
 
+    } else if (g_strcmp0(method_name, "GetStats") == 0) {
+        const gchar *category = NULL;
+        g_variant_get(parameters, "(&s)", &category);
+
+        GVariant *stats = NULL;
+        if (service->stats_callback) {
+            stats = service->stats_callback(category, service->stats_user_data);
+        }
+
+        if (stats == NULL) {
+            g_dbus_method_invocation_return_error(invocation,
+                                                   G_DBUS_ERROR,
+                                                   G_DBUS_ERROR_INVALID_ARGS,
+                                                   "Unknown statistics category: %s",
+                                                   category);
+            return;
+        }
+
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(@a{sv})", stats));
+
+    } else if (g_strcmp0(method_name, "GetUsage") == 0) {
+        const gchar *address = NULL;
+        g_variant_get(parameters, "(&s)", &address);
+
+        GVariant *usage = NULL;
+        if (service->usage_callback) {
+            usage = service->usage_callback(address, service->usage_user_data);
+        }
+
+        if (usage == NULL) {
+            g_dbus_method_invocation_return_error(invocation,
+                                                   G_DBUS_ERROR,
+                                                   G_DBUS_ERROR_INVALID_ARGS,
+                                                   "Invalid device address: %s",
+                                                   address);
+            return;
+        }
+
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(@aa{sv})", usage));
+
     } else {
         g_dbus_method_invocation_return_error(invocation,
                                                G_DBUS_ERROR,
@@ -320,16 +455,19 @@ static void on_name_lost(GDBusConnection *connection,
     g_warning("D-Bus name lost: %s", name);
 }
 
-DbusService *dbus_service_new(AirPodsState *state)
+DbusService *dbus_service_new(AirPodsState *state, GBusType bus_type)
 {
     DbusService *service = g_new0(DbusService, 1);
     service->state = state;
+    service->bus_type = bus_type;
+    service->clients = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, unwatch_client);
 
     GError *error = NULL;
     service->introspection_data = g_dbus_node_info_new_for_xml(introspection_xml, &error);
     if (error) {
         g_warning("Failed to parse introspection XML: %s", error->message);
         g_error_free(error);
+        g_hash_table_destroy(service->clients);
         g_free(service);
         return NULL;
     }
@@ -347,13 +485,14 @@ void dbus_service_free(DbusService *service)
     if (service->introspection_data)
         g_dbus_node_info_unref(service->introspection_data);
 
+    g_hash_table_destroy(service->clients);
     g_free(service);
 }
 
 bool dbus_service_start(DbusService *service)
 {
     service->bus_name_id = g_bus_own_name(
-        G_BUS_TYPE_SESSION,
+        service->bus_type,
         DBUS_SERVICE_NAME,
         G_BUS_NAME_OWNER_FLAGS_NONE,
         on_bus_acquired,
@@ -378,6 +517,8 @@ void dbus_service_stop(DbusService *service)
         service->bus_name_id = 0;
     }
 
+    g_hash_table_remove_all(service->clients);
+
     if (service->connection) {
         g_object_unref(service->connection);
         service->connection = NULL;
@@ -432,19 +573,40 @@ void dbus_service_set_display_name_callback(DbusService *service,
     service->display_name_user_data = user_data;
 }
 
-static void emit_signal(DbusService *service,
-                         const char *signal_name,
-                         GVariant *parameters)
+void dbus_service_set_stats_callback(DbusService *service,
+                                      DbusStatsCallback callback,
+                                      void *user_data)
 {
-    if (service->connection == NULL)
-        return;
+    service->stats_callback = callback;
+    service->stats_user_data = user_data;
+}
+
+void dbus_service_set_usage_callback(DbusService *service,
+                                      DbusUsageCallback callback,
+                                      void *user_data)
+{
+    service->usage_callback = callback;
+    service->usage_user_data = user_data;
+}
 
+void dbus_service_set_authorize_callback(DbusService *service,
+                                          DbusAuthorizeCallback callback,
+                                          void *user_data)
+{
+    service->authorize_callback = callback;
+    service->authorize_user_data = user_data;
+}
+
+static void emit_to(DbusService *service, const char *destination,
+                    const char *interface_name, const char *signal_name,
+                    GVariant *parameters)
+{
     GError *error = NULL;
     g_dbus_connection_emit_signal(
         service->connection,
-        NULL,  /* Broadcast to all listeners */
+        destination,
         DBUS_OBJECT_PATH,
-        DBUS_INTERFACE_NAME,
+        interface_name,
         signal_name,
         parameters,
         &error
@@ -456,20 +618,61 @@ static void emit_signal(DbusService *service,
     }
 }
 
+/* Broadcast, or with an authorize callback (system bus) send one unicast
+ * copy to each client that is currently allowed; device state must not
+ * reach users on other seats */
+static void emit_filtered(DbusService *service, const char *interface_name,
+                          const char *signal_name, GVariant *parameters)
+{
+    if (service->connection == NULL) {
+        g_variant_unref(g_variant_ref_sink(parameters));
+        return;
+    }
+
+    if (service->authorize_callback == NULL) {
+        emit_to(service, NULL, interface_name, signal_name, parameters);
+        return;
+    }
+
+    g_variant_ref_sink(parameters);
+
+    GHashTableIter iter;
+    gpointer name;
+    g_hash_table_iter_init(&iter, service->clients);
+    while (g_hash_table_iter_next(&iter, &name, NULL)) {
+        if (service->authorize_callback(name, service->authorize_user_data)) {
+            emit_to(service, name, interface_name, signal_name, parameters);
+        }
+    }
+
+    g_variant_unref(parameters);
+}
+
+static void emit_signal(DbusService *service,
+                         const char *signal_name,
+                         GVariant *parameters)
+{
+    emit_filtered(service, DBUS_INTERFACE_NAME, signal_name, parameters);
+}
+
 void dbus_service_emit_device_connected(DbusService *service,
-                                         const char *address,
+                                         const BtAddr *address,
                                          const char *name)
 {
+    char address_str[BT_ADDR_STRLEN];
     emit_signal(service, "DeviceConnected",
-                g_variant_new("(ss)", address ? address : "", name ? name : ""));
+                g_variant_new("(ss)", bt_addr_to_string(address, address_str),
+                              name ? name : ""));
 }
 
 void dbus_service_emit_device_disconnected(DbusService *service,
-                                            const char *address,
+                                            const BtAddr *address,
                                             const char *name)
 {
+    char address_str[BT_ADDR_STRLEN];
     emit_signal(service, "DeviceDisconnected",
-                g_variant_new("(ss)", address ? address : "", name ? name : ""));
+                g_variant_new("(ss)", bt_addr_to_string(address, address_str),
+                              name ? name : ""));
 }
 
 void dbus_service_emit_battery_changed(DbusService *service,
@@ -511,22 +714,9 @@ void dbus_service_emit_properties_changed(DbusService *service,
     g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
     g_variant_builder_add(&builder, "{sv}", property_name, prop_value);
 
-    GError *error = NULL;
-    g_dbus_connection_emit_signal(
-        service->connection,
-        NULL,
-        DBUS_OBJECT_PATH,
-        "org.freedesktop.DBus.Properties",
-        "PropertiesChanged",
-        g_variant_new("(sa{sv}as)",
-                      DBUS_INTERFACE_NAME,
-                      &builder,
-                      NULL),
-        &error
-    );
-
-    if (error) {
-        g_warning("Failed to emit PropertiesChanged: %s", error->message);
-        g_error_free(error);
-    }
+    emit_filtered(service, "org.freedesktop.DBus.Properties", "PropertiesChanged",
+                  g_variant_new("(sa{sv}as)",
+                                DBUS_INTERFACE_NAME,
+                                &builder,
+                                NULL));
 }
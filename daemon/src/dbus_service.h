@@ -35,6 +35,17 @@ typedef void (*DbusListeningModesCallback)(bool off, bool transparency, bool anc
 /* Callback for display name change request */
 typedef void (*DbusDisplayNameCallback)(const char *name, void *user_data);
 
+/* Callback returning an a{sv} dictionary of runtime statistics for a
+ * category, or NULL if the category is unknown */
+typedef GVariant *(*DbusStatsCallback)(const char *category, void *user_data);
+
+/* Callback returning per-day usage (aa{sv}) of a device, or NULL if the
+ * address is invalid; an empty address means the connected device */
+typedef GVariant *(*DbusUsageCallback)(const char *address, void *user_data);
+
+/* Callback deciding whether a client may access the service */
+typedef bool (*DbusAuthorizeCallback)(const char *sender, void *user_data);
+
 /* D-Bus service context */
 typedef struct DbusService DbusService;
 
@@ -42,9 +53,10 @@ typedef struct DbusService DbusService;
  * Create a new D-Bus service
  *
  * @param state Pointer to AirPods state (must remain valid)
+ * @param bus_type Bus to own the service name on (session or system)
  * @return New service or NULL on error
  */
-DbusService *dbus_service_new(AirPodsState *state);
+DbusService *dbus_service_new(AirPodsState *state, GBusType bus_type);
 
 /**
  * Free D-Bus service
@@ -105,18 +117,42 @@ void dbus_service_set_display_name_callback(DbusService *service,
                                              DbusDisplayNameCallback callback,
                                              void *user_data);
 
+/**
+ * Set callback providing statistics for the GetStats method
+ */
+void dbus_service_set_stats_callback(DbusService *service,
+                                      DbusStatsCallback callback,
+                                      void *user_data);
+
+/**
+ * Set callback providing per-day usage for the GetUsage method
+ */
+void dbus_service_set_usage_callback(DbusService *service,
+                                      DbusUsageCallback callback,
+                                      void *user_data);
+
+/**
+ * Set callback used to authorize method calls and property reads
+ * Without a callback every client is allowed and signals are broadcast.
+ * With one, signals are sent only to clients that have called the service
+ * and are allowed when the signal is emitted.
+ */
+void dbus_service_set_authorize_callback(DbusService *service,
+                                          DbusAuthorizeCallback callback,
+                                          void *user_data);
+
 /**
  * Emit DeviceConnected signal
  */
 void dbus_service_emit_device_connected(DbusService *service,
-                                         const char *address,
+                                         const BtAddr *address,
                                          const char *name);
 
 /**
  * Emit DeviceDisconnected signal
  */
 void dbus_service_emit_device_disconnected(DbusService *service,
-                                            const char *address,
+                                            const BtAddr *address,
                                             const char *name);
 
 /**
@@ -0,0 +1,135 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ */
+
+#include "event_bus.h"
+#include "histogram.h"
+
+#include <time.h>
+
+#define ROUTE_END G_MAXUINT8
+
+static const char *type_names[AAP_PKT_TYPE_COUNT] = {
+    [AAP_PKT_TYPE_UNKNOWN]         = "Unknown",
+    [AAP_PKT_TYPE_BATTERY]         = "Battery",
+    [AAP_PKT_TYPE_EAR_DETECTION]   = "EarDetection",
+    [AAP_PKT_TYPE_NOISE_CONTROL]   = "NoiseControl",
+    [AAP_PKT_TYPE_CONV_AWARENESS]  = "ConversationalAwareness",
+    [AAP_PKT_TYPE_CA_DETECTION]    = "CaDetection",
+    [AAP_PKT_TYPE_METADATA]        = "Metadata",
+    [AAP_PKT_TYPE_LISTENING_MODES] = "ListeningModes",
+};
+
+struct EventBus {
+    const EventSubscriber *subscribers;
+    guint n_subscribers;
+    void *user_data;
+
+    /* Subscriber indices per type in priority order, ROUTE_END terminated */
+    guint8 routes[AAP_PKT_TYPE_COUNT][EVENT_MAX_SUBSCRIBERS + 1];
+
+    /* Dispatch cost, in nanoseconds since handlers are mostly sub-µs */
+    guint64 published[AAP_PKT_TYPE_COUNT];
+    Log2Histogram dispatch_ns[AAP_PKT_TYPE_COUNT];
+    Log2Histogram handler_ns[EVENT_MAX_SUBSCRIBERS];
+};
+
+static guint64 now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (guint64)ts.tv_sec * G_GUINT64_CONSTANT(1000000000) + ts.tv_nsec;
+}
+
+EventBus *event_bus_new(const EventSubscriber *subscribers, guint n_subscribers,
+                        void *user_data)
+{
+    if (n_subscribers > EVENT_MAX_SUBSCRIBERS) {
+        g_warning("Too many event subscribers: %u", n_subscribers);
+        return NULL;
+    }
+
+    EventBus *bus = g_new0(EventBus, 1);
+    bus->subscribers = subscribers;
+    bus->n_subscribers = n_subscribers;
+    bus->user_data = user_data;
+
+    /* Subscriber order sorted by priority, ties keep table order */
+    guint8 order[EVENT_MAX_SUBSCRIBERS];
+    for (guint i = 0; i < n_subscribers; i++) {
+        guint j = i;
+        while (j > 0 && subscribers[order[j - 1]].priority > subscribers[i].priority) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = (guint8)i;
+    }
+
+    for (guint type = 0; type < AAP_PKT_TYPE_COUNT; type++) {
+        guint n = 0;
+        for (guint i = 0; i < n_subscribers; i++) {
+            if (subscribers[order[i]].mask & EVENT_MASK(type)) {
+                bus->routes[type][n++] = order[i];
+            }
+        }
+        bus->routes[type][n] = ROUTE_END;
+    }
+
+    return bus;
+}
+
+void event_bus_free(EventBus *bus)
+{
+    g_free(bus);
+}
+
+void event_bus_publish(EventBus *bus, const Event *event)
+{
+    if ((guint)event->type >= AAP_PKT_TYPE_COUNT) {
+        return;
+    }
+
+    guint64 start = now_ns();
+    guint64 last = start;
+
+    for (const guint8 *route = bus->routes[event->type]; *route != ROUTE_END; route++) {
+        bus->subscribers[*route].handler(event, bus->user_data);
+
+        guint64 now = now_ns();
+        log2_histogram_add(&bus->handler_ns[*route], now - last);
+        last = now;
+    }
+
+    bus->published[event->type]++;
+    log2_histogram_add(&bus->dispatch_ns[event->type], last - start);
+}
+
+GVariant *event_bus_get_stats(EventBus *bus)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+
+    GVariantBuilder events;
+    g_variant_builder_init(&events, G_VARIANT_TYPE("a{sv}"));
+    for (guint type = 0; type < AAP_PKT_TYPE_COUNT; type++) {
+        GVariantBuilder event;
+        g_variant_builder_init(&event, G_VARIANT_TYPE("a{sv}"));
+        g_variant_builder_add(&event, "{sv}", "Published",
+                              g_variant_new_uint64(bus->published[type]));
+        g_variant_builder_add(&event, "{sv}", "DispatchNs",
+                              log2_histogram_to_variant(&bus->dispatch_ns[type]));
+        g_variant_builder_add(&events, "{sv}", type_names[type], g_variant_builder_end(&event));
+    }
+    g_variant_builder_add(&builder, "{sv}", "Events", g_variant_builder_end(&events));
+
+    GVariantBuilder subscribers;
+    g_variant_builder_init(&subscribers, G_VARIANT_TYPE("a{sv}"));
+    for (guint i = 0; i < bus->n_subscribers; i++) {
+        g_variant_builder_add(&subscribers, "{sv}", bus->subscribers[i].name,
+                              log2_histogram_to_variant(&bus->handler_ns[i]));
+    }
+    g_variant_builder_add(&builder, "{sv}", "HandlerNs", g_variant_builder_end(&subscribers));
+
+    return g_variant_builder_end(&builder);
+}
@@ -0,0 +1,73 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * Dispatch of received AAP packets to their consumers
+ */
+
+#ifndef EVENT_BUS_H
+#define EVENT_BUS_H
+
+#include <glib.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "aap_protocol.h"
+
+/* Subscribers per bus */
+#define EVENT_MAX_SUBSCRIBERS 16
+
+/* Event mask bit for a packet type */
+#define EVENT_MASK(type) (1u << (type))
+
+/* A received packet; only valid during dispatch, nothing is copied */
+typedef struct {
+    AapPacketType type;
+    const AapParsedPacket *packet;  /* NULL if the opcode is unknown */
+    const uint8_t *data;            /* Raw frame */
+    size_t len;
+} Event;
+
+typedef void (*EventHandler)(const Event *event, void *user_data);
+
+/* A consumer of events, usually from a static table */
+typedef struct {
+    const char *name;
+    guint32 mask;       /* EVENT_MASK() of the types it wants */
+    int priority;       /* Lower runs first */
+    EventHandler handler;
+} EventSubscriber;
+
+/* Event bus context */
+typedef struct EventBus EventBus;
+
+/**
+ * Create an event bus for a fixed set of subscribers
+ *
+ * Routes are computed once: publishing only walks the subscribers of
+ * the event's type, in priority order.
+ *
+ * @param subscribers Subscriber table, must outlive the bus
+ * @param n_subscribers Number of subscribers (at most EVENT_MAX_SUBSCRIBERS)
+ * @param user_data Passed to every handler
+ * @return New event bus, or NULL if there are too many subscribers
+ */
+EventBus *event_bus_new(const EventSubscriber *subscribers, guint n_subscribers,
+                        void *user_data);
+
+/**
+ * Free event bus
+ */
+void event_bus_free(EventBus *bus);
+
+/**
+ * Deliver an event to its subscribers
+ */
+void event_bus_publish(EventBus *bus, const Event *event);
+
+/**
+ * Get events per type and dispatch time per subscriber as a{sv}
+ */
+GVariant *event_bus_get_stats(EventBus *bus);
+
+#endif /* EVENT_BUS_H */
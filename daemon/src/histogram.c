@@ -0,0 +1,38 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ */
+
+#include "histogram.h"
+
+void log2_histogram_add(Log2Histogram *histogram, guint64 value)
+{
+    guint bucket = value == 0 ? 0 : g_bit_storage(value);
+
+    histogram->buckets[MIN(bucket, HISTOGRAM_BUCKETS - 1)]++;
+    histogram->count++;
+    histogram->sum += value;
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+GVariant *log2_histogram_to_variant(const Log2Histogram *histogram)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+
+    g_variant_builder_add(&builder, "{sv}", "Buckets",
+                          g_variant_new_fixed_array(G_VARIANT_TYPE_UINT32,
+                                                    histogram->buckets,
+                                                    HISTOGRAM_BUCKETS,
+                                                    sizeof(guint32)));
+    g_variant_builder_add(&builder, "{sv}", "Count", g_variant_new_uint64(histogram->count));
+    g_variant_builder_add(&builder, "{sv}", "Mean",
+                          g_variant_new_double(histogram->count > 0
+                                               ? (double)histogram->sum / histogram->count
+                                               : 0.0));
+    g_variant_builder_add(&builder, "{sv}", "Max", g_variant_new_uint64(histogram->max));
+
+    return g_variant_builder_end(&builder);
+}
@@ -0,0 +1,33 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * Fixed-size log2 histograms for latency statistics
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <glib.h>
+
+/* Bucket n counts values in [2^(n-1), 2^n), bucket 0 counts zeros */
+#define HISTOGRAM_BUCKETS 24
+
+typedef struct {
+    guint32 buckets[HISTOGRAM_BUCKETS];
+    guint64 count;
+    guint64 sum;
+    guint64 max;
+} Log2Histogram;
+
+/**
+ * Record one value (unit is up to the caller)
+ */
+void log2_histogram_add(Log2Histogram *histogram, guint64 value);
+
+/**
+ * Get histogram as a{sv} with Buckets, Count, Mean and Max
+ */
+GVariant *log2_histogram_to_variant(const Log2Histogram *histogram);
+
+#endif /* HISTOGRAM_H */
@@ -11,14 +11,47 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 
+#include "build-config.h"
 #include "airpods_state.h"
 #include "aap_protocol.h"
 #include "bluetooth.h"
 #include "bluez_monitor.h"
 #include "config.h"
 #include "dbus_service.h"
+#include "seat_policy.h"
+#include "stall_detector.h"
+#include "wakeup_stats.h"
+#include "histogram.h"
+#include "event_bus.h"
+#if HAVE_MEDIA_CONTROL
 #include "media_control.h"
+#endif
+#if HAVE_PERSISTENCE
+#include "config_monitor.h"
+#endif
+#if HAVE_SUSPEND_HANDLING
+#include "sleep_monitor.h"
+#endif
+#if HAVE_PACKET_SAMPLER
+#include "packet_sampler.h"
+#endif
+#if HAVE_USAGE_STATS
+#include "usage_stats.h"
+#endif
+
+/* State directory of the system-wide daemon (overridden by systemd) */
+#define SYSTEM_STATE_DIR "/var/lib/librepods"
+
+/* Resume fast path: re-check BlueZ this often until the link is back */
+#define RESUME_RECHECK_INTERVAL_MS 1000
+#define RESUME_RECHECK_MAX_ATTEMPTS 5
+
+/* Non-urgent timers may fire this late, so they can share wakeups */
+#define TIMER_SLACK_MS 1000
 
 /* Global application state */
 typedef struct {
@@ -27,162 +60,159 @@ typedef struct {
     BluetoothConnection *bt_conn;
     BluezMonitor *bluez_monitor;
     DbusService *dbus_service;
+    StallDetector *stall_detector;
+    EventBus *event_bus;
+#if HAVE_MEDIA_CONTROL
     MediaControl *media_control;
+#endif
+#if HAVE_PERSISTENCE
+    ConfigMonitor *config_monitor;
+#endif
+#if HAVE_SUSPEND_HANDLING
+    SleepMonitor *sleep_monitor;
+#endif
+#if HAVE_PACKET_SAMPLER
+    PacketSampler *packet_sampler;
+#endif
+#if HAVE_USAGE_STATS
+    UsageStats *usage_stats;
+#endif
     LibrePodsConfig config;
 
+    /* System-wide mode */
+    gboolean system_mode;
+    SeatPolicy *seat_policy;
+    char device_seat[32];  /* Seat allowed to use the connected device */
+
     /* Pending connect info */
-    char *pending_address;
+    BtAddr pending_address;
     char *pending_name;
+    char *pending_adapter;      /* Adapter object path used for the connect */
+    gint64 connect_started_us;
 
     /* Reconnection */
     guint reconnect_timeout_id;
     int reconnect_attempts;
+    guint apply_settings_timeout_id;
+
+    /* Suspend/resume */
+    BtAddr resume_address;      /* Device connected when the system went to sleep */
+    gint64 resume_started_us;   /* 0 once the link is ready again */
+    guint suspend_count;
+    guint resume_ready_count;
+    gint64 resume_ready_last_us;
+    gint64 resume_ready_total_us;
+
+    gint64 started_us;
+    gint64 startup_us;          /* Process start to main loop */
+
+    /* Connection lifecycle accounting */
+    guint connect_cycles;
+    guint disconnect_cycles;
+    Log2Histogram connect_us;   /* Connect attempt to link up */
 } AppContext;
 
 static AppContext app = {0};
 
 /* Forward declarations */
-static void connect_to_airpods(const char *address, const char *name);
+static void connect_to_airpods(const BtAddr *address, const char *name,
+                               const BluezAdapterInfo *adapter);
 static void disconnect_from_airpods(void);
-static void apply_device_profile(const char *address);
+static void apply_device_profile(const BtAddr *address);
 static gboolean apply_saved_settings_idle(gpointer user_data);
+#if HAVE_SUSPEND_HANDLING
+static void note_resume_ready(void);
+#endif
 
 /* ============================================================================
  * Bluetooth data handling
  * ========================================================================== */
 
-static void on_bt_data_received(const uint8_t *data, size_t len, void *user_data)
+/* Keeps the daemon's own state current; runs before everything else */
+static void update_state(const Event *event, void *user_data)
 {
     (void)user_data;
+    const AapParsedPacket *packet = event->packet;
 
-    AapParsedPacket packet;
-    AapParseResult result = aap_parse_packet(data, len, &packet);
-
-    if (result != AAP_PARSE_OK) {
-        if (result != AAP_PARSE_UNKNOWN_OPCODE) {
-            g_debug("Failed to parse packet: %d", result);
-        }
-        return;
-    }
-
-    switch (packet.type) {
+    switch (event->type) {
     case AAP_PKT_TYPE_BATTERY:
         g_message("Battery: L=%d%% (status=%d) R=%d%% (status=%d) Case=%d%% (status=%d)",
-                  packet.data.battery.left_level,
-                  packet.data.battery.left_status,
-                  packet.data.battery.right_level,
-                  packet.data.battery.right_status,
-                  packet.data.battery.case_level,
-                  packet.data.battery.case_status);
+                  packet->data.battery.left_level,
+                  packet->data.battery.left_status,
+                  packet->data.battery.right_level,
+                  packet->data.battery.right_status,
+                  packet->data.battery.case_level,
+                  packet->data.battery.case_status);
 
         airpods_state_set_battery(&app.state,
-                                   packet.data.battery.left_level,
-                                   packet.data.battery.left_status,
-                                   packet.data.battery.right_level,
-                                   packet.data.battery.right_status,
-                                   packet.data.battery.case_level,
-                                   packet.data.battery.case_status);
-
-        dbus_service_emit_battery_changed(app.dbus_service,
-                                           packet.data.battery.left_level,
-                                           packet.data.battery.right_level,
-                                           packet.data.battery.case_level);
-        dbus_service_emit_properties_changed(app.dbus_service, "BatteryLeft");
-        dbus_service_emit_properties_changed(app.dbus_service, "BatteryRight");
-        dbus_service_emit_properties_changed(app.dbus_service, "BatteryCase");
-        dbus_service_emit_properties_changed(app.dbus_service, "ChargingLeft");
-        dbus_service_emit_properties_changed(app.dbus_service, "ChargingRight");
-        dbus_service_emit_properties_changed(app.dbus_service, "ChargingCase");
+                                   packet->data.battery.left_level,
+                                   packet->data.battery.left_status,
+                                   packet->data.battery.right_level,
+                                   packet->data.battery.right_status,
+                                   packet->data.battery.case_level,
+                                   packet->data.battery.case_status);
         break;
 
     case AAP_PKT_TYPE_EAR_DETECTION:
         g_message("Ear detection: primary=%s secondary=%s",
-                  packet.data.ear_detection.primary_in_ear ? "in" : "out",
-                  packet.data.ear_detection.secondary_in_ear ? "in" : "out");
+                  packet->data.ear_detection.primary_in_ear ? "in" : "out",
+                  packet->data.ear_detection.secondary_in_ear ? "in" : "out");
 
         airpods_state_set_ear_detection(&app.state,
-                                         packet.data.ear_detection.primary_in_ear,
-                                         packet.data.ear_detection.secondary_in_ear,
-                                         packet.data.ear_detection.primary_left);
-
-        dbus_service_emit_ear_detection_changed(app.dbus_service,
-                                                 app.state.ear_detection.left_in_ear,
-                                                 app.state.ear_detection.right_in_ear);
-        dbus_service_emit_properties_changed(app.dbus_service, "LeftInEar");
-        dbus_service_emit_properties_changed(app.dbus_service, "RightInEar");
-
-        /* Trigger media pause/resume based on ear detection */
-        if (app.media_control) {
-            media_control_on_ear_detection_changed(app.media_control,
-                                                    app.state.ear_detection.left_in_ear,
-                                                    app.state.ear_detection.right_in_ear);
-        }
+                                         packet->data.ear_detection.primary_in_ear,
+                                         packet->data.ear_detection.secondary_in_ear,
+                                         packet->data.ear_detection.primary_left);
         break;
 
     case AAP_PKT_TYPE_NOISE_CONTROL:
         g_message("Noise control mode: %s",
-                  noise_control_mode_to_string(packet.data.noise_control));
+                  noise_control_mode_to_string(packet->data.noise_control));
 
-        airpods_state_set_noise_control(&app.state, packet.data.noise_control);
-
-        dbus_service_emit_noise_control_changed(app.dbus_service,
-                                                 packet.data.noise_control);
-        dbus_service_emit_properties_changed(app.dbus_service, "NoiseControlMode");
+        airpods_state_set_noise_control(&app.state, packet->data.noise_control);
         break;
 
     case AAP_PKT_TYPE_CONV_AWARENESS:
         g_message("Conversational awareness: %s",
-                  packet.data.conversational_awareness ? "enabled" : "disabled");
+                  packet->data.conversational_awareness ? "enabled" : "disabled");
 
         airpods_state_set_conversational_awareness(&app.state,
-                                                    packet.data.conversational_awareness);
-
-        dbus_service_emit_properties_changed(app.dbus_service, "ConversationalAwareness");
+                                                    packet->data.conversational_awareness);
         break;
 
     case AAP_PKT_TYPE_CA_DETECTION:
-        g_debug("CA detection event: volume_level=%d", packet.data.ca_volume_level);
+        g_debug("CA detection event: volume_level=%d", packet->data.ca_volume_level);
         break;
 
     case AAP_PKT_TYPE_LISTENING_MODES:
         g_message("Listening modes: off=%s transparency=%s anc=%s adaptive=%s (raw=0x%02X)",
-                  packet.data.listening_modes.off_enabled ? "on" : "off",
-                  packet.data.listening_modes.transparency_enabled ? "on" : "off",
-                  packet.data.listening_modes.anc_enabled ? "on" : "off",
-                  packet.data.listening_modes.adaptive_enabled ? "on" : "off",
-                  packet.data.listening_modes.raw_value);
+                  packet->data.listening_modes.off_enabled ? "on" : "off",
+                  packet->data.listening_modes.transparency_enabled ? "on" : "off",
+                  packet->data.listening_modes.anc_enabled ? "on" : "off",
+                  packet->data.listening_modes.adaptive_enabled ? "on" : "off",
+                  packet->data.listening_modes.raw_value);
 
         airpods_state_set_listening_modes(&app.state,
-                                           packet.data.listening_modes.off_enabled,
-                                           packet.data.listening_modes.transparency_enabled,
-                                           packet.data.listening_modes.anc_enabled,
-                                           packet.data.listening_modes.adaptive_enabled);
-
-        dbus_service_emit_properties_changed(app.dbus_service, "ListeningModeOff");
-        dbus_service_emit_properties_changed(app.dbus_service, "ListeningModeTransparency");
-        dbus_service_emit_properties_changed(app.dbus_service, "ListeningModeANC");
-        dbus_service_emit_properties_changed(app.dbus_service, "ListeningModeAdaptive");
+                                           packet->data.listening_modes.off_enabled,
+                                           packet->data.listening_modes.transparency_enabled,
+                                           packet->data.listening_modes.anc_enabled,
+                                           packet->data.listening_modes.adaptive_enabled);
         break;
 
     case AAP_PKT_TYPE_METADATA:
         g_message("Metadata received: device='%s' model='%s' manufacturer='%s'",
-                  packet.data.metadata.device_name,
-                  packet.data.metadata.model_number,
-                  packet.data.metadata.manufacturer);
+                  packet->data.metadata.device_name,
+                  packet->data.metadata.model_number,
+                  packet->data.metadata.manufacturer);
 
         /* Update model from model number */
         {
-            AirPodsModel detected_model = airpods_model_from_number(packet.data.metadata.model_number);
+            AirPodsModel detected_model = airpods_model_from_number(packet->data.metadata.model_number);
             if (detected_model != AIRPODS_MODEL_UNKNOWN) {
                 g_mutex_lock(&app.state.lock);
                 app.state.model = detected_model;
                 g_mutex_unlock(&app.state.lock);
 
                 g_message("Detected AirPods model: %s", airpods_model_to_string(detected_model));
-                dbus_service_emit_properties_changed(app.dbus_service, "DeviceModel");
-                dbus_service_emit_properties_changed(app.dbus_service, "IsHeadphones");
-                dbus_service_emit_properties_changed(app.dbus_service, "SupportsANC");
-                dbus_service_emit_properties_changed(app.dbus_service, "SupportsAdaptive");
             }
         }
         break;
@@ -192,6 +222,182 @@ static void on_bt_data_received(const uint8_t *data, size_t len, void *user_data
     }
 }
 
+/* Tells D-Bus clients what changed, from the updated state */
+static void emit_changes(const Event *event, void *user_data)
+{
+    (void)user_data;
+    const AapParsedPacket *packet = event->packet;
+
+    switch (event->type) {
+    case AAP_PKT_TYPE_BATTERY:
+        dbus_service_emit_battery_changed(app.dbus_service,
+                                           packet->data.battery.left_level,
+                                           packet->data.battery.right_level,
+                                           packet->data.battery.case_level);
+        dbus_service_emit_properties_changed(app.dbus_service, "BatteryLeft");
+        dbus_service_emit_properties_changed(app.dbus_service, "BatteryRight");
+        dbus_service_emit_properties_changed(app.dbus_service, "BatteryCase");
+        dbus_service_emit_properties_changed(app.dbus_service, "ChargingLeft");
+        dbus_service_emit_properties_changed(app.dbus_service, "ChargingRight");
+        dbus_service_emit_properties_changed(app.dbus_service, "ChargingCase");
+        break;
+
+    case AAP_PKT_TYPE_EAR_DETECTION:
+        dbus_service_emit_ear_detection_changed(app.dbus_service,
+                                                 app.state.ear_detection.left_in_ear,
+                                                 app.state.ear_detection.right_in_ear);
+        dbus_service_emit_properties_changed(app.dbus_service, "LeftInEar");
+        dbus_service_emit_properties_changed(app.dbus_service, "RightInEar");
+        break;
+
+    case AAP_PKT_TYPE_NOISE_CONTROL:
+        dbus_service_emit_noise_control_changed(app.dbus_service,
+                                                 packet->data.noise_control);
+        dbus_service_emit_properties_changed(app.dbus_service, "NoiseControlMode");
+        break;
+
+    case AAP_PKT_TYPE_CONV_AWARENESS:
+        dbus_service_emit_properties_changed(app.dbus_service, "ConversationalAwareness");
+        break;
+
+    case AAP_PKT_TYPE_LISTENING_MODES:
+        dbus_service_emit_properties_changed(app.dbus_service, "ListeningModeOff");
+        dbus_service_emit_properties_changed(app.dbus_service, "ListeningModeTransparency");
+        dbus_service_emit_properties_changed(app.dbus_service, "ListeningModeANC");
+        dbus_service_emit_properties_changed(app.dbus_service, "ListeningModeAdaptive");
+        break;
+
+    case AAP_PKT_TYPE_METADATA:
+        if (airpods_model_from_number(packet->data.metadata.model_number) != AIRPODS_MODEL_UNKNOWN) {
+            dbus_service_emit_properties_changed(app.dbus_service, "DeviceModel");
+            dbus_service_emit_properties_changed(app.dbus_service, "IsHeadphones");
+            dbus_service_emit_properties_changed(app.dbus_service, "SupportsANC");
+            dbus_service_emit_properties_changed(app.dbus_service, "SupportsAdaptive");
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+#if HAVE_MEDIA_CONTROL
+/* Pause/resume on ear detection, duck on conversational awareness */
+static void control_media(const Event *event, void *user_data)
+{
+    (void)user_data;
+
+    if (app.media_control == NULL) {
+        return;
+    }
+
+    if (event->type == AAP_PKT_TYPE_EAR_DETECTION) {
+        media_control_on_ear_detection_changed(app.media_control,
+                                                app.state.ear_detection.left_in_ear,
+                                                app.state.ear_detection.right_in_ear);
+        return;
+    }
+
+    /* Levels in between keep the current volume */
+    int level = event->packet->data.ca_volume_level;
+    if (level >= 1 && level <= AAP_CA_LEVEL_SPEAKING) {
+        media_control_duck(app.media_control);
+    } else if (level >= AAP_CA_LEVEL_STOPPED) {
+        media_control_restore_volume(app.media_control);
+    }
+}
+#endif
+
+#if HAVE_USAGE_STATS
+static void account_usage(const Event *event, void *user_data)
+{
+    (void)user_data;
+    const AapEarDetectionData *ear = &event->packet->data.ear_detection;
+
+    usage_stats_on_ear_detection(app.usage_stats,
+                                 ear->primary_in_ear, ear->secondary_in_ear,
+                                 ear->primary_in_case, ear->secondary_in_case);
+}
+#endif
+
+#if HAVE_SUSPEND_HANDLING
+/* Fresh battery state is what users wait for after a resume */
+static void check_resume_ready(const Event *event, void *user_data)
+{
+    (void)event;
+    (void)user_data;
+
+    if (app.resume_started_us != 0) {
+        note_resume_ready();
+    }
+}
+#endif
+
+#if HAVE_PACKET_SAMPLER
+static void sample_unknown(const Event *event, void *user_data)
+{
+    (void)user_data;
+
+    if (event->packet == NULL) {
+        packet_sampler_record_opcode(app.packet_sampler, event->data, event->len);
+    } else if (aap_get_opcode(event->data, event->len) == AAP_OPCODE_CONTROL) {
+        packet_sampler_record_control(app.packet_sampler, event->data, event->len);
+    }
+}
+#endif
+
+#define STATE_EVENTS (EVENT_MASK(AAP_PKT_TYPE_BATTERY) | \
+                      EVENT_MASK(AAP_PKT_TYPE_EAR_DETECTION) | \
+                      EVENT_MASK(AAP_PKT_TYPE_NOISE_CONTROL) | \
+                      EVENT_MASK(AAP_PKT_TYPE_CONV_AWARENESS) | \
+                      EVENT_MASK(AAP_PKT_TYPE_CA_DETECTION) | \
+                      EVENT_MASK(AAP_PKT_TYPE_LISTENING_MODES) | \
+                      EVENT_MASK(AAP_PKT_TYPE_METADATA))
+
+/* Packet consumers; the state is updated first so the others can read it */
+static const EventSubscriber packet_subscribers[] = {
+    { "state",    STATE_EVENTS, 0, update_state },
+    { "dbus",     STATE_EVENTS, 10, emit_changes },
+#if HAVE_MEDIA_CONTROL
+    { "media",    EVENT_MASK(AAP_PKT_TYPE_EAR_DETECTION) |
+                  EVENT_MASK(AAP_PKT_TYPE_CA_DETECTION), 20, control_media },
+#endif
+#if HAVE_USAGE_STATS
+    { "usage",    EVENT_MASK(AAP_PKT_TYPE_EAR_DETECTION), 30, account_usage },
+#endif
+#if HAVE_SUSPEND_HANDLING
+    { "resume",   EVENT_MASK(AAP_PKT_TYPE_BATTERY), 40, check_resume_ready },
+#endif
+#if HAVE_PACKET_SAMPLER
+    { "sampler",  EVENT_MASK(AAP_PKT_TYPE_UNKNOWN), 50, sample_unknown },
+#endif
+};
+
+static void on_bt_data_received(const uint8_t *data, size_t len, void *user_data)
+{
+    (void)user_data;
+
+    AapParsedPacket packet;
+    AapParseResult result = aap_parse_packet(data, len, &packet);
+
+    Event event = {
+        .type = AAP_PKT_TYPE_UNKNOWN,
+        .packet = NULL,
+        .data = data,
+        .len = len,
+    };
+
+    if (result == AAP_PARSE_OK) {
+        event.type = packet.type;
+        event.packet = &packet;
+    } else if (result != AAP_PARSE_UNKNOWN_OPCODE) {
+        g_debug("Failed to parse packet: %d", result);
+        return;
+    }
+
+    event_bus_publish(app.event_bus, &event);
+}
+
 static void on_bt_state_changed(BluetoothState state, const char *error, void *user_data)
 {
     (void)user_data;
@@ -200,31 +406,36 @@ static void on_bt_state_changed(BluetoothState state, const char *error, void *u
     case BT_STATE_CONNECTED:
         g_message("Bluetooth connected, sending handshake...");
         app.reconnect_attempts = 0;
+        if (app.reconnect_timeout_id != 0) {
+            g_source_remove(app.reconnect_timeout_id);
+            app.reconnect_timeout_id = 0;
+        }
+
+        bluez_monitor_record_connect_result(app.bluez_monitor, app.pending_adapter, true,
+                                            g_get_monotonic_time() - app.connect_started_us);
+        app.connect_cycles++;
+        log2_histogram_add(&app.connect_us, g_get_monotonic_time() - app.connect_started_us);
 
         /* Attach to main loop for data reception */
         bt_connection_attach_to_mainloop(app.bt_conn, NULL);
 
-        /* Send initialization sequence */
-        g_usleep(100000);  /* 100ms delay */
-        bt_connection_send_handshake(app.bt_conn);
-
-        g_usleep(50000);  /* 50ms delay */
-        bt_connection_send_set_features(app.bt_conn);
-
-        g_usleep(50000);
-        bt_connection_send_request_notifications(app.bt_conn);
+        /* Send initialization sequence, paced by timers */
+        bt_connection_start_handshake(app.bt_conn);
 
         /* Update state */
         airpods_state_set_device(&app.state,
                                   app.pending_name,
-                                  app.pending_address,
+                                  &app.pending_address,
                                   AIRPODS_MODEL_UNKNOWN);  /* Model detected later via metadata */
 
         /* Load and apply saved device profile */
-        apply_device_profile(app.pending_address);
+        apply_device_profile(&app.pending_address);
+#if HAVE_USAGE_STATS
+        usage_stats_start(app.usage_stats, &app.pending_address);
+#endif
 
         dbus_service_emit_device_connected(app.dbus_service,
-                                            app.pending_address,
+                                            &app.pending_address,
                                             app.pending_name);
         dbus_service_emit_properties_changed(app.dbus_service, "Connected");
         dbus_service_emit_properties_changed(app.dbus_service, "DeviceName");
@@ -232,24 +443,59 @@ static void on_bt_state_changed(BluetoothState state, const char *error, void *u
         dbus_service_emit_properties_changed(app.dbus_service, "DisplayName");
 
         /* Schedule sending saved settings after connection stabilizes (500ms delay) */
-        g_timeout_add(500, apply_saved_settings_idle, g_strdup(app.pending_address));
+        if (app.apply_settings_timeout_id != 0) {
+            g_source_remove(app.apply_settings_timeout_id);
+            app.apply_settings_timeout_id = 0;
+        }
+        if (HAVE_PERSISTENCE) {
+            app.apply_settings_timeout_id = wakeup_timeout_add(500, TIMER_SLACK_MS,
+                                                               apply_saved_settings_idle, NULL);
+        }
         break;
 
     case BT_STATE_DISCONNECTED:
         g_message("Bluetooth disconnected");
+        app.disconnect_cycles++;
+
+        /* Settings are for the link that just went away */
+        if (app.apply_settings_timeout_id != 0) {
+            g_source_remove(app.apply_settings_timeout_id);
+            app.apply_settings_timeout_id = 0;
+        }
 
         if (app.state.connected) {
             dbus_service_emit_device_disconnected(app.dbus_service,
-                                                   app.state.device_address,
+                                                   &app.state.device_address,
                                                    app.state.device_name);
+            bluez_monitor_record_disconnect(app.bluez_monitor, app.pending_adapter);
         }
 
+#if HAVE_MEDIA_CONTROL
+        /* No end of conversation will come from a closed link */
+        if (app.media_control) {
+            media_control_restore_volume(app.media_control);
+        }
+#endif
+
+#if HAVE_USAGE_STATS
+        usage_stats_stop(app.usage_stats);
+#endif
+
+#if HAVE_PERSISTENCE
+        if (app.config_monitor) {
+            config_monitor_set_device(app.config_monitor, NULL, NULL);
+        }
+#endif
+
         airpods_state_reset(&app.state);
+        g_strlcpy(app.device_seat, app.config.seat, sizeof(app.device_seat));
         dbus_service_emit_properties_changed(app.dbus_service, "Connected");
         break;
 
     case BT_STATE_ERROR:
         g_warning("Bluetooth error: %s", error ? error : "unknown");
+        bluez_monitor_record_connect_result(app.bluez_monitor, app.pending_adapter, false,
+                                            g_get_monotonic_time() - app.connect_started_us);
         break;
 
     default:
@@ -261,21 +507,36 @@ static void on_bt_state_changed(BluetoothState state, const char *error, void *u
  * Device profile management
  * ========================================================================== */
 
-static void apply_device_profile(const char *address)
+static void apply_device_profile(const BtAddr *address)
 {
-    if (address == NULL || address[0] == '\0') {
+    if (bt_addr_is_null(address)) {
         return;
     }
 
+    char address_str[BT_ADDR_STRLEN];
+    bt_addr_to_string(address, address_str);
+
     DeviceProfile profile;
     bool has_profile = config_load_device_profile(address, &profile);
 
+#if HAVE_PERSISTENCE
+    /* Later edits to the profile are applied from here on */
+    if (app.config_monitor) {
+        config_monitor_set_device(app.config_monitor, address, &profile);
+    }
+#endif
+
+    /* Per-device seat overrides the configured default */
+    g_strlcpy(app.device_seat,
+              profile.seat[0] != '\0' ? profile.seat : app.config.seat,
+              sizeof(app.device_seat));
+
     if (!has_profile || !profile.has_saved_settings) {
-        g_message("No saved profile for device %s, using defaults", address);
+        g_message("No saved profile for device %s, using defaults", address_str);
         return;
     }
 
-    g_message("Applying saved profile for device %s", address);
+    g_message("Applying saved profile for device %s", address_str);
 
     /* Apply display name */
     airpods_state_set_display_name(&app.state, profile.display_name);
@@ -296,16 +557,18 @@ static void apply_device_profile(const char *address)
 
 static gboolean apply_saved_settings_idle(gpointer user_data)
 {
-    const char *address = (const char *)user_data;
+    (void)user_data;
+
+    wakeup_stats_count(WAKEUP_TIMER_APPLY_SETTINGS);
+    app.apply_settings_timeout_id = 0;
 
     if (!app.bt_conn || !bt_connection_is_connected(app.bt_conn)) {
-        g_free((gchar *)address);
         return G_SOURCE_REMOVE;
     }
 
     DeviceProfile profile;
-    if (!config_load_device_profile(address, &profile) || !profile.has_saved_settings) {
-        g_free((gchar *)address);
+    if (!config_load_device_profile(&app.state.device_address, &profile) ||
+        !profile.has_saved_settings) {
         return G_SOURCE_REMOVE;
     }
 
@@ -320,38 +583,152 @@ static gboolean apply_saved_settings_idle(gpointer user_data)
 
     uint8_t packet[AAP_CONTROL_CMD_SIZE];
     aap_build_listening_modes_cmd(modes, packet);
-    bt_connection_send(app.bt_conn, packet, AAP_CONTROL_CMD_SIZE);
+    bt_connection_send_paced(app.bt_conn, 0, packet, AAP_CONTROL_CMD_SIZE);
 
-    /* Send conversational awareness setting */
-    g_usleep(50000);  /* 50ms delay between commands */
+    /* Send conversational awareness setting, 50ms between commands */
     aap_build_conv_awareness_cmd(profile.conversational_awareness, packet);
-    bt_connection_send(app.bt_conn, packet, AAP_CONTROL_CMD_SIZE);
+    bt_connection_send_paced(app.bt_conn, 50, packet, AAP_CONTROL_CMD_SIZE);
 
     /* Send adaptive noise level */
-    g_usleep(50000);
     aap_build_adaptive_level_cmd(profile.adaptive_noise_level, packet);
-    bt_connection_send(app.bt_conn, packet, AAP_CONTROL_CMD_SIZE);
+    bt_connection_send_paced(app.bt_conn, 50, packet, AAP_CONTROL_CMD_SIZE);
 
-    g_free((gchar *)address);
     return G_SOURCE_REMOVE;
 }
 
+#if HAVE_PERSISTENCE
+/* ============================================================================
+ * Live configuration reload
+ * ========================================================================== */
+
+/* Settings edited on disk that the running daemon does not have yet */
+static void on_config_reloaded(const ConfigSnapshot *old, const ConfigSnapshot *new,
+                               void *user_data)
+{
+    (void)user_data;
+
+    if (new->config.ear_pause_mode != old->config.ear_pause_mode &&
+        new->config.ear_pause_mode != app.config.ear_pause_mode) {
+        g_message("Config: ear pause mode %d", new->config.ear_pause_mode);
+        app.config.ear_pause_mode = new->config.ear_pause_mode;
+
+        g_mutex_lock(&app.state.lock);
+        app.state.ear_pause_mode = new->config.ear_pause_mode;
+        g_mutex_unlock(&app.state.lock);
+
+#if HAVE_MEDIA_CONTROL
+        if (app.media_control) {
+            media_control_set_ear_pause_mode(app.media_control,
+                                             (EarPauseMode)new->config.ear_pause_mode);
+        }
+        dbus_service_emit_properties_changed(app.dbus_service, "EarPauseMode");
+#endif
+    }
+
+    if (strcmp(new->config.seat, old->config.seat) != 0) {
+        g_strlcpy(app.config.seat, new->config.seat, sizeof(app.config.seat));
+    }
+
+    if (!app.state.connected) {
+        g_strlcpy(app.device_seat, app.config.seat, sizeof(app.device_seat));
+        return;
+    }
+
+    if (!bt_addr_equal(&new->device, &app.state.device_address)) {
+        return;
+    }
+
+    const DeviceProfile *profile = &new->profile;
+    const char *seat = profile->seat[0] != '\0' ? profile->seat : app.config.seat;
+    if (strcmp(seat, app.device_seat) != 0) {
+        g_message("Config: device now belongs to %s", seat);
+        g_strlcpy(app.device_seat, seat, sizeof(app.device_seat));
+    }
+
+    if (!profile->has_saved_settings) {
+        return;
+    }
+
+    if (strcmp(profile->display_name, old->profile.display_name) != 0) {
+        airpods_state_set_display_name(&app.state, profile->display_name);
+        dbus_service_emit_properties_changed(app.dbus_service, "DisplayName");
+    }
+
+    if (!app.bt_conn || !bt_connection_is_connected(app.bt_conn)) {
+        return;
+    }
+
+    /* Only send what changed in the file and differs from the device */
+    uint8_t packet[AAP_CONTROL_CMD_SIZE];
+    guint delay_ms = 0;
+
+    g_mutex_lock(&app.state.lock);
+    ListeningModesConfig live_modes = app.state.listening_modes;
+    bool live_ca = app.state.conversational_awareness;
+    int live_level = app.state.adaptive_noise_level;
+    g_mutex_unlock(&app.state.lock);
+
+    const ListeningModesConfig *modes = &profile->listening_modes;
+    const ListeningModesConfig *old_modes = &old->profile.listening_modes;
+    bool modes_changed = modes->off_enabled != old_modes->off_enabled ||
+                         modes->transparency_enabled != old_modes->transparency_enabled ||
+                         modes->anc_enabled != old_modes->anc_enabled ||
+                         modes->adaptive_enabled != old_modes->adaptive_enabled;
+    bool modes_differ = modes->off_enabled != live_modes.off_enabled ||
+                        modes->transparency_enabled != live_modes.transparency_enabled ||
+                        modes->anc_enabled != live_modes.anc_enabled ||
+                        modes->adaptive_enabled != live_modes.adaptive_enabled;
+    if (modes_changed && modes_differ) {
+        uint8_t bits = 0;
+        if (modes->off_enabled) bits |= AAP_LISTENING_MODE_OFF;
+        if (modes->transparency_enabled) bits |= AAP_LISTENING_MODE_TRANSPARENCY;
+        if (modes->anc_enabled) bits |= AAP_LISTENING_MODE_ANC;
+        if (modes->adaptive_enabled) bits |= AAP_LISTENING_MODE_ADAPTIVE;
+
+        g_message("Config: listening modes 0x%02X", bits);
+        aap_build_listening_modes_cmd(bits, packet);
+        bt_connection_send_paced(app.bt_conn, delay_ms, packet, AAP_CONTROL_CMD_SIZE);
+        delay_ms = 50;
+    }
+
+    if (profile->conversational_awareness != old->profile.conversational_awareness &&
+        profile->conversational_awareness != live_ca) {
+        g_message("Config: conversational awareness %s",
+                  profile->conversational_awareness ? "on" : "off");
+        aap_build_conv_awareness_cmd(profile->conversational_awareness, packet);
+        bt_connection_send_paced(app.bt_conn, delay_ms, packet, AAP_CONTROL_CMD_SIZE);
+        delay_ms = 50;
+    }
+
+    if (profile->adaptive_noise_level != old->profile.adaptive_noise_level &&
+        profile->adaptive_noise_level != live_level) {
+        g_message("Config: adaptive noise level %d", profile->adaptive_noise_level);
+        aap_build_adaptive_level_cmd(profile->adaptive_noise_level, packet);
+        bt_connection_send_paced(app.bt_conn, delay_ms, packet, AAP_CONTROL_CMD_SIZE);
+    }
+}
+#endif /* HAVE_PERSISTENCE */
+
 /* ============================================================================
  * Connection management
  * ========================================================================== */
 
-static void connect_to_airpods(const char *address, const char *name)
+static void connect_to_airpods(const BtAddr *address, const char *name,
+                               const BluezAdapterInfo *adapter)
 {
+    char address_str[BT_ADDR_STRLEN];
+
     if (app.bt_conn && bt_connection_is_connected(app.bt_conn)) {
         g_message("Already connected, ignoring connect request");
         return;
     }
 
     /* Store pending info */
-    g_free(app.pending_address);
     g_free(app.pending_name);
-    app.pending_address = g_strdup(address);
+    app.pending_address = *address;
     app.pending_name = g_strdup(name);
+    g_free(app.pending_adapter);
+    app.pending_adapter = adapter ? g_strdup(adapter->object_path) : NULL;
 
     /* Create new connection if needed */
     if (app.bt_conn == NULL) {
@@ -360,9 +737,14 @@ static void connect_to_airpods(const char *address, const char *name)
         bt_connection_set_state_callback(app.bt_conn, on_bt_state_changed, NULL);
     }
 
-    g_message("Connecting to AirPods: %s (%s)", name, address);
+    g_message("Connecting to AirPods: %s (%s) via %s", name,
+              bt_addr_to_string(address, address_str),
+              adapter ? adapter->object_path : "default adapter");
 
-    if (!bt_connection_connect(app.bt_conn, address)) {
+    bluez_monitor_record_connect_attempt(app.bluez_monitor, app.pending_adapter);
+    app.connect_started_us = g_get_monotonic_time();
+
+    if (!bt_connection_connect(app.bt_conn, address, adapter ? &adapter->address : NULL)) {
         g_warning("Failed to initiate connection");
     }
 }
@@ -381,15 +763,65 @@ static void disconnect_from_airpods(void)
 static void on_bluez_device_connected(const BluezDeviceInfo *device, void *user_data)
 {
     (void)user_data;
-    g_message("BlueZ: AirPods connected - %s (%s)", device->name, device->address);
-    connect_to_airpods(device->address, device->name);
+    char address[BT_ADDR_STRLEN];
+    g_message("BlueZ: AirPods connected - %s (%s)", device->name,
+              bt_addr_to_string(&device->address, address));
+    connect_to_airpods(&device->address, device->name,
+                       bluez_monitor_select_adapter(app.bluez_monitor, device));
 }
 
 static void on_bluez_device_disconnected(const BluezDeviceInfo *device, void *user_data)
 {
     (void)user_data;
-    g_message("BlueZ: AirPods disconnected - %s (%s)", device->name, device->address);
+    char address[BT_ADDR_STRLEN];
+    g_message("BlueZ: AirPods disconnected - %s (%s)", device->name,
+              bt_addr_to_string(&device->address, address));
+    disconnect_from_airpods();
+}
+
+static gboolean check_existing_devices_idle(gpointer user_data)
+{
+    (void)user_data;
+
+    wakeup_stats_count(WAKEUP_IDLE_RESCAN);
+
+    if (app.bluez_monitor && !bluez_monitor_is_dormant(app.bluez_monitor)) {
+        bluez_monitor_check_existing_devices(app.bluez_monitor);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+static void on_bluez_power_changed(bool powered, void *user_data)
+{
+    (void)user_data;
+
+    if (app.stall_detector) {
+        stall_detector_set_idle(app.stall_detector, !powered);
+    }
+
+    if (powered) {
+        /* Pick up devices that connected while we were not listening.
+         * Deferred, as this may be called from inside a device scan. */
+        g_message("Bluetooth is back, looking for AirPods");
+        g_idle_add(check_existing_devices_idle, NULL);
+        return;
+    }
+
+    g_message("Bluetooth is off, idling");
+
+    if (app.reconnect_timeout_id != 0) {
+        g_source_remove(app.reconnect_timeout_id);
+        app.reconnect_timeout_id = 0;
+    }
+    app.resume_started_us = 0;
+
     disconnect_from_airpods();
+
+#if HAVE_MEDIA_CONTROL
+    if (app.media_control) {
+        media_control_reset(app.media_control);
+    }
+#endif
 }
 
 /* ============================================================================
@@ -424,11 +856,11 @@ static void on_set_conv_awareness(bool enabled, void *user_data)
     bt_connection_send(app.bt_conn, packet, AAP_CONTROL_CMD_SIZE);
 
     /* Save to device profile */
-    if (app.state.device_address && app.state.device_address[0] != '\0') {
+    if (!bt_addr_is_null(&app.state.device_address)) {
         DeviceProfile profile;
-        config_load_device_profile(app.state.device_address, &profile);
+        config_load_device_profile(&app.state.device_address, &profile);
         profile.conversational_awareness = enabled;
-        config_save_device_profile(app.state.device_address, &profile);
+        config_save_device_profile(&app.state.device_address, &profile);
     }
 }
 
@@ -446,14 +878,15 @@ static void on_set_adaptive_level(int level, void *user_data)
     bt_connection_send(app.bt_conn, packet, AAP_CONTROL_CMD_SIZE);
 
     /* Save to device profile */
-    if (app.state.device_address && app.state.device_address[0] != '\0') {
+    if (!bt_addr_is_null(&app.state.device_address)) {
         DeviceProfile profile;
-        config_load_device_profile(app.state.device_address, &profile);
+        config_load_device_profile(&app.state.device_address, &profile);
         profile.adaptive_noise_level = level;
-        config_save_device_profile(app.state.device_address, &profile);
+        config_save_device_profile(&app.state.device_address, &profile);
     }
 }
 
+#if HAVE_MEDIA_CONTROL
 static void on_set_ear_pause_mode(int mode, void *user_data)
 {
     (void)user_data;
@@ -477,6 +910,7 @@ static void on_set_ear_pause_mode(int mode, void *user_data)
     /* Notify property change */
     dbus_service_emit_properties_changed(app.dbus_service, "EarPauseMode");
 }
+#endif
 
 static void on_set_listening_modes(bool off, bool transparency, bool anc, bool adaptive, void *user_data)
 {
@@ -511,14 +945,14 @@ static void on_set_listening_modes(bool off, bool transparency, bool anc, bool a
     airpods_state_set_listening_modes(&app.state, off, transparency, anc, adaptive);
 
     /* Save to device profile */
-    if (app.state.device_address && app.state.device_address[0] != '\0') {
+    if (!bt_addr_is_null(&app.state.device_address)) {
         DeviceProfile profile;
-        config_load_device_profile(app.state.device_address, &profile);
+        config_load_device_profile(&app.state.device_address, &profile);
         profile.listening_modes.off_enabled = off;
         profile.listening_modes.transparency_enabled = transparency;
         profile.listening_modes.anc_enabled = anc;
         profile.listening_modes.adaptive_enabled = adaptive;
-        config_save_device_profile(app.state.device_address, &profile);
+        config_save_device_profile(&app.state.device_address, &profile);
     }
 
     dbus_service_emit_properties_changed(app.dbus_service, "ListeningModeOff");
@@ -537,22 +971,431 @@ static void on_set_display_name(const char *name, void *user_data)
     airpods_state_set_display_name(&app.state, name);
 
     /* Save to device profile */
-    if (app.state.device_address && app.state.device_address[0] != '\0') {
+    if (!bt_addr_is_null(&app.state.device_address)) {
         DeviceProfile profile;
-        config_load_device_profile(app.state.device_address, &profile);
+        config_load_device_profile(&app.state.device_address, &profile);
         if (name && name[0] != '\0') {
             strncpy(profile.display_name, name, sizeof(profile.display_name) - 1);
             profile.display_name[sizeof(profile.display_name) - 1] = '\0';
         } else {
             profile.display_name[0] = '\0';
         }
-        config_save_device_profile(app.state.device_address, &profile);
+        config_save_device_profile(&app.state.device_address, &profile);
     }
 
     /* Notify property change */
     dbus_service_emit_properties_changed(app.dbus_service, "DisplayName");
 }
 
+#if HAVE_SUSPEND_HANDLING
+/* ============================================================================
+ * Suspend/resume
+ * ========================================================================== */
+
+static void flush_device_profile(void)
+{
+    if (!app.state.connected || bt_addr_is_null(&app.state.device_address)) {
+        return;
+    }
+
+    /* Only refresh profiles the user has saved, never create new ones */
+    DeviceProfile profile;
+    if (!config_load_device_profile(&app.state.device_address, &profile) ||
+        !profile.has_saved_settings) {
+        return;
+    }
+
+    g_mutex_lock(&app.state.lock);
+    profile.listening_modes = app.state.listening_modes;
+    profile.conversational_awareness = app.state.conversational_awareness;
+    profile.adaptive_noise_level = app.state.adaptive_noise_level;
+    g_strlcpy(profile.preferred_nc_mode,
+              noise_control_mode_to_string(app.state.noise_control_mode),
+              sizeof(profile.preferred_nc_mode));
+    g_mutex_unlock(&app.state.lock);
+
+    config_save_device_profile(&app.state.device_address, &profile);
+}
+
+static void note_resume_ready(void)
+{
+    gint64 elapsed = g_get_monotonic_time() - app.resume_started_us;
+
+    app.resume_started_us = 0;
+    app.resume_ready_count++;
+    app.resume_ready_last_us = elapsed;
+    app.resume_ready_total_us += elapsed;
+
+    g_message("AirPods ready %.1f ms after resume", elapsed / 1000.0);
+}
+
+static gboolean on_resume_recheck(gpointer user_data)
+{
+    (void)user_data;
+
+    wakeup_stats_count(WAKEUP_TIMER_RESUME_RECHECK);
+
+    if (app.bt_conn && bt_connection_get_state(app.bt_conn) != BT_STATE_DISCONNECTED) {
+        app.reconnect_timeout_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+
+    if (++app.reconnect_attempts >= RESUME_RECHECK_MAX_ATTEMPTS) {
+        g_message("AirPods did not come back after resume, waiting for BlueZ");
+        app.reconnect_timeout_id = 0;
+        app.resume_started_us = 0;
+        return G_SOURCE_REMOVE;
+    }
+
+    bluez_monitor_check_existing_devices(app.bluez_monitor);
+    return G_SOURCE_CONTINUE;
+}
+
+static void on_sleep_changed(bool going_to_sleep, void *user_data)
+{
+    (void)user_data;
+
+    if (app.reconnect_timeout_id != 0) {
+        g_source_remove(app.reconnect_timeout_id);
+        app.reconnect_timeout_id = 0;
+    }
+
+    if (going_to_sleep) {
+        g_message("System is going to sleep, disconnecting AirPods");
+        app.suspend_count++;
+        app.resume_started_us = 0;
+
+        memset(&app.resume_address, 0, sizeof(app.resume_address));
+        if (app.state.connected) {
+            app.resume_address = app.state.device_address;
+        }
+
+        /* The socket would go stale during sleep, close it while we still can */
+        flush_device_profile();
+        disconnect_from_airpods();
+        return;
+    }
+
+    bool reconnect = !bt_addr_is_null(&app.resume_address);
+    g_message("System resumed%s", reconnect ? ", reconnecting AirPods" : "");
+
+    if (!reconnect || app.bluez_monitor == NULL) {
+        return;
+    }
+
+    memset(&app.resume_address, 0, sizeof(app.resume_address));
+    app.resume_started_us = g_get_monotonic_time();
+    app.reconnect_attempts = 0;
+
+    /* The adapter is still powering up; leaving dormant mode will rescan */
+    if (bluez_monitor_is_dormant(app.bluez_monitor)) {
+        return;
+    }
+
+    /* BlueZ often still reports the device as connected, so there will be
+     * no Connected property change to wait for: look it up directly */
+    bluez_monitor_check_existing_devices(app.bluez_monitor);
+
+    if (!app.bt_conn || bt_connection_get_state(app.bt_conn) == BT_STATE_DISCONNECTED) {
+        app.reconnect_timeout_id = wakeup_timeout_add(RESUME_RECHECK_INTERVAL_MS, TIMER_SLACK_MS,
+                                                      on_resume_recheck, NULL);
+    }
+}
+#endif /* HAVE_SUSPEND_HANDLING */
+
+/* ============================================================================
+ * Statistics
+ * ========================================================================== */
+
+#if HAVE_SUSPEND_HANDLING
+static GVariant *get_sleep_stats(void)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+
+    g_variant_builder_add(&builder, "{sv}", "Suspends",
+                          g_variant_new_uint32(app.suspend_count));
+    g_variant_builder_add(&builder, "{sv}", "Resumes",
+                          g_variant_new_uint32(app.resume_ready_count));
+    g_variant_builder_add(&builder, "{sv}", "ResumeReadyLastMs",
+                          g_variant_new_double(app.resume_ready_last_us / 1000.0));
+    g_variant_builder_add(&builder, "{sv}", "ResumeReadyAvgMs",
+                          g_variant_new_double(app.resume_ready_count > 0
+                              ? app.resume_ready_total_us / 1000.0 / app.resume_ready_count
+                              : 0.0));
+
+    return g_variant_builder_end(&builder);
+}
+#endif
+
+/* Optional subsystems built into this binary (see meson_options.txt) */
+static const char *const build_features[] = {
+#if HAVE_MEDIA_CONTROL
+    "media-control",
+#endif
+#if HAVE_PERSISTENCE
+    "persistence",
+#endif
+#if HAVE_USAGE_STATS
+    "usage-stats",
+#endif
+#if HAVE_SUSPEND_HANDLING
+    "suspend-handling",
+#endif
+#if HAVE_PACKET_SAMPLER
+    "packet-sampler",
+#endif
+#if HAVE_LIBURING
+    "io-uring",
+#endif
+    NULL
+};
+
+static gint64 binary_size(void)
+{
+    struct stat st;
+    return stat("/proc/self/exe", &st) == 0 ? (gint64)st.st_size : -1;
+}
+
+static GVariant *get_process_stats(void)
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return NULL;
+    }
+
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+
+    g_variant_builder_add(&builder, "{sv}", "UserCpuUs",
+                          g_variant_new_int64((gint64)usage.ru_utime.tv_sec * G_USEC_PER_SEC +
+                                              usage.ru_utime.tv_usec));
+    g_variant_builder_add(&builder, "{sv}", "SystemCpuUs",
+                          g_variant_new_int64((gint64)usage.ru_stime.tv_sec * G_USEC_PER_SEC +
+                                              usage.ru_stime.tv_usec));
+    g_variant_builder_add(&builder, "{sv}", "MaxRssKiB", g_variant_new_int64(usage.ru_maxrss));
+    g_variant_builder_add(&builder, "{sv}", "MinorFaults", g_variant_new_int64(usage.ru_minflt));
+    g_variant_builder_add(&builder, "{sv}", "VoluntaryContextSwitches",
+                          g_variant_new_int64(usage.ru_nvcsw));
+    g_variant_builder_add(&builder, "{sv}", "InvoluntaryContextSwitches",
+                          g_variant_new_int64(usage.ru_nivcsw));
+    g_variant_builder_add(&builder, "{sv}", "UptimeUs",
+                          g_variant_new_int64(g_get_monotonic_time() - app.started_us));
+    g_variant_builder_add(&builder, "{sv}", "StartupUs", g_variant_new_int64(app.startup_us));
+    g_variant_builder_add(&builder, "{sv}", "BinaryBytes", g_variant_new_int64(binary_size()));
+    g_variant_builder_add(&builder, "{sv}", "Features", g_variant_new_strv(build_features, -1));
+
+    return g_variant_builder_end(&builder);
+}
+
+static guint count_open_fds(void)
+{
+    GDir *dir = g_dir_open("/proc/self/fd", 0, NULL);
+    if (dir == NULL) {
+        return 0;
+    }
+
+    guint count = 0;
+    while (g_dir_read_name(dir) != NULL) {
+        count++;
+    }
+    g_dir_close(dir);
+
+    /* Minus the descriptor used to read the directory */
+    return count > 0 ? count - 1 : 0;
+}
+
+static gint64 current_rss_kib(void)
+{
+    gchar *contents = NULL;
+    if (!g_file_get_contents("/proc/self/statm", &contents, NULL, NULL)) {
+        return -1;
+    }
+
+    /* Second field is resident pages */
+    long resident = 0;
+    if (sscanf(contents, "%*s %ld", &resident) != 1) {
+        resident = -1;
+    }
+    g_free(contents);
+
+    return resident < 0 ? -1 : resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/* Lifecycle counters to spot growth across connect/disconnect cycles */
+static GVariant *get_resource_stats(void)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+
+    g_variant_builder_add(&builder, "{sv}", "OpenFds", g_variant_new_uint32(count_open_fds()));
+    g_variant_builder_add(&builder, "{sv}", "RssKiB", g_variant_new_int64(current_rss_kib()));
+    g_variant_builder_add(&builder, "{sv}", "Connects", g_variant_new_uint32(app.connect_cycles));
+    g_variant_builder_add(&builder, "{sv}", "Disconnects", g_variant_new_uint32(app.disconnect_cycles));
+    g_variant_builder_add(&builder, "{sv}", "ConnectUs", log2_histogram_to_variant(&app.connect_us));
+
+    return g_variant_builder_end(&builder);
+}
+
+static GVariant *get_adapter_stats(void)
+{
+    return app.bluez_monitor ? bluez_monitor_get_adapter_stats(app.bluez_monitor) : NULL;
+}
+
+static GVariant *get_bluez_stats(void)
+{
+    return app.bluez_monitor ? bluez_monitor_get_power_stats(app.bluez_monitor) : NULL;
+}
+
+static GVariant *get_latency_stats(void)
+{
+    return app.bt_conn ? bt_connection_get_latency_stats(app.bt_conn)
+                       : g_variant_new("a{sv}", NULL);
+}
+
+static GVariant *get_io_stats(void)
+{
+    return app.bt_conn ? bt_connection_get_io_stats(app.bt_conn)
+                       : g_variant_new("a{sv}", NULL);
+}
+
+#if HAVE_MEDIA_CONTROL
+static GVariant *get_media_stats(void)
+{
+    return app.media_control ? media_control_get_stats(app.media_control) : NULL;
+}
+#endif
+
+static GVariant *get_stall_stats(void)
+{
+    return app.stall_detector ? stall_detector_get_stats(app.stall_detector) : NULL;
+}
+
+#if HAVE_PACKET_SAMPLER
+static GVariant *get_unknown_packet_stats(void)
+{
+    return packet_sampler_get_stats(app.packet_sampler);
+}
+#endif
+
+static GVariant *get_event_stats(void)
+{
+    return event_bus_get_stats(app.event_bus);
+}
+
+/* GetStats categories; NULL from a getter means the subsystem is disabled */
+static const struct {
+    const char *name;
+    GVariant *(*get)(void);
+} stats_categories[] = {
+    { "adapters", get_adapter_stats },
+    { "bluez",    get_bluez_stats },
+    { "latency",  get_latency_stats },
+    { "io",       get_io_stats },
+#if HAVE_MEDIA_CONTROL
+    { "media",    get_media_stats },
+#endif
+    { "wakeups",  wakeup_stats_get },
+#if HAVE_SUSPEND_HANDLING
+    { "sleep",    get_sleep_stats },
+#endif
+    { "stalls",   get_stall_stats },
+    { "process",  get_process_stats },
+    { "resources", get_resource_stats },
+#if HAVE_PACKET_SAMPLER
+    { "unknown-packets", get_unknown_packet_stats },
+#endif
+    { "events",   get_event_stats },
+};
+
+/* Every category in one snapshot, for tools that record and compare runs */
+static GVariant *get_all_stats(void)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+
+    g_variant_builder_add(&builder, "{sv}", "TimestampUs",
+                          g_variant_new_int64(g_get_monotonic_time()));
+
+    for (gsize i = 0; i < G_N_ELEMENTS(stats_categories); i++) {
+        GVariant *stats = stats_categories[i].get();
+        if (stats != NULL) {
+            g_variant_builder_add(&builder, "{sv}", stats_categories[i].name, stats);
+        }
+    }
+
+    return g_variant_builder_end(&builder);
+}
+
+static GVariant *on_get_stats(const char *category, void *user_data)
+{
+    (void)user_data;
+
+    if (g_strcmp0(category, "all") == 0) {
+        return get_all_stats();
+    }
+
+    for (gsize i = 0; i < G_N_ELEMENTS(stats_categories); i++) {
+        if (g_strcmp0(category, stats_categories[i].name) == 0) {
+            /* Known but not running, e.g. media control in system mode */
+            GVariant *stats = stats_categories[i].get();
+            return stats ? stats : g_variant_new("a{sv}", NULL);
+        }
+    }
+
+    return NULL;
+}
+
+#if HAVE_USAGE_STATS
+static GVariant *on_get_usage(const char *address, void *user_data)
+{
+    (void)user_data;
+    BtAddr device;
+
+    if (address == NULL || address[0] == '\0') {
+        if (!app.state.connected) {
+            return g_variant_new("aa{sv}", NULL);
+        }
+        device = app.state.device_address;
+    } else if (!bt_addr_from_string(address, &device)) {
+        return NULL;
+    }
+
+    return usage_stats_get(app.usage_stats, &device);
+}
+#endif
+
+/* ============================================================================
+ * System-wide mode
+ * ========================================================================== */
+
+static bool on_authorize(const char *sender, void *user_data)
+{
+    (void)user_data;
+    return seat_policy_is_allowed(app.seat_policy, sender, app.device_seat);
+}
+
+static bool setup_system_mode(void)
+{
+    /* systemd passes StateDirectory= through the environment */
+    const char *state_dir = g_getenv("STATE_DIRECTORY");
+    config_set_directory(state_dir != NULL ? state_dir : SYSTEM_STATE_DIR);
+    config_set_system_mode(true);
+
+    GError *error = NULL;
+    GDBusConnection *system_bus = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, &error);
+    if (error) {
+        g_warning("Failed to connect to system bus: %s", error->message);
+        g_error_free(error);
+        return false;
+    }
+
+    app.seat_policy = seat_policy_new(system_bus);
+    g_object_unref(system_bus);
+
+    return true;
+}
+
 /* ============================================================================
  * Signal handlers
  * ========================================================================== */
@@ -581,11 +1424,54 @@ static void cleanup(void)
 {
     g_message("Cleaning up...");
 
+    if (app.reconnect_timeout_id != 0) {
+        g_source_remove(app.reconnect_timeout_id);
+        app.reconnect_timeout_id = 0;
+    }
+
+    if (app.apply_settings_timeout_id != 0) {
+        g_source_remove(app.apply_settings_timeout_id);
+        app.apply_settings_timeout_id = 0;
+    }
+
+#if HAVE_SUSPEND_HANDLING
+    if (app.sleep_monitor) {
+        sleep_monitor_free(app.sleep_monitor);
+        app.sleep_monitor = NULL;
+    }
+#endif
+
+    /* Freeing the connection disconnects, and the state handler still
+     * reaches usage stats, the sampler and the event bus */
     if (app.bt_conn) {
         bt_connection_free(app.bt_conn);
         app.bt_conn = NULL;
     }
 
+    if (app.stall_detector) {
+        stall_detector_free(app.stall_detector);
+        app.stall_detector = NULL;
+    }
+
+#if HAVE_PACKET_SAMPLER
+    if (app.packet_sampler) {
+        packet_sampler_free(app.packet_sampler);
+        app.packet_sampler = NULL;
+    }
+#endif
+
+#if HAVE_USAGE_STATS
+    if (app.usage_stats) {
+        usage_stats_free(app.usage_stats);
+        app.usage_stats = NULL;
+    }
+#endif
+
+    if (app.event_bus) {
+        event_bus_free(app.event_bus);
+        app.event_bus = NULL;
+    }
+
     if (app.bluez_monitor) {
         bluez_monitor_free(app.bluez_monitor);
         app.bluez_monitor = NULL;
@@ -596,13 +1482,27 @@ static void cleanup(void)
         app.dbus_service = NULL;
     }
 
+#if HAVE_MEDIA_CONTROL
     if (app.media_control) {
         media_control_free(app.media_control);
         app.media_control = NULL;
     }
+#endif
+
+#if HAVE_PERSISTENCE
+    if (app.config_monitor) {
+        config_monitor_free(app.config_monitor);
+        app.config_monitor = NULL;
+    }
+#endif
+
+    if (app.seat_policy) {
+        seat_policy_free(app.seat_policy);
+        app.seat_policy = NULL;
+    }
 
-    g_free(app.pending_address);
     g_free(app.pending_name);
+    g_free(app.pending_adapter);
 
     airpods_state_cleanup(&app.state);
 
@@ -614,13 +1514,34 @@ static void cleanup(void)
 
 int main(int argc, char *argv[])
 {
-    (void)argc;
-    (void)argv;
+    GOptionEntry entries[] = {
+        {"system", 0, 0, G_OPTION_ARG_NONE, &app.system_mode,
+         "Run as a system-wide daemon on the system bus", NULL},
+        {NULL, 0, 0, 0, NULL, NULL, NULL}
+    };
+
+    GError *error = NULL;
+    GOptionContext *context = g_option_context_new("- AirPods integration daemon");
+    g_option_context_add_main_entries(context, entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+        g_printerr("%s\n", error->message);
+        g_error_free(error);
+        g_option_context_free(context);
+        return 1;
+    }
+    g_option_context_free(context);
+
+    app.started_us = g_get_monotonic_time();
+    g_message("LibrePods Daemon starting%s...", app.system_mode ? " (system-wide mode)" : "");
 
-    g_message("LibrePods Daemon starting...");
+    if (app.system_mode && !setup_system_mode()) {
+        g_warning("Failed to set up system-wide mode");
+        return 1;
+    }
 
     /* Load configuration */
     config_load(&app.config);
+    g_strlcpy(app.device_seat, app.config.seat, sizeof(app.device_seat));
 
     /* Initialize state */
     airpods_state_init(&app.state);
@@ -632,8 +1553,31 @@ int main(int argc, char *argv[])
     g_unix_signal_add(SIGINT, on_sigint, NULL);
     g_unix_signal_add(SIGTERM, on_sigterm, NULL);
 
+    /* Watch the main loop for stalls (also feeds the systemd watchdog) */
+    app.stall_detector = stall_detector_new();
+    stall_detector_start(app.stall_detector);
+
+#if HAVE_PACKET_SAMPLER
+    /* Keep a few frames of traffic the parser does not know yet */
+    app.packet_sampler = packet_sampler_new();
+#endif
+
+#if HAVE_USAGE_STATS
+    /* Wear time per device and day */
+    app.usage_stats = usage_stats_new();
+#endif
+
+    /* Route received packets to their consumers */
+    app.event_bus = event_bus_new(packet_subscribers, G_N_ELEMENTS(packet_subscribers), NULL);
+    if (app.event_bus == NULL) {
+        g_error("Failed to create event bus");
+        cleanup();
+        return 1;
+    }
+
     /* Create D-Bus service */
-    app.dbus_service = dbus_service_new(&app.state);
+    app.dbus_service = dbus_service_new(&app.state,
+                                         app.system_mode ? G_BUS_TYPE_SYSTEM : G_BUS_TYPE_SESSION);
     if (app.dbus_service == NULL) {
         g_error("Failed to create D-Bus service");
         cleanup();
@@ -643,9 +1587,18 @@ int main(int argc, char *argv[])
     dbus_service_set_noise_control_callback(app.dbus_service, on_set_noise_control, NULL);
     dbus_service_set_conv_awareness_callback(app.dbus_service, on_set_conv_awareness, NULL);
     dbus_service_set_adaptive_level_callback(app.dbus_service, on_set_adaptive_level, NULL);
+#if HAVE_MEDIA_CONTROL
     dbus_service_set_ear_pause_mode_callback(app.dbus_service, on_set_ear_pause_mode, NULL);
+#endif
     dbus_service_set_listening_modes_callback(app.dbus_service, on_set_listening_modes, NULL);
     dbus_service_set_display_name_callback(app.dbus_service, on_set_display_name, NULL);
+    dbus_service_set_stats_callback(app.dbus_service, on_get_stats, NULL);
+#if HAVE_USAGE_STATS
+    dbus_service_set_usage_callback(app.dbus_service, on_get_usage, NULL);
+#endif
+    if (app.system_mode) {
+        dbus_service_set_authorize_callback(app.dbus_service, on_authorize, NULL);
+    }
 
     if (!dbus_service_start(app.dbus_service)) {
         g_error("Failed to start D-Bus service");
@@ -653,9 +1606,12 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    /* Create media control for MPRIS integration */
-    app.media_control = media_control_new();
-    if (app.media_control == NULL) {
+#if HAVE_MEDIA_CONTROL
+    /* Create media control for MPRIS integration. Players live on the
+     * users' session buses, which the system-wide daemon cannot reach. */
+    if (app.system_mode) {
+        g_message("Media control disabled in system-wide mode");
+    } else if ((app.media_control = media_control_new()) == NULL) {
         g_warning("Failed to create media control (MPRIS pause/resume disabled)");
     } else {
         /* Load ear pause mode from config */
@@ -663,6 +1619,14 @@ int main(int argc, char *argv[])
         media_control_set_ear_pause_mode(app.media_control, (EarPauseMode)app.config.ear_pause_mode);
         g_message("Media control enabled (ear_pause_mode=%d)", app.config.ear_pause_mode);
     }
+#endif
+
+#if HAVE_PERSISTENCE
+    /* Pick up edits to daemon.conf and devices.conf without a restart */
+    app.config_monitor = config_monitor_new();
+    config_monitor_set_callback(app.config_monitor, on_config_reloaded, NULL);
+    config_monitor_start(app.config_monitor, &app.config);
+#endif
 
     /* Create BlueZ monitor */
     app.bluez_monitor = bluez_monitor_new();
@@ -674,6 +1638,7 @@ int main(int argc, char *argv[])
 
     bluez_monitor_set_connected_callback(app.bluez_monitor, on_bluez_device_connected, NULL);
     bluez_monitor_set_disconnected_callback(app.bluez_monitor, on_bluez_device_disconnected, NULL);
+    bluez_monitor_set_power_callback(app.bluez_monitor, on_bluez_power_changed, NULL);
 
     if (!bluez_monitor_start(app.bluez_monitor)) {
         g_error("Failed to start BlueZ monitor");
@@ -684,7 +1649,20 @@ int main(int argc, char *argv[])
     /* Check for already connected devices */
     bluez_monitor_check_existing_devices(app.bluez_monitor);
 
-    g_message("LibrePods Daemon running. Press Ctrl+C to quit.");
+#if HAVE_SUSPEND_HANDLING
+    /* Follow system suspend/resume (optional) */
+    app.sleep_monitor = sleep_monitor_new();
+    if (app.sleep_monitor == NULL) {
+        g_warning("Failed to create sleep monitor (suspend handling disabled)");
+    } else {
+        sleep_monitor_set_callback(app.sleep_monitor, on_sleep_changed, NULL);
+        sleep_monitor_start(app.sleep_monitor);
+    }
+#endif
+
+    app.startup_us = g_get_monotonic_time() - app.started_us;
+    g_message("LibrePods Daemon running (started in %.1f ms). Press Ctrl+C to quit.",
+              app.startup_us / 1000.0);
 
     /* Run main loop */
     g_main_loop_run(app.main_loop);
@@ -6,6 +6,8 @@
  */
 
 #include "media_control.h"
+#include "histogram.h"
+#include "wakeup_stats.h"
 #include <gio/gio.h>
 #include <string.h>
 
@@ -14,12 +16,54 @@
 #define MPRIS_PLAYER_INTERFACE "org.mpris.MediaPlayer2.Player"
 #define DBUS_PROPERTIES_INTERFACE "org.freedesktop.DBus.Properties"
 
+/* A hung player must not hold its pause back for the default 25 s */
+#define MPRIS_CALL_TIMEOUT_MS 2000
+
+/* Volume while the user is speaking, relative to the player's own */
+#define DUCK_VOLUME_FACTOR 0.2
+
+/* Ducking slower than this misses the start of what the user says */
+#define DUCK_LATENCY_TARGET_US (150 * 1000)
+
+/* Players round volumes they are given */
+#define VOLUME_EPSILON 0.02
+
+/* A player on the bus, as last reported by its signals */
+typedef struct {
+    gchar *bus_name;        /* Well-known name, for messages */
+    bool playing;
+    double volume;          /* -1 until known */
+    bool ducked;
+    double restore_volume;  /* Volume before ducking */
+} MprisPlayer;
+
 struct MediaControl {
     GDBusConnection *connection;
     EarPauseMode ear_pause_mode;
 
     /* Track which players we paused */
-    GList *paused_players;     /* List of player names (strings) that we paused */
+    GList *paused_players;     /* Unique bus names of the players we paused */
+    guint generation;          /* Bumped on every pause, resume and reset */
+    GCancellable *cancellable; /* Cancels calls still in flight on free */
+
+    /* Fan-out statistics */
+    Log2Histogram pause_latency_us;  /* Ear-out until every player answered */
+    Log2Histogram blocking_us;       /* Main loop time spent starting a fan-out */
+    guint last_player_count;         /* Playing players the last pause went to */
+    guint players_paused;
+    guint pause_failures;
+
+    /* MPRIS players by unique bus name, kept current from signals */
+    GHashTable *players;
+    guint name_owner_changed_id;
+    guint properties_changed_id;
+
+    /* Conversational awareness ducking */
+    bool ducked;
+    Log2Histogram duck_latency_us;  /* CA event until every player took the volume */
+    guint ducks;
+    guint ducks_over_target;
+    guint duck_failures;
 
     /* Previous ear state for edge detection */
     bool prev_left_in_ear;
@@ -27,32 +71,158 @@ struct MediaControl {
     bool prev_state_valid;
 };
 
+static bool call_cancelled(GError *error)
+{
+    return g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+}
+
 /* ============================================================================
- * Helper functions
+ * Player cache
+ *
+ * Ducking has to be quick, so the players, their playback status and
+ * volume are tracked from NameOwnerChanged and PropertiesChanged instead
+ * of being queried when the user starts speaking.
  * ========================================================================== */
 
-static GList *get_mpris_players(MediaControl *mc)
+/* A query about one player; the name is looked up again on reply */
+typedef struct {
+    MediaControl *mc;
+    gchar *name;
+} PlayerQuery;
+
+static PlayerQuery *player_query_new(MediaControl *mc, const gchar *name)
+{
+    PlayerQuery *query = g_new0(PlayerQuery, 1);
+    query->mc = mc;
+    query->name = g_strdup(name);
+    return query;
+}
+
+static void player_query_free(PlayerQuery *query)
+{
+    g_free(query->name);
+    g_free(query);
+}
+
+static void mpris_player_free(gpointer data)
 {
-    GList *players = NULL;
+    MprisPlayer *player = data;
+    g_free(player->bus_name);
+    g_free(player);
+}
+
+static void apply_player_properties(MprisPlayer *player, GVariant *properties)
+{
+    GVariantIter iter;
+    const gchar *key;
+    GVariant *value;
+
+    g_variant_iter_init(&iter, properties);
+    while (g_variant_iter_loop(&iter, "{&sv}", &key, &value)) {
+        if (g_strcmp0(key, "PlaybackStatus") == 0 &&
+            g_variant_is_of_type(value, G_VARIANT_TYPE_STRING)) {
+            player->playing = g_strcmp0(g_variant_get_string(value, NULL), "Playing") == 0;
+        } else if (g_strcmp0(key, "Volume") == 0 &&
+                   g_variant_is_of_type(value, G_VARIANT_TYPE_DOUBLE)) {
+            player->volume = g_variant_get_double(value);
+        }
+    }
+}
+
+static void on_player_properties(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+    PlayerQuery *query = user_data;
     GError *error = NULL;
 
-    GVariant *result = g_dbus_connection_call_sync(
+    wakeup_stats_count(WAKEUP_MPRIS_REPLY);
+
+    GVariant *result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (error != NULL) {
+        if (!call_cancelled(error)) {
+            g_debug("Failed to get properties of %s: %s", query->name, error->message);
+        }
+        g_error_free(error);
+        player_query_free(query);
+        return;
+    }
+
+    MprisPlayer *player = g_hash_table_lookup(query->mc->players, query->name);
+    if (player != NULL) {
+        GVariant *properties;
+        g_variant_get(result, "(@a{sv})", &properties);
+        apply_player_properties(player, properties);
+        g_variant_unref(properties);
+    }
+
+    g_variant_unref(result);
+    player_query_free(query);
+}
+
+static void add_player(MediaControl *mc, const gchar *bus_name, const gchar *unique_name)
+{
+    if (g_hash_table_contains(mc->players, unique_name)) {
+        return;
+    }
+
+    MprisPlayer *player = g_new0(MprisPlayer, 1);
+    player->bus_name = g_strdup(bus_name);
+    player->volume = -1;
+    g_hash_table_insert(mc->players, g_strdup(unique_name), player);
+
+    g_debug("Tracking media player %s (%s)", bus_name, unique_name);
+
+    g_dbus_connection_call(
         mc->connection,
-        "org.freedesktop.DBus",
-        "/org/freedesktop/DBus",
-        "org.freedesktop.DBus",
-        "ListNames",
-        NULL,
-        G_VARIANT_TYPE("(as)"),
+        unique_name,
+        MPRIS_DBUS_PATH,
+        DBUS_PROPERTIES_INTERFACE,
+        "GetAll",
+        g_variant_new("(s)", MPRIS_PLAYER_INTERFACE),
+        G_VARIANT_TYPE("(a{sv})"),
         G_DBUS_CALL_FLAGS_NONE,
-        -1,
-        NULL,
-        &error);
+        MPRIS_CALL_TIMEOUT_MS,
+        mc->cancellable,
+        on_player_properties,
+        player_query_new(mc, unique_name));
+}
 
+static void on_player_owner(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+    PlayerQuery *query = user_data;
+    GError *error = NULL;
+
+    wakeup_stats_count(WAKEUP_MPRIS_REPLY);
+
+    GVariant *result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
     if (error != NULL) {
-        g_warning("Failed to list D-Bus names: %s", error->message);
+        /* The player may simply have quit in the meantime */
         g_error_free(error);
-        return NULL;
+        player_query_free(query);
+        return;
+    }
+
+    const gchar *owner;
+    g_variant_get(result, "(&s)", &owner);
+    add_player(query->mc, query->name, owner);
+
+    g_variant_unref(result);
+    player_query_free(query);
+}
+
+static void on_player_names(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+    MediaControl *mc = user_data;
+    GError *error = NULL;
+
+    wakeup_stats_count(WAKEUP_MPRIS_REPLY);
+
+    GVariant *result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (error != NULL) {
+        if (!call_cancelled(error)) {
+            g_warning("Failed to list D-Bus names: %s", error->message);
+        }
+        g_error_free(error);
+        return;
     }
 
     GVariantIter *iter;
@@ -60,102 +230,362 @@ static GList *get_mpris_players(MediaControl *mc)
     g_variant_get(result, "(as)", &iter);
 
     while (g_variant_iter_loop(iter, "&s", &name)) {
-        if (g_str_has_prefix(name, MPRIS_DBUS_NAME_PREFIX)) {
-            players = g_list_append(players, g_strdup(name));
+        if (!g_str_has_prefix(name, MPRIS_DBUS_NAME_PREFIX)) {
+            continue;
         }
+
+        g_dbus_connection_call(
+            mc->connection,
+            "org.freedesktop.DBus",
+            "/org/freedesktop/DBus",
+            "org.freedesktop.DBus",
+            "GetNameOwner",
+            g_variant_new("(s)", name),
+            G_VARIANT_TYPE("(s)"),
+            G_DBUS_CALL_FLAGS_NONE,
+            MPRIS_CALL_TIMEOUT_MS,
+            mc->cancellable,
+            on_player_owner,
+            player_query_new(mc, name));
     }
 
     g_variant_iter_free(iter);
     g_variant_unref(result);
+}
+
+static void on_name_owner_changed(GDBusConnection *connection G_GNUC_UNUSED,
+                                  const gchar *sender_name G_GNUC_UNUSED,
+                                  const gchar *object_path G_GNUC_UNUSED,
+                                  const gchar *interface_name G_GNUC_UNUSED,
+                                  const gchar *signal_name G_GNUC_UNUSED,
+                                  GVariant *parameters,
+                                  gpointer user_data)
+{
+    MediaControl *mc = user_data;
+    const gchar *name;
+    const gchar *old_owner;
+    const gchar *new_owner;
+
+    wakeup_stats_count(WAKEUP_MPRIS_SIGNAL);
+
+    g_variant_get(parameters, "(&s&s&s)", &name, &old_owner, &new_owner);
+    if (!g_str_has_prefix(name, MPRIS_DBUS_NAME_PREFIX)) {
+        return;
+    }
 
-    return players;
+    if (*old_owner != '\0') {
+        g_hash_table_remove(mc->players, old_owner);
+    }
+    if (*new_owner != '\0') {
+        add_player(mc, name, new_owner);
+    }
 }
 
-static gchar *get_player_playback_status(MediaControl *mc, const gchar *player_name)
+static void on_player_properties_changed(GDBusConnection *connection G_GNUC_UNUSED,
+                                         const gchar *sender_name,
+                                         const gchar *object_path G_GNUC_UNUSED,
+                                         const gchar *interface_name G_GNUC_UNUSED,
+                                         const gchar *signal_name G_GNUC_UNUSED,
+                                         GVariant *parameters,
+                                         gpointer user_data)
 {
-    GError *error = NULL;
-    gchar *status = NULL;
+    MediaControl *mc = user_data;
+
+    wakeup_stats_count(WAKEUP_MPRIS_SIGNAL);
+
+    MprisPlayer *player = g_hash_table_lookup(mc->players, sender_name);
+    if (player == NULL) {
+        return;
+    }
+
+    GVariant *changed;
+    g_variant_get(parameters, "(&s@a{sv}@as)", NULL, &changed, NULL);
+    apply_player_properties(player, changed);
+    g_variant_unref(changed);
+}
+
+static void start_player_cache(MediaControl *mc)
+{
+    mc->players = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, mpris_player_free);
 
-    GVariant *result = g_dbus_connection_call_sync(
+    mc->name_owner_changed_id = g_dbus_connection_signal_subscribe(
         mc->connection,
-        player_name,
-        MPRIS_DBUS_PATH,
+        "org.freedesktop.DBus",
+        "org.freedesktop.DBus",
+        "NameOwnerChanged",
+        "/org/freedesktop/DBus",
+        "org.mpris.MediaPlayer2",
+        G_DBUS_SIGNAL_FLAGS_MATCH_ARG0_NAMESPACE,
+        on_name_owner_changed,
+        mc,
+        NULL);
+
+    mc->properties_changed_id = g_dbus_connection_signal_subscribe(
+        mc->connection,
+        NULL,  /* Any player */
         DBUS_PROPERTIES_INTERFACE,
-        "Get",
-        g_variant_new("(ss)", MPRIS_PLAYER_INTERFACE, "PlaybackStatus"),
-        G_VARIANT_TYPE("(v)"),
-        G_DBUS_CALL_FLAGS_NONE,
-        -1,
+        "PropertiesChanged",
+        MPRIS_DBUS_PATH,
+        MPRIS_PLAYER_INTERFACE,
+        G_DBUS_SIGNAL_FLAGS_NONE,
+        on_player_properties_changed,
+        mc,
+        NULL);
+
+    /* Players that were already running */
+    g_dbus_connection_call(
+        mc->connection,
+        "org.freedesktop.DBus",
+        "/org/freedesktop/DBus",
+        "org.freedesktop.DBus",
+        "ListNames",
         NULL,
-        &error);
+        G_VARIANT_TYPE("(as)"),
+        G_DBUS_CALL_FLAGS_NONE,
+        MPRIS_CALL_TIMEOUT_MS,
+        mc->cancellable,
+        on_player_names,
+        mc);
+}
 
-    if (error != NULL) {
-        g_debug("Failed to get playback status from %s: %s", player_name, error->message);
-        g_error_free(error);
-        return NULL;
+/* ============================================================================
+ * Pause fan-out
+ *
+ * Pause goes straight to every player the cache knows to be playing, all
+ * at once and without querying anything first, so a slow or hung player
+ * neither blocks the main loop nor delays the others.
+ * ========================================================================== */
+
+/* One pause fan-out, alive until every call in it has completed */
+typedef struct {
+    MediaControl *mc;
+    guint generation;       /* mc->generation when the fan-out started */
+    guint pending;          /* Outstanding calls */
+    gint64 started_us;
+} PauseBatch;
+
+/* A call to one player on behalf of a batch */
+typedef struct {
+    PauseBatch *batch;
+    gchar *unique_name;
+} PlayerCall;
+
+static void player_call_free(PlayerCall *call)
+{
+    g_free(call->unique_name);
+    g_free(call);
+}
+
+/* Drop one reference; cancelled calls must not touch mc, it is gone */
+static void batch_release(PauseBatch *batch, bool cancelled)
+{
+    if (--batch->pending > 0) {
+        return;
     }
 
-    GVariant *variant;
-    g_variant_get(result, "(v)", &variant);
-    status = g_strdup(g_variant_get_string(variant, NULL));
-    g_variant_unref(variant);
-    g_variant_unref(result);
+    if (!cancelled) {
+        log2_histogram_add(&batch->mc->pause_latency_us,
+                           g_get_monotonic_time() - batch->started_us);
+    }
+    g_free(batch);
+}
 
-    return status;
+/* Well-known name of a cached player, for messages */
+static const gchar *player_display_name(MediaControl *mc, const gchar *unique_name)
+{
+    MprisPlayer *player = g_hash_table_lookup(mc->players, unique_name);
+    return player ? player->bus_name : unique_name;
 }
 
-static bool player_pause(MediaControl *mc, const gchar *player_name)
+static void on_played(GObject *source, GAsyncResult *res, gpointer user_data)
 {
+    PlayerQuery *query = user_data;
     GError *error = NULL;
 
-    g_dbus_connection_call_sync(
+    wakeup_stats_count(WAKEUP_MPRIS_REPLY);
+
+    GVariant *result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (error != NULL) {
+        if (!call_cancelled(error)) {
+            g_debug("Failed to play %s: %s",
+                    player_display_name(query->mc, query->name), error->message);
+        }
+        g_error_free(error);
+    } else {
+        g_message("Resumed media player: %s", player_display_name(query->mc, query->name));
+        g_variant_unref(result);
+    }
+
+    player_query_free(query);
+}
+
+static void player_play(MediaControl *mc, const gchar *unique_name)
+{
+    g_dbus_connection_call(
         mc->connection,
-        player_name,
+        unique_name,
         MPRIS_DBUS_PATH,
         MPRIS_PLAYER_INTERFACE,
-        "Pause",
+        "Play",
         NULL,
         NULL,
         G_DBUS_CALL_FLAGS_NONE,
-        -1,
-        NULL,
-        &error);
+        MPRIS_CALL_TIMEOUT_MS,
+        mc->cancellable,
+        on_played,
+        player_query_new(mc, unique_name));
+}
+
+static void on_paused(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+    PlayerCall *call = user_data;
+    PauseBatch *batch = call->batch;
+    GError *error = NULL;
+
+    wakeup_stats_count(WAKEUP_MPRIS_REPLY);
+
+    GVariant *result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (call_cancelled(error)) {
+        g_error_free(error);
+        player_call_free(call);
+        batch_release(batch, true);
+        return;
+    }
+
+    MediaControl *mc = batch->mc;
+    const gchar *name = player_display_name(mc, call->unique_name);
 
     if (error != NULL) {
-        g_debug("Failed to pause %s: %s", player_name, error->message);
+        g_debug("Failed to pause %s: %s", name, error->message);
+        mc->pause_failures++;
         g_error_free(error);
-        return false;
+    } else {
+        g_variant_unref(result);
+        mc->players_paused++;
+
+        if (batch->generation == mc->generation) {
+            g_message("Paused media player: %s", name);
+            mc->paused_players = g_list_append(mc->paused_players, g_strdup(call->unique_name));
+        } else {
+            /* Pods went back in while the pause was in flight */
+            g_message("Paused media player %s late, resuming it", name);
+            player_play(mc, call->unique_name);
+        }
     }
 
-    g_message("Paused media player: %s", player_name);
-    return true;
+    player_call_free(call);
+    batch_release(batch, false);
 }
 
-static bool player_play(MediaControl *mc, const gchar *player_name)
+static void player_pause(PauseBatch *batch, const gchar *unique_name)
 {
-    GError *error = NULL;
-
-    g_dbus_connection_call_sync(
-        mc->connection,
-        player_name,
+    PlayerCall *call = g_new0(PlayerCall, 1);
+    call->batch = batch;
+    call->unique_name = g_strdup(unique_name);
+    batch->pending++;
+
+    g_dbus_connection_call(
+        batch->mc->connection,
+        unique_name,
         MPRIS_DBUS_PATH,
         MPRIS_PLAYER_INTERFACE,
-        "Play",
+        "Pause",
         NULL,
         NULL,
         G_DBUS_CALL_FLAGS_NONE,
-        -1,
-        NULL,
-        &error);
+        MPRIS_CALL_TIMEOUT_MS,
+        batch->mc->cancellable,
+        on_paused,
+        call);
+}
+
+/* ============================================================================
+ * Volume ducking
+ *
+ * Volume writes go out to all playing players in the same main loop
+ * iteration, straight from the cache, without waiting for any reply.
+ * ========================================================================== */
+
+/* Volume writes started together */
+typedef struct {
+    MediaControl *mc;
+    guint pending;
+    guint players;
+    gint64 started_us;
+    bool duck;              /* Only ducking latency is recorded */
+} VolumeBatch;
+
+static void volume_batch_release(VolumeBatch *batch, bool cancelled)
+{
+    if (--batch->pending > 0) {
+        return;
+    }
+
+    if (!cancelled && batch->duck && batch->players > 0) {
+        gint64 latency = g_get_monotonic_time() - batch->started_us;
+        log2_histogram_add(&batch->mc->duck_latency_us, latency);
+        if (latency > DUCK_LATENCY_TARGET_US) {
+            batch->mc->ducks_over_target++;
+            g_debug("Ducking took %" G_GINT64_FORMAT " ms", latency / 1000);
+        }
+    }
+    g_free(batch);
+}
+
+static void on_volume_set(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+    VolumeBatch *batch = user_data;
+    GError *error = NULL;
+
+    wakeup_stats_count(WAKEUP_MPRIS_REPLY);
+
+    GVariant *result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (call_cancelled(error)) {
+        g_error_free(error);
+        volume_batch_release(batch, true);
+        return;
+    }
 
     if (error != NULL) {
-        g_debug("Failed to play %s: %s", player_name, error->message);
+        g_debug("Failed to set player volume: %s", error->message);
+        batch->mc->duck_failures++;
         g_error_free(error);
-        return false;
+    } else {
+        g_variant_unref(result);
     }
 
-    g_message("Resumed media player: %s", player_name);
-    return true;
+    volume_batch_release(batch, false);
+}
+
+static void set_player_volume(MediaControl *mc, VolumeBatch *batch,
+                              const gchar *unique_name, double volume)
+{
+    batch->pending++;
+    batch->players++;
+
+    g_dbus_connection_call(
+        mc->connection,
+        unique_name,
+        MPRIS_DBUS_PATH,
+        DBUS_PROPERTIES_INTERFACE,
+        "Set",
+        g_variant_new("(ssv)", MPRIS_PLAYER_INTERFACE, "Volume", g_variant_new_double(volume)),
+        NULL,
+        G_DBUS_CALL_FLAGS_NONE,
+        MPRIS_CALL_TIMEOUT_MS,
+        mc->cancellable,
+        on_volume_set,
+        batch);
+}
+
+static VolumeBatch *volume_batch_new(MediaControl *mc, bool duck)
+{
+    VolumeBatch *batch = g_new0(VolumeBatch, 1);
+    batch->mc = mc;
+    batch->pending = 1;  /* Held until every call is started */
+    batch->started_us = g_get_monotonic_time();
+    batch->duck = duck;
+    return batch;
 }
 
 /* ============================================================================
@@ -177,8 +607,11 @@ MediaControl *media_control_new(void)
 
     mc->ear_pause_mode = EAR_PAUSE_ONE_OUT;  /* Default: pause when one pod is removed */
     mc->paused_players = NULL;
+    mc->cancellable = g_cancellable_new();
     mc->prev_state_valid = false;
 
+    start_player_cache(mc);
+
     return mc;
 }
 
@@ -188,9 +621,17 @@ void media_control_free(MediaControl *mc)
         return;
     }
 
+    /* Callbacks of cancelled calls no longer touch mc */
+    g_cancellable_cancel(mc->cancellable);
+    g_object_unref(mc->cancellable);
+
     /* Free paused players list */
     g_list_free_full(mc->paused_players, g_free);
 
+    g_dbus_connection_signal_unsubscribe(mc->connection, mc->name_owner_changed_id);
+    g_dbus_connection_signal_unsubscribe(mc->connection, mc->properties_changed_id);
+    g_hash_table_destroy(mc->players);
+
     if (mc->connection) {
         g_object_unref(mc->connection);
     }
@@ -293,28 +734,36 @@ void media_control_pause_all(MediaControl *mc)
         return;
     }
 
+    gint64 start = g_get_monotonic_time();
+
     /* Clear previous paused list */
     g_list_free_full(mc->paused_players, g_free);
     mc->paused_players = NULL;
-
-    /* Get all MPRIS players */
-    GList *players = get_mpris_players(mc);
-
-    for (GList *l = players; l != NULL; l = l->next) {
-        const gchar *player_name = l->data;
-
-        /* Check if player is currently playing */
-        gchar *status = get_player_playback_status(mc, player_name);
-        if (status != NULL && g_strcmp0(status, "Playing") == 0) {
-            /* Pause this player and remember it */
-            if (player_pause(mc, player_name)) {
-                mc->paused_players = g_list_append(mc->paused_players, g_strdup(player_name));
-            }
+    mc->generation++;
+
+    PauseBatch *batch = g_new0(PauseBatch, 1);
+    batch->mc = mc;
+    batch->generation = mc->generation;
+    batch->pending = 1;  /* Held until every call is started */
+    batch->started_us = start;
+
+    GHashTableIter iter;
+    gpointer key, value;
+    guint players = 0;
+
+    g_hash_table_iter_init(&iter, mc->players);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        MprisPlayer *player = value;
+        if (player->playing) {
+            player_pause(batch, key);
+            players++;
         }
-        g_free(status);
     }
 
-    g_list_free_full(players, g_free);
+    mc->last_player_count = players;
+    batch_release(batch, false);
+
+    log2_histogram_add(&mc->blocking_us, g_get_monotonic_time() - start);
 }
 
 void media_control_resume(MediaControl *mc)
@@ -323,6 +772,9 @@ void media_control_resume(MediaControl *mc)
         return;
     }
 
+    /* Pauses still in flight resume their player when they land */
+    mc->generation++;
+
     /* Resume only players that we paused */
     for (GList *l = mc->paused_players; l != NULL; l = l->next) {
         const gchar *player_name = l->data;
@@ -332,4 +784,112 @@ void media_control_resume(MediaControl *mc)
     /* Clear the paused list */
     g_list_free_full(mc->paused_players, g_free);
     mc->paused_players = NULL;
-}
\ No newline at end of file
+}
+
+void media_control_reset(MediaControl *mc)
+{
+    if (mc == NULL) {
+        return;
+    }
+
+    g_list_free_full(mc->paused_players, g_free);
+    mc->paused_players = NULL;
+    mc->generation++;
+    mc->prev_state_valid = false;
+
+    media_control_restore_volume(mc);
+}
+
+void media_control_duck(MediaControl *mc)
+{
+    if (mc == NULL || mc->connection == NULL || mc->ducked) {
+        return;
+    }
+
+    mc->ducked = true;
+
+    VolumeBatch *batch = volume_batch_new(mc, true);
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, mc->players);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        MprisPlayer *player = value;
+        if (!player->playing || player->volume <= 0 || player->ducked) {
+            continue;
+        }
+
+        player->ducked = true;
+        player->restore_volume = player->volume;
+        player->volume *= DUCK_VOLUME_FACTOR;
+        set_player_volume(mc, batch, key, player->volume);
+    }
+
+    if (batch->players > 0) {
+        mc->ducks++;
+        g_message("Conversation detected, lowering %u player(s)", batch->players);
+    }
+    volume_batch_release(batch, false);
+}
+
+void media_control_restore_volume(MediaControl *mc)
+{
+    if (mc == NULL || mc->connection == NULL || !mc->ducked) {
+        return;
+    }
+
+    mc->ducked = false;
+
+    VolumeBatch *batch = volume_batch_new(mc, false);
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, mc->players);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        MprisPlayer *player = value;
+        if (!player->ducked) {
+            continue;
+        }
+        player->ducked = false;
+
+        /* Leave the volume alone if the user changed it meanwhile */
+        double ducked_volume = player->restore_volume * DUCK_VOLUME_FACTOR;
+        if (ABS(player->volume - ducked_volume) > VOLUME_EPSILON) {
+            continue;
+        }
+
+        player->volume = player->restore_volume;
+        set_player_volume(mc, batch, key, player->volume);
+    }
+
+    if (batch->players > 0) {
+        g_message("Conversation ended, restoring %u player(s)", batch->players);
+    }
+    volume_batch_release(batch, false);
+}
+
+GVariant *media_control_get_stats(MediaControl *mc)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+
+    g_variant_builder_add(&builder, "{sv}", "PauseLatencyUs",
+                          log2_histogram_to_variant(&mc->pause_latency_us));
+    g_variant_builder_add(&builder, "{sv}", "BlockingUs",
+                          log2_histogram_to_variant(&mc->blocking_us));
+    g_variant_builder_add(&builder, "{sv}", "Players", g_variant_new_uint32(mc->last_player_count));
+    g_variant_builder_add(&builder, "{sv}", "PlayersPaused", g_variant_new_uint32(mc->players_paused));
+    g_variant_builder_add(&builder, "{sv}", "PauseFailures", g_variant_new_uint32(mc->pause_failures));
+    g_variant_builder_add(&builder, "{sv}", "CachedPlayers",
+                          g_variant_new_uint32(g_hash_table_size(mc->players)));
+    g_variant_builder_add(&builder, "{sv}", "DuckLatencyUs",
+                          log2_histogram_to_variant(&mc->duck_latency_us));
+    g_variant_builder_add(&builder, "{sv}", "DuckLatencyTargetUs",
+                          g_variant_new_int64(DUCK_LATENCY_TARGET_US));
+    g_variant_builder_add(&builder, "{sv}", "Ducks", g_variant_new_uint32(mc->ducks));
+    g_variant_builder_add(&builder, "{sv}", "DucksOverTarget",
+                          g_variant_new_uint32(mc->ducks_over_target));
+    g_variant_builder_add(&builder, "{sv}", "DuckFailures", g_variant_new_uint32(mc->duck_failures));
+
+    return g_variant_builder_end(&builder);
+}
@@ -3,7 +3,8 @@
  * SPDX-FileCopyrightText: 2024 LibrePods Contributors
  *
  * Media control via MPRIS D-Bus interface
- * Handles pause/play when AirPods are removed from ears
+ * Handles pause/play when AirPods are removed from ears, and lowers
+ * the volume while conversational awareness detects speech
  */
 
 #ifndef MEDIA_CONTROL_H
@@ -39,10 +40,22 @@ void media_control_on_ear_detection_changed(MediaControl *mc,
                                             bool left_in_ear,
                                             bool right_in_ear);
 
-/* Pause all playing media players */
+/* Pause all playing media players (asynchronous, returns immediately) */
 void media_control_pause_all(MediaControl *mc);
 
 /* Resume media players that were paused by us */
 void media_control_resume(MediaControl *mc);
 
+/* Forget paused players and ear state (e.g. when the adapter goes away) */
+void media_control_reset(MediaControl *mc);
+
+/* Lower the volume of playing players while the user is speaking */
+void media_control_duck(MediaControl *mc);
+
+/* Restore volumes lowered by media_control_duck(), unless changed since */
+void media_control_restore_volume(MediaControl *mc);
+
+/* Get pause fan-out and ducking latency and main loop blocking time as a{sv} */
+GVariant *media_control_get_stats(MediaControl *mc);
+
 #endif /* MEDIA_CONTROL_H */
\ No newline at end of file
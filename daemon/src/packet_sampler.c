@@ -0,0 +1,149 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ */
+
+#include "packet_sampler.h"
+#include "aap_protocol.h"
+
+#include <string.h>
+
+/* Frames kept per code, and how much of each frame */
+#define SAMPLES_PER_CODE 4
+#define SAMPLE_MAX_BYTES 64
+
+typedef struct {
+    guint8 len;
+    guint8 data[SAMPLE_MAX_BYTES];
+} Sample;
+
+/* One unknown opcode or control ID, allocated when first seen */
+typedef struct {
+    guint64 count;
+    gint64 first_seen_us;
+    gint64 last_seen_us;
+    guint n_samples;
+    Sample samples[SAMPLES_PER_CODE];
+} CodeEntry;
+
+struct PacketSampler {
+    CodeEntry *opcodes[256];
+    CodeEntry *controls[256];
+    GRand *rand;
+};
+
+PacketSampler *packet_sampler_new(void)
+{
+    PacketSampler *sampler = g_new0(PacketSampler, 1);
+    sampler->rand = g_rand_new();
+    return sampler;
+}
+
+void packet_sampler_free(PacketSampler *sampler)
+{
+    if (sampler == NULL)
+        return;
+
+    for (int i = 0; i < 256; i++) {
+        g_free(sampler->opcodes[i]);
+        g_free(sampler->controls[i]);
+    }
+    g_rand_free(sampler->rand);
+    g_free(sampler);
+}
+
+static void record(PacketSampler *sampler, CodeEntry **slot, const uint8_t *data, size_t len)
+{
+    gint64 now = g_get_real_time();
+
+    if (*slot == NULL) {
+        *slot = g_new0(CodeEntry, 1);
+        (*slot)->first_seen_us = now;
+    }
+
+    CodeEntry *entry = *slot;
+    entry->count++;
+    entry->last_seen_us = now;
+
+    /* Reservoir sampling: every frame so far is kept with equal chance */
+    guint index;
+    if (entry->n_samples < SAMPLES_PER_CODE) {
+        index = entry->n_samples++;
+    } else {
+        if (entry->count > G_MAXINT32) {
+            return;  /* the samples are long settled by then */
+        }
+        index = (guint)g_rand_int_range(sampler->rand, 0, (gint32)entry->count);
+        if (index >= SAMPLES_PER_CODE) {
+            return;
+        }
+    }
+
+    Sample *sample = &entry->samples[index];
+    sample->len = (guint8)MIN(len, SAMPLE_MAX_BYTES);
+    memcpy(sample->data, data, sample->len);
+}
+
+void packet_sampler_record_opcode(PacketSampler *sampler, const uint8_t *data, size_t len)
+{
+    if (len <= 4)
+        return;
+
+    record(sampler, &sampler->opcodes[aap_get_opcode(data, len)], data, len);
+}
+
+void packet_sampler_record_control(PacketSampler *sampler, const uint8_t *data, size_t len)
+{
+    if (len <= 6)
+        return;
+
+    record(sampler, &sampler->controls[data[6]], data, len);
+}
+
+static GVariant *table_to_variant(CodeEntry *const *table)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+
+    for (int i = 0; i < 256; i++) {
+        const CodeEntry *entry = table[i];
+        if (entry == NULL) {
+            continue;
+        }
+
+        GVariantBuilder samples;
+        g_variant_builder_init(&samples, G_VARIANT_TYPE("aay"));
+        for (guint s = 0; s < entry->n_samples; s++) {
+            g_variant_builder_add_value(&samples,
+                                        g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE,
+                                                                  entry->samples[s].data,
+                                                                  entry->samples[s].len, 1));
+        }
+
+        GVariantBuilder code;
+        g_variant_builder_init(&code, G_VARIANT_TYPE("a{sv}"));
+        g_variant_builder_add(&code, "{sv}", "Count", g_variant_new_uint64(entry->count));
+        g_variant_builder_add(&code, "{sv}", "FirstSeenUs",
+                              g_variant_new_int64(entry->first_seen_us));
+        g_variant_builder_add(&code, "{sv}", "LastSeenUs",
+                              g_variant_new_int64(entry->last_seen_us));
+        g_variant_builder_add(&code, "{sv}", "Samples", g_variant_builder_end(&samples));
+
+        char key[8];
+        g_snprintf(key, sizeof(key), "0x%02X", i);
+        g_variant_builder_add(&builder, "{sv}", key, g_variant_builder_end(&code));
+    }
+
+    return g_variant_builder_end(&builder);
+}
+
+GVariant *packet_sampler_get_stats(PacketSampler *sampler)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+
+    g_variant_builder_add(&builder, "{sv}", "Opcodes", table_to_variant(sampler->opcodes));
+    g_variant_builder_add(&builder, "{sv}", "Controls", table_to_variant(sampler->controls));
+
+    return g_variant_builder_end(&builder);
+}
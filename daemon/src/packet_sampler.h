@@ -0,0 +1,48 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * Bounded sampling of AAP packets the parser does not understand
+ */
+
+#ifndef PACKET_SAMPLER_H
+#define PACKET_SAMPLER_H
+
+#include <glib.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* Packet sampler context */
+typedef struct PacketSampler PacketSampler;
+
+/**
+ * Create a new packet sampler
+ *
+ * Memory is bounded by the 256 possible opcodes and control IDs, each
+ * keeping a count and a few sample frames.
+ *
+ * @return New packet sampler
+ */
+PacketSampler *packet_sampler_new(void);
+
+/**
+ * Free packet sampler
+ */
+void packet_sampler_free(PacketSampler *sampler);
+
+/**
+ * Record a packet with an unknown opcode
+ */
+void packet_sampler_record_opcode(PacketSampler *sampler, const uint8_t *data, size_t len);
+
+/**
+ * Record a control packet with an unknown control ID
+ */
+void packet_sampler_record_control(PacketSampler *sampler, const uint8_t *data, size_t len);
+
+/**
+ * Get counts and sample frames per unknown opcode and control ID as a{sv}
+ */
+GVariant *packet_sampler_get_stats(PacketSampler *sampler);
+
+#endif /* PACKET_SAMPLER_H */
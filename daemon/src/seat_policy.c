@@ -0,0 +1,456 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ */
+
+#include "seat_policy.h"
+#include "stall_detector.h"
+#include "wakeup_stats.h"
+
+#include <string.h>
+
+/* Unique names are never reused by the bus, so cached entries only go
+ * stale when clients leave. Bound the cache instead of tracking that. */
+#define SENDER_CACHE_MAX 256
+
+/* logind and the bus answer in milliseconds; do not wait like for a player */
+#define POLICY_CALL_TIMEOUT_MS 1000
+
+/* An active logind session, as last read */
+typedef struct {
+    guint32 uid;
+    gchar *seat;
+} ActiveSession;
+
+/* A client's uid and the last decision about it */
+typedef struct {
+    guint32 uid;
+    gchar *seat;            /* Seat the decision was made for */
+    guint generation;       /* Session list the decision was made with */
+    bool allowed;
+    bool denial_logged;
+} SenderEntry;
+
+/* One re-read of the session list, outliving the policy if cancelled */
+typedef struct {
+    SeatPolicy *policy;
+    GCancellable *cancellable;
+    GArray *sessions;       /* ActiveSession, filled as answers arrive */
+    guint pending;          /* Active queries not answered yet */
+} SessionRefresh;
+
+/* The Active query of one listed session */
+typedef struct {
+    SessionRefresh *refresh;
+    guint32 uid;
+    gchar *seat;
+} SessionQuery;
+
+struct SeatPolicy {
+    GDBusConnection *connection;
+    GHashTable *senders;      /* unique name -> SenderEntry */
+
+    /* Active sessions, replaced as a whole when a re-read completes */
+    GArray *active_sessions;  /* ActiveSession */
+    guint generation;         /* Bumped on every replacement, 0 before the first */
+    bool refreshing;
+    bool refresh_pending;     /* Sessions changed again during a re-read */
+    GCancellable *cancellable;
+
+    guint session_new_id;
+    guint session_removed_id;
+    guint session_changed_id;
+};
+
+static void refresh_sessions(SeatPolicy *policy);
+
+/* ============================================================================
+ * Callers
+ * ========================================================================== */
+
+static void sender_entry_free(gpointer data)
+{
+    SenderEntry *entry = data;
+    g_free(entry->seat);
+    g_free(entry);
+}
+
+/* Entry for a client, resolving its uid on first contact */
+static SenderEntry *lookup_sender(SeatPolicy *policy, const char *sender)
+{
+    SenderEntry *entry = g_hash_table_lookup(policy->senders, sender);
+    if (entry != NULL) {
+        return entry;
+    }
+
+    /* Answered by the bus daemon itself, so this stays short */
+    GError *error = NULL;
+    const char *prev_activity = stall_detector_enter("logind-call");
+    GVariant *result = g_dbus_connection_call_sync(
+        policy->connection,
+        "org.freedesktop.DBus",
+        "/org/freedesktop/DBus",
+        "org.freedesktop.DBus",
+        "GetConnectionUnixUser",
+        g_variant_new("(s)", sender),
+        G_VARIANT_TYPE("(u)"),
+        G_DBUS_CALL_FLAGS_NONE,
+        POLICY_CALL_TIMEOUT_MS,
+        NULL,
+        &error);
+    stall_detector_leave(prev_activity);
+
+    if (error) {
+        g_warning("Failed to resolve caller %s: %s", sender, error->message);
+        g_error_free(error);
+        return NULL;
+    }
+
+    if (g_hash_table_size(policy->senders) >= SENDER_CACHE_MAX) {
+        g_hash_table_remove_all(policy->senders);
+    }
+
+    entry = g_new0(SenderEntry, 1);
+    g_variant_get(result, "(u)", &entry->uid);
+    g_variant_unref(result);
+
+    g_hash_table_insert(policy->senders, g_strdup(sender), entry);
+    return entry;
+}
+
+static bool has_active_session(SeatPolicy *policy, guint32 uid, const char *seat)
+{
+    for (guint i = 0; i < policy->active_sessions->len; i++) {
+        const ActiveSession *session = &g_array_index(policy->active_sessions, ActiveSession, i);
+        if (session->uid == uid &&
+            (seat[0] == '\0' || g_strcmp0(session->seat, seat) == 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* ============================================================================
+ * Session list
+ * ========================================================================== */
+
+static void clear_active_session(gpointer data)
+{
+    ActiveSession *session = data;
+    g_free(session->seat);
+}
+
+static GArray *session_array_new(void)
+{
+    GArray *sessions = g_array_new(FALSE, FALSE, sizeof(ActiveSession));
+    g_array_set_clear_func(sessions, clear_active_session);
+    return sessions;
+}
+
+static void finish_refresh(SessionRefresh *refresh)
+{
+    SeatPolicy *policy = refresh->policy;
+
+    if (!g_cancellable_is_cancelled(refresh->cancellable)) {
+        g_array_unref(policy->active_sessions);
+        policy->active_sessions = g_steal_pointer(&refresh->sessions);
+
+        /* Cached decisions are re-made on their next use */
+        policy->generation++;
+        policy->refreshing = false;
+        g_debug("%u active logind sessions", policy->active_sessions->len);
+
+        if (policy->refresh_pending) {
+            refresh_sessions(policy);
+        }
+    }
+
+    if (refresh->sessions != NULL) {
+        g_array_unref(refresh->sessions);
+    }
+    g_object_unref(refresh->cancellable);
+    g_free(refresh);
+}
+
+static void on_session_active(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+    SessionQuery *query = user_data;
+    SessionRefresh *refresh = query->refresh;
+    GError *error = NULL;
+
+    wakeup_stats_count(WAKEUP_LOGIND_REPLY);
+
+    GVariant *result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (error != NULL) {
+        /* A session may end between the list and the query */
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_debug("Failed to query session: %s", error->message);
+        }
+        g_error_free(error);
+    } else {
+        GVariant *variant = NULL;
+        g_variant_get(result, "(v)", &variant);
+
+        if (g_variant_is_of_type(variant, G_VARIANT_TYPE_BOOLEAN) &&
+            g_variant_get_boolean(variant)) {
+            ActiveSession session = {
+                .uid = query->uid,
+                .seat = g_steal_pointer(&query->seat),
+            };
+            g_array_append_val(refresh->sessions, session);
+        }
+
+        g_variant_unref(variant);
+        g_variant_unref(result);
+    }
+
+    g_free(query->seat);
+    g_free(query);
+
+    if (--refresh->pending == 0) {
+        finish_refresh(refresh);
+    }
+}
+
+static void on_list_sessions(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+    SessionRefresh *refresh = user_data;
+    GError *error = NULL;
+
+    wakeup_stats_count(WAKEUP_LOGIND_REPLY);
+
+    GVariant *result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (error != NULL) {
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_warning("Failed to list logind sessions: %s", error->message);
+            refresh->policy->refreshing = false;
+        }
+        g_error_free(error);
+        g_array_unref(refresh->sessions);
+        g_object_unref(refresh->cancellable);
+        g_free(refresh);
+        return;
+    }
+
+    GVariantIter *iter = NULL;
+    guint32 session_uid;
+    const gchar *session_seat;
+    const gchar *session_path;
+
+    /* Held while the queries go out, so none can finish the refresh early */
+    refresh->pending = 1;
+
+    g_variant_get(result, "(a(susso))", &iter);
+    while (g_variant_iter_loop(iter, "(&su&s&s&o)",
+                               NULL, &session_uid, NULL,
+                               &session_seat, &session_path)) {
+        SessionQuery *query = g_new0(SessionQuery, 1);
+        query->refresh = refresh;
+        query->uid = session_uid;
+        query->seat = g_strdup(session_seat);
+        refresh->pending++;
+
+        g_dbus_connection_call(
+            G_DBUS_CONNECTION(source),
+            LOGIND_SERVICE,
+            session_path,
+            "org.freedesktop.DBus.Properties",
+            "Get",
+            g_variant_new("(ss)", LOGIND_SESSION_INTERFACE, "Active"),
+            G_VARIANT_TYPE("(v)"),
+            G_DBUS_CALL_FLAGS_NONE,
+            POLICY_CALL_TIMEOUT_MS,
+            refresh->cancellable,
+            on_session_active,
+            query);
+    }
+
+    g_variant_iter_free(iter);
+    g_variant_unref(result);
+
+    if (--refresh->pending == 0) {
+        finish_refresh(refresh);
+    }
+}
+
+/* Re-read the active sessions from logind in the background; decisions
+ * use the previous list until the new one is complete */
+static void refresh_sessions(SeatPolicy *policy)
+{
+    if (policy->refreshing) {
+        policy->refresh_pending = true;
+        return;
+    }
+
+    policy->refreshing = true;
+    policy->refresh_pending = false;
+
+    SessionRefresh *refresh = g_new0(SessionRefresh, 1);
+    refresh->policy = policy;
+    refresh->cancellable = g_object_ref(policy->cancellable);
+    refresh->sessions = session_array_new();
+
+    g_dbus_connection_call(
+        policy->connection,
+        LOGIND_SERVICE,
+        LOGIND_OBJECT_PATH,
+        LOGIND_MANAGER_INTERFACE,
+        "ListSessions",
+        NULL,
+        G_VARIANT_TYPE("(a(susso))"),
+        G_DBUS_CALL_FLAGS_NONE,
+        POLICY_CALL_TIMEOUT_MS,
+        refresh->cancellable,
+        on_list_sessions,
+        refresh);
+}
+
+/* A session was added or removed */
+static void on_sessions_changed(GDBusConnection *connection,
+                                const gchar *sender_name,
+                                const gchar *object_path,
+                                const gchar *interface_name,
+                                const gchar *signal_name,
+                                GVariant *parameters,
+                                gpointer user_data)
+{
+    (void)connection;
+    (void)sender_name;
+    (void)object_path;
+    (void)interface_name;
+    (void)signal_name;
+    (void)parameters;
+    SeatPolicy *policy = user_data;
+
+    wakeup_stats_count(WAKEUP_LOGIND_SIGNAL);
+    refresh_sessions(policy);
+}
+
+/* A session property changed; only Active matters, not idle or lock hints */
+static void on_session_properties_changed(GDBusConnection *connection,
+                                          const gchar *sender_name,
+                                          const gchar *object_path,
+                                          const gchar *interface_name,
+                                          const gchar *signal_name,
+                                          GVariant *parameters,
+                                          gpointer user_data)
+{
+    (void)connection;
+    (void)sender_name;
+    (void)object_path;
+    (void)interface_name;
+    (void)signal_name;
+    SeatPolicy *policy = user_data;
+
+    wakeup_stats_count(WAKEUP_LOGIND_SIGNAL);
+
+    GVariant *changed = NULL;
+    const gchar **invalidated = NULL;
+    g_variant_get(parameters, "(&s@a{sv}^a&s)", NULL, &changed, &invalidated);
+
+    GVariant *active = g_variant_lookup_value(changed, "Active", NULL);
+    bool active_changed = active != NULL || g_strv_contains(invalidated, "Active");
+
+    if (active != NULL) {
+        g_variant_unref(active);
+    }
+    g_variant_unref(changed);
+    g_free(invalidated);
+
+    if (active_changed) {
+        refresh_sessions(policy);
+    }
+}
+
+/* ============================================================================
+ * Public API
+ * ========================================================================== */
+
+SeatPolicy *seat_policy_new(GDBusConnection *connection)
+{
+    SeatPolicy *policy = g_new0(SeatPolicy, 1);
+    policy->connection = g_object_ref(connection);
+    policy->senders = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, sender_entry_free);
+    policy->active_sessions = session_array_new();
+    policy->cancellable = g_cancellable_new();
+
+    policy->session_new_id = g_dbus_connection_signal_subscribe(
+        connection, LOGIND_SERVICE, LOGIND_MANAGER_INTERFACE, "SessionNew",
+        LOGIND_OBJECT_PATH, NULL, G_DBUS_SIGNAL_FLAGS_NONE,
+        on_sessions_changed, policy, NULL);
+    policy->session_removed_id = g_dbus_connection_signal_subscribe(
+        connection, LOGIND_SERVICE, LOGIND_MANAGER_INTERFACE, "SessionRemoved",
+        LOGIND_OBJECT_PATH, NULL, G_DBUS_SIGNAL_FLAGS_NONE,
+        on_sessions_changed, policy, NULL);
+
+    /* Session objects report Active switching through PropertiesChanged */
+    policy->session_changed_id = g_dbus_connection_signal_subscribe(
+        connection, LOGIND_SERVICE, "org.freedesktop.DBus.Properties", "PropertiesChanged",
+        NULL, LOGIND_SESSION_INTERFACE, G_DBUS_SIGNAL_FLAGS_NONE,
+        on_session_properties_changed, policy, NULL);
+
+    refresh_sessions(policy);
+    return policy;
+}
+
+void seat_policy_free(SeatPolicy *policy)
+{
+    if (policy == NULL)
+        return;
+
+    g_dbus_connection_signal_unsubscribe(policy->connection, policy->session_new_id);
+    g_dbus_connection_signal_unsubscribe(policy->connection, policy->session_removed_id);
+    g_dbus_connection_signal_unsubscribe(policy->connection, policy->session_changed_id);
+
+    /* A re-read in flight frees itself once its calls are cancelled */
+    g_cancellable_cancel(policy->cancellable);
+    g_object_unref(policy->cancellable);
+
+    g_array_unref(policy->active_sessions);
+    g_hash_table_destroy(policy->senders);
+    g_object_unref(policy->connection);
+    g_free(policy);
+}
+
+bool seat_policy_is_allowed(SeatPolicy *policy, const char *sender, const char *seat)
+{
+    if (policy == NULL || sender == NULL) {
+        return false;
+    }
+
+    SenderEntry *entry = lookup_sender(policy, sender);
+    if (entry == NULL) {
+        return false;
+    }
+
+    /* Root (other system services, administrators) is always allowed */
+    if (entry->uid == 0) {
+        return true;
+    }
+
+    if (seat == NULL) {
+        seat = "";
+    }
+
+    /* Signals ask for every client on every emission, so reuse the last
+     * decision until the sessions or the device's seat change */
+    if (entry->generation == policy->generation && g_strcmp0(entry->seat, seat) == 0) {
+        return entry->allowed;
+    }
+
+    entry->allowed = has_active_session(policy, entry->uid, seat);
+    entry->generation = policy->generation;
+    g_free(entry->seat);
+    entry->seat = g_strdup(seat);
+
+    if (!entry->allowed) {
+        if (!entry->denial_logged) {
+            g_message("Denied access for %s (uid %u) to seat '%s'", sender, entry->uid, seat);
+            entry->denial_logged = true;
+        } else {
+            g_debug("Denied access for %s (uid %u) to seat '%s'", sender, entry->uid, seat);
+        }
+    }
+
+    return entry->allowed;
+}
@@ -0,0 +1,57 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * Seat-based access control for the system-wide daemon mode
+ */
+
+#ifndef SEAT_POLICY_H
+#define SEAT_POLICY_H
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <stdbool.h>
+
+/* logind D-Bus constants */
+#define LOGIND_SERVICE            "org.freedesktop.login1"
+#define LOGIND_OBJECT_PATH        "/org/freedesktop/login1"
+#define LOGIND_MANAGER_INTERFACE  "org.freedesktop.login1.Manager"
+#define LOGIND_SESSION_INTERFACE  "org.freedesktop.login1.Session"
+
+/* Seat policy context */
+typedef struct SeatPolicy SeatPolicy;
+
+/**
+ * Create a new seat policy
+ *
+ * @param connection System bus connection (a reference is taken)
+ * @return New policy
+ */
+SeatPolicy *seat_policy_new(GDBusConnection *connection);
+
+/**
+ * Free seat policy
+ */
+void seat_policy_free(SeatPolicy *policy);
+
+/**
+ * Check whether a D-Bus client may access devices bound to a seat
+ *
+ * A client is allowed if it runs as root, or if its user owns an active
+ * logind session on the given seat. An empty or NULL seat allows any user
+ * with an active session.
+ *
+ * Active sessions are cached and re-read in the background after logind
+ * reports a session being added, removed or (de)activated; until the
+ * first read completes only root is allowed. The decision per client is
+ * cached too, so asking on every signal emission is cheap, and a denial
+ * is logged once per client.
+ *
+ * @param policy Policy context
+ * @param sender Unique bus name of the client
+ * @param seat Seat identifier (e.g. "seat0")
+ * @return true if access is allowed
+ */
+bool seat_policy_is_allowed(SeatPolicy *policy, const char *sender, const char *seat);
+
+#endif /* SEAT_POLICY_H */
@@ -0,0 +1,191 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ */
+
+#include "sleep_monitor.h"
+#include "seat_policy.h"
+#include "wakeup_stats.h"
+
+#include <gio/gunixfdlist.h>
+#include <unistd.h>
+
+struct SleepMonitor {
+    GDBusConnection *connection;
+    guint prepare_for_sleep_id;
+    GCancellable *cancellable;
+
+    int inhibit_fd;  /* Delay inhibitor, -1 when not held */
+
+    SleepCallback callback;
+    void *callback_user_data;
+};
+
+static void release_inhibitor(SleepMonitor *monitor)
+{
+    if (monitor->inhibit_fd >= 0) {
+        close(monitor->inhibit_fd);
+        monitor->inhibit_fd = -1;
+        g_debug("Released sleep delay inhibitor");
+    }
+}
+
+static void on_inhibit_reply(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+    GUnixFDList *fd_list = NULL;
+    GError *error = NULL;
+
+    GVariant *result = g_dbus_connection_call_with_unix_fd_list_finish(
+        G_DBUS_CONNECTION(source), &fd_list, res, &error);
+
+    if (error) {
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_warning("Failed to take sleep inhibitor: %s", error->message);
+        }
+        g_error_free(error);
+        return;
+    }
+
+    SleepMonitor *monitor = user_data;
+
+    gint32 index = -1;
+    g_variant_get(result, "(h)", &index);
+    g_variant_unref(result);
+
+    int fd = fd_list ? g_unix_fd_list_get(fd_list, index, &error) : -1;
+    if (fd < 0) {
+        g_warning("Sleep inhibitor reply carried no file descriptor");
+        g_clear_error(&error);
+    } else {
+        /* A resume/sleep race may have left an older one behind */
+        release_inhibitor(monitor);
+        monitor->inhibit_fd = fd;
+        g_debug("Took sleep delay inhibitor");
+    }
+
+    if (fd_list) {
+        g_object_unref(fd_list);
+    }
+}
+
+static void take_inhibitor(SleepMonitor *monitor)
+{
+    g_dbus_connection_call_with_unix_fd_list(
+        monitor->connection,
+        LOGIND_SERVICE,
+        LOGIND_OBJECT_PATH,
+        LOGIND_MANAGER_INTERFACE,
+        "Inhibit",
+        g_variant_new("(ssss)", "sleep", "LibrePods",
+                      "Disconnect AirPods cleanly before suspend", "delay"),
+        G_VARIANT_TYPE("(h)"),
+        G_DBUS_CALL_FLAGS_NONE,
+        -1,
+        NULL,
+        monitor->cancellable,
+        on_inhibit_reply,
+        monitor);
+}
+
+static void on_prepare_for_sleep(GDBusConnection *connection G_GNUC_UNUSED,
+                                 const gchar *sender_name G_GNUC_UNUSED,
+                                 const gchar *object_path G_GNUC_UNUSED,
+                                 const gchar *interface_name G_GNUC_UNUSED,
+                                 const gchar *signal_name G_GNUC_UNUSED,
+                                 GVariant *parameters,
+                                 gpointer user_data)
+{
+    SleepMonitor *monitor = user_data;
+    gboolean going_to_sleep = FALSE;
+
+    g_variant_get(parameters, "(b)", &going_to_sleep);
+    wakeup_stats_count(WAKEUP_LOGIND_SIGNAL);
+
+    if (monitor->callback) {
+        monitor->callback(going_to_sleep, monitor->callback_user_data);
+    }
+
+    if (going_to_sleep) {
+        /* Teardown is done, let logind proceed */
+        release_inhibitor(monitor);
+    } else {
+        take_inhibitor(monitor);
+    }
+}
+
+SleepMonitor *sleep_monitor_new(void)
+{
+    GError *error = NULL;
+    GDBusConnection *connection = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, &error);
+
+    if (error) {
+        g_warning("Failed to connect to system bus: %s", error->message);
+        g_error_free(error);
+        return NULL;
+    }
+
+    SleepMonitor *monitor = g_new0(SleepMonitor, 1);
+    monitor->connection = connection;
+    monitor->inhibit_fd = -1;
+    return monitor;
+}
+
+void sleep_monitor_free(SleepMonitor *monitor)
+{
+    if (monitor == NULL)
+        return;
+
+    sleep_monitor_stop(monitor);
+    g_object_unref(monitor->connection);
+    g_free(monitor);
+}
+
+void sleep_monitor_set_callback(SleepMonitor *monitor,
+                                SleepCallback callback,
+                                void *user_data)
+{
+    monitor->callback = callback;
+    monitor->callback_user_data = user_data;
+}
+
+bool sleep_monitor_start(SleepMonitor *monitor)
+{
+    if (monitor->prepare_for_sleep_id != 0) {
+        return true;
+    }
+
+    monitor->prepare_for_sleep_id = g_dbus_connection_signal_subscribe(
+        monitor->connection,
+        LOGIND_SERVICE,
+        LOGIND_MANAGER_INTERFACE,
+        "PrepareForSleep",
+        LOGIND_OBJECT_PATH,
+        NULL,
+        G_DBUS_SIGNAL_FLAGS_NONE,
+        on_prepare_for_sleep,
+        monitor,
+        NULL);
+
+    monitor->cancellable = g_cancellable_new();
+    take_inhibitor(monitor);
+
+    g_message("Sleep monitor started");
+    return true;
+}
+
+void sleep_monitor_stop(SleepMonitor *monitor)
+{
+    if (monitor->prepare_for_sleep_id != 0) {
+        g_dbus_connection_signal_unsubscribe(monitor->connection,
+                                             monitor->prepare_for_sleep_id);
+        monitor->prepare_for_sleep_id = 0;
+    }
+
+    if (monitor->cancellable) {
+        g_cancellable_cancel(monitor->cancellable);
+        g_object_unref(monitor->cancellable);
+        monitor->cancellable = NULL;
+    }
+
+    release_inhibitor(monitor);
+}
@@ -0,0 +1,58 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * System suspend/resume tracking via logind PrepareForSleep
+ */
+
+#ifndef SLEEP_MONITOR_H
+#define SLEEP_MONITOR_H
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <stdbool.h>
+
+/* Callback type, called with true before sleep and false after resume */
+typedef void (*SleepCallback)(bool going_to_sleep, void *user_data);
+
+/* Sleep monitor context */
+typedef struct SleepMonitor SleepMonitor;
+
+/**
+ * Create a new sleep monitor
+ *
+ * Connects to the system bus, so DBUS_SYSTEM_BUS_ADDRESS can point it at
+ * a logind stand-in.
+ *
+ * @return New monitor or NULL on error
+ */
+SleepMonitor *sleep_monitor_new(void);
+
+/**
+ * Free sleep monitor
+ */
+void sleep_monitor_free(SleepMonitor *monitor);
+
+/**
+ * Set sleep/resume callback
+ *
+ * The sleep callback runs while a delay inhibitor is held; the inhibitor
+ * is released as soon as it returns, so all teardown must be done inline.
+ */
+void sleep_monitor_set_callback(SleepMonitor *monitor,
+                                SleepCallback callback,
+                                void *user_data);
+
+/**
+ * Start monitoring and take the delay inhibitor
+ *
+ * @return true on success
+ */
+bool sleep_monitor_start(SleepMonitor *monitor);
+
+/**
+ * Stop monitoring and release the inhibitor
+ */
+void sleep_monitor_stop(SleepMonitor *monitor);
+
+#endif /* SLEEP_MONITOR_H */
@@ -0,0 +1,370 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ */
+
+#include "stall_detector.h"
+#include "histogram.h"
+#include "wakeup_stats.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Main loop heartbeat; lag is how late it fires. It sits on the
+ * coalesced per-second timer grid, which never adds more than 250 ms. */
+#define HEARTBEAT_INTERVAL_MS 1000
+
+/* Lag at which the main loop counts as stalled */
+#define STALL_THRESHOLD_MS 500
+
+/* Activity currently running on the main loop (static strings only) */
+static gpointer current_activity = NULL;
+
+struct StallDetector {
+    guint heartbeat_id;
+    bool idle;                      /* Nothing to do, see stall_detector_set_idle() */
+
+    /* Helper thread */
+    GThread *thread;
+    GMutex lock;
+    GCond cond;
+    bool running;
+
+    /* Shared with the helper thread, protected by lock */
+    guint interval_ms;              /* Heartbeat interval, 0 while parked */
+    gint64 last_beat_us;
+    const char *stalled_activity;   /* Captured while the stall was ongoing */
+    guint thread_wakeups;           /* Not yet passed on to wakeup stats */
+
+    /* Statistics, main thread only */
+    Log2Histogram lag_ms;
+    guint stall_count;
+    gint64 longest_stall_us;
+    gint64 last_stall_us;
+    const char *last_stall_activity;
+
+    /* systemd watchdog */
+    int notify_fd;
+    struct sockaddr_un notify_addr;
+    socklen_t notify_addr_len;
+    gint64 watchdog_usec;           /* 0 if disabled */
+    guint watchdog_pings;
+};
+
+const char *stall_detector_enter(const char *activity)
+{
+    /* Only the main thread writes, so no exchange is needed */
+    const char *previous = g_atomic_pointer_get(&current_activity);
+    g_atomic_pointer_set(&current_activity, (gpointer)activity);
+    return previous;
+}
+
+void stall_detector_leave(const char *previous)
+{
+    g_atomic_pointer_set(&current_activity, (gpointer)previous);
+}
+
+/* ============================================================================
+ * systemd notification (sd_notify without libsystemd)
+ * ========================================================================== */
+
+static void setup_watchdog(StallDetector *detector)
+{
+    const char *socket_path = g_getenv("NOTIFY_SOCKET");
+    const char *usec = g_getenv("WATCHDOG_USEC");
+    const char *pid = g_getenv("WATCHDOG_PID");
+
+    if (socket_path == NULL || usec == NULL) {
+        return;
+    }
+
+    /* The watchdog may be meant for a parent process */
+    if (pid != NULL && strtol(pid, NULL, 10) != (long)getpid()) {
+        return;
+    }
+
+    gint64 watchdog_usec = g_ascii_strtoll(usec, NULL, 10);
+    size_t path_len = strlen(socket_path);
+    if (watchdog_usec <= 0 || path_len == 0 ||
+        path_len >= sizeof(detector->notify_addr.sun_path)) {
+        return;
+    }
+
+    memset(&detector->notify_addr, 0, sizeof(detector->notify_addr));
+    detector->notify_addr.sun_family = AF_UNIX;
+    memcpy(detector->notify_addr.sun_path, socket_path, path_len);
+
+    /* Abstract namespace socket */
+    if (socket_path[0] == '@') {
+        detector->notify_addr.sun_path[0] = '\0';
+    }
+
+    detector->notify_addr_len = offsetof(struct sockaddr_un, sun_path) + path_len;
+    detector->notify_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (detector->notify_fd < 0) {
+        g_warning("Failed to create notify socket: %s", strerror(errno));
+        return;
+    }
+
+    detector->watchdog_usec = watchdog_usec;
+    g_message("systemd watchdog enabled (%" G_GINT64_FORMAT " ms)", watchdog_usec / 1000);
+}
+
+static void send_watchdog_ping(StallDetector *detector)
+{
+    static const char message[] = "WATCHDOG=1";
+
+    if (sendto(detector->notify_fd, message, sizeof(message) - 1, MSG_NOSIGNAL,
+               (struct sockaddr *)&detector->notify_addr, detector->notify_addr_len) < 0) {
+        g_debug("Failed to ping watchdog: %s", strerror(errno));
+        return;
+    }
+
+    detector->watchdog_pings++;
+}
+
+/* ============================================================================
+ * Heartbeat and helper thread
+ * ========================================================================== */
+
+static void record_lag(StallDetector *detector, gint64 lag_us, const char *activity)
+{
+    guint64 lag_ms = (guint64)lag_us / 1000;
+    log2_histogram_add(&detector->lag_ms, lag_ms);
+
+    if (lag_ms < STALL_THRESHOLD_MS) {
+        return;
+    }
+
+    detector->stall_count++;
+    detector->last_stall_us = lag_us;
+    detector->last_stall_activity = activity;
+    if (lag_us > detector->longest_stall_us) {
+        detector->longest_stall_us = lag_us;
+    }
+
+    g_warning("Main loop stalled for %" G_GUINT64_FORMAT " ms (in %s)", lag_ms, activity);
+}
+
+static gboolean on_heartbeat(gpointer user_data)
+{
+    StallDetector *detector = user_data;
+    gint64 now = g_get_monotonic_time();
+
+    wakeup_stats_count(WAKEUP_TIMER_HEARTBEAT);
+
+    g_mutex_lock(&detector->lock);
+    gint64 lag = MAX(now - detector->last_beat_us - (gint64)detector->interval_ms * 1000, 0);
+    detector->last_beat_us = now;
+    const char *activity = detector->stalled_activity;
+    detector->stalled_activity = NULL;
+    guint thread_wakeups = detector->thread_wakeups;
+    detector->thread_wakeups = 0;
+    g_mutex_unlock(&detector->lock);
+
+    if (thread_wakeups > 0) {
+        wakeup_stats_add(WAKEUP_STALL_THREAD, thread_wakeups);
+    }
+
+    record_lag(detector, lag, activity ? activity : "unknown");
+
+    return G_SOURCE_CONTINUE;
+}
+
+/* Heartbeat interval for the current mode. While idle, the heartbeat only
+ * runs to feed the watchdog, as rarely as it allows on the per-second
+ * grid; without a watchdog both the heartbeat and the helper thread park. */
+static guint heartbeat_interval(StallDetector *detector)
+{
+    if (!detector->idle) {
+        return HEARTBEAT_INTERVAL_MS;
+    }
+    if (detector->watchdog_usec > 0) {
+        return MAX(detector->watchdog_usec / 4 / G_USEC_PER_SEC, 1) * 1000;
+    }
+    return 0;
+}
+
+static void schedule_heartbeat(StallDetector *detector)
+{
+    if (detector->heartbeat_id != 0) {
+        g_source_remove(detector->heartbeat_id);
+        detector->heartbeat_id = 0;
+    }
+
+    guint interval_ms = heartbeat_interval(detector);
+
+    /* Restart lag measurement from now, with the new interval */
+    g_mutex_lock(&detector->lock);
+    detector->interval_ms = interval_ms;
+    detector->last_beat_us = g_get_monotonic_time();
+    detector->stalled_activity = NULL;
+    g_cond_signal(&detector->cond);
+    g_mutex_unlock(&detector->lock);
+
+    if (interval_ms > 0) {
+        detector->heartbeat_id = wakeup_timeout_add(interval_ms, 1000, on_heartbeat, detector);
+    }
+}
+
+static gpointer helper_thread(gpointer user_data)
+{
+    StallDetector *detector = user_data;
+    gint64 last_ping = 0;
+
+    g_mutex_lock(&detector->lock);
+    while (detector->running) {
+        detector->thread_wakeups++;
+
+        /* Parked: wait for stall_detector_set_idle() or stop */
+        if (detector->interval_ms == 0) {
+            g_cond_wait(&detector->cond, &detector->lock);
+            continue;
+        }
+
+        gint64 interval_us = (gint64)detector->interval_ms * 1000;
+        gint64 check_interval = interval_us;
+        if (detector->watchdog_usec > 0) {
+            check_interval = MIN(check_interval, detector->watchdog_usec / 4);
+        }
+
+        gint64 now = g_get_monotonic_time();
+        gint64 beat_age = now - detector->last_beat_us;
+
+        /* Overdue heartbeat: note what the main loop is stuck in */
+        if (beat_age > interval_us + STALL_THRESHOLD_MS * 1000 &&
+            detector->stalled_activity == NULL) {
+            const char *activity = g_atomic_pointer_get(&current_activity);
+            detector->stalled_activity = activity ? activity : "idle";
+        }
+
+        /* Only vouch for the daemon while the main loop is responsive */
+        if (detector->watchdog_usec > 0 &&
+            beat_age < detector->watchdog_usec / 2 &&
+            now - last_ping >= detector->watchdog_usec / 2 - check_interval) {
+            send_watchdog_ping(detector);
+            last_ping = now;
+        }
+
+        g_cond_wait_until(&detector->cond, &detector->lock, now + check_interval);
+    }
+    g_mutex_unlock(&detector->lock);
+
+    return NULL;
+}
+
+/* ============================================================================
+ * Public API
+ * ========================================================================== */
+
+StallDetector *stall_detector_new(void)
+{
+    StallDetector *detector = g_new0(StallDetector, 1);
+    detector->notify_fd = -1;
+    g_mutex_init(&detector->lock);
+    g_cond_init(&detector->cond);
+
+    setup_watchdog(detector);
+
+    return detector;
+}
+
+void stall_detector_free(StallDetector *detector)
+{
+    if (detector == NULL)
+        return;
+
+    stall_detector_stop(detector);
+
+    if (detector->notify_fd >= 0) {
+        close(detector->notify_fd);
+    }
+
+    g_mutex_clear(&detector->lock);
+    g_cond_clear(&detector->cond);
+    g_free(detector);
+}
+
+bool stall_detector_start(StallDetector *detector)
+{
+    if (detector->thread != NULL) {
+        return true;
+    }
+
+    schedule_heartbeat(detector);
+
+    GError *error = NULL;
+    detector->running = true;
+    detector->thread = g_thread_try_new("stall-detector", helper_thread, detector, &error);
+    if (detector->thread == NULL) {
+        g_warning("Failed to start stall detector thread: %s", error->message);
+        g_error_free(error);
+        detector->running = false;
+        g_source_remove(detector->heartbeat_id);
+        detector->heartbeat_id = 0;
+        return false;
+    }
+
+    return true;
+}
+
+void stall_detector_stop(StallDetector *detector)
+{
+    if (detector->thread != NULL) {
+        g_mutex_lock(&detector->lock);
+        detector->running = false;
+        g_cond_signal(&detector->cond);
+        g_mutex_unlock(&detector->lock);
+
+        g_thread_join(detector->thread);
+        detector->thread = NULL;
+    }
+
+    if (detector->heartbeat_id != 0) {
+        g_source_remove(detector->heartbeat_id);
+        detector->heartbeat_id = 0;
+    }
+}
+
+void stall_detector_set_idle(StallDetector *detector, bool idle)
+{
+    if (detector->idle == idle) {
+        return;
+    }
+
+    detector->idle = idle;
+    g_debug("Stall detector %s", idle ? "idle" : "active");
+
+    if (detector->thread != NULL) {
+        schedule_heartbeat(detector);
+    }
+}
+
+GVariant *stall_detector_get_stats(StallDetector *detector)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+
+    g_variant_builder_add(&builder, "{sv}", "LagMs", log2_histogram_to_variant(&detector->lag_ms));
+    g_variant_builder_add(&builder, "{sv}", "Stalls", g_variant_new_uint32(detector->stall_count));
+    g_variant_builder_add(&builder, "{sv}", "LongestStallMs",
+                          g_variant_new_uint32((guint32)(detector->longest_stall_us / 1000)));
+    g_variant_builder_add(&builder, "{sv}", "LastStallMs",
+                          g_variant_new_uint32((guint32)(detector->last_stall_us / 1000)));
+    g_variant_builder_add(&builder, "{sv}", "LastStallActivity",
+                          g_variant_new_string(detector->last_stall_activity
+                                               ? detector->last_stall_activity : ""));
+    g_variant_builder_add(&builder, "{sv}", "WatchdogEnabled",
+                          g_variant_new_boolean(detector->watchdog_usec > 0));
+    g_variant_builder_add(&builder, "{sv}", "WatchdogPings", g_variant_new_uint32(detector->watchdog_pings));
+    g_variant_builder_add(&builder, "{sv}", "Idle", g_variant_new_boolean(detector->idle));
+    g_variant_builder_add(&builder, "{sv}", "HeartbeatIntervalMs",
+                          g_variant_new_uint32(detector->heartbeat_id != 0 ? detector->interval_ms : 0));
+
+    return g_variant_builder_end(&builder);
+}
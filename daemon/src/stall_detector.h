@@ -0,0 +1,75 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * Main-loop stall detection and systemd watchdog support
+ */
+
+#ifndef STALL_DETECTOR_H
+#define STALL_DETECTOR_H
+
+#include <glib.h>
+#include <stdbool.h>
+
+/* Stall detector context */
+typedef struct StallDetector StallDetector;
+
+/**
+ * Create a new stall detector for the default main context
+ *
+ * If the service manager asked for watchdog keep-alives (WATCHDOG_USEC),
+ * they are sent from the helper thread, but only while the main loop
+ * keeps up with its heartbeat.
+ *
+ * @return New stall detector
+ */
+StallDetector *stall_detector_new(void);
+
+/**
+ * Free stall detector
+ */
+void stall_detector_free(StallDetector *detector);
+
+/**
+ * Start the heartbeat and the helper thread
+ *
+ * @return true on success
+ */
+bool stall_detector_start(StallDetector *detector);
+
+/**
+ * Stop the heartbeat and join the helper thread
+ */
+void stall_detector_stop(StallDetector *detector);
+
+/**
+ * Switch between normal and idle operation
+ *
+ * While idle (no usable Bluetooth adapter) stalls are not tracked. The
+ * heartbeat and the helper thread park entirely, or, if the watchdog is
+ * enabled, only run as often as it needs keep-alives.
+ */
+void stall_detector_set_idle(StallDetector *detector, bool idle);
+
+/**
+ * Mark the main loop as busy with an activity
+ *
+ * Used to tell which work was running when a stall is detected. Cheap
+ * enough to call on every dispatch, even without a running detector.
+ *
+ * @param activity Static string naming the activity
+ * @return Previous activity, to be passed to stall_detector_leave()
+ */
+const char *stall_detector_enter(const char *activity);
+
+/**
+ * Restore the activity returned by stall_detector_enter()
+ */
+void stall_detector_leave(const char *previous);
+
+/**
+ * Get lag histogram and stall statistics as a{sv}
+ */
+GVariant *stall_detector_get_stats(StallDetector *detector);
+
+#endif /* STALL_DETECTOR_H */
@@ -0,0 +1,243 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ */
+
+#include "usage_stats.h"
+#include "config.h"
+
+#include <string.h>
+
+/* Save on an ear change at most this often; always on disconnect */
+#define USAGE_SAVE_INTERVAL_US (15 * 60 * G_USEC_PER_SEC)
+
+typedef enum {
+    USAGE_STATE_OTHER,      /* Unknown, or out of ear but not in the case */
+    USAGE_STATE_BOTH_IN_EAR,
+    USAGE_STATE_ONE_IN_EAR,
+    USAGE_STATE_IN_CASE,
+    USAGE_STATE_COUNT,
+} UsageState;
+
+struct UsageStats {
+    bool active;
+    BtAddr device;
+
+    /* Oldest first, the last entry is the most recent day */
+    DailyUsage days[USAGE_MAX_DAYS];
+    guint n_days;
+
+    /* Current state and when it began (wall clock, for day boundaries) */
+    UsageState state;
+    gint64 state_since_us;
+    gint64 remainder_us[USAGE_STATE_COUNT];  /* Not yet a full second */
+
+    bool dirty;
+    gint64 last_save_us;
+};
+
+UsageStats *usage_stats_new(void)
+{
+    return g_new0(UsageStats, 1);
+}
+
+void usage_stats_free(UsageStats *stats)
+{
+    if (stats == NULL)
+        return;
+
+    usage_stats_stop(stats);
+    g_free(stats);
+}
+
+/* Julian day of a time, and the time the next local day starts */
+static guint32 local_day(gint64 time_us, gint64 *next_day_us)
+{
+    GDateTime *time = g_date_time_new_from_unix_local(time_us / G_USEC_PER_SEC);
+    gint year, month, day;
+    g_date_time_get_ymd(time, &year, &month, &day);
+    g_date_time_unref(time);
+
+    GDateTime *midnight = g_date_time_new_local(year, month, day, 0, 0, 0);
+    GDateTime *next = g_date_time_add_days(midnight, 1);
+    *next_day_us = g_date_time_to_unix(next) * G_USEC_PER_SEC;
+    g_date_time_unref(next);
+    g_date_time_unref(midnight);
+
+    GDate date;
+    g_date_clear(&date, 1);
+    g_date_set_dmy(&date, day, month, year);
+    return g_date_get_julian(&date);
+}
+
+static DailyUsage *day_entry(UsageStats *stats, guint32 day)
+{
+    /* Days only move forward; a clock set back keeps the latest day */
+    if (stats->n_days > 0 && stats->days[stats->n_days - 1].day >= day) {
+        return &stats->days[stats->n_days - 1];
+    }
+
+    if (stats->n_days == USAGE_MAX_DAYS) {
+        memmove(&stats->days[0], &stats->days[1], (USAGE_MAX_DAYS - 1) * sizeof(DailyUsage));
+        stats->n_days--;
+    }
+
+    DailyUsage *entry = &stats->days[stats->n_days++];
+    memset(entry, 0, sizeof(*entry));
+    entry->day = day;
+    return entry;
+}
+
+/* Book the time since the state began, split at local midnight */
+static void account(UsageStats *stats, gint64 now)
+{
+    gint64 start = stats->state_since_us;
+    stats->state_since_us = now;
+
+    if (stats->state == USAGE_STATE_OTHER) {
+        return;
+    }
+
+    while (start < now) {
+        gint64 next_day_us;
+        DailyUsage *day = day_entry(stats, local_day(start, &next_day_us));
+        gint64 end = MIN(now, next_day_us);
+
+        gint64 elapsed = end - start + stats->remainder_us[stats->state];
+        guint32 seconds = (guint32)(elapsed / G_USEC_PER_SEC);
+        stats->remainder_us[stats->state] = elapsed % G_USEC_PER_SEC;
+
+        switch (stats->state) {
+        case USAGE_STATE_BOTH_IN_EAR:
+            day->both_in_ear_s += seconds;
+            break;
+        case USAGE_STATE_ONE_IN_EAR:
+            day->one_in_ear_s += seconds;
+            break;
+        case USAGE_STATE_IN_CASE:
+            day->in_case_s += seconds;
+            break;
+        default:
+            break;
+        }
+
+        start = end;
+    }
+
+    stats->dirty = true;
+}
+
+static void save(UsageStats *stats, gint64 now)
+{
+    if (stats->dirty && config_save_device_usage(&stats->device, stats->days, stats->n_days)) {
+        stats->dirty = false;
+    }
+    stats->last_save_us = now;
+}
+
+void usage_stats_start(UsageStats *stats, const BtAddr *device_address)
+{
+    usage_stats_stop(stats);
+
+    stats->active = true;
+    stats->device = *device_address;
+    stats->n_days = config_load_device_usage(device_address, stats->days);
+    stats->state = USAGE_STATE_OTHER;
+    stats->state_since_us = g_get_real_time();
+    memset(stats->remainder_us, 0, sizeof(stats->remainder_us));
+    stats->dirty = false;
+    stats->last_save_us = stats->state_since_us;
+}
+
+void usage_stats_stop(UsageStats *stats)
+{
+    if (stats == NULL || !stats->active) {
+        return;
+    }
+
+    gint64 now = g_get_real_time();
+    account(stats, now);
+    save(stats, now);
+    stats->active = false;
+}
+
+void usage_stats_on_ear_detection(UsageStats *stats,
+                                  bool primary_in_ear, bool secondary_in_ear,
+                                  bool primary_in_case, bool secondary_in_case)
+{
+    if (!stats->active) {
+        return;
+    }
+
+    UsageState state;
+    if (primary_in_ear && secondary_in_ear) {
+        state = USAGE_STATE_BOTH_IN_EAR;
+    } else if (primary_in_ear || secondary_in_ear) {
+        state = USAGE_STATE_ONE_IN_EAR;
+    } else if (primary_in_case && secondary_in_case) {
+        state = USAGE_STATE_IN_CASE;
+    } else {
+        state = USAGE_STATE_OTHER;
+    }
+
+    if (state == stats->state) {
+        return;
+    }
+
+    gint64 now = g_get_real_time();
+    account(stats, now);
+    stats->state = state;
+
+    gint64 next_day_us;
+    day_entry(stats, local_day(now, &next_day_us))->transitions++;
+    stats->dirty = true;
+
+    if (now - stats->last_save_us >= USAGE_SAVE_INTERVAL_US) {
+        save(stats, now);
+    }
+}
+
+GVariant *usage_stats_get(UsageStats *stats, const BtAddr *device_address)
+{
+    const DailyUsage *days = stats->days;
+    DailyUsage *loaded = NULL;
+    guint n_days;
+
+    if (stats->active && bt_addr_equal(&stats->device, device_address)) {
+        /* Include the state the buds are in right now */
+        account(stats, g_get_real_time());
+        n_days = stats->n_days;
+    } else {
+        loaded = g_new(DailyUsage, USAGE_MAX_DAYS);
+        n_days = config_load_device_usage(device_address, loaded);
+        days = loaded;
+    }
+
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("aa{sv}"));
+
+    for (guint i = 0; i < n_days; i++) {
+        GDate date;
+        g_date_clear(&date, 1);
+        g_date_set_julian(&date, days[i].day);
+
+        char date_str[16];
+        g_snprintf(date_str, sizeof(date_str), "%04u-%02u-%02u",
+                   g_date_get_year(&date), g_date_get_month(&date), g_date_get_day(&date));
+
+        g_variant_builder_open(&builder, G_VARIANT_TYPE("a{sv}"));
+        g_variant_builder_add(&builder, "{sv}", "Date", g_variant_new_string(date_str));
+        g_variant_builder_add(&builder, "{sv}", "BothInEarSeconds",
+                              g_variant_new_uint32(days[i].both_in_ear_s));
+        g_variant_builder_add(&builder, "{sv}", "OneInEarSeconds",
+                              g_variant_new_uint32(days[i].one_in_ear_s));
+        g_variant_builder_add(&builder, "{sv}", "InCaseSeconds",
+                              g_variant_new_uint32(days[i].in_case_s));
+        g_variant_builder_add(&builder, "{sv}", "Transitions",
+                              g_variant_new_uint32(days[i].transitions));
+        g_variant_builder_close(&builder);
+    }
+
+    g_free(loaded);
+    return g_variant_builder_end(&builder);
+}
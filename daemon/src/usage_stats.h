@@ -0,0 +1,64 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * Per-device wear time, aggregated per day
+ */
+
+#ifndef USAGE_STATS_H
+#define USAGE_STATS_H
+
+#include <glib.h>
+#include <stdbool.h>
+
+#include "bt_addr.h"
+
+/* Usage accounting context */
+typedef struct UsageStats UsageStats;
+
+/**
+ * Create a new usage accounting context
+ *
+ * @return New context
+ */
+UsageStats *usage_stats_new(void);
+
+/**
+ * Free context, saving the connected device's usage first
+ */
+void usage_stats_free(UsageStats *stats);
+
+/**
+ * Start accounting for a connected device
+ *
+ * Loads the days stored for the device. Time is not counted until the
+ * first ear detection update.
+ */
+void usage_stats_start(UsageStats *stats, const BtAddr *device_address);
+
+/**
+ * Stop accounting and save the device's usage
+ *
+ * Does nothing if stats is NULL or accounting was not started.
+ */
+void usage_stats_stop(UsageStats *stats);
+
+/**
+ * Record the current ear state
+ *
+ * Cheap when nothing changed; a change books the time spent in the
+ * previous state to the day(s) it fell on.
+ */
+void usage_stats_on_ear_detection(UsageStats *stats,
+                                  bool primary_in_ear, bool secondary_in_ear,
+                                  bool primary_in_case, bool secondary_in_case);
+
+/**
+ * Get per-day usage of a device as aa{sv}, oldest day first
+ *
+ * Each day has Date (YYYY-MM-DD), BothInEarSeconds, OneInEarSeconds,
+ * InCaseSeconds and Transitions.
+ */
+GVariant *usage_stats_get(UsageStats *stats, const BtAddr *device_address);
+
+#endif /* USAGE_STATS_H */
@@ -0,0 +1,198 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ */
+
+#include "wakeup_stats.h"
+
+#include <stdbool.h>
+
+static const char *source_names[WAKEUP_SOURCE_COUNT] = {
+    [WAKEUP_BT_SOCKET]             = "BtSocket",
+    [WAKEUP_BLUEZ_ADAPTER_SIGNAL]  = "BluezAdapterSignal",
+    [WAKEUP_BLUEZ_DEVICE_SIGNAL]   = "BluezDeviceSignal",
+    [WAKEUP_BLUEZ_OBJECT_SIGNAL]   = "BluezObjectSignal",
+    [WAKEUP_LOGIND_SIGNAL]         = "LogindSignal",
+    [WAKEUP_LOGIND_REPLY]          = "LogindReply",
+    [WAKEUP_DBUS_METHOD]           = "DbusMethod",
+    [WAKEUP_DBUS_PROPERTY]         = "DbusProperty",
+    [WAKEUP_MPRIS_REPLY]           = "MprisReply",
+    [WAKEUP_MPRIS_SIGNAL]          = "MprisSignal",
+    [WAKEUP_CONFIG_FILE]           = "ConfigFile",
+    [WAKEUP_TIMER_HEARTBEAT]       = "TimerHeartbeat",
+    [WAKEUP_STALL_THREAD]          = "StallThread",
+    [WAKEUP_TIMER_APPLY_SETTINGS]  = "TimerApplySettings",
+    [WAKEUP_TIMER_RESUME_RECHECK]  = "TimerResumeRecheck",
+    [WAKEUP_TIMER_TX_PACING]       = "TimerTxPacing",
+    [WAKEUP_IDLE_RESCAN]           = "IdleRescan",
+};
+
+static guint64 counts[WAKEUP_SOURCE_COUNT];
+static gint64 start_time_us;   /* Rates are measured from the first wakeup */
+
+void wakeup_stats_count(WakeupSource source)
+{
+    wakeup_stats_add(source, 1);
+}
+
+void wakeup_stats_add(WakeupSource source, guint count)
+{
+    if (start_time_us == 0) {
+        start_time_us = g_get_monotonic_time();
+    }
+    counts[source] += count;
+}
+
+GVariant *wakeup_stats_get(void)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+
+    guint64 total = 0;
+    for (int i = 0; i < WAKEUP_SOURCE_COUNT; i++) {
+        g_variant_builder_add(&builder, "{sv}", source_names[i], g_variant_new_uint64(counts[i]));
+        total += counts[i];
+    }
+
+    double minutes = start_time_us != 0
+                     ? (g_get_monotonic_time() - start_time_us) / (60.0 * G_USEC_PER_SEC)
+                     : 0.0;
+
+    g_variant_builder_add(&builder, "{sv}", "Total", g_variant_new_uint64(total));
+    g_variant_builder_add(&builder, "{sv}", "PerMinute",
+                          g_variant_new_double(minutes > 0.0 ? total / minutes : 0.0));
+
+    return g_variant_builder_end(&builder);
+}
+
+/* ============================================================================
+ * Virtual clock
+ * ========================================================================== */
+
+/* A timer on the virtual clock */
+typedef struct {
+    GSource source;
+    guint interval_ms;
+    gint64 deadline_ms;
+} VirtualTimer;
+
+static bool clock_virtual;
+static gint64 virtual_now_ms;
+static GList *virtual_timers;  /* Every VirtualTimer not yet finalized */
+
+static gboolean virtual_timer_prepare(GSource *source, gint *timeout)
+{
+    /* Nothing to wait for: only wakeup_clock_advance() makes a timer due */
+    *timeout = -1;
+    return ((VirtualTimer *)source)->deadline_ms <= virtual_now_ms;
+}
+
+static gboolean virtual_timer_check(GSource *source)
+{
+    return ((VirtualTimer *)source)->deadline_ms <= virtual_now_ms;
+}
+
+static gboolean virtual_timer_dispatch(GSource *source, GSourceFunc callback, gpointer user_data)
+{
+    VirtualTimer *timer = (VirtualTimer *)source;
+
+    if (!callback(user_data)) {
+        return G_SOURCE_REMOVE;
+    }
+    timer->deadline_ms += timer->interval_ms;
+    return G_SOURCE_CONTINUE;
+}
+
+static void virtual_timer_finalize(GSource *source)
+{
+    virtual_timers = g_list_remove(virtual_timers, source);
+}
+
+static GSourceFuncs virtual_timer_funcs = {
+    .prepare = virtual_timer_prepare,
+    .check = virtual_timer_check,
+    .dispatch = virtual_timer_dispatch,
+    .finalize = virtual_timer_finalize,
+};
+
+static guint virtual_timeout_add(guint interval_ms, GSourceFunc function, gpointer data)
+{
+    GSource *source = g_source_new(&virtual_timer_funcs, sizeof(VirtualTimer));
+    VirtualTimer *timer = (VirtualTimer *)source;
+    timer->interval_ms = interval_ms;
+    timer->deadline_ms = virtual_now_ms + interval_ms;
+
+    g_source_set_callback(source, function, data, NULL);
+    guint id = g_source_attach(source, NULL);
+    virtual_timers = g_list_prepend(virtual_timers, source);
+    g_source_unref(source);
+    return id;
+}
+
+/* Earliest deadline of a timer still attached, or G_MAXINT64 */
+static gint64 next_deadline(void)
+{
+    gint64 next = G_MAXINT64;
+    for (GList *l = virtual_timers; l != NULL; l = l->next) {
+        VirtualTimer *timer = l->data;
+        if (!g_source_is_destroyed(&timer->source)) {
+            next = MIN(next, timer->deadline_ms);
+        }
+    }
+    return next;
+}
+
+static void dispatch_ready(void)
+{
+    while (g_main_context_iteration(NULL, FALSE)) {
+    }
+}
+
+void wakeup_clock_use_virtual(void)
+{
+    clock_virtual = true;
+}
+
+void wakeup_clock_advance(guint ms)
+{
+    gint64 target = virtual_now_ms + ms;
+
+    dispatch_ready();
+    for (gint64 next = next_deadline(); next <= target; next = next_deadline()) {
+        virtual_now_ms = MAX(virtual_now_ms, next);
+        dispatch_ready();
+    }
+
+    virtual_now_ms = target;
+}
+
+gint64 wakeup_clock_now_ms(void)
+{
+    return virtual_now_ms;
+}
+
+guint wakeup_clock_pending(void)
+{
+    guint pending = 0;
+    for (GList *l = virtual_timers; l != NULL; l = l->next) {
+        pending += !g_source_is_destroyed(&((VirtualTimer *)l->data)->source);
+    }
+    return pending;
+}
+
+/* ============================================================================
+ * Coalesced timers
+ * ========================================================================== */
+
+guint wakeup_timeout_add(guint interval_ms, guint slack_ms,
+                         GSourceFunc function, gpointer data)
+{
+    if (clock_virtual) {
+        return virtual_timeout_add(interval_ms, function, data);
+    }
+
+    if (slack_ms >= 1000) {
+        return g_timeout_add_seconds(MAX((interval_ms + 999) / 1000, 1), function, data);
+    }
+    return g_timeout_add(interval_ms, function, data);
+}
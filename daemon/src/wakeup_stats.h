@@ -0,0 +1,92 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * Per-source wakeup accounting and coalesced timers
+ */
+
+#ifndef WAKEUP_STATS_H
+#define WAKEUP_STATS_H
+
+#include <glib.h>
+
+/* Everything that can wake the daemon up */
+typedef enum {
+    WAKEUP_BT_SOCKET,
+    WAKEUP_BLUEZ_ADAPTER_SIGNAL,
+    WAKEUP_BLUEZ_DEVICE_SIGNAL,
+    WAKEUP_BLUEZ_OBJECT_SIGNAL,
+    WAKEUP_LOGIND_SIGNAL,
+    WAKEUP_LOGIND_REPLY,
+    WAKEUP_DBUS_METHOD,
+    WAKEUP_DBUS_PROPERTY,
+    WAKEUP_MPRIS_REPLY,
+    WAKEUP_MPRIS_SIGNAL,
+    WAKEUP_CONFIG_FILE,
+    WAKEUP_TIMER_HEARTBEAT,
+    WAKEUP_STALL_THREAD,
+    WAKEUP_TIMER_APPLY_SETTINGS,
+    WAKEUP_TIMER_RESUME_RECHECK,
+    WAKEUP_TIMER_TX_PACING,
+    WAKEUP_IDLE_RESCAN,
+    WAKEUP_SOURCE_COUNT,
+} WakeupSource;
+
+/**
+ * Count one wakeup (main thread only)
+ */
+void wakeup_stats_count(WakeupSource source);
+
+/**
+ * Count wakeups collected elsewhere, e.g. by a helper thread (main thread only)
+ */
+void wakeup_stats_add(WakeupSource source, guint count);
+
+/**
+ * Get wakeup counts per source, total and rate as a{sv}
+ */
+GVariant *wakeup_stats_get(void);
+
+/**
+ * Add a timer that may fire late by up to slack_ms
+ *
+ * With a second or more of slack the timer is put on GLib's per-second
+ * timer grid (g_timeout_add_seconds), so it fires together with the
+ * other coalesced timers instead of waking the daemon on its own.
+ *
+ * @param interval_ms Nominal interval
+ * @param slack_ms How late the timer may fire
+ * @return Source ID
+ */
+guint wakeup_timeout_add(guint interval_ms, guint slack_ms,
+                         GSourceFunc function, gpointer data);
+
+/**
+ * Run timers added from now on by wakeup_timeout_add() on a virtual clock
+ *
+ * For tests: such timers only fire when wakeup_clock_advance() moves the
+ * clock past their deadline, and then exactly on it, whatever their slack.
+ * They can still be removed with g_source_remove().
+ */
+void wakeup_clock_use_virtual(void);
+
+/**
+ * Move the virtual clock forward
+ *
+ * Stops at every timer deadline on the way, in deadline order, and
+ * dispatches the default main context until nothing is ready, so that
+ * whatever a timer sets off has happened before the next one fires.
+ */
+void wakeup_clock_advance(guint ms);
+
+/**
+ * Get the virtual clock, in milliseconds since it was started
+ */
+gint64 wakeup_clock_now_ms(void);
+
+/**
+ * Count timers waiting on the virtual clock
+ */
+guint wakeup_clock_pending(void);
+
+#endif /* WAKEUP_STATS_H */
@@ -0,0 +1,137 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * Tests for device address parsing and formatting
+ */
+
+#include "bt_addr.h"
+
+static const BtAddr expected = { { 0x01, 0x23, 0x45, 0x67, 0x89, 0xAB } };
+
+static void test_from_string(void)
+{
+    BtAddr addr;
+
+    g_assert_true(bt_addr_from_string("01:23:45:67:89:AB", &addr));
+    g_assert_true(bt_addr_equal(&addr, &expected));
+
+    /* Config groups use '_', and case does not matter */
+    memset(&addr, 0, sizeof(addr));
+    g_assert_true(bt_addr_from_string("01_23_45_67_89_ab", &addr));
+    g_assert_true(bt_addr_equal(&addr, &expected));
+}
+
+static void test_from_string_invalid(void)
+{
+    static const char *const invalid[] = {
+        "",
+        "01:23:45:67:89",
+        "01:23:45:67:89:A",
+        "01:23:45:67:89:ABC",
+        "01:23:45:67:89:AB:",
+        "01-23-45-67-89-AB",
+        "0123456789AB",
+        "01:23:45:67:89:AG",
+        " 01:23:45:67:89:AB",
+        "1:23:45:67:89:AB",
+    };
+    static const BtAddr untouched = { { 0xDE, 0xAD, 0xBE, 0xEF, 0x00, 0x01 } };
+
+    for (gsize i = 0; i < G_N_ELEMENTS(invalid); i++) {
+        BtAddr addr = untouched;
+        g_assert_false(bt_addr_from_string(invalid[i], &addr));
+        g_assert_true(bt_addr_equal(&addr, &untouched));
+    }
+
+    BtAddr addr = untouched;
+    g_assert_false(bt_addr_from_string(NULL, &addr));
+}
+
+static void test_from_device_path(void)
+{
+    BtAddr addr;
+    guint adapter_index = 99;
+
+    g_assert_true(bt_addr_from_device_path("/org/bluez/hci0/dev_01_23_45_67_89_AB",
+                                           &addr, &adapter_index));
+    g_assert_true(bt_addr_equal(&addr, &expected));
+    g_assert_cmpuint(adapter_index, ==, 0);
+
+    g_assert_true(bt_addr_from_device_path("/org/bluez/hci12/dev_01_23_45_67_89_AB",
+                                           &addr, &adapter_index));
+    g_assert_cmpuint(adapter_index, ==, 12);
+
+    /* The adapter index is optional */
+    g_assert_true(bt_addr_from_device_path("/org/bluez/hci1/dev_01_23_45_67_89_AB", &addr, NULL));
+}
+
+static void test_from_device_path_invalid(void)
+{
+    static const char *const invalid[] = {
+        "/org/bluez/hci0",
+        "/org/bluez/hci0/dev_01_23_45_67_89",
+        "/org/bluez/hci0/dev_01_23_45_67_89_AB/sep1",
+        "/org/bluez/hci0/01_23_45_67_89_AB",
+        "dev_01_23_45_67_89_AB",
+    };
+    BtAddr addr;
+
+    for (gsize i = 0; i < G_N_ELEMENTS(invalid); i++) {
+        g_assert_false(bt_addr_from_device_path(invalid[i], &addr, NULL));
+    }
+    g_assert_false(bt_addr_from_device_path(NULL, &addr, NULL));
+}
+
+static void test_format_round_trip(void)
+{
+    char buf[BT_ADDR_STRLEN];
+    BtAddr addr;
+
+    g_assert_cmpstr(bt_addr_to_string(&expected, buf), ==, "01:23:45:67:89:AB");
+    g_assert_true(bt_addr_from_string(buf, &addr));
+    g_assert_true(bt_addr_equal(&addr, &expected));
+
+    g_assert_cmpstr(bt_addr_format(&expected, '_', buf), ==, "01_23_45_67_89_AB");
+    g_assert_true(bt_addr_from_string(buf, &addr));
+    g_assert_true(bt_addr_equal(&addr, &expected));
+}
+
+static void test_to_u64(void)
+{
+    static const BtAddr high = { { 0xFF, 0x00, 0x00, 0x00, 0x00, 0x01 } };
+
+    /* Most significant byte first, as written */
+    g_assert_cmpuint(bt_addr_to_u64(&expected), ==, G_GUINT64_CONSTANT(0x0123456789AB));
+    g_assert_cmpuint(bt_addr_to_u64(&high), ==, G_GUINT64_CONSTANT(0xFF0000000001));
+}
+
+static void test_null_address(void)
+{
+    static const BtAddr null_address = { { 0 } };
+    char buf[BT_ADDR_STRLEN];
+    BtAddr addr;
+
+    g_assert_true(bt_addr_is_null(&null_address));
+    g_assert_false(bt_addr_is_null(&expected));
+    g_assert_cmpuint(bt_addr_to_u64(&null_address), ==, 0);
+
+    g_assert_true(bt_addr_from_string("00:00:00:00:00:00", &addr));
+    g_assert_true(bt_addr_is_null(&addr));
+    g_assert_cmpstr(bt_addr_to_string(&null_address, buf), ==, "00:00:00:00:00:00");
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/bt-addr/from-string", test_from_string);
+    g_test_add_func("/bt-addr/from-string-invalid", test_from_string_invalid);
+    g_test_add_func("/bt-addr/from-device-path", test_from_device_path);
+    g_test_add_func("/bt-addr/from-device-path-invalid", test_from_device_path_invalid);
+    g_test_add_func("/bt-addr/format-round-trip", test_format_round_trip);
+    g_test_add_func("/bt-addr/to-u64", test_to_u64);
+    g_test_add_func("/bt-addr/null-address", test_null_address);
+
+    return g_test_run();
+}
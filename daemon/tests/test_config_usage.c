@@ -0,0 +1,143 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * Tests for storing per-day usage in usage.conf
+ */
+
+#include "config.h"
+
+#include <glib/gstdio.h>
+
+static const BtAddr device_a = { { 0xAA, 0xBB, 0xCC, 0x00, 0x11, 0x22 } };
+static const BtAddr device_b = { { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06 } };
+
+static gchar *test_dir;
+
+static guint32 julian(GDateYear year, GDateMonth month, GDateDay day)
+{
+    GDate date;
+    g_date_clear(&date, 1);
+    g_date_set_dmy(&date, day, month, year);
+    return g_date_get_julian(&date);
+}
+
+static void write_usage_file(const char *contents)
+{
+    gchar *path = g_build_filename(test_dir, "usage.conf", NULL);
+    g_assert_true(g_file_set_contents(path, contents, -1, NULL));
+    g_free(path);
+}
+
+static void setup(void)
+{
+    test_dir = g_dir_make_tmp("librepods-test-XXXXXX", NULL);
+    g_assert_nonnull(test_dir);
+    config_set_directory(test_dir);
+}
+
+static void teardown(void)
+{
+    gchar *path = g_build_filename(test_dir, "usage.conf", NULL);
+    g_remove(path);
+    g_free(path);
+    g_rmdir(test_dir);
+    g_clear_pointer(&test_dir, g_free);
+}
+
+static void test_round_trip(void)
+{
+    DailyUsage saved[] = {
+        { julian(2024, G_DATE_MAY, 30), 3600, 120, 40000, 12 },
+        { julian(2024, G_DATE_MAY, 31), 0, 0, 86400, 0 },
+        { julian(2024, G_DATE_JUNE, 1), 7200, 60, 100, 3 },
+    };
+    DailyUsage loaded[USAGE_MAX_DAYS];
+
+    setup();
+
+    g_assert_true(config_save_device_usage(&device_a, saved, G_N_ELEMENTS(saved)));
+    g_assert_cmpuint(config_load_device_usage(&device_a, loaded), ==, G_N_ELEMENTS(saved));
+    g_assert_cmpmem(loaded, sizeof(saved), saved, sizeof(saved));
+
+    teardown();
+}
+
+static void test_missing_file(void)
+{
+    DailyUsage loaded[USAGE_MAX_DAYS];
+
+    setup();
+    g_assert_cmpuint(config_load_device_usage(&device_a, loaded), ==, 0);
+    teardown();
+}
+
+static void test_other_devices_kept(void)
+{
+    DailyUsage usage_a = { julian(2024, G_DATE_MAY, 31), 10, 20, 30, 4 };
+    DailyUsage usage_b = { julian(2024, G_DATE_JUNE, 1), 50, 60, 70, 8 };
+    DailyUsage loaded[USAGE_MAX_DAYS];
+
+    setup();
+
+    g_assert_true(config_save_device_usage(&device_a, &usage_a, 1));
+    g_assert_true(config_save_device_usage(&device_b, &usage_b, 1));
+
+    /* Saving replaces the device's days, and only those */
+    g_assert_true(config_save_device_usage(&device_b, &usage_b, 1));
+
+    g_assert_cmpuint(config_load_device_usage(&device_a, loaded), ==, 1);
+    g_assert_cmpmem(&loaded[0], sizeof(DailyUsage), &usage_a, sizeof(usage_a));
+    g_assert_cmpuint(config_load_device_usage(&device_b, loaded), ==, 1);
+    g_assert_cmpmem(&loaded[0], sizeof(DailyUsage), &usage_b, sizeof(usage_b));
+
+    teardown();
+}
+
+static void test_malformed_entries_skipped(void)
+{
+    DailyUsage loaded[USAGE_MAX_DAYS];
+
+    setup();
+
+    /* Hand-edited file: bad dates and field counts, days out of order */
+    write_usage_file("[AA_BB_CC_00_11_22]\n"
+                     "2024-06-02=5;6;7;8;\n"
+                     "2024-13-40=1;2;3;4;\n"
+                     "yesterday=1;2;3;4;\n"
+                     "2024-06-03=1;2;3;\n"
+                     "2024-06-01=1;-2;3;4;\n");
+
+    g_assert_cmpuint(config_load_device_usage(&device_a, loaded), ==, 2);
+    g_assert_cmpuint(loaded[0].day, ==, julian(2024, G_DATE_JUNE, 1));
+    g_assert_cmpuint(loaded[0].one_in_ear_s, ==, 0);
+    g_assert_cmpuint(loaded[1].day, ==, julian(2024, G_DATE_JUNE, 2));
+    g_assert_cmpuint(loaded[1].both_in_ear_s, ==, 5);
+    g_assert_cmpuint(loaded[1].transitions, ==, 8);
+
+    teardown();
+}
+
+static void test_null_address_rejected(void)
+{
+    static const BtAddr null_address = { { 0 } };
+    DailyUsage usage = { julian(2024, G_DATE_MAY, 31), 1, 2, 3, 4 };
+
+    setup();
+    g_assert_false(config_save_device_usage(&null_address, &usage, 1));
+    g_assert_false(config_save_device_usage(NULL, &usage, 1));
+    teardown();
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/config-usage/round-trip", test_round_trip);
+    g_test_add_func("/config-usage/missing-file", test_missing_file);
+    g_test_add_func("/config-usage/other-devices-kept", test_other_devices_kept);
+    g_test_add_func("/config-usage/malformed-entries-skipped", test_malformed_entries_skipped);
+    g_test_add_func("/config-usage/null-address-rejected", test_null_address_rejected);
+
+    return g_test_run();
+}
@@ -0,0 +1,199 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * Tests for event routing
+ */
+
+#include "event_bus.h"
+
+/* Handlers append their tag, so tests can check who ran and in which order */
+typedef struct {
+    GString *calls;
+    const Event *last_event;
+} Recorder;
+
+static void record(Recorder *recorder, char tag, const Event *event)
+{
+    g_string_append_c(recorder->calls, tag);
+    recorder->last_event = event;
+}
+
+static void on_a(const Event *event, void *user_data) { record(user_data, 'a', event); }
+static void on_b(const Event *event, void *user_data) { record(user_data, 'b', event); }
+static void on_c(const Event *event, void *user_data) { record(user_data, 'c', event); }
+static void on_d(const Event *event, void *user_data) { record(user_data, 'd', event); }
+
+static void publish(EventBus *bus, AapPacketType type)
+{
+    static const uint8_t frame[] = { 0x04, 0x00, 0x04, 0x00, 0x09, 0x00 };
+    Event event = { .type = type, .packet = NULL, .data = frame, .len = sizeof(frame) };
+    event_bus_publish(bus, &event);
+}
+
+static void test_routing_by_mask(void)
+{
+    static const EventSubscriber subscribers[] = {
+        { "a", EVENT_MASK(AAP_PKT_TYPE_BATTERY), 0, on_a },
+        { "b", EVENT_MASK(AAP_PKT_TYPE_EAR_DETECTION), 0, on_b },
+        { "c", EVENT_MASK(AAP_PKT_TYPE_BATTERY) | EVENT_MASK(AAP_PKT_TYPE_METADATA), 0, on_c },
+    };
+    Recorder recorder = { g_string_new(NULL), NULL };
+
+    EventBus *bus = event_bus_new(subscribers, G_N_ELEMENTS(subscribers), &recorder);
+    g_assert_nonnull(bus);
+
+    publish(bus, AAP_PKT_TYPE_BATTERY);
+    g_assert_cmpstr(recorder.calls->str, ==, "ac");
+
+    g_string_truncate(recorder.calls, 0);
+    publish(bus, AAP_PKT_TYPE_EAR_DETECTION);
+    g_assert_cmpstr(recorder.calls->str, ==, "b");
+
+    g_string_truncate(recorder.calls, 0);
+    publish(bus, AAP_PKT_TYPE_NOISE_CONTROL);
+    g_assert_cmpstr(recorder.calls->str, ==, "");
+
+    event_bus_free(bus);
+    g_string_free(recorder.calls, TRUE);
+}
+
+static void test_priority_order(void)
+{
+    static const EventSubscriber subscribers[] = {
+        { "a", EVENT_MASK(AAP_PKT_TYPE_BATTERY), 10, on_a },
+        { "b", EVENT_MASK(AAP_PKT_TYPE_BATTERY), -5, on_b },
+        { "c", EVENT_MASK(AAP_PKT_TYPE_BATTERY), 10, on_c },
+        { "d", EVENT_MASK(AAP_PKT_TYPE_BATTERY), 0, on_d },
+    };
+    Recorder recorder = { g_string_new(NULL), NULL };
+
+    EventBus *bus = event_bus_new(subscribers, G_N_ELEMENTS(subscribers), &recorder);
+    g_assert_nonnull(bus);
+
+    /* Lower priority first, ties in table order */
+    publish(bus, AAP_PKT_TYPE_BATTERY);
+    g_assert_cmpstr(recorder.calls->str, ==, "bdac");
+
+    event_bus_free(bus);
+    g_string_free(recorder.calls, TRUE);
+}
+
+static void test_event_passed_through(void)
+{
+    static const EventSubscriber subscribers[] = {
+        { "a", EVENT_MASK(AAP_PKT_TYPE_UNKNOWN), 0, on_a },
+    };
+    static const uint8_t frame[] = { 0x04, 0x00, 0x04, 0x00, 0x77, 0x00 };
+    Recorder recorder = { g_string_new(NULL), NULL };
+
+    EventBus *bus = event_bus_new(subscribers, G_N_ELEMENTS(subscribers), &recorder);
+    Event event = { .type = AAP_PKT_TYPE_UNKNOWN, .packet = NULL, .data = frame, .len = sizeof(frame) };
+    event_bus_publish(bus, &event);
+
+    /* Handlers see the caller's event, nothing is copied */
+    g_assert_true(recorder.last_event == &event);
+
+    event_bus_free(bus);
+    g_string_free(recorder.calls, TRUE);
+}
+
+static void test_out_of_range_type(void)
+{
+    static const EventSubscriber subscribers[] = {
+        { "a", G_MAXUINT32, 0, on_a },
+    };
+    Recorder recorder = { g_string_new(NULL), NULL };
+
+    EventBus *bus = event_bus_new(subscribers, G_N_ELEMENTS(subscribers), &recorder);
+    publish(bus, AAP_PKT_TYPE_COUNT);
+    publish(bus, (AapPacketType)-1);
+    g_assert_cmpstr(recorder.calls->str, ==, "");
+
+    event_bus_free(bus);
+    g_string_free(recorder.calls, TRUE);
+}
+
+static void test_too_many_subscribers(void)
+{
+    EventSubscriber subscribers[EVENT_MAX_SUBSCRIBERS + 1];
+    for (guint i = 0; i < G_N_ELEMENTS(subscribers); i++) {
+        subscribers[i] = (EventSubscriber){ "a", EVENT_MASK(AAP_PKT_TYPE_BATTERY), 0, on_a };
+    }
+
+    g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING, "Too many event subscribers*");
+    g_assert_null(event_bus_new(subscribers, G_N_ELEMENTS(subscribers), NULL));
+    g_test_assert_expected_messages();
+
+    EventBus *bus = event_bus_new(subscribers, EVENT_MAX_SUBSCRIBERS, NULL);
+    g_assert_nonnull(bus);
+    event_bus_free(bus);
+}
+
+static void test_stats(void)
+{
+    static const EventSubscriber subscribers[] = {
+        { "first", EVENT_MASK(AAP_PKT_TYPE_BATTERY), 0, on_a },
+        { "second", EVENT_MASK(AAP_PKT_TYPE_METADATA), 0, on_b },
+    };
+    Recorder recorder = { g_string_new(NULL), NULL };
+
+    EventBus *bus = event_bus_new(subscribers, G_N_ELEMENTS(subscribers), &recorder);
+    publish(bus, AAP_PKT_TYPE_BATTERY);
+    publish(bus, AAP_PKT_TYPE_BATTERY);
+    publish(bus, AAP_PKT_TYPE_METADATA);
+
+    GVariant *stats = g_variant_ref_sink(event_bus_get_stats(bus));
+    GVariantDict dict;
+    g_variant_dict_init(&dict, stats);
+
+    GVariant *events = g_variant_dict_lookup_value(&dict, "Events", G_VARIANT_TYPE_VARDICT);
+    g_assert_nonnull(events);
+    GVariantDict events_dict;
+    g_variant_dict_init(&events_dict, events);
+
+    GVariant *battery = g_variant_dict_lookup_value(&events_dict, "Battery", G_VARIANT_TYPE_VARDICT);
+    g_assert_nonnull(battery);
+    guint64 published = 0;
+    g_assert_true(g_variant_lookup(battery, "Published", "t", &published));
+    g_assert_cmpuint(published, ==, 2);
+    g_variant_unref(battery);
+
+    GVariant *metadata = g_variant_dict_lookup_value(&events_dict, "Metadata", G_VARIANT_TYPE_VARDICT);
+    g_assert_nonnull(metadata);
+    g_assert_true(g_variant_lookup(metadata, "Published", "t", &published));
+    g_assert_cmpuint(published, ==, 1);
+    g_variant_unref(metadata);
+
+    /* Every handler gets a timing histogram under its name */
+    GVariant *handlers = g_variant_dict_lookup_value(&dict, "HandlerNs", G_VARIANT_TYPE_VARDICT);
+    g_assert_nonnull(handlers);
+    GVariant *first = g_variant_lookup_value(handlers, "first", G_VARIANT_TYPE_VARDICT);
+    g_assert_nonnull(first);
+    guint64 count = 0;
+    g_assert_true(g_variant_lookup(first, "Count", "t", &count));
+    g_assert_cmpuint(count, ==, 2);
+    g_variant_unref(first);
+    g_variant_unref(handlers);
+
+    g_variant_dict_clear(&events_dict);
+    g_variant_unref(events);
+    g_variant_dict_clear(&dict);
+    g_variant_unref(stats);
+    event_bus_free(bus);
+    g_string_free(recorder.calls, TRUE);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/event-bus/routing-by-mask", test_routing_by_mask);
+    g_test_add_func("/event-bus/priority-order", test_priority_order);
+    g_test_add_func("/event-bus/event-passed-through", test_event_passed_through);
+    g_test_add_func("/event-bus/out-of-range-type", test_out_of_range_type);
+    g_test_add_func("/event-bus/too-many-subscribers", test_too_many_subscribers);
+    g_test_add_func("/event-bus/stats", test_stats);
+
+    return g_test_run();
+}
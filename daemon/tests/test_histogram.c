@@ -0,0 +1,115 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * Tests for the log2 histogram
+ */
+
+#include "histogram.h"
+
+static void test_buckets(void)
+{
+    Log2Histogram histogram = { 0 };
+
+    log2_histogram_add(&histogram, 0);
+    log2_histogram_add(&histogram, 1);
+    log2_histogram_add(&histogram, 2);
+    log2_histogram_add(&histogram, 3);
+    log2_histogram_add(&histogram, 4);
+    log2_histogram_add(&histogram, 1023);
+    log2_histogram_add(&histogram, 1024);
+
+    g_assert_cmpuint(histogram.buckets[0], ==, 1);   /* 0 */
+    g_assert_cmpuint(histogram.buckets[1], ==, 1);   /* [1, 2) */
+    g_assert_cmpuint(histogram.buckets[2], ==, 2);   /* [2, 4) */
+    g_assert_cmpuint(histogram.buckets[3], ==, 1);   /* [4, 8) */
+    g_assert_cmpuint(histogram.buckets[10], ==, 1);  /* [512, 1024) */
+    g_assert_cmpuint(histogram.buckets[11], ==, 1);  /* [1024, 2048) */
+}
+
+static void test_overflow_bucket(void)
+{
+    Log2Histogram histogram = { 0 };
+
+    /* Values past the last bucket's range are counted there */
+    log2_histogram_add(&histogram, G_GUINT64_CONSTANT(1) << 40);
+    log2_histogram_add(&histogram, G_MAXUINT64);
+
+    g_assert_cmpuint(histogram.buckets[HISTOGRAM_BUCKETS - 1], ==, 2);
+    g_assert_cmpuint(histogram.max, ==, G_MAXUINT64);
+}
+
+static void test_summary(void)
+{
+    Log2Histogram histogram = { 0 };
+
+    log2_histogram_add(&histogram, 10);
+    log2_histogram_add(&histogram, 20);
+    log2_histogram_add(&histogram, 60);
+
+    g_assert_cmpuint(histogram.count, ==, 3);
+    g_assert_cmpuint(histogram.sum, ==, 90);
+    g_assert_cmpuint(histogram.max, ==, 60);
+}
+
+static void test_variant(void)
+{
+    Log2Histogram histogram = { 0 };
+    log2_histogram_add(&histogram, 3);
+    log2_histogram_add(&histogram, 5);
+
+    GVariant *variant = g_variant_ref_sink(log2_histogram_to_variant(&histogram));
+    GVariantDict dict;
+    g_variant_dict_init(&dict, variant);
+
+    guint64 count = 0, max = 0;
+    gdouble mean = 0;
+    g_assert_true(g_variant_dict_lookup(&dict, "Count", "t", &count));
+    g_assert_true(g_variant_dict_lookup(&dict, "Max", "t", &max));
+    g_assert_true(g_variant_dict_lookup(&dict, "Mean", "d", &mean));
+    g_assert_cmpuint(count, ==, 2);
+    g_assert_cmpuint(max, ==, 5);
+    g_assert_cmpfloat(mean, ==, 4.0);
+
+    GVariant *buckets = g_variant_dict_lookup_value(&dict, "Buckets", G_VARIANT_TYPE("au"));
+    g_assert_nonnull(buckets);
+    gsize n_buckets = 0;
+    const guint32 *values = g_variant_get_fixed_array(buckets, &n_buckets, sizeof(guint32));
+    g_assert_cmpuint(n_buckets, ==, HISTOGRAM_BUCKETS);
+    g_assert_cmpuint(values[2], ==, 1);
+    g_assert_cmpuint(values[3], ==, 1);
+
+    g_variant_unref(buckets);
+    g_variant_dict_clear(&dict);
+    g_variant_unref(variant);
+}
+
+static void test_empty_variant(void)
+{
+    Log2Histogram histogram = { 0 };
+
+    GVariant *variant = g_variant_ref_sink(log2_histogram_to_variant(&histogram));
+    GVariantDict dict;
+    g_variant_dict_init(&dict, variant);
+
+    /* No division by zero for an empty histogram */
+    gdouble mean = -1;
+    g_assert_true(g_variant_dict_lookup(&dict, "Mean", "d", &mean));
+    g_assert_cmpfloat(mean, ==, 0.0);
+
+    g_variant_dict_clear(&dict);
+    g_variant_unref(variant);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/histogram/buckets", test_buckets);
+    g_test_add_func("/histogram/overflow-bucket", test_overflow_bucket);
+    g_test_add_func("/histogram/summary", test_summary);
+    g_test_add_func("/histogram/variant", test_variant);
+    g_test_add_func("/histogram/empty-variant", test_empty_variant);
+
+    return g_test_run();
+}
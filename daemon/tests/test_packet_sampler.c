@@ -0,0 +1,137 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * Tests for unknown packet sampling
+ */
+
+#include "packet_sampler.h"
+
+#include <string.h>
+
+/* Look up one code in a table of the stats, NULL if it was never recorded */
+static GVariant *lookup_code(PacketSampler *sampler, const char *table, const char *key)
+{
+    GVariant *stats = g_variant_ref_sink(packet_sampler_get_stats(sampler));
+    GVariant *codes = g_variant_lookup_value(stats, table, G_VARIANT_TYPE_VARDICT);
+    g_assert_nonnull(codes);
+
+    GVariant *code = g_variant_lookup_value(codes, key, G_VARIANT_TYPE_VARDICT);
+
+    g_variant_unref(codes);
+    g_variant_unref(stats);
+    return code;
+}
+
+static guint64 code_count(GVariant *code)
+{
+    guint64 count = 0;
+    g_assert_true(g_variant_lookup(code, "Count", "t", &count));
+    return count;
+}
+
+static void test_opcode_keyed_on_byte_4(void)
+{
+    static const uint8_t frame[] = { 0x04, 0x00, 0x04, 0x00, 0xAB, 0x00, 0x01 };
+    PacketSampler *sampler = packet_sampler_new();
+
+    packet_sampler_record_opcode(sampler, frame, sizeof(frame));
+    packet_sampler_record_opcode(sampler, frame, sizeof(frame));
+
+    GVariant *code = lookup_code(sampler, "Opcodes", "0xAB");
+    g_assert_nonnull(code);
+    g_assert_cmpuint(code_count(code), ==, 2);
+
+    gint64 first = 0, last = 0;
+    g_assert_true(g_variant_lookup(code, "FirstSeenUs", "x", &first));
+    g_assert_true(g_variant_lookup(code, "LastSeenUs", "x", &last));
+    g_assert_cmpint(first, >, 0);
+    g_assert_cmpint(last, >=, first);
+    g_variant_unref(code);
+
+    /* Nothing leaks into the other table */
+    g_assert_null(lookup_code(sampler, "Controls", "0xAB"));
+
+    packet_sampler_free(sampler);
+}
+
+static void test_control_keyed_on_byte_6(void)
+{
+    static const uint8_t frame[] = { 0x04, 0x00, 0x04, 0x00, 0x09, 0x00, 0x42, 0x01 };
+    PacketSampler *sampler = packet_sampler_new();
+
+    packet_sampler_record_control(sampler, frame, sizeof(frame));
+
+    GVariant *code = lookup_code(sampler, "Controls", "0x42");
+    g_assert_nonnull(code);
+    g_assert_cmpuint(code_count(code), ==, 1);
+    g_variant_unref(code);
+
+    packet_sampler_free(sampler);
+}
+
+static void test_short_frames_ignored(void)
+{
+    static const uint8_t frame[] = { 0x04, 0x00, 0x04, 0x00, 0x09, 0x00, 0x42 };
+    PacketSampler *sampler = packet_sampler_new();
+
+    /* Too short to carry an opcode or a control ID */
+    packet_sampler_record_opcode(sampler, frame, 4);
+    packet_sampler_record_control(sampler, frame, 6);
+
+    GVariant *stats = g_variant_ref_sink(packet_sampler_get_stats(sampler));
+    GVariant *opcodes = g_variant_lookup_value(stats, "Opcodes", G_VARIANT_TYPE_VARDICT);
+    GVariant *controls = g_variant_lookup_value(stats, "Controls", G_VARIANT_TYPE_VARDICT);
+    g_assert_cmpuint(g_variant_n_children(opcodes), ==, 0);
+    g_assert_cmpuint(g_variant_n_children(controls), ==, 0);
+
+    g_variant_unref(controls);
+    g_variant_unref(opcodes);
+    g_variant_unref(stats);
+    packet_sampler_free(sampler);
+}
+
+static void test_samples_bounded(void)
+{
+    uint8_t frame[200];
+    memset(frame, 0x55, sizeof(frame));
+    frame[4] = 0x80;
+
+    PacketSampler *sampler = packet_sampler_new();
+    for (int i = 0; i < 100; i++) {
+        packet_sampler_record_opcode(sampler, frame, sizeof(frame));
+    }
+
+    GVariant *code = lookup_code(sampler, "Opcodes", "0x80");
+    g_assert_nonnull(code);
+    g_assert_cmpuint(code_count(code), ==, 100);
+
+    /* A few samples per code, each truncated */
+    GVariant *samples = g_variant_lookup_value(code, "Samples", G_VARIANT_TYPE("aay"));
+    g_assert_nonnull(samples);
+    g_assert_cmpuint(g_variant_n_children(samples), ==, 4);
+    for (gsize i = 0; i < g_variant_n_children(samples); i++) {
+        GVariant *sample = g_variant_get_child_value(samples, i);
+        gsize len = 0;
+        const guint8 *bytes = g_variant_get_fixed_array(sample, &len, 1);
+        g_assert_cmpuint(len, ==, 64);
+        g_assert_cmpmem(bytes, len, frame, 64);
+        g_variant_unref(sample);
+    }
+
+    g_variant_unref(samples);
+    g_variant_unref(code);
+    packet_sampler_free(sampler);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/packet-sampler/opcode-keyed-on-byte-4", test_opcode_keyed_on_byte_4);
+    g_test_add_func("/packet-sampler/control-keyed-on-byte-6", test_control_keyed_on_byte_6);
+    g_test_add_func("/packet-sampler/short-frames-ignored", test_short_frames_ignored);
+    g_test_add_func("/packet-sampler/samples-bounded", test_samples_bounded);
+
+    return g_test_run();
+}
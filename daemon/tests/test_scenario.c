@@ -0,0 +1,230 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * Scripted connection scenarios against a fake device
+ *
+ * The device is the other end of a socketpair and the pacing timers run
+ * on the virtual clock, so every step happens at a known time and the
+ * scenarios play out the same way on every run.
+ */
+
+#include "aap_protocol.h"
+#include "airpods_state.h"
+#include "bluetooth.h"
+#include "wakeup_stats.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+static const BtAddr device = { { 0xAA, 0xBB, 0xCC, 0x00, 0x11, 0x22 } };
+
+static const uint8_t both_in_ear[] = { 0x04, 0x00, 0x04, 0x00, 0x06, 0x00, 0x00, 0x00 };
+static const uint8_t one_out[] = { 0x04, 0x00, 0x04, 0x00, 0x06, 0x00, 0x01, 0x00 };
+static const uint8_t both_out[] = { 0x04, 0x00, 0x04, 0x00, 0x06, 0x00, 0x01, 0x01 };
+
+typedef struct {
+    BluetoothConnection *conn;
+    int peer;                   /* The fake device's end */
+    AirPodsState state;
+    guint packets;              /* Received by the connection */
+    GString *ear_changes;       /* "i" both in ear, "o" otherwise, per change */
+    BluetoothState last_state;
+} Scenario;
+
+static void on_data(const uint8_t *data, size_t len, void *user_data)
+{
+    Scenario *scenario = user_data;
+    AapParsedPacket packet;
+
+    scenario->packets++;
+    if (aap_parse_packet(data, len, &packet) != AAP_PARSE_OK ||
+        packet.type != AAP_PKT_TYPE_EAR_DETECTION) {
+        return;
+    }
+
+    /* As the daemon's update_state() does */
+    bool was_in = scenario->state.ear_detection.left_in_ear &&
+                  scenario->state.ear_detection.right_in_ear;
+    airpods_state_set_ear_detection(&scenario->state,
+                                    packet.data.ear_detection.primary_in_ear,
+                                    packet.data.ear_detection.secondary_in_ear,
+                                    packet.data.ear_detection.primary_left);
+    bool is_in = scenario->state.ear_detection.left_in_ear &&
+                 scenario->state.ear_detection.right_in_ear;
+
+    if (is_in != was_in) {
+        g_string_append_c(scenario->ear_changes, is_in ? 'i' : 'o');
+    }
+}
+
+static void on_state(BluetoothState state, const char *error, void *user_data)
+{
+    (void)error;
+    ((Scenario *)user_data)->last_state = state;
+}
+
+static void scenario_start(Scenario *scenario)
+{
+    int fds[2];
+    g_assert_cmpint(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds), ==, 0);
+
+    memset(scenario, 0, sizeof(*scenario));
+    airpods_state_init(&scenario->state);
+    scenario->ear_changes = g_string_new(NULL);
+    scenario->peer = fds[1];
+
+    scenario->conn = bt_connection_new();
+    bt_connection_set_data_callback(scenario->conn, on_data, scenario);
+    bt_connection_set_state_callback(scenario->conn, on_state, scenario);
+
+    g_assert_true(bt_connection_adopt_socket(scenario->conn, fds[0], &device));
+    g_assert_cmpint(scenario->last_state, ==, BT_STATE_CONNECTED);
+    g_assert_true(bt_connection_attach_to_mainloop(scenario->conn, NULL));
+}
+
+static void scenario_stop(Scenario *scenario)
+{
+    bt_connection_free(scenario->conn);
+    if (scenario->peer >= 0) {
+        close(scenario->peer);
+    }
+    airpods_state_cleanup(&scenario->state);
+    g_string_free(scenario->ear_changes, TRUE);
+}
+
+/* The device has received exactly this packet */
+static void assert_device_got(Scenario *scenario, const uint8_t *packet, size_t len)
+{
+    uint8_t buffer[BT_MAX_PACKET_SIZE];
+    ssize_t received = recv(scenario->peer, buffer, sizeof(buffer), MSG_DONTWAIT);
+
+    g_assert_cmpint(received, ==, (ssize_t)len);
+    g_assert_cmpmem(buffer, (size_t)received, packet, len);
+}
+
+/* The device has nothing to read */
+static void assert_device_idle(Scenario *scenario)
+{
+    uint8_t buffer[BT_MAX_PACKET_SIZE];
+    g_assert_cmpint(recv(scenario->peer, buffer, sizeof(buffer), MSG_DONTWAIT), ==, -1);
+    g_assert_cmpint(errno, ==, EAGAIN);
+}
+
+/* Send from the device and wait until the connection has handled it */
+static void device_send(Scenario *scenario, const uint8_t *packet, size_t len)
+{
+    guint expected = scenario->packets + 1;
+
+    g_assert_cmpint(send(scenario->peer, packet, len, 0), ==, (ssize_t)len);
+    while (scenario->packets < expected) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+}
+
+static void complete_handshake(Scenario *scenario)
+{
+    g_assert_true(bt_connection_start_handshake(scenario->conn));
+    wakeup_clock_advance(200);
+
+    assert_device_got(scenario, AAP_PKT_HANDSHAKE, AAP_HANDSHAKE_SIZE);
+    assert_device_got(scenario, AAP_PKT_SET_FEATURES, AAP_SET_FEATURES_SIZE);
+    assert_device_got(scenario, AAP_PKT_REQUEST_NOTIFICATIONS, AAP_REQUEST_NOTIF_SIZE);
+}
+
+static void test_handshake_pacing(void)
+{
+    Scenario scenario;
+    scenario_start(&scenario);
+
+    g_assert_true(bt_connection_start_handshake(scenario.conn));
+    g_assert_cmpuint(wakeup_clock_pending(), ==, 1);
+
+    /* 100 ms before the handshake, then 50 ms before each of the others */
+    wakeup_clock_advance(99);
+    assert_device_idle(&scenario);
+    wakeup_clock_advance(1);
+    assert_device_got(&scenario, AAP_PKT_HANDSHAKE, AAP_HANDSHAKE_SIZE);
+
+    wakeup_clock_advance(49);
+    assert_device_idle(&scenario);
+    wakeup_clock_advance(1);
+    assert_device_got(&scenario, AAP_PKT_SET_FEATURES, AAP_SET_FEATURES_SIZE);
+
+    wakeup_clock_advance(49);
+    assert_device_idle(&scenario);
+    wakeup_clock_advance(1);
+    assert_device_got(&scenario, AAP_PKT_REQUEST_NOTIFICATIONS, AAP_REQUEST_NOTIF_SIZE);
+
+    g_assert_cmpuint(wakeup_clock_pending(), ==, 0);
+    wakeup_clock_advance(1000);
+    assert_device_idle(&scenario);
+
+    scenario_stop(&scenario);
+}
+
+static void test_ear_flap(void)
+{
+    Scenario scenario;
+    scenario_start(&scenario);
+    complete_handshake(&scenario);
+
+    /* A bud taken out and put back several times in quick succession */
+    device_send(&scenario, both_in_ear, sizeof(both_in_ear));
+    device_send(&scenario, one_out, sizeof(one_out));
+    device_send(&scenario, both_in_ear, sizeof(both_in_ear));
+    device_send(&scenario, one_out, sizeof(one_out));
+    device_send(&scenario, one_out, sizeof(one_out));
+    device_send(&scenario, both_in_ear, sizeof(both_in_ear));
+    device_send(&scenario, both_out, sizeof(both_out));
+
+    g_assert_cmpstr(scenario.ear_changes->str, ==, "ioioio");
+    g_assert_false(scenario.state.ear_detection.left_in_ear);
+    g_assert_false(scenario.state.ear_detection.right_in_ear);
+    g_assert_cmpuint(scenario.packets, ==, 7);
+    g_assert_true(bt_connection_is_connected(scenario.conn));
+
+    scenario_stop(&scenario);
+}
+
+static void test_disconnect_during_handshake(void)
+{
+    Scenario scenario;
+    scenario_start(&scenario);
+
+    g_assert_true(bt_connection_start_handshake(scenario.conn));
+    wakeup_clock_advance(100);
+    assert_device_got(&scenario, AAP_PKT_HANDSHAKE, AAP_HANDSHAKE_SIZE);
+
+    /* The device goes away with two packets still queued */
+    close(scenario.peer);
+    scenario.peer = -1;
+    g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING, "Socket error or hangup");
+    while (scenario.last_state != BT_STATE_DISCONNECTED) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    g_test_assert_expected_messages();
+
+    g_assert_cmpuint(wakeup_clock_pending(), ==, 0);
+    g_assert_cmpint(bt_connection_get_fd(scenario.conn), ==, -1);
+    wakeup_clock_advance(1000);
+
+    scenario_stop(&scenario);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    /* The poll source reads packets as soon as they are dispatched */
+    g_setenv("LIBREPODS_IO_BACKEND", "poll", TRUE);
+    wakeup_clock_use_virtual();
+
+    g_test_add_func("/scenario/handshake-pacing", test_handshake_pacing);
+    g_test_add_func("/scenario/ear-flap", test_ear_flap);
+    g_test_add_func("/scenario/disconnect-during-handshake", test_disconnect_during_handshake);
+
+    return g_test_run();
+}
@@ -0,0 +1,260 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * Connection soak test
+ *
+ * Runs many connect, handshake, packet and disconnect cycles against a
+ * fake device on a socketpair, reusing one connection as the daemon
+ * does. Disconnects alternate between the daemon and the device. Open
+ * file descriptors, attached sources and resident memory must not grow
+ * from cycle to cycle, and neither must the time a cycle takes.
+ */
+
+#include "aap_protocol.h"
+#include "bluetooth.h"
+#include "wakeup_stats.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+/* Cycles run before measuring, so that allocator pools settle */
+#define WARMUP_CYCLES 50
+#define SOAK_CYCLES 1000
+
+/* Growth tolerated over the measured cycles */
+#define RSS_GROWTH_KIB 256
+#define LATENCY_SLACK_US 500
+
+static const BtAddr device = { { 0xAA, 0xBB, 0xCC, 0x00, 0x11, 0x22 } };
+
+static const uint8_t both_in_ear[] = { 0x04, 0x00, 0x04, 0x00, 0x06, 0x00, 0x00, 0x00 };
+
+typedef struct {
+    BluetoothConnection *conn;
+    int peer;                   /* The fake device's end */
+    guint packets;              /* Received by the connection */
+    BluetoothState last_state;
+    guint first_source_id;      /* Sources before this one are gone */
+} Soak;
+
+static void on_data(const uint8_t *data, size_t len, void *user_data)
+{
+    (void)data;
+    (void)len;
+    ((Soak *)user_data)->packets++;
+}
+
+static void on_state(BluetoothState state, const char *error, void *user_data)
+{
+    (void)error;
+    ((Soak *)user_data)->last_state = state;
+}
+
+/* ============================================================================
+ * Resource counts
+ * ========================================================================== */
+
+static guint count_open_fds(void)
+{
+    GDir *dir = g_dir_open("/proc/self/fd", 0, NULL);
+    g_assert_nonnull(dir);
+
+    guint count = 0;
+    while (g_dir_read_name(dir) != NULL) {
+        count++;
+    }
+    g_dir_close(dir);
+
+    /* Not counting the directory itself */
+    return count - 1;
+}
+
+static gint64 current_rss_kib(void)
+{
+    gchar *contents = NULL;
+    g_assert_true(g_file_get_contents("/proc/self/statm", &contents, NULL, NULL));
+
+    /* Second field is resident pages */
+    long resident = 0;
+    g_assert_cmpint(sscanf(contents, "%*s %ld", &resident), ==, 1);
+    g_free(contents);
+
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static gboolean never_dispatched(gpointer user_data)
+{
+    (void)user_data;
+    return G_SOURCE_REMOVE;
+}
+
+/* Sources still attached to the default context since the last time
+ * there were none. Source IDs only increase, so a probe source marks
+ * the end of the range. */
+static guint attached_sources(Soak *soak)
+{
+    guint probe = g_idle_add(never_dispatched, NULL);
+    g_source_remove(probe);
+
+    guint attached = 0;
+    for (guint id = soak->first_source_id; id < probe; id++) {
+        attached += g_main_context_find_source_by_id(NULL, id) != NULL;
+    }
+    if (attached == 0) {
+        soak->first_source_id = probe;
+    }
+    return attached;
+}
+
+/* ============================================================================
+ * Cycles
+ * ========================================================================== */
+
+/* Receive the next packet on the device, running the main loop until
+ * the connection has sent it */
+static void device_receive(Soak *soak, const uint8_t *packet, size_t len)
+{
+    uint8_t buffer[BT_MAX_PACKET_SIZE];
+    ssize_t received;
+
+    while ((received = recv(soak->peer, buffer, sizeof(buffer), MSG_DONTWAIT)) < 0) {
+        g_assert_cmpint(errno, ==, EAGAIN);
+        g_main_context_iteration(NULL, TRUE);
+    }
+    g_assert_cmpmem(buffer, (size_t)received, packet, len);
+}
+
+static bool using_poll(Soak *soak)
+{
+    GVariant *stats = bt_connection_get_io_stats(soak->conn);
+    const gchar *backend = NULL;
+
+    g_assert_true(g_variant_lookup(stats, "Backend", "&s", &backend));
+    bool poll = g_strcmp0(backend, "poll") == 0;
+    g_variant_unref(stats);
+    return poll;
+}
+
+static void run_cycle(Soak *soak, guint cycle)
+{
+    int fds[2];
+    g_assert_cmpint(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds), ==, 0);
+    soak->peer = fds[1];
+
+    g_assert_true(bt_connection_adopt_socket(soak->conn, fds[0], &device));
+    g_assert_true(bt_connection_attach_to_mainloop(soak->conn, NULL));
+
+    g_assert_true(bt_connection_start_handshake(soak->conn));
+    wakeup_clock_advance(200);
+    device_receive(soak, AAP_PKT_HANDSHAKE, AAP_HANDSHAKE_SIZE);
+    device_receive(soak, AAP_PKT_SET_FEATURES, AAP_SET_FEATURES_SIZE);
+    device_receive(soak, AAP_PKT_REQUEST_NOTIFICATIONS, AAP_REQUEST_NOTIF_SIZE);
+
+    guint expected = soak->packets + 1;
+    g_assert_cmpint(send(soak->peer, both_in_ear, sizeof(both_in_ear), 0), ==,
+                    (ssize_t)sizeof(both_in_ear));
+    while (soak->packets < expected) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+
+    if (cycle % 2 == 0) {
+        bt_connection_disconnect(soak->conn);
+        close(soak->peer);
+    } else {
+        /* The poll source sees a hangup; io_uring reads end of stream */
+        bool hangup = using_poll(soak);
+        close(soak->peer);
+        if (hangup) {
+            g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING, "Socket error or hangup");
+        }
+        while (soak->last_state != BT_STATE_DISCONNECTED) {
+            g_main_context_iteration(NULL, TRUE);
+        }
+        g_test_assert_expected_messages();
+    }
+    soak->peer = -1;
+
+    /* io_uring teardown may finish on the main loop */
+    while (attached_sources(soak) > 0) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    g_assert_cmpuint(wakeup_clock_pending(), ==, 0);
+    g_assert_cmpint(bt_connection_get_fd(soak->conn), ==, -1);
+}
+
+static gint64 mean_us(const gint64 *durations, guint count)
+{
+    gint64 total = 0;
+    for (guint i = 0; i < count; i++) {
+        total += durations[i];
+    }
+    return total / count;
+}
+
+static void soak(void)
+{
+    Soak soak = { .peer = -1 };
+    soak.conn = bt_connection_new();
+    bt_connection_set_data_callback(soak.conn, on_data, &soak);
+    bt_connection_set_state_callback(soak.conn, on_state, &soak);
+    soak.first_source_id = g_idle_add(never_dispatched, NULL);
+    g_source_remove(soak.first_source_id);
+
+    guint cycle = 0;
+    for (; cycle < WARMUP_CYCLES; cycle++) {
+        run_cycle(&soak, cycle);
+    }
+
+    guint fds_before = count_open_fds();
+    gint64 rss_before = current_rss_kib();
+    gint64 *durations = g_new(gint64, SOAK_CYCLES);
+
+    for (guint i = 0; i < SOAK_CYCLES; i++, cycle++) {
+        gint64 start = g_get_monotonic_time();
+        run_cycle(&soak, cycle);
+        durations[i] = g_get_monotonic_time() - start;
+    }
+
+    g_assert_cmpuint(count_open_fds(), ==, fds_before);
+    g_assert_cmpuint(attached_sources(&soak), ==, 0);
+    g_assert_cmpint(current_rss_kib() - rss_before, <=, RSS_GROWTH_KIB);
+
+    /* The last quarter of the cycles is no slower than the first */
+    guint quarter = SOAK_CYCLES / 4;
+    gint64 first = mean_us(durations, quarter);
+    gint64 last = mean_us(durations + SOAK_CYCLES - quarter, quarter);
+    g_test_message("Mean cycle: %" G_GINT64_FORMAT " us first quarter, "
+                   "%" G_GINT64_FORMAT " us last quarter", first, last);
+    g_assert_cmpint(last, <=, 2 * first + LATENCY_SLACK_US);
+
+    g_free(durations);
+    bt_connection_free(soak.conn);
+}
+
+static void test_soak_poll(void)
+{
+    g_setenv("LIBREPODS_IO_BACKEND", "poll", TRUE);
+    soak();
+}
+
+/* io_uring where the build and kernel support it */
+static void test_soak_default(void)
+{
+    g_unsetenv("LIBREPODS_IO_BACKEND");
+    soak();
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+    wakeup_clock_use_virtual();
+
+    g_test_add_func("/soak/poll", test_soak_poll);
+    g_test_add_func("/soak/default", test_soak_default);
+
+    return g_test_run();
+}
@@ -0,0 +1,209 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * Tests for wear time accounting
+ *
+ * The day split works on the wall clock, so the accounting is driven
+ * directly with fixed times rather than through the public API.
+ */
+
+#include "../src/usage_stats.c"
+
+#include <glib/gstdio.h>
+
+static const BtAddr device = { { 0xAA, 0xBB, 0xCC, 0x00, 0x11, 0x22 } };
+
+static guint32 julian(GDateYear year, GDateMonth month, GDateDay day)
+{
+    GDate date;
+    g_date_clear(&date, 1);
+    g_date_set_dmy(&date, day, month, year);
+    return g_date_get_julian(&date);
+}
+
+/* Wall clock time in microseconds, UTC (the tests run with TZ=UTC) */
+static gint64 time_us(gint year, gint month, gint day, gint hour, gint minute, gdouble seconds)
+{
+    GDateTime *time = g_date_time_new_utc(year, month, day, hour, minute, seconds);
+    gint64 us = g_date_time_to_unix(time) * G_USEC_PER_SEC +
+                g_date_time_get_microsecond(time);
+    g_date_time_unref(time);
+    return us;
+}
+
+static UsageStats *new_stats(UsageState state, gint64 since_us)
+{
+    UsageStats *stats = usage_stats_new();
+    stats->device = device;
+    stats->state = state;
+    stats->state_since_us = since_us;
+    return stats;
+}
+
+static void test_same_day(void)
+{
+    UsageStats *stats = new_stats(USAGE_STATE_BOTH_IN_EAR, time_us(2024, 5, 31, 10, 0, 0));
+
+    account(stats, time_us(2024, 5, 31, 11, 30, 0));
+
+    g_assert_cmpuint(stats->n_days, ==, 1);
+    g_assert_cmpuint(stats->days[0].day, ==, julian(2024, G_DATE_MAY, 31));
+    g_assert_cmpuint(stats->days[0].both_in_ear_s, ==, 5400);
+    g_assert_cmpuint(stats->days[0].one_in_ear_s, ==, 0);
+    g_assert_true(stats->dirty);
+
+    g_free(stats);
+}
+
+static void test_split_at_midnight(void)
+{
+    UsageStats *stats = new_stats(USAGE_STATE_ONE_IN_EAR, time_us(2024, 5, 31, 23, 30, 0));
+
+    account(stats, time_us(2024, 6, 1, 0, 45, 0));
+
+    g_assert_cmpuint(stats->n_days, ==, 2);
+    g_assert_cmpuint(stats->days[0].day, ==, julian(2024, G_DATE_MAY, 31));
+    g_assert_cmpuint(stats->days[0].one_in_ear_s, ==, 1800);
+    g_assert_cmpuint(stats->days[1].day, ==, julian(2024, G_DATE_JUNE, 1));
+    g_assert_cmpuint(stats->days[1].one_in_ear_s, ==, 2700);
+
+    g_free(stats);
+}
+
+static void test_split_over_several_days(void)
+{
+    UsageStats *stats = new_stats(USAGE_STATE_IN_CASE, time_us(2024, 2, 28, 12, 0, 0));
+
+    /* Left in the case over a leap day */
+    account(stats, time_us(2024, 3, 1, 6, 0, 0));
+
+    g_assert_cmpuint(stats->n_days, ==, 3);
+    g_assert_cmpuint(stats->days[0].in_case_s, ==, 12 * 3600);
+    g_assert_cmpuint(stats->days[1].day, ==, julian(2024, G_DATE_FEBRUARY, 29));
+    g_assert_cmpuint(stats->days[1].in_case_s, ==, 24 * 3600);
+    g_assert_cmpuint(stats->days[2].in_case_s, ==, 6 * 3600);
+
+    g_free(stats);
+}
+
+static void test_partial_seconds_carried(void)
+{
+    gint64 start = time_us(2024, 5, 31, 10, 0, 0);
+    UsageStats *stats = new_stats(USAGE_STATE_BOTH_IN_EAR, start);
+
+    account(stats, start + 1500000);
+    g_assert_cmpuint(stats->days[0].both_in_ear_s, ==, 1);
+
+    account(stats, start + 3000000);
+    g_assert_cmpuint(stats->days[0].both_in_ear_s, ==, 3);
+    g_assert_cmpint(stats->remainder_us[USAGE_STATE_BOTH_IN_EAR], ==, 0);
+
+    g_free(stats);
+}
+
+static void test_other_state_not_counted(void)
+{
+    UsageStats *stats = new_stats(USAGE_STATE_OTHER, time_us(2024, 5, 31, 10, 0, 0));
+
+    account(stats, time_us(2024, 5, 31, 12, 0, 0));
+
+    g_assert_cmpuint(stats->n_days, ==, 0);
+    g_assert_cmpint(stats->state_since_us, ==, time_us(2024, 5, 31, 12, 0, 0));
+
+    g_free(stats);
+}
+
+static void test_clock_set_back(void)
+{
+    UsageStats *stats = new_stats(USAGE_STATE_BOTH_IN_EAR, time_us(2024, 5, 31, 10, 0, 0));
+    account(stats, time_us(2024, 5, 31, 10, 1, 0));
+
+    /* Time from an earlier day goes to the latest day instead of a new entry */
+    stats->state_since_us = time_us(2024, 5, 30, 10, 0, 0);
+    account(stats, time_us(2024, 5, 30, 10, 1, 0));
+
+    g_assert_cmpuint(stats->n_days, ==, 1);
+    g_assert_cmpuint(stats->days[0].day, ==, julian(2024, G_DATE_MAY, 31));
+    g_assert_cmpuint(stats->days[0].both_in_ear_s, ==, 120);
+
+    g_free(stats);
+}
+
+static void test_oldest_day_dropped(void)
+{
+    UsageStats *stats = usage_stats_new();
+    guint32 first = julian(2024, G_DATE_JANUARY, 1);
+
+    for (guint i = 0; i < USAGE_MAX_DAYS; i++) {
+        day_entry(stats, first + i)->transitions = i;
+    }
+    g_assert_cmpuint(stats->n_days, ==, USAGE_MAX_DAYS);
+
+    DailyUsage *entry = day_entry(stats, first + USAGE_MAX_DAYS);
+
+    g_assert_cmpuint(stats->n_days, ==, USAGE_MAX_DAYS);
+    g_assert_true(entry == &stats->days[USAGE_MAX_DAYS - 1]);
+    g_assert_cmpuint(entry->day, ==, first + USAGE_MAX_DAYS);
+    g_assert_cmpuint(entry->transitions, ==, 0);
+    g_assert_cmpuint(stats->days[0].day, ==, first + 1);
+    g_assert_cmpuint(stats->days[0].transitions, ==, 1);
+
+    g_free(stats);
+}
+
+static void test_get_stored_days(void)
+{
+    gchar *dir = g_dir_make_tmp("librepods-test-XXXXXX", NULL);
+    g_assert_nonnull(dir);
+    config_set_directory(dir);
+
+    DailyUsage days[] = {
+        { julian(2024, G_DATE_MAY, 31), 3600, 60, 7200, 5 },
+    };
+    g_assert_true(config_save_device_usage(&device, days, G_N_ELEMENTS(days)));
+
+    /* Not the connected device, so the stored days are reported */
+    UsageStats *stats = usage_stats_new();
+    GVariant *usage = g_variant_ref_sink(usage_stats_get(stats, &device));
+
+    g_assert_cmpuint(g_variant_n_children(usage), ==, 1);
+    GVariant *day = g_variant_get_child_value(usage, 0);
+    const gchar *date = NULL;
+    guint32 both = 0, transitions = 0;
+    g_assert_true(g_variant_lookup(day, "Date", "&s", &date));
+    g_assert_true(g_variant_lookup(day, "BothInEarSeconds", "u", &both));
+    g_assert_true(g_variant_lookup(day, "Transitions", "u", &transitions));
+    g_assert_cmpstr(date, ==, "2024-05-31");
+    g_assert_cmpuint(both, ==, 3600);
+    g_assert_cmpuint(transitions, ==, 5);
+
+    g_variant_unref(day);
+    g_variant_unref(usage);
+    usage_stats_free(stats);
+
+    gchar *path = g_build_filename(dir, "usage.conf", NULL);
+    g_remove(path);
+    g_free(path);
+    g_rmdir(dir);
+    g_free(dir);
+}
+
+int main(int argc, char *argv[])
+{
+    /* Day boundaries are local midnight */
+    g_setenv("TZ", "UTC", TRUE);
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/usage-stats/same-day", test_same_day);
+    g_test_add_func("/usage-stats/split-at-midnight", test_split_at_midnight);
+    g_test_add_func("/usage-stats/split-over-several-days", test_split_over_several_days);
+    g_test_add_func("/usage-stats/partial-seconds-carried", test_partial_seconds_carried);
+    g_test_add_func("/usage-stats/other-state-not-counted", test_other_state_not_counted);
+    g_test_add_func("/usage-stats/clock-set-back", test_clock_set_back);
+    g_test_add_func("/usage-stats/oldest-day-dropped", test_oldest_day_dropped);
+    g_test_add_func("/usage-stats/get-stored-days", test_get_stored_days);
+
+    return g_test_run();
+}
@@ -0,0 +1,773 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * Offline analyzer for recorded AAP traffic
+ *
+ * The daemon logs every packet as "RX: 04 00 ..." / "TX: ..." lines. A
+ * capture is that log, ideally with timestamps:
+ *
+ *   journalctl --user -u librepods-daemon -o short-unix > capture.log
+ *   librepods-analyze capture.log other-machine.log
+ *
+ * Input is read in fixed-size batches that are parsed on a thread pool
+ * and merged back in order, so memory use does not depend on file size.
+ */
+
+#include <glib.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "aap_protocol.h"
+#include "histogram.h"
+
+#define BATCH_SIZE (1024 * 1024)
+#define MAX_PACKET_SIZE 1024
+
+#define DIR_RX 0
+#define DIR_TX 1
+
+/* aap_debug_print_packet() stops after 64 bytes and ends the line with this */
+#define TRUNCATED_MARKER "... ("
+
+typedef struct {
+    gint64 timestamp_us;
+    int8_t level[3];    /* left, right, case */
+} BatterySample;
+
+typedef struct {
+    gint64 timestamp_us;
+    bool in_ear[2];     /* primary, secondary */
+} EarSample;
+
+/* Counters that add up across batches and files */
+typedef struct {
+    guint64 lines;
+    guint64 skipped_lines;
+    guint64 packets[2];
+    guint64 opcodes[2][256];
+    guint64 handshakes;
+    guint64 invalid_header;
+    guint64 malformed;
+    guint64 truncated;      /* Logged with only the first 64 bytes */
+    guint64 unknown_opcodes[256];
+    guint64 unknown_controls[256];
+    Log2Histogram rx_gap_us;
+} Counters;
+
+typedef struct {
+    guint64 seq;
+    guint file_index;
+    char *data;
+    size_t len;
+
+    /* Results, filled by the worker */
+    Counters counters;
+    gint64 first_us;
+    gint64 last_us;
+    gint64 first_rx_us;
+    gint64 last_rx_us;
+    GArray *battery;    /* BatterySample, only changes */
+    GArray *ear;        /* EarSample, only changes */
+} Batch;
+
+/* Per-file state for metrics that span batch boundaries */
+typedef struct {
+    guint index;
+    gint64 first_us;
+    gint64 last_us;
+    gint64 last_rx_us;
+    bool have_battery;
+    int8_t level[3];
+    gint64 level_us[3];
+    bool have_ear;
+    bool in_ear[2];
+} FileState;
+
+typedef struct {
+    Counters counters;
+    guint files;
+    gint64 capture_us;
+    guint64 battery_changes;
+    guint64 drain_percent[3];
+    gint64 drain_us[3];
+    guint64 ear_changes;
+    guint64 ear_flaps;
+
+    FileState file;
+    char **file_names;
+    FILE *battery_csv;
+
+    /* Batches are recycled; at most one pool's worth exist at once */
+    GThreadPool *pool;
+    GAsyncQueue *done;
+    GQueue free_batches;
+    GPtrArray *finished;    /* out of order, waiting to be merged */
+    guint64 next_seq;
+    guint64 next_merge;
+    guint in_flight;
+} Analyzer;
+
+static const char *component_names[3] = { "left", "right", "case" };
+
+static const char *opcode_name(guint opcode)
+{
+    switch (opcode) {
+    case AAP_OPCODE_BATTERY:        return "battery";
+    case AAP_OPCODE_EAR_DETECTION:  return "ear-detection";
+    case AAP_OPCODE_CONTROL:        return "control";
+    case AAP_OPCODE_NOTIFICATIONS:  return "notifications";
+    case AAP_OPCODE_HEAD_TRACKING:  return "head-tracking";
+    case AAP_OPCODE_METADATA:       return "metadata";
+    case AAP_OPCODE_CA_DETECTION:   return "ca-detection";
+    case AAP_OPCODE_SET_FEATURES:   return "set-features";
+    default:                        return "";
+    }
+}
+
+/* ============================================================================
+ * Line parsing (worker threads)
+ * ============================================================================ */
+
+/* Leading "<seconds>.<fraction>" as written by journalctl -o short-unix */
+static gint64 parse_timestamp(const char *line)
+{
+    if (!g_ascii_isdigit(line[0])) {
+        return -1;
+    }
+
+    char *end;
+    double seconds = g_ascii_strtod(line, &end);
+    if (*end != ' ' || seconds <= 0) {
+        return -1;
+    }
+
+    return (gint64)(seconds * G_USEC_PER_SEC);
+}
+
+static size_t parse_hex(const char *p, uint8_t *out, size_t max)
+{
+    size_t len = 0;
+
+    while (len < max) {
+        while (*p == ' ') {
+            p++;
+        }
+
+        int high = g_ascii_xdigit_value(p[0]);
+        int low = high < 0 ? -1 : g_ascii_xdigit_value(p[1]);
+        if (low < 0 || (p[2] != ' ' && p[2] != '\0')) {
+            break;  /* end of packet, or the "... (N more bytes)" marker */
+        }
+
+        out[len++] = (uint8_t)(high << 4 | low);
+        p += 2;
+    }
+
+    return len;
+}
+
+static void record_battery(Batch *batch, gint64 timestamp_us, const AapBatteryData *battery)
+{
+    BatterySample sample = {
+        .timestamp_us = timestamp_us,
+        .level = { battery->left_level, battery->right_level, battery->case_level },
+    };
+
+    if (batch->battery->len > 0) {
+        const BatterySample *last = &g_array_index(batch->battery, BatterySample,
+                                                   batch->battery->len - 1);
+        if (memcmp(last->level, sample.level, sizeof(sample.level)) == 0) {
+            return;
+        }
+    }
+
+    g_array_append_val(batch->battery, sample);
+}
+
+static void record_ear(Batch *batch, gint64 timestamp_us, const AapEarDetectionData *ear)
+{
+    EarSample sample = {
+        .timestamp_us = timestamp_us,
+        .in_ear = { ear->primary_in_ear, ear->secondary_in_ear },
+    };
+
+    if (batch->ear->len > 0) {
+        const EarSample *last = &g_array_index(batch->ear, EarSample, batch->ear->len - 1);
+        if (last->in_ear[0] == sample.in_ear[0] && last->in_ear[1] == sample.in_ear[1]) {
+            return;
+        }
+    }
+
+    g_array_append_val(batch->ear, sample);
+}
+
+static void analyze_packet(Batch *batch, int dir, gint64 timestamp_us,
+                           const uint8_t *data, size_t len, bool truncated)
+{
+    Counters *counters = &batch->counters;
+    counters->packets[dir]++;
+
+    if (timestamp_us >= 0) {
+        if (batch->first_us < 0) {
+            batch->first_us = timestamp_us;
+        }
+        batch->last_us = timestamp_us;
+    }
+
+    if (!aap_has_valid_header(data, len)) {
+        if (len >= 2 && data[0] == AAP_HANDSHAKE_HEADER_BYTE0 &&
+            data[1] == AAP_HANDSHAKE_HEADER_BYTE1) {
+            counters->handshakes++;
+        } else {
+            counters->invalid_header++;
+        }
+        return;
+    }
+
+    counters->opcodes[dir][aap_get_opcode(data, len)]++;
+
+    /* Only incoming packets are interesting beyond their opcode */
+    if (dir != DIR_RX) {
+        return;
+    }
+
+    if (timestamp_us >= 0) {
+        if (batch->last_rx_us >= 0) {
+            log2_histogram_add(&counters->rx_gap_us, MAX(timestamp_us - batch->last_rx_us, 0));
+        } else {
+            batch->first_rx_us = timestamp_us;
+        }
+        batch->last_rx_us = timestamp_us;
+    }
+
+    /* The rest of the frame is not in the log, so it cannot be parsed */
+    if (truncated) {
+        counters->truncated++;
+        return;
+    }
+
+    AapParsedPacket packet;
+    switch (aap_parse_packet(data, len, &packet)) {
+    case AAP_PARSE_OK:
+        if (packet.type == AAP_PKT_TYPE_BATTERY) {
+            record_battery(batch, timestamp_us, &packet.data.battery);
+        } else if (packet.type == AAP_PKT_TYPE_EAR_DETECTION) {
+            record_ear(batch, timestamp_us, &packet.data.ear_detection);
+        }
+        break;
+    case AAP_PARSE_UNKNOWN_OPCODE:
+        if (data[4] == AAP_OPCODE_CONTROL && len > 6) {
+            counters->unknown_controls[data[6]]++;
+        } else {
+            counters->unknown_opcodes[data[4]]++;
+        }
+        break;
+    case AAP_PARSE_INCOMPLETE:
+    case AAP_PARSE_MALFORMED:
+        counters->malformed++;
+        break;
+    case AAP_PARSE_INVALID_HEADER:
+        break;
+    }
+}
+
+static void analyze_line(Batch *batch, const char *line)
+{
+    int dir;
+    const char *marker = strstr(line, "RX: ");
+    if (marker != NULL) {
+        dir = DIR_RX;
+    } else if ((marker = strstr(line, "TX: ")) != NULL) {
+        dir = DIR_TX;
+    } else {
+        batch->counters.skipped_lines++;
+        return;
+    }
+
+    uint8_t data[MAX_PACKET_SIZE];
+    size_t len = parse_hex(marker + 4, data, sizeof(data));
+    if (len == 0) {
+        batch->counters.skipped_lines++;
+        return;
+    }
+
+    bool truncated = strstr(marker + 4, TRUNCATED_MARKER) != NULL;
+    analyze_packet(batch, dir, parse_timestamp(line), data, len, truncated);
+}
+
+static void analyze_batch(gpointer data, gpointer user_data)
+{
+    Batch *batch = data;
+    Analyzer *analyzer = user_data;
+
+    /* The batch is ours until it is handed back, so split it in place */
+    batch->data[batch->len] = '\0';
+    char *line = batch->data;
+    while (*line != '\0') {
+        char *newline = strchr(line, '\n');
+        if (newline != NULL) {
+            *newline = '\0';
+        }
+
+        batch->counters.lines++;
+        analyze_line(batch, line);
+
+        if (newline == NULL) {
+            break;
+        }
+        line = newline + 1;
+    }
+
+    g_async_queue_push(analyzer->done, batch);
+}
+
+/* ============================================================================
+ * In-order merging (main thread)
+ * ============================================================================ */
+
+static void merge_counters(Counters *total, const Counters *counters)
+{
+    total->lines += counters->lines;
+    total->skipped_lines += counters->skipped_lines;
+    total->handshakes += counters->handshakes;
+    total->invalid_header += counters->invalid_header;
+    total->malformed += counters->malformed;
+    total->truncated += counters->truncated;
+
+    for (int dir = 0; dir < 2; dir++) {
+        total->packets[dir] += counters->packets[dir];
+        for (int i = 0; i < 256; i++) {
+            total->opcodes[dir][i] += counters->opcodes[dir][i];
+        }
+    }
+
+    for (int i = 0; i < 256; i++) {
+        total->unknown_opcodes[i] += counters->unknown_opcodes[i];
+        total->unknown_controls[i] += counters->unknown_controls[i];
+    }
+
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        total->rx_gap_us.buckets[i] += counters->rx_gap_us.buckets[i];
+    }
+    total->rx_gap_us.count += counters->rx_gap_us.count;
+    total->rx_gap_us.sum += counters->rx_gap_us.sum;
+    total->rx_gap_us.max = MAX(total->rx_gap_us.max, counters->rx_gap_us.max);
+}
+
+static void finish_file(Analyzer *analyzer)
+{
+    FileState *file = &analyzer->file;
+
+    if (file->first_us >= 0 && file->last_us > file->first_us) {
+        analyzer->capture_us += file->last_us - file->first_us;
+    }
+
+    memset(file, 0, sizeof(*file));
+    file->first_us = file->last_us = file->last_rx_us = -1;
+}
+
+static void merge_battery(Analyzer *analyzer, const BatterySample *sample)
+{
+    FileState *file = &analyzer->file;
+
+    if (file->have_battery &&
+        memcmp(file->level, sample->level, sizeof(sample->level)) == 0) {
+        return;  /* same reading as the end of the previous batch */
+    }
+
+    analyzer->battery_changes++;
+
+    for (int i = 0; i < 3; i++) {
+        if (file->have_battery && file->level[i] == sample->level[i]) {
+            continue;
+        }
+
+        if (file->have_battery && file->level[i] > sample->level[i] && sample->level[i] >= 0 &&
+            file->level_us[i] >= 0 && sample->timestamp_us > file->level_us[i]) {
+            analyzer->drain_percent[i] += file->level[i] - sample->level[i];
+            analyzer->drain_us[i] += sample->timestamp_us - file->level_us[i];
+        }
+
+        file->level[i] = sample->level[i];
+        file->level_us[i] = sample->timestamp_us;
+    }
+    file->have_battery = true;
+
+    if (analyzer->battery_csv != NULL) {
+        fprintf(analyzer->battery_csv, "%s,%" G_GINT64_FORMAT ",%d,%d,%d\n",
+                analyzer->file_names[file->index], sample->timestamp_us,
+                sample->level[0], sample->level[1], sample->level[2]);
+    }
+}
+
+static void merge_ear(Analyzer *analyzer, const EarSample *sample)
+{
+    FileState *file = &analyzer->file;
+
+    if (file->have_ear) {
+        if (file->in_ear[0] == sample->in_ear[0] && file->in_ear[1] == sample->in_ear[1]) {
+            return;
+        }
+        for (int i = 0; i < 2; i++) {
+            if (file->in_ear[i] != sample->in_ear[i]) {
+                analyzer->ear_flaps++;
+            }
+        }
+    }
+
+    analyzer->ear_changes++;
+    file->in_ear[0] = sample->in_ear[0];
+    file->in_ear[1] = sample->in_ear[1];
+    file->have_ear = true;
+}
+
+static void merge_batch(Analyzer *analyzer, Batch *batch)
+{
+    FileState *file = &analyzer->file;
+
+    if (batch->file_index != file->index) {
+        finish_file(analyzer);
+        file->index = batch->file_index;
+    }
+
+    merge_counters(&analyzer->counters, &batch->counters);
+
+    if (batch->first_us >= 0) {
+        if (file->first_us < 0) {
+            file->first_us = batch->first_us;
+        }
+        file->last_us = batch->last_us;
+    }
+
+    /* The gap across the batch boundary is only known here */
+    if (batch->first_rx_us >= 0) {
+        if (file->last_rx_us >= 0) {
+            log2_histogram_add(&analyzer->counters.rx_gap_us,
+                               MAX(batch->first_rx_us - file->last_rx_us, 0));
+        }
+        file->last_rx_us = batch->last_rx_us;
+    }
+
+    for (guint i = 0; i < batch->battery->len; i++) {
+        merge_battery(analyzer, &g_array_index(batch->battery, BatterySample, i));
+    }
+    for (guint i = 0; i < batch->ear->len; i++) {
+        merge_ear(analyzer, &g_array_index(batch->ear, EarSample, i));
+    }
+}
+
+static void collect_batch(Analyzer *analyzer, Batch *batch)
+{
+    analyzer->in_flight--;
+    g_ptr_array_add(analyzer->finished, batch);
+
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (guint i = 0; i < analyzer->finished->len; i++) {
+            Batch *next = g_ptr_array_index(analyzer->finished, i);
+            if (next->seq == analyzer->next_merge) {
+                g_ptr_array_remove_index_fast(analyzer->finished, i);
+                merge_batch(analyzer, next);
+                analyzer->next_merge++;
+                g_queue_push_tail(&analyzer->free_batches, next);
+                merged = true;
+                break;
+            }
+        }
+    }
+}
+
+/* ============================================================================
+ * Reading
+ * ============================================================================ */
+
+static Batch *get_free_batch(Analyzer *analyzer)
+{
+    /* Wait for the workers when every batch is in use */
+    while (g_queue_is_empty(&analyzer->free_batches)) {
+        collect_batch(analyzer, g_async_queue_pop(analyzer->done));
+    }
+
+    Batch *batch = g_queue_pop_head(&analyzer->free_batches);
+
+    memset(&batch->counters, 0, sizeof(batch->counters));
+    batch->first_us = batch->last_us = -1;
+    batch->first_rx_us = batch->last_rx_us = -1;
+    g_array_set_size(batch->battery, 0);
+    g_array_set_size(batch->ear, 0);
+
+    return batch;
+}
+
+static bool analyze_file(Analyzer *analyzer, guint index)
+{
+    const char *path = analyzer->file_names[index];
+    FILE *fp = g_strcmp0(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (fp == NULL) {
+        g_printerr("%s: %s\n", path, g_strerror(errno));
+        return false;
+    }
+
+    /* Partial last line of the previous batch */
+    char *carry = g_malloc(BATCH_SIZE);
+    size_t carry_len = 0;
+    bool eof = false;
+    bool ok = true;
+
+    while (!eof || carry_len > 0) {
+        Batch *batch = get_free_batch(analyzer);
+
+        memcpy(batch->data, carry, carry_len);
+        batch->len = carry_len;
+        carry_len = 0;
+
+        while (batch->len < BATCH_SIZE && !eof) {
+            size_t n = fread(batch->data + batch->len, 1, BATCH_SIZE - batch->len, fp);
+            if (n == 0) {
+                if (ferror(fp)) {
+                    g_printerr("%s: read error\n", path);
+                    ok = false;
+                }
+                eof = true;
+            }
+            batch->len += n;
+        }
+
+        /* Keep lines whole; a single line longer than a batch gets split */
+        if (!eof) {
+            size_t line_end = batch->len;
+            while (line_end > 0 && batch->data[line_end - 1] != '\n') {
+                line_end--;
+            }
+            if (line_end > 0) {
+                carry_len = batch->len - line_end;
+                memcpy(carry, batch->data + line_end, carry_len);
+                batch->len = line_end;
+            }
+        }
+
+        if (batch->len == 0) {
+            g_queue_push_head(&analyzer->free_batches, batch);
+            continue;
+        }
+
+        batch->seq = analyzer->next_seq++;
+        batch->file_index = index;
+        analyzer->in_flight++;
+        g_thread_pool_push(analyzer->pool, batch, NULL);
+    }
+
+    g_free(carry);
+    if (fp != stdin) {
+        fclose(fp);
+    }
+
+    analyzer->files++;
+    return ok;
+}
+
+/* ============================================================================
+ * Report
+ * ============================================================================ */
+
+static void print_histogram(const char *title, const char *unit, const Log2Histogram *histogram)
+{
+    g_print("\n%s (%" G_GUINT64_FORMAT " samples, mean %.0f %s, max %" G_GUINT64_FORMAT " %s)\n",
+            title, histogram->count,
+            histogram->count > 0 ? (double)histogram->sum / histogram->count : 0.0, unit,
+            histogram->max, unit);
+
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (histogram->buckets[i] == 0) {
+            continue;
+        }
+
+        double share = 100.0 * histogram->buckets[i] / histogram->count;
+        if (i == 0) {
+            g_print("  %22s  %10u  %5.1f%%\n", "0", histogram->buckets[i], share);
+        } else if (i == HISTOGRAM_BUCKETS - 1) {
+            g_print("  >= %-19" G_GUINT64_FORMAT "  %10u  %5.1f%%\n",
+                    (guint64)1 << (i - 1), histogram->buckets[i], share);
+        } else {
+            char range[32];
+            g_snprintf(range, sizeof(range), "%" G_GUINT64_FORMAT " - %" G_GUINT64_FORMAT,
+                       (guint64)1 << (i - 1), ((guint64)1 << i) - 1);
+            g_print("  %22s  %10u  %5.1f%%\n", range, histogram->buckets[i], share);
+        }
+    }
+}
+
+static void print_code_table(const char *title, const guint64 *counts)
+{
+    bool any = false;
+    for (int i = 0; i < 256; i++) {
+        if (counts[i] == 0) {
+            continue;
+        }
+        if (!any) {
+            g_print("\n%s\n", title);
+            any = true;
+        }
+        g_print("  0x%02X  %12" G_GUINT64_FORMAT "\n", i, counts[i]);
+    }
+}
+
+static void print_report(Analyzer *analyzer)
+{
+    const Counters *counters = &analyzer->counters;
+    double hours = analyzer->capture_us / (3600.0 * G_USEC_PER_SEC);
+
+    g_print("Files:    %u\n", analyzer->files);
+    g_print("Lines:    %" G_GUINT64_FORMAT " (%" G_GUINT64_FORMAT " without packets)\n",
+            counters->lines, counters->skipped_lines);
+    g_print("Packets:  %" G_GUINT64_FORMAT " RX, %" G_GUINT64_FORMAT " TX\n",
+            counters->packets[DIR_RX], counters->packets[DIR_TX]);
+    g_print("Other:    %" G_GUINT64_FORMAT " handshakes, %" G_GUINT64_FORMAT
+            " invalid headers, %" G_GUINT64_FORMAT " malformed, %" G_GUINT64_FORMAT
+            " truncated\n",
+            counters->handshakes, counters->invalid_header, counters->malformed,
+            counters->truncated);
+    g_print("Captured: %.1f h\n", hours);
+
+    g_print("\nOpcode                        RX            TX\n");
+    for (int i = 0; i < 256; i++) {
+        if (counters->opcodes[DIR_RX][i] == 0 && counters->opcodes[DIR_TX][i] == 0) {
+            continue;
+        }
+        g_print("  0x%02X %-14s  %12" G_GUINT64_FORMAT "  %12" G_GUINT64_FORMAT "\n",
+                i, opcode_name(i), counters->opcodes[DIR_RX][i], counters->opcodes[DIR_TX][i]);
+    }
+
+    print_code_table("Unknown opcodes (RX)", counters->unknown_opcodes);
+    print_code_table("Unknown control identifiers (RX)", counters->unknown_controls);
+
+    print_histogram("RX inter-arrival", "us", &counters->rx_gap_us);
+
+    g_print("\nEar detection: %" G_GUINT64_FORMAT " changes, %" G_GUINT64_FORMAT " flaps",
+            analyzer->ear_changes, analyzer->ear_flaps);
+    if (hours > 0) {
+        g_print(" (%.2f per hour)", analyzer->ear_flaps / hours);
+    }
+    g_print("\n");
+
+    g_print("\nBattery: %" G_GUINT64_FORMAT " level changes\n", analyzer->battery_changes);
+    for (int i = 0; i < 3; i++) {
+        if (analyzer->drain_us[i] == 0) {
+            continue;
+        }
+        g_print("  %-5s  %.1f %%/h drain over %.1f h\n", component_names[i],
+                analyzer->drain_percent[i] /
+                    (analyzer->drain_us[i] / (3600.0 * G_USEC_PER_SEC)),
+                analyzer->drain_us[i] / (3600.0 * G_USEC_PER_SEC));
+    }
+}
+
+/* ============================================================================
+ * Main
+ * ============================================================================ */
+
+int main(int argc, char *argv[])
+{
+    gint jobs = 0;
+    gchar *battery_csv = NULL;
+    gchar **files = NULL;
+
+    GOptionEntry entries[] = {
+        { "jobs", 'j', 0, G_OPTION_ARG_INT, &jobs,
+          "Number of parser threads (default: number of CPUs)", "N" },
+        { "battery-csv", 0, 0, G_OPTION_ARG_FILENAME, &battery_csv,
+          "Write battery level changes to a CSV file", "FILE" },
+        { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &files, NULL, NULL },
+        { NULL, 0, 0, 0, NULL, NULL, NULL }
+    };
+
+    GError *error = NULL;
+    GOptionContext *context = g_option_context_new("CAPTURE... - analyze recorded AAP traffic");
+    g_option_context_add_main_entries(context, entries, NULL);
+    g_option_context_set_description(context,
+        "Captures are daemon logs, e.g. from\n"
+        "  journalctl --user -u librepods-daemon -o short-unix\n"
+        "Use - to read standard input.\n"
+        "\n"
+        "The daemon logs at most 64 bytes of a packet, so longer ones (such as\n"
+        "metadata) are counted by opcode and as truncated, but not decoded.\n");
+
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+        g_printerr("%s\n", error->message);
+        g_error_free(error);
+        g_option_context_free(context);
+        return 1;
+    }
+    g_option_context_free(context);
+
+    if (files == NULL || files[0] == NULL) {
+        g_printerr("No capture files given\n");
+        return 1;
+    }
+
+    if (jobs <= 0) {
+        jobs = (gint)g_get_num_processors();
+    }
+
+    Analyzer analyzer = { 0 };
+    analyzer.file_names = files;
+    analyzer.done = g_async_queue_new();
+    analyzer.finished = g_ptr_array_new();
+    g_queue_init(&analyzer.free_batches);
+    finish_file(&analyzer);
+
+    if (battery_csv != NULL) {
+        analyzer.battery_csv = fopen(battery_csv, "w");
+        if (analyzer.battery_csv == NULL) {
+            g_printerr("%s: %s\n", battery_csv, g_strerror(errno));
+            return 1;
+        }
+        fprintf(analyzer.battery_csv, "file,timestamp_us,left,right,case\n");
+    }
+
+    analyzer.pool = g_thread_pool_new(analyze_batch, &analyzer, jobs, FALSE, NULL);
+
+    /* Two batches per thread keep the workers busy while the next is read */
+    for (gint i = 0; i < jobs * 2; i++) {
+        Batch *batch = g_new0(Batch, 1);
+        batch->data = g_malloc(BATCH_SIZE + 1);
+        batch->battery = g_array_new(FALSE, FALSE, sizeof(BatterySample));
+        batch->ear = g_array_new(FALSE, FALSE, sizeof(EarSample));
+        g_queue_push_tail(&analyzer.free_batches, batch);
+    }
+
+    bool ok = true;
+    for (guint i = 0; files[i] != NULL; i++) {
+        ok &= analyze_file(&analyzer, i);
+    }
+
+    while (analyzer.in_flight > 0) {
+        collect_batch(&analyzer, g_async_queue_pop(analyzer.done));
+    }
+    finish_file(&analyzer);
+
+    g_thread_pool_free(analyzer.pool, FALSE, TRUE);
+
+    print_report(&analyzer);
+
+    Batch *batch;
+    while ((batch = g_queue_pop_head(&analyzer.free_batches)) != NULL) {
+        g_array_unref(batch->battery);
+        g_array_unref(batch->ear);
+        g_free(batch->data);
+        g_free(batch);
+    }
+    g_ptr_array_unref(analyzer.finished);
+    g_async_queue_unref(analyzer.done);
+
+    if (analyzer.battery_csv != NULL) {
+        fclose(analyzer.battery_csv);
+    }
+    g_free(battery_csv);
+    g_strfreev(files);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,631 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2024 LibrePods Contributors
+ *
+ * Command-line client for the LibrePods daemon
+ *
+ *   librepodsctl get BatteryLeft
+ *   librepodsctl set noise-control anc
+ *   librepodsctl watch --format '{BatteryLeft}% {BatteryRight}%'
+ *
+ * watch keeps one PropertiesChanged subscription and prints a line only
+ * when the output changes, so status bars do not have to poll.
+ */
+
+#include <glib.h>
+#include <glib-unix.h>
+#include <gio/gio.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "dbus_service.h"
+
+#define CALL_TIMEOUT_MS 5000
+
+#define DEFAULT_FORMAT "{DisplayName} L:{BatteryLeft}% R:{BatteryRight}% C:{BatteryCase}% {NoiseControlMode}"
+
+static gboolean use_system_bus = FALSE;
+static gboolean use_json = FALSE;
+static gchar *watch_format = NULL;
+
+/* ============================================================================
+ * Output
+ * ========================================================================== */
+
+static void append_json_string(GString *out, const char *str)
+{
+    g_string_append_c(out, '"');
+    for (const char *p = str; *p != '\0'; p++) {
+        switch (*p) {
+        case '"':  g_string_append(out, "\\\""); break;
+        case '\\': g_string_append(out, "\\\\"); break;
+        case '\n': g_string_append(out, "\\n"); break;
+        case '\t': g_string_append(out, "\\t"); break;
+        default:
+            if ((guchar)*p < 0x20) {
+                g_string_append_printf(out, "\\u%04x", (guchar)*p);
+            } else {
+                g_string_append_c(out, *p);
+            }
+            break;
+        }
+    }
+    g_string_append_c(out, '"');
+}
+
+/* Properties are all booleans, integers or strings */
+static void append_value(GString *out, GVariant *value, bool json)
+{
+    if (g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN)) {
+        g_string_append(out, g_variant_get_boolean(value) ? "true" : "false");
+    } else if (g_variant_is_of_type(value, G_VARIANT_TYPE_INT32)) {
+        g_string_append_printf(out, "%d", g_variant_get_int32(value));
+    } else if (g_variant_is_of_type(value, G_VARIANT_TYPE_STRING)) {
+        if (json) {
+            append_json_string(out, g_variant_get_string(value, NULL));
+        } else {
+            g_string_append(out, g_variant_get_string(value, NULL));
+        }
+    } else {
+        gchar *text = g_variant_print(value, FALSE);
+        if (json) {
+            append_json_string(out, text);
+        } else {
+            g_string_append(out, text);
+        }
+        g_free(text);
+    }
+}
+
+/* One JSON object per line, properties in the daemon's order */
+static gchar *format_json(GVariant *properties)
+{
+    GString *out = g_string_new("{");
+    GVariantIter iter;
+    const char *name;
+    GVariant *value;
+    bool first = true;
+
+    g_variant_iter_init(&iter, properties);
+    while (g_variant_iter_next(&iter, "{&sv}", &name, &value)) {
+        if (!first) {
+            g_string_append_c(out, ',');
+        }
+        first = false;
+
+        append_json_string(out, name);
+        g_string_append_c(out, ':');
+        append_value(out, value, true);
+        g_variant_unref(value);
+    }
+
+    g_string_append_c(out, '}');
+    return g_string_free(out, FALSE);
+}
+
+/* Replace {Property} with its value; unknown properties expand to nothing */
+static gchar *format_template(const char *format, GVariant *properties)
+{
+    GString *out = g_string_new(NULL);
+    const char *p = format;
+
+    while (*p != '\0') {
+        const char *close = *p == '{' ? strchr(p, '}') : NULL;
+        if (close == NULL) {
+            g_string_append_c(out, *p++);
+            continue;
+        }
+
+        gchar *name = g_strndup(p + 1, close - p - 1);
+        GVariant *value = g_variant_lookup_value(properties, name, NULL);
+        if (value != NULL) {
+            append_value(out, value, false);
+            g_variant_unref(value);
+        }
+        g_free(name);
+
+        p = close + 1;
+    }
+
+    return g_string_free(out, FALSE);
+}
+
+/* ============================================================================
+ * get / set
+ * ========================================================================== */
+
+static GVariant *get_all_properties(GDBusConnection *connection, GError **error)
+{
+    GVariant *reply = g_dbus_connection_call_sync(connection,
+                                                  DBUS_SERVICE_NAME,
+                                                  DBUS_OBJECT_PATH,
+                                                  "org.freedesktop.DBus.Properties",
+                                                  "GetAll",
+                                                  g_variant_new("(s)", DBUS_INTERFACE_NAME),
+                                                  G_VARIANT_TYPE("(a{sv})"),
+                                                  G_DBUS_CALL_FLAGS_NONE,
+                                                  CALL_TIMEOUT_MS,
+                                                  NULL,
+                                                  error);
+    if (reply == NULL) {
+        return NULL;
+    }
+
+    GVariant *properties = g_variant_get_child_value(reply, 0);
+    g_variant_unref(reply);
+    return properties;
+}
+
+static int cmd_get(GDBusConnection *connection, int argc, char **argv)
+{
+    GError *error = NULL;
+    GVariant *properties = get_all_properties(connection, &error);
+    if (properties == NULL) {
+        g_printerr("Failed to read properties: %s\n", error->message);
+        g_error_free(error);
+        return 1;
+    }
+
+    int ret = 0;
+    GString *out = g_string_new(NULL);
+
+    if (argc == 0 && use_json) {
+        gchar *json = format_json(properties);
+        g_string_append(out, json);
+        g_string_append_c(out, '\n');
+        g_free(json);
+    } else if (argc == 0) {
+        GVariantIter iter;
+        const char *name;
+        GVariant *value;
+
+        g_variant_iter_init(&iter, properties);
+        while (g_variant_iter_next(&iter, "{&sv}", &name, &value)) {
+            g_string_append_printf(out, "%s=", name);
+            append_value(out, value, false);
+            g_string_append_c(out, '\n');
+            g_variant_unref(value);
+        }
+    } else {
+        /* Values only, one per line, for scripts */
+        for (int i = 0; i < argc; i++) {
+            GVariant *value = g_variant_lookup_value(properties, argv[i], NULL);
+            if (value == NULL) {
+                g_printerr("Unknown property: %s\n", argv[i]);
+                ret = 1;
+                continue;
+            }
+            append_value(out, value, use_json);
+            g_string_append_c(out, '\n');
+            g_variant_unref(value);
+        }
+    }
+
+    fputs(out->str, stdout);
+    g_string_free(out, TRUE);
+    g_variant_unref(properties);
+    return ret;
+}
+
+static bool parse_bool(const char *str, gboolean *value)
+{
+    if (g_ascii_strcasecmp(str, "on") == 0 || g_ascii_strcasecmp(str, "true") == 0 ||
+        g_ascii_strcasecmp(str, "yes") == 0 || strcmp(str, "1") == 0) {
+        *value = TRUE;
+        return true;
+    }
+    if (g_ascii_strcasecmp(str, "off") == 0 || g_ascii_strcasecmp(str, "false") == 0 ||
+        g_ascii_strcasecmp(str, "no") == 0 || strcmp(str, "0") == 0) {
+        *value = FALSE;
+        return true;
+    }
+    return false;
+}
+
+static GVariant *parse_int_range(const char *str, gint64 min, gint64 max)
+{
+    gint64 value;
+    if (!g_ascii_string_to_signed(str, 10, min, max, &value, NULL)) {
+        return NULL;
+    }
+    return g_variant_new("(i)", (gint32)value);
+}
+
+static GVariant *parse_level(const char *str)
+{
+    return parse_int_range(str, 0, 100);
+}
+
+static GVariant *parse_ear_pause_mode(const char *str)
+{
+    return parse_int_range(str, 0, 2);
+}
+
+/* The daemon takes any other string as "off", so check it here */
+static GVariant *parse_noise_control(const char *str)
+{
+    static const char *const modes[] = { "off", "anc", "transparency", "adaptive" };
+
+    for (gsize i = 0; i < G_N_ELEMENTS(modes); i++) {
+        if (g_ascii_strcasecmp(str, modes[i]) == 0) {
+            return g_variant_new("(s)", modes[i]);
+        }
+    }
+    return NULL;
+}
+
+/* "anc,transparency" -> (bbbb) in SetListeningModes order */
+static GVariant *parse_listening_modes(const char *str)
+{
+    gboolean off = FALSE, transparency = FALSE, anc = FALSE, adaptive = FALSE;
+    gchar **modes = g_strsplit(str, ",", -1);
+    bool ok = true;
+
+    for (int i = 0; modes[i] != NULL; i++) {
+        const char *mode = g_strstrip(modes[i]);
+        if (strcmp(mode, "off") == 0) {
+            off = TRUE;
+        } else if (strcmp(mode, "transparency") == 0) {
+            transparency = TRUE;
+        } else if (strcmp(mode, "anc") == 0) {
+            anc = TRUE;
+        } else if (strcmp(mode, "adaptive") == 0) {
+            adaptive = TRUE;
+        } else if (mode[0] != '\0') {
+            ok = false;
+        }
+    }
+    g_strfreev(modes);
+
+    return ok ? g_variant_new("(bbbb)", off, transparency, anc, adaptive) : NULL;
+}
+
+static GVariant *parse_string(const char *str)
+{
+    return g_variant_new("(s)", str);
+}
+
+static GVariant *parse_switch(const char *str)
+{
+    gboolean value;
+    return parse_bool(str, &value) ? g_variant_new("(b)", value) : NULL;
+}
+
+static const struct {
+    const char *name;
+    const char *method;
+    GVariant *(*parse)(const char *value);
+    const char *values;
+} settings[] = {
+    { "noise-control",            "SetNoiseControlMode",        parse_noise_control,
+      "off|anc|transparency|adaptive" },
+    { "conversational-awareness", "SetConversationalAwareness", parse_switch, "on|off" },
+    { "adaptive-level",           "SetAdaptiveNoiseLevel",      parse_level,  "0-100" },
+    { "ear-pause-mode",           "SetEarPauseMode",            parse_ear_pause_mode, "0|1|2" },
+    { "listening-modes",          "SetListeningModes",          parse_listening_modes,
+      "off,transparency,anc,adaptive" },
+    { "display-name",             "SetDisplayName",             parse_string, "NAME" },
+};
+
+static int cmd_set(GDBusConnection *connection, int argc, char **argv)
+{
+    if (argc != 2) {
+        g_printerr("Usage: librepodsctl set SETTING VALUE\n");
+        for (gsize i = 0; i < G_N_ELEMENTS(settings); i++) {
+            g_printerr("  %-26s %s\n", settings[i].name, settings[i].values);
+        }
+        return 1;
+    }
+
+    for (gsize i = 0; i < G_N_ELEMENTS(settings); i++) {
+        if (strcmp(argv[0], settings[i].name) != 0) {
+            continue;
+        }
+
+        GVariant *parameters = settings[i].parse(argv[1]);
+        if (parameters == NULL) {
+            g_printerr("Invalid value for %s: %s (expected %s)\n",
+                       settings[i].name, argv[1], settings[i].values);
+            return 1;
+        }
+
+        GError *error = NULL;
+        GVariant *reply = g_dbus_connection_call_sync(connection,
+                                                      DBUS_SERVICE_NAME,
+                                                      DBUS_OBJECT_PATH,
+                                                      DBUS_INTERFACE_NAME,
+                                                      settings[i].method,
+                                                      parameters,
+                                                      NULL,
+                                                      G_DBUS_CALL_FLAGS_NONE,
+                                                      CALL_TIMEOUT_MS,
+                                                      NULL,
+                                                      &error);
+        if (reply == NULL) {
+            g_printerr("Failed to set %s: %s\n", settings[i].name, error->message);
+            g_error_free(error);
+            return 1;
+        }
+
+        g_variant_unref(reply);
+        return 0;
+    }
+
+    g_printerr("Unknown setting: %s\n", argv[0]);
+    return 1;
+}
+
+/* ============================================================================
+ * watch
+ * ========================================================================== */
+
+typedef struct {
+    GDBusConnection *connection;
+    GCancellable *cancellable;
+    GHashTable *properties;     /* name -> GVariant, in sync with the daemon */
+    GPtrArray *order;           /* Property names in the daemon's order */
+    gchar *last_output;
+} Watcher;
+
+static void print_if_changed(Watcher *watcher)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+
+    for (guint i = 0; i < watcher->order->len; i++) {
+        const char *name = g_ptr_array_index(watcher->order, i);
+        GVariant *value = g_hash_table_lookup(watcher->properties, name);
+        if (value != NULL) {
+            g_variant_builder_add(&builder, "{sv}", name, value);
+        }
+    }
+
+    GVariant *properties = g_variant_ref_sink(g_variant_builder_end(&builder));
+    gchar *output = use_json ? format_json(properties)
+                             : format_template(watch_format ? watch_format : DEFAULT_FORMAT,
+                                               properties);
+    g_variant_unref(properties);
+
+    if (g_strcmp0(output, watcher->last_output) == 0) {
+        g_free(output);
+        return;
+    }
+
+    /* Flush every line: the reader is usually a pipe */
+    printf("%s\n", output);
+    fflush(stdout);
+
+    g_free(watcher->last_output);
+    watcher->last_output = output;
+}
+
+static void store_property(Watcher *watcher, const char *name, GVariant *value)
+{
+    if (!g_hash_table_contains(watcher->properties, name)) {
+        g_ptr_array_add(watcher->order, g_strdup(name));
+    }
+    g_hash_table_insert(watcher->properties, g_strdup(name), g_variant_ref(value));
+}
+
+static void on_properties_changed(GDBusConnection *connection, const gchar *sender,
+                                  const gchar *object_path, const gchar *interface_name,
+                                  const gchar *signal_name, GVariant *parameters,
+                                  gpointer user_data)
+{
+    (void)connection;
+    (void)sender;
+    (void)object_path;
+    (void)interface_name;
+    (void)signal_name;
+    Watcher *watcher = user_data;
+
+    const char *interface;
+    GVariantIter *changed;
+    GVariantIter *invalidated;
+    g_variant_get(parameters, "(&sa{sv}as)", &interface, &changed, &invalidated);
+
+    if (g_strcmp0(interface, DBUS_INTERFACE_NAME) == 0) {
+        const char *name;
+        GVariant *value;
+        while (g_variant_iter_next(changed, "{&sv}", &name, &value)) {
+            store_property(watcher, name, value);
+            g_variant_unref(value);
+        }
+        while (g_variant_iter_next(invalidated, "&s", &name)) {
+            g_hash_table_remove(watcher->properties, name);
+        }
+        print_if_changed(watcher);
+    }
+
+    g_variant_iter_free(changed);
+    g_variant_iter_free(invalidated);
+}
+
+static void on_get_all_reply(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+    GError *error = NULL;
+    GVariant *reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+
+    if (reply == NULL) {
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_printerr("Failed to read properties: %s\n", error->message);
+        }
+        g_error_free(error);
+        return;
+    }
+
+    Watcher *watcher = user_data;
+    GVariantIter *iter;
+    const char *name;
+    GVariant *value;
+
+    g_variant_get(reply, "(a{sv})", &iter);
+    while (g_variant_iter_next(iter, "{&sv}", &name, &value)) {
+        store_property(watcher, name, value);
+        g_variant_unref(value);
+    }
+    g_variant_iter_free(iter);
+    g_variant_unref(reply);
+
+    print_if_changed(watcher);
+}
+
+static void on_daemon_appeared(GDBusConnection *connection, const gchar *name,
+                               const gchar *name_owner, gpointer user_data)
+{
+    (void)name;
+    (void)name_owner;
+    Watcher *watcher = user_data;
+
+    /* Signals are already subscribed, so nothing between here and the
+     * reply is missed; the reply only fills in the rest */
+    g_dbus_connection_call(connection,
+                           DBUS_SERVICE_NAME,
+                           DBUS_OBJECT_PATH,
+                           "org.freedesktop.DBus.Properties",
+                           "GetAll",
+                           g_variant_new("(s)", DBUS_INTERFACE_NAME),
+                           G_VARIANT_TYPE("(a{sv})"),
+                           G_DBUS_CALL_FLAGS_NONE,
+                           CALL_TIMEOUT_MS,
+                           watcher->cancellable,
+                           on_get_all_reply,
+                           watcher);
+}
+
+static void on_daemon_vanished(GDBusConnection *connection, const gchar *name,
+                               gpointer user_data)
+{
+    (void)connection;
+    (void)name;
+    Watcher *watcher = user_data;
+
+    /* An empty line (or {}) tells the reader the daemon is gone */
+    g_hash_table_remove_all(watcher->properties);
+    print_if_changed(watcher);
+}
+
+static gboolean on_quit_signal(gpointer user_data)
+{
+    g_main_loop_quit(user_data);
+    return G_SOURCE_REMOVE;
+}
+
+static int cmd_watch(GDBusConnection *connection)
+{
+    Watcher watcher = {
+        .connection = connection,
+        .cancellable = g_cancellable_new(),
+        .properties = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                            (GDestroyNotify)g_variant_unref),
+        .order = g_ptr_array_new_with_free_func(g_free),
+        .last_output = NULL,
+    };
+
+    guint subscription_id = g_dbus_connection_signal_subscribe(connection,
+                                                               DBUS_SERVICE_NAME,
+                                                               "org.freedesktop.DBus.Properties",
+                                                               "PropertiesChanged",
+                                                               DBUS_OBJECT_PATH,
+                                                               DBUS_INTERFACE_NAME,
+                                                               G_DBUS_SIGNAL_FLAGS_NONE,
+                                                               on_properties_changed,
+                                                               &watcher,
+                                                               NULL);
+
+    guint watch_id = g_bus_watch_name_on_connection(connection,
+                                                    DBUS_SERVICE_NAME,
+                                                    G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                                    on_daemon_appeared,
+                                                    on_daemon_vanished,
+                                                    &watcher,
+                                                    NULL);
+
+    GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+    g_unix_signal_add(SIGINT, on_quit_signal, loop);
+    g_unix_signal_add(SIGTERM, on_quit_signal, loop);
+    g_main_loop_run(loop);
+
+    g_bus_unwatch_name(watch_id);
+    g_dbus_connection_signal_unsubscribe(connection, subscription_id);
+    g_cancellable_cancel(watcher.cancellable);
+    g_object_unref(watcher.cancellable);
+    g_main_loop_unref(loop);
+    g_hash_table_unref(watcher.properties);
+    g_ptr_array_unref(watcher.order);
+    g_free(watcher.last_output);
+
+    return 0;
+}
+
+/* ============================================================================
+ * Main
+ * ========================================================================== */
+
+int main(int argc, char *argv[])
+{
+    GOptionEntry entries[] = {
+        { "system", 0, 0, G_OPTION_ARG_NONE, &use_system_bus,
+          "Talk to the system-wide daemon", NULL },
+        { "json", 'j', 0, G_OPTION_ARG_NONE, &use_json,
+          "Print JSON instead of text", NULL },
+        { "format", 'f', 0, G_OPTION_ARG_STRING, &watch_format,
+          "Line format for watch, with {Property} placeholders", "FORMAT" },
+        { NULL, 0, 0, 0, NULL, NULL, NULL }
+    };
+
+    GError *error = NULL;
+    GOptionContext *context = g_option_context_new("COMMAND [ARGS...] - control the LibrePods daemon");
+    g_option_context_add_main_entries(context, entries, NULL);
+    g_option_context_set_description(context,
+        "Commands:\n"
+        "  get [PROPERTY...]     Print all properties, or the values of some\n"
+        "  set SETTING VALUE     Change a setting (run without VALUE for a list)\n"
+        "  watch                 Print a line whenever the output changes\n"
+        "\n"
+        "Default watch format:\n"
+        "  " DEFAULT_FORMAT "\n");
+
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+        g_printerr("%s\n", error->message);
+        g_error_free(error);
+        g_option_context_free(context);
+        return 1;
+    }
+
+    if (argc < 2) {
+        gchar *help = g_option_context_get_help(context, TRUE, NULL);
+        g_printerr("%s", help);
+        g_free(help);
+        g_option_context_free(context);
+        return 1;
+    }
+    g_option_context_free(context);
+
+    GDBusConnection *connection = g_bus_get_sync(use_system_bus ? G_BUS_TYPE_SYSTEM
+                                                                : G_BUS_TYPE_SESSION,
+                                                 NULL, &error);
+    if (connection == NULL) {
+        g_printerr("Failed to connect to the bus: %s\n", error->message);
+        g_error_free(error);
+        return 1;
+    }
+
+    int ret;
+    const char *command = argv[1];
+    if (strcmp(command, "get") == 0) {
+        ret = cmd_get(connection, argc - 2, argv + 2);
+    } else if (strcmp(command, "set") == 0) {
+        ret = cmd_set(connection, argc - 2, argv + 2);
+    } else if (strcmp(command, "watch") == 0) {
+        ret = cmd_watch(connection);
+    } else {
+        g_printerr("Unknown command: %s\n", command);
+        ret = 1;
+    }
+
+    g_object_unref(connection);
+    g_free(watch_format);
+    return ret;
+}
@@ -9,6 +9,7 @@ import GObject from 'gi://GObject';
 import Gio from 'gi://Gio';
 import St from 'gi://St';
 import Clutter from 'gi://Clutter';
+import Meta from 'gi://Meta';
 
 import * as Main from 'resource:///org/gnome/shell/ui/main.js';
 import * as QuickSettings from 'resource:///org/gnome/shell/ui/quickSettings.js';
@@ -73,6 +74,78 @@ const AirPodsProxy = Gio.DBusProxy.makeProxyWrapper(AirPodsInterface);
 /* Icon size for battery indicators */
 const BATTERY_ICON_SIZE = 32;
 
+/* Routes g-properties-changed to the handlers of the properties that
+ * changed, so one battery update does not redraw the whole menu.
+ * Handlers run once per frame, right before it is drawn, however many
+ * signals arrived in between (the daemon sends a burst on connect). */
+class PropertyDispatcher {
+    constructor() {
+        this._handlers = new Map();
+        this._pending = new Set();
+        this._laterId = 0;
+
+        /* Signals and handler runs of the frame being collected, and totals */
+        this._frameSignals = 0;
+        this._stats = {frames: 0, signals: 0, updates: 0, maxSignalsPerFrame: 0};
+    }
+
+    /* Run handler whenever one of the named properties changes */
+    add(properties, handler) {
+        for (const name of properties) {
+            if (!this._handlers.has(name))
+                this._handlers.set(name, []);
+            this._handlers.get(name).push(handler);
+        }
+    }
+
+    dispatch(changed, invalidated) {
+        /* Each handler runs once, however many of its properties changed */
+        for (const name of [...Object.keys(changed.unpack()), ...invalidated]) {
+            for (const handler of this._handlers.get(name) ?? [])
+                this._pending.add(handler);
+        }
+        this._frameSignals++;
+
+        if (this._laterId === 0 && this._pending.size > 0) {
+            this._laterId = global.compositor.get_laters().add(
+                Meta.LaterType.BEFORE_REDRAW, () => this._flush());
+        }
+    }
+
+    _flush() {
+        this._laterId = 0;
+
+        const pending = this._pending;
+        const signals = this._frameSignals;
+        this._pending = new Set();
+        this._frameSignals = 0;
+
+        for (const handler of pending)
+            handler();
+
+        this._stats.frames++;
+        this._stats.signals += signals;
+        this._stats.updates += pending.size;
+        this._stats.maxSignalsPerFrame = Math.max(this._stats.maxSignalsPerFrame, signals);
+
+        if (signals > 1) {
+            console.debug(`LibrePods: ${signals} property changes in one frame, ` +
+                `${pending.size} updates (totals: ${this._stats.signals} changes, ` +
+                `${this._stats.updates} updates in ${this._stats.frames} frames)`);
+        }
+
+        return false;
+    }
+
+    destroy() {
+        if (this._laterId !== 0) {
+            global.compositor.get_laters().remove(this._laterId);
+            this._laterId = 0;
+        }
+        this._pending.clear();
+    }
+}
+
 /* Battery indicator widget with symbolic icon and progress bar */
 const BatteryIndicator = GObject.registerClass(
 class BatteryIndicator extends St.BoxLayout {
@@ -274,7 +347,6 @@ class LibrePodsToggle extends QuickSettings.QuickMenuToggle {
 
         this._extensionObject = extensionObject;
         this._proxy = null;
-        this._propertiesChangedId = 0;
         this._signalIds = [];
 
         /* Load settings */
@@ -289,9 +361,9 @@ class LibrePodsToggle extends QuickSettings.QuickMenuToggle {
         this._createMenu();
     }
 
-    setProxy(proxy) {
+    setProxy(proxy, dispatcher) {
         this._proxy = proxy;
-        this._connectProxySignals();
+        this._connectProxySignals(dispatcher);
     }
 
     _getNotificationSource() {
@@ -320,6 +392,41 @@ class LibrePodsToggle extends QuickSettings.QuickMenuToggle {
         /* Header */
         this.menu.setHeader('audio-headphones-symbolic', 'LibrePods');
 
+        /* Settings button */
+        this._settingsItem = new PopupMenu.PopupImageMenuItem(
+            'Advanced Settings',
+            'emblem-system-symbolic'
+        );
+        this._settingsItem.connect('activate', () => this._openSettings());
+        this.menu.addMenuItem(this._settingsItem);
+
+        /* The rest is only needed once the menu is opened */
+        this._menuBuilt = false;
+        this.menu.connect('open-state-changed', (menu, isOpen) => {
+            if (isOpen)
+                this._onMenuOpened();
+        });
+
+        /* Set initial disconnected state; stays if the daemon never shows up */
+        this._updateDisconnectedState();
+    }
+
+    _onMenuOpened() {
+        if (!this._menuBuilt) {
+            this._buildMenuContents();
+            this._menuBuilt = true;
+        }
+
+        /* Nothing in the menu was updated while it was closed */
+        this._updateMenu();
+    }
+
+    _isMenuVisible() {
+        return this._menuBuilt && this.menu.isOpen;
+    }
+
+    /* Battery and noise control sections, above the settings button */
+    _buildMenuContents() {
         /* Battery section */
         this._batteryBox = new St.BoxLayout({
             style_class: 'librepods-battery-box',
@@ -340,10 +447,10 @@ class LibrePodsToggle extends QuickSettings.QuickMenuToggle {
             can_focus: false,
         });
         batteryItem.add_child(this._batteryBox);
-        this.menu.addMenuItem(batteryItem);
+        this.menu.addMenuItem(batteryItem, 0);
 
         /* Separator */
-        this.menu.addMenuItem(new PopupMenu.PopupSeparatorMenuItem());
+        this.menu.addMenuItem(new PopupMenu.PopupSeparatorMenuItem(), 1);
 
         /* Noise control section */
         this._ncBox = new St.BoxLayout({
@@ -369,32 +476,45 @@ class LibrePodsToggle extends QuickSettings.QuickMenuToggle {
             can_focus: false,
         });
         ncItem.add_child(this._ncBox);
-        this.menu.addMenuItem(ncItem);
+        this.menu.addMenuItem(ncItem, 2);
 
         /* Separator */
-        this.menu.addMenuItem(new PopupMenu.PopupSeparatorMenuItem());
-
-        /* Settings button */
-        this._settingsItem = new PopupMenu.PopupImageMenuItem(
-            'Advanced Settings',
-            'emblem-system-symbolic'
-        );
-        this._settingsItem.connect('activate', () => this._openSettings());
-        this.menu.addMenuItem(this._settingsItem);
-
-        /* Set initial disconnected state */
-        this._updateDisconnectedState();
+        this.menu.addMenuItem(new PopupMenu.PopupSeparatorMenuItem(), 3);
     }
 
-    _connectProxySignals() {
+    _connectProxySignals(dispatcher) {
         if (!this._proxy)
             return;
 
-        /* Connect to property changes */
-        this._propertiesChangedId = this._proxy.connect(
-            'g-properties-changed',
-            this._onPropertiesChanged.bind(this)
-        );
+        /* Property changes update only what depends on them. Battery and
+         * noise control signals carry the same values, so the properties
+         * are enough. The menu is refreshed as a whole when it opens, so
+         * while it is closed only the toggle itself is kept current. */
+        const whenConnected = handler => () => {
+            if (this._proxy.Connected)
+                handler();
+        };
+        const whenVisible = handler => whenConnected(() => {
+            if (this._isMenuVisible())
+                handler();
+        });
+
+        dispatcher.add(['Connected'], () => this._updateState());
+        dispatcher.add(['DisplayName', 'DeviceModel'], whenConnected(() => this._updateSubtitle()));
+        dispatcher.add(['BatteryLeft', 'BatteryRight'], whenConnected(() => {
+            this._checkLowBattery(this._proxy.BatteryLeft, this._proxy.BatteryRight);
+        }));
+        dispatcher.add(['IsHeadphones', 'DeviceModel'], whenVisible(() => this._updateLayout()));
+        dispatcher.add(['BatteryLeft', 'ChargingLeft'], whenVisible(() => this._updateLeftBattery()));
+        dispatcher.add(['BatteryRight', 'ChargingRight'], whenVisible(() => this._updateRightBattery()));
+        dispatcher.add(['BatteryCase', 'ChargingCase'], whenVisible(() => this._updateCaseBattery()));
+        dispatcher.add(['SupportsANC', 'SupportsAdaptive'], whenVisible(() => {
+            this._updateNoiseControlVisibility(this._proxy.SupportsANC || false,
+                this._proxy.SupportsAdaptive || false);
+        }));
+        dispatcher.add(['NoiseControlMode'], whenVisible(() => {
+            this._updateNoiseControlButtons(this._proxy.NoiseControlMode);
+        }));
 
         /* Connect to signals */
         this._signalIds.push(
@@ -403,21 +523,11 @@ class LibrePodsToggle extends QuickSettings.QuickMenuToggle {
         this._signalIds.push(
             this._proxy.connectSignal('DeviceDisconnected', this._onDeviceDisconnected.bind(this))
         );
-        this._signalIds.push(
-            this._proxy.connectSignal('BatteryChanged', this._onBatteryChanged.bind(this))
-        );
-        this._signalIds.push(
-            this._proxy.connectSignal('NoiseControlModeChanged', this._onNoiseControlChanged.bind(this))
-        );
 
         /* Initial state update */
         this._updateState();
     }
 
-    _onPropertiesChanged(proxy, changed, invalidated) {
-        this._updateState();
-    }
-
     _onDeviceConnected(proxy, sender, [address, name]) {
         console.log(`LibrePods: Device connected - ${name}`);
 
@@ -428,8 +538,6 @@ class LibrePodsToggle extends QuickSettings.QuickMenuToggle {
         if (this._settings.get_boolean('enable-connection-notifications')) {
             this._showNotification('AirPods Connected', name || 'AirPods');
         }
-
-        this._updateState();
     }
 
     _onDeviceDisconnected(proxy, sender, [address, name]) {
@@ -439,17 +547,6 @@ class LibrePodsToggle extends QuickSettings.QuickMenuToggle {
         if (this._settings.get_boolean('enable-connection-notifications')) {
             this._showNotification('AirPods Disconnected', name || 'AirPods');
         }
-
-        this._updateDisconnectedState();
-    }
-
-    _onBatteryChanged(proxy, sender, [left, right, caseBattery]) {
-        this._leftBattery.setLevel(left, this._proxy.ChargingLeft);
-        this._rightBattery.setLevel(right, this._proxy.ChargingRight);
-        this._caseBattery.setLevel(caseBattery, this._proxy.ChargingCase);
-
-        /* Check for low battery notifications */
-        this._checkLowBattery(left, right);
     }
 
     _checkLowBattery(left, right) {
@@ -491,56 +588,87 @@ class LibrePodsToggle extends QuickSettings.QuickMenuToggle {
         }
     }
 
-    _onNoiseControlChanged(proxy, sender, [mode]) {
-        this._updateNoiseControlButtons(mode);
-    }
-
+    /* Full refresh, on startup and when the connection changes */
     _updateState() {
         if (!this._proxy)
             return;
 
-        const connected = this._proxy.Connected;
+        if (!this._proxy.Connected) {
+            this._updateDisconnectedState();
+            return;
+        }
 
-        if (connected) {
-            const isHeadphones = this._proxy.IsHeadphones || false;
-            const supportsANC = this._proxy.SupportsANC || false;
-            const supportsAdaptive = this._proxy.SupportsAdaptive || false;
-            const deviceModel = this._proxy.DeviceModel || null;
-
-            this.subtitle = this._proxy.DisplayName || this._proxy.DeviceModel || 'Connected';
-            this.checked = true;
-            this._batteryBox.opacity = 255;
-
-            /* Update layout based on device type */
-            this._leftBattery.setHeadphonesMode(isHeadphones, deviceModel);
-            this._rightBattery.setHeadphonesMode(isHeadphones);
-            this._caseBattery.setHeadphonesMode(isHeadphones);
-
-            /* Update battery */
-            const batteryLeft = this._proxy.BatteryLeft;
-            const batteryRight = this._proxy.BatteryRight;
-            this._leftBattery.setLevel(batteryLeft, this._proxy.ChargingLeft);
-            if (!isHeadphones) {
-                this._rightBattery.setLevel(batteryRight, this._proxy.ChargingRight);
-                this._caseBattery.setLevel(this._proxy.BatteryCase, this._proxy.ChargingCase);
-            }
+        this.checked = true;
+        this._updateSubtitle();
 
-            /* Check for low battery on state update */
-            this._checkLowBattery(batteryLeft, batteryRight);
+        /* Check for low battery on state update */
+        this._checkLowBattery(this._proxy.BatteryLeft, this._proxy.BatteryRight);
 
-            /* Update noise control buttons visibility based on features */
-            this._updateNoiseControlVisibility(supportsANC, supportsAdaptive);
+        if (this._isMenuVisible())
+            this._updateMenu();
+    }
 
-            /* Update noise control */
-            this._updateNoiseControlButtons(this._proxy.NoiseControlMode);
-        } else {
-            this._updateDisconnectedState();
+    _updateMenu() {
+        if (!this._proxy || !this._proxy.Connected) {
+            this._updateMenuDisconnected();
+            return;
         }
+
+        this._batteryBox.opacity = 255;
+        this._ncBox.opacity = 255;
+
+        /* Sets the battery levels too */
+        this._updateLayout();
+
+        /* Update noise control buttons visibility based on features */
+        this._updateNoiseControlVisibility(this._proxy.SupportsANC || false,
+            this._proxy.SupportsAdaptive || false);
+
+        /* Update noise control */
+        this._updateNoiseControlButtons(this._proxy.NoiseControlMode);
+    }
+
+    _updateSubtitle() {
+        this.subtitle = this._proxy.DisplayName || this._proxy.DeviceModel || 'Connected';
+    }
+
+    /* Update layout based on device type */
+    _updateLayout() {
+        const isHeadphones = this._proxy.IsHeadphones || false;
+        const deviceModel = this._proxy.DeviceModel || null;
+
+        this._leftBattery.setHeadphonesMode(isHeadphones, deviceModel);
+        this._rightBattery.setHeadphonesMode(isHeadphones);
+        this._caseBattery.setHeadphonesMode(isHeadphones);
+
+        this._updateLeftBattery();
+        this._updateRightBattery();
+        this._updateCaseBattery();
+    }
+
+    _updateLeftBattery() {
+        this._leftBattery.setLevel(this._proxy.BatteryLeft, this._proxy.ChargingLeft);
+    }
+
+    _updateRightBattery() {
+        if (!this._proxy.IsHeadphones)
+            this._rightBattery.setLevel(this._proxy.BatteryRight, this._proxy.ChargingRight);
+    }
+
+    _updateCaseBattery() {
+        if (!this._proxy.IsHeadphones)
+            this._caseBattery.setLevel(this._proxy.BatteryCase, this._proxy.ChargingCase);
     }
 
     _updateDisconnectedState() {
         this.subtitle = 'Disconnected';
         this.checked = false;
+
+        if (this._isMenuVisible())
+            this._updateMenuDisconnected();
+    }
+
+    _updateMenuDisconnected() {
         this._batteryBox.opacity = 128;
         this._ncBox.opacity = 128;
 
@@ -602,10 +730,6 @@ class LibrePodsToggle extends QuickSettings.QuickMenuToggle {
 
     destroy() {
         if (this._proxy) {
-            if (this._propertiesChangedId > 0) {
-                this._proxy.disconnect(this._propertiesChangedId);
-            }
-
             for (const id of this._signalIds) {
                 this._proxy.disconnectSignal(id);
             }
@@ -645,6 +769,11 @@ class LibrePodsIndicator extends QuickSettings.SystemIndicator {
         this._propertiesChangedId = 0;
         this._extensionObject = extensionObject;
 
+        /* One g-properties-changed connection for the indicator and the toggle */
+        this._dispatcher = new PropertyDispatcher();
+        this._dispatcher.add(['Connected', 'IsHeadphones', 'BatteryLeft', 'BatteryRight'],
+            () => this._updateIndicator());
+
         /* Create toggle immediately so it's available for addExternalIndicator */
         this._toggle = new LibrePodsToggle(extensionObject);
         this.quickSettingsItems.push(this._toggle);
@@ -654,33 +783,65 @@ class LibrePodsIndicator extends QuickSettings.SystemIndicator {
     }
 
     _createProxy() {
+        /* Prefer a system-wide daemon if one is running, otherwise use (and
+         * D-Bus activate) the per-user daemon on the session bus */
+        const createSessionProxy = () => {
+            this._createProxyOnBus(Gio.DBus.session, Gio.DBusProxyFlags.NONE, sessionProxy => {
+                this._proxy = sessionProxy;
+                this._onProxyReady();
+            });
+        };
+
+        this._createProxyOnBus(Gio.DBus.system, Gio.DBusProxyFlags.DO_NOT_AUTO_START, proxy => {
+            if (proxy.g_name_owner !== null) {
+                this._proxy = proxy;
+                this._onProxyReady();
+                return;
+            }
+
+            createSessionProxy();
+        }, createSessionProxy);
+    }
+
+    /* onFailed, if given, is called instead of logging an error */
+    _createProxyOnBus(bus, flags, onReady, onFailed = null) {
         try {
-            this._proxy = new AirPodsProxy(
-                Gio.DBus.session,
+            new AirPodsProxy(
+                bus,
                 'org.librepods.Daemon',
                 '/org/librepods/AirPods',
                 (proxy, error) => {
                     if (error) {
+                        if (onFailed) {
+                            console.debug('LibrePods: No daemon on this bus:', error.message);
+                            onFailed();
+                            return;
+                        }
                         console.error('LibrePods: Failed to connect to daemon:', error.message);
                         return;
                     }
 
-                    this._onProxyReady();
-                }
+                    onReady(proxy);
+                },
+                null,
+                flags
             );
         } catch (e) {
+            if (onFailed) {
+                console.debug('LibrePods: No daemon on this bus:', e.message);
+                onFailed();
+                return;
+            }
             console.error('LibrePods: Error creating proxy:', e.message);
         }
     }
 
     _onProxyReady() {
         /* Pass proxy to toggle */
-        this._toggle.setProxy(this._proxy);
+        this._toggle.setProxy(this._proxy, this._dispatcher);
 
-        /* Connect to property changes for panel indicator */
-        this._propertiesChangedId = this._proxy.connect('g-properties-changed', () => {
-            this._updateIndicator();
-        });
+        this._propertiesChangedId = this._proxy.connect('g-properties-changed',
+            (proxy, changed, invalidated) => this._dispatcher.dispatch(changed, invalidated));
 
         this._updateIndicator();
     }
@@ -734,6 +895,7 @@ class LibrePodsIndicator extends QuickSettings.SystemIndicator {
         if (this._proxy && this._propertiesChangedId > 0) {
             this._proxy.disconnect(this._propertiesChangedId);
         }
+        this._dispatcher.destroy();
         if (this._toggle) {
             this._toggle.destroy();
         }
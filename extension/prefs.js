@@ -334,22 +334,53 @@ export default class LibrePodsPreferences extends ExtensionPreferences {
     }
 
     _connectProxy() {
+        /* Prefer a system-wide daemon, fall back to the per-user one */
+        const connectSession = () => {
+            this._connectProxyOnBus(Gio.DBus.session, Gio.DBusProxyFlags.NONE, sessionProxy => {
+                this._proxy = sessionProxy;
+                this._onProxyReady();
+            });
+        };
+
+        this._connectProxyOnBus(Gio.DBus.system, Gio.DBusProxyFlags.DO_NOT_AUTO_START, proxy => {
+            if (proxy.g_name_owner !== null) {
+                this._proxy = proxy;
+                this._onProxyReady();
+                return;
+            }
+
+            connectSession();
+        }, connectSession);
+    }
+
+    /* onFailed, if given, replaces the error status (e.g. to try another bus) */
+    _connectProxyOnBus(bus, flags, onReady, onFailed = null) {
         try {
-            this._proxy = new AirPodsProxy(
-                Gio.DBus.session,
+            new AirPodsProxy(
+                bus,
                 'org.librepods.Daemon',
                 '/org/librepods/AirPods',
                 (proxy, error) => {
                     if (error) {
+                        if (onFailed) {
+                            onFailed();
+                            return;
+                        }
                         this._statusRow.subtitle = 'Daemon not running';
                         this._setSensitive(false);
                         return;
                     }
 
-                    this._onProxyReady();
-                }
+                    onReady(proxy);
+                },
+                null,
+                flags
             );
         } catch (e) {
+            if (onFailed) {
+                onFailed();
+                return;
+            }
             this._statusRow.subtitle = 'Error connecting to daemon';
             this._setSensitive(false);
         }
@@ -360,8 +391,11 @@ export default class LibrePodsPreferences extends ExtensionPreferences {
             this._updateState();
         });
 
-        /* Initialize ear pause mode (available even when AirPods are not connected) */
-        this._earPauseRow.selected = this._proxy.EarPauseMode;
+        /* Initialize ear pause mode (available even when AirPods are not connected).
+         * Daemons built without media control do not have it. */
+        this._earPauseRow.visible = this._proxy.EarPauseMode !== null;
+        if (this._earPauseRow.visible)
+            this._earPauseRow.selected = this._proxy.EarPauseMode;
 
         this._updateState();
     }
@@ -399,7 +433,8 @@ export default class LibrePodsPreferences extends ExtensionPreferences {
 
             this._caRow.active = this._proxy.ConversationalAwareness;
             this._adaptiveRow.value = this._proxy.AdaptiveNoiseLevel;
-            this._earPauseRow.selected = this._proxy.EarPauseMode;
+            if (this._proxy.EarPauseMode !== null)
+                this._earPauseRow.selected = this._proxy.EarPauseMode;
 
             /* Update listening modes */
             this._updatingListeningModes = true;
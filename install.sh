@@ -135,6 +135,21 @@ enable_daemon_service() {
     print_success "Daemon service enabled and started"
 }
 
+enable_system_daemon_service() {
+    print_step "Enabling system-wide daemon service (requires sudo)..."
+
+    sudo systemctl daemon-reload
+    sudo systemctl reload dbus.service 2>/dev/null || true
+
+    # Per-user instances would race the system daemon for the L2CAP channel
+    sudo systemctl --global disable librepods-daemon.service 2>/dev/null || true
+    systemctl --user disable --now librepods-daemon.service 2>/dev/null || true
+
+    sudo systemctl enable --now librepods-daemon-system.service
+
+    print_success "System-wide daemon service enabled and started"
+}
+
 install_extension() {
     print_step "Installing GNOME Shell extension..."
 
@@ -195,6 +210,7 @@ uninstall() {
     # Stop and disable service
     print_step "Stopping daemon service..."
     systemctl --user disable --now librepods-daemon.service 2>/dev/null || true
+    sudo systemctl disable --now librepods-daemon-system.service 2>/dev/null || true
     print_success "Daemon service stopped"
 
     # Uninstall daemon
@@ -226,6 +242,9 @@ show_help() {
     echo "  --install     Install daemon and extension (default)"
     echo "  --uninstall   Remove daemon and extension"
     echo "  --daemon      Install only the daemon"
+    echo "  --system-daemon"
+    echo "                Install the daemon as one system-wide service"
+    echo "                shared by all logged-in users"
     echo "  --extension   Install only the extension"
     echo "  --help        Show this help message"
     echo ""
@@ -246,6 +265,15 @@ main() {
             echo ""
             print_success "Daemon installation completed!"
             ;;
+        --system-daemon)
+            print_header
+            check_dependencies
+            build_daemon
+            install_daemon
+            enable_system_daemon_service
+            echo ""
+            print_success "System-wide daemon installation completed!"
+            ;;
         --extension)
             print_header
             install_extension